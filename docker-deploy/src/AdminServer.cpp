@@ -0,0 +1,188 @@
+#include "AdminServer.hpp"
+#include "CacheMaster.hpp"
+#include "CacheKey.hpp"
+#include "CacheStats.hpp"
+#include "HttpDate.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cctype>
+#include <cerrno>
+#include <stdexcept>
+
+namespace {
+
+string percentDecode(const string & value) {
+    string out;
+    for (size_t i = 0; i < value.size(); i++) {
+        if (value[i] == '%' && i + 2 < value.size() &&
+            isxdigit(static_cast<unsigned char>(value[i + 1])) && isxdigit(static_cast<unsigned char>(value[i + 2]))) {
+            out += static_cast<char>(stoi(value.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            out += value[i] == '+' ? ' ' : value[i];
+        }
+    }
+    return out;
+}
+
+// value of name in a query string, empty if absent
+string queryParam(const string & query, const string & name) {
+    size_t start = 0;
+    while (start < query.size()) {
+        size_t end = query.find('&', start);
+        if (end == string::npos) {
+            end = query.size();
+        }
+        size_t eq = query.find('=', start);
+        if (eq != string::npos && eq < end && query.compare(start, eq - start, name) == 0) {
+            return percentDecode(query.substr(eq + 1, end - eq - 1));
+        }
+        start = end + 1;
+    }
+    return "";
+}
+
+// cache keys have a lower case scheme and host, a prefix can stop anywhere
+string prefixKey(string prefix) {
+    size_t scheme = prefix.find("://");
+    size_t host_end = scheme == string::npos ? string::npos : prefix.find('/', scheme + 3);
+    for (size_t i = 0; i < prefix.size() && i < host_end; i++) {
+        prefix[i] = tolower(static_cast<unsigned char>(prefix[i]));
+    }
+    return prefix;
+}
+
+}
+
+AdminServer::AdminServer(int port) : port(port), listen_fd(-1), running(false) {}
+
+AdminServer::~AdminServer() {
+    stop();
+}
+
+void AdminServer::start() {
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        throw runtime_error("Failed to create admin socket");
+    }
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listen_fd, 16) < 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        throw runtime_error("Failed to bind admin port " + to_string(port));
+    }
+    socklen_t addrlen = sizeof(address);
+    getsockname(listen_fd, (struct sockaddr *)&address, &addrlen);
+    port = ntohs(address.sin_port);
+
+    running = true;
+    acceptor = thread([this]() { serve(); });
+    LOG_INFO("admin interface on 127.0.0.1:" + to_string(port));
+}
+
+void AdminServer::stop() {
+    if (!running) {
+        return;
+    }
+    running = false;
+    shutdown(listen_fd, SHUT_RDWR);
+    close(listen_fd);
+    listen_fd = -1;
+    if (acceptor.joinable()) {
+        acceptor.join();
+    }
+}
+
+int AdminServer::getPort() const {
+    return port;
+}
+
+// requests are rare and tiny, one at a time is plenty
+void AdminServer::serve() {
+    while (running) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (running && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        struct timeval timeout{5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+        string request;
+        char buffer[4096];
+        while (request.find("\r\n\r\n") == string::npos && request.size() < 16 * 1024) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                break;
+            }
+            request.append(buffer, n);
+        }
+        string response = handle(request);
+        send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+        close(fd);
+    }
+}
+
+string AdminServer::handle(const string & request) {
+    size_t line_end = request.find("\r\n");
+    size_t method_end = request.find(' ');
+    size_t target_end = method_end == string::npos ? string::npos : request.find(' ', method_end + 1);
+    if (line_end == string::npos || target_end == string::npos || target_end > line_end) {
+        return respond(400, "Bad Request", "malformed request line\n");
+    }
+    string method = request.substr(0, method_end);
+    string target = request.substr(method_end + 1, target_end - method_end - 1);
+    CacheMaster & master = CacheMaster::getInstance();
+
+    if (method == "PURGE") {
+        size_t removed = master.purge(CacheKey::getInstance().normalize(target));
+        return respond(200, "OK", "purged " + to_string(removed) + "\n");
+    }
+    size_t query_start = target.find('?');
+    string path = target.substr(0, query_start);
+    string query = query_start == string::npos ? "" : target.substr(query_start + 1);
+    if (path == "/stats") {
+        if (method != "GET") {
+            return respond(405, "Method Not Allowed", "use GET\n");
+        }
+        return respond(200, "OK", CacheStats::getInstance().report() + "\n" + master.memoryReport() + "\n");
+    }
+    if (path != "/purge") {
+        return respond(404, "Not Found", "unknown endpoint " + path + "\n");
+    }
+    if (method != "POST" && method != "DELETE") {
+        return respond(405, "Method Not Allowed", "use POST\n");
+    }
+
+    size_t removed;
+    string url = queryParam(query, "url");
+    string prefix = queryParam(query, "prefix");
+    string host = queryParam(query, "host");
+    if (!url.empty()) {
+        removed = master.purge(CacheKey::getInstance().normalize(url));
+    } else if (!prefix.empty()) {
+        removed = master.purgePrefix(prefixKey(prefix));
+    } else if (!host.empty()) {
+        removed = master.purgeHost(host);
+    } else {
+        return respond(400, "Bad Request", "expected url, prefix or host\n");
+    }
+    return respond(200, "OK", "purged " + to_string(removed) + "\n");
+}
+
+string AdminServer::respond(int status, const string & reason, const string & body) {
+    return "HTTP/1.1 " + to_string(status) + " " + reason + "\r\n"
+           "Date: " + HttpDate::now() + "\r\n"
+           "Content-Type: text/plain\r\n"
+           "Content-Length: " + to_string(body.size()) + "\r\n"
+           "Connection: close\r\n\r\n" + body;
+}
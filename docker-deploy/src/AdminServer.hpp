@@ -0,0 +1,45 @@
+#ifndef ADMINSERVER_HPP
+#define ADMINSERVER_HPP
+
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include "Logger.hpp"
+
+using namespace std;
+
+// Cache administration on a port of its own, bound to localhost only:
+//   POST /purge?url=<url>        the url and all its variants
+//   POST /purge?prefix=<prefix>  every cached url starting with prefix
+//   POST /purge?host=<host>      every cached url of host
+//   PURGE <url>                  same as ?url=, as curl -X PURGE sends it
+//   GET /stats                   cache counters and memory footprint
+// Values are percent-decoded; urls go through the cache key rules.
+class AdminServer {
+public:
+    // port 0 lets the system pick one
+    explicit AdminServer(int port);
+    ~AdminServer();
+
+    // bind and serve on a thread of its own
+    void start();
+    void stop();
+
+    int getPort() const;
+
+    // full response to one raw request
+    static string handle(const string & request);
+
+private:
+    void serve();
+    static string respond(int status, const string & reason, const string & body);
+
+    int port;
+    int listen_fd;
+    atomic<bool> running;
+    thread acceptor;
+    static inline Logger & logger = Logger::getInstance();
+};
+
+#endif
@@ -0,0 +1,319 @@
+#include "BinaryLog.hpp"
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cctype>
+#include <climits>
+
+namespace {
+
+constexpr char LOG_MAGIC[8] = {'P', 'X', 'L', 'O', 'G', '0', '0', '2'};
+// read back on a host of the other byte order, it shows
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+// a file interns at most this many strings, then the next one starts;
+// longer strings are never interned, they are written where they are used
+constexpr uint32_t MAX_INTERNED = 65536;
+constexpr size_t MAX_INTERNED_LENGTH = 512;
+// variable tokens of a message taken out of its pattern, the rest stay in
+constexpr size_t MAX_FIELDS = 32;
+// ids 0 to MAX_FIELDS - 1 are scratch for fields that are not interned,
+// MAX_FIELDS is for such a pattern; interned strings come after
+constexpr uint32_t PATTERN_SCRATCH = MAX_FIELDS;
+constexpr uint32_t FIRST_ID = PATTERN_SCRATCH + 1;
+// stands for a field in a pattern
+constexpr char FIELD_MARK = '\x01';
+// a field word with this bit is a number, otherwise a string id
+constexpr uint32_t NUMBER_BIT = 0x80000000;
+// the buffer goes to the file once it holds this much
+constexpr size_t WRITE_CHUNK = 256 * 1024;
+
+enum Kind : uint8_t { STRING = 1, EVENT = 2 };
+
+struct FileHeader {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t reserved;
+    int64_t created;
+};
+
+// followed by length bytes of text
+struct StringRecord {
+    uint8_t kind;
+    uint8_t reserved[3];
+    uint32_t id;
+    uint32_t length;
+    uint32_t reserved2;
+};
+
+// followed by one uint32_t word per field
+struct EventRecord {
+    uint8_t kind;
+    uint8_t level;
+    uint8_t fields;
+    uint8_t reserved;
+    int32_t pid;
+    // seconds since the file was created
+    int32_t time;
+    uint32_t pattern;
+};
+
+static_assert(sizeof(EventRecord) == 16, "events are 16 bytes on disk");
+static_assert(sizeof(StringRecord) == 16, "string headers are 16 bytes on disk");
+
+template <typename T>
+void put(string & buffer, const T & record) {
+    buffer.append(reinterpret_cast<const char *>(&record), sizeof(record));
+}
+
+// a url splits into its host and path segments, which repeat far more
+// often than the whole url
+bool isDelimiter(char c) {
+    return c != '\0' && strchr(" \t\r\n\"'()[]{},;=:/?&", c) != nullptr;
+}
+
+// hosts, numbers, file names, addresses: what changes from one record of
+// a message to the next
+bool isVariable(string_view token) {
+    if (token.size() > 24) {
+        return true;
+    }
+    for (char c : token) {
+        if (isdigit(static_cast<unsigned char>(c)) || c == '.' || c == '@') {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a number that prints back the same, as a field word
+bool asNumber(string_view token, uint32_t & word) {
+    if (token.empty() || token.size() > 9 || (token[0] == '0' && token.size() > 1)) {
+        return false;
+    }
+    uint32_t value = 0;
+    for (char c : token) {
+        if (!isdigit(static_cast<unsigned char>(c))) {
+            return false;
+        }
+        value = value * 10 + (c - '0');
+    }
+    word = NUMBER_BIT | value;
+    return true;
+}
+
+// "Requesting \"GET http://a.com/b.js HTTP/1.1\" from a.com:80" gives the
+// pattern "Requesting \"GET http://\x01/\x01 \x01\" from \x01:\x01" and its
+// five fields
+void split(const string & message, string & pattern, vector<string_view> & fields) {
+    pattern.clear();
+    fields.clear();
+    if (message.find(FIELD_MARK) != string::npos) {
+        pattern = FIELD_MARK;
+        fields.push_back(message);
+        return;
+    }
+    size_t i = 0;
+    while (i < message.size()) {
+        if (isDelimiter(message[i])) {
+            pattern += message[i++];
+            continue;
+        }
+        size_t start = i;
+        while (i < message.size() && !isDelimiter(message[i])) {
+            i++;
+        }
+        // a sentence's full stop is not part of the token
+        size_t end = i;
+        while (end > start && message[end - 1] == '.') {
+            end--;
+        }
+        string_view token(message.data() + start, end - start);
+        if (fields.size() < MAX_FIELDS && isVariable(token)) {
+            pattern += FIELD_MARK;
+            fields.push_back(token);
+        } else {
+            pattern.append(token);
+        }
+        pattern.append(message, end, i - end);
+    }
+}
+
+}
+
+BinaryLog::BinaryLog(const string & dir, size_t rotate_bytes, int rotate_sec)
+:   dir(dir),
+    rotate_bytes(rotate_bytes),
+    rotate_sec(rotate_sec),
+    fd(-1),
+    opened(0),
+    written(0),
+    sequence(0),
+    next_id(FIRST_ID) {}
+
+BinaryLog::~BinaryLog() {
+    flush();
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void BinaryLog::open(time_t now) {
+    flush();
+    if (fd >= 0) {
+        close(fd);
+    }
+    struct tm local;
+    localtime_r(&now, &local);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+    path = dir + "proxy." + stamp + "." + to_string(sequence++) + ".bin";
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    opened = now;
+    written = 0;
+    strings.clear();
+    next_id = FIRST_ID;
+
+    FileHeader header{};
+    memcpy(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+    header.byte_order = BYTE_ORDER_MARK;
+    header.created = now;
+    put(buffer, header);
+}
+
+uint32_t BinaryLog::intern(string_view text, uint32_t scratch) {
+    // looked up through a reused string, not a new one per field
+    lookup_key.assign(text.data(), text.size());
+    auto it = strings.find(lookup_key);
+    if (it != strings.end()) {
+        return it->second;
+    }
+    uint32_t id = scratch;
+    if (text.size() <= MAX_INTERNED_LENGTH) {
+        id = next_id++;
+        strings.emplace(lookup_key, id);
+    }
+    StringRecord record{};
+    record.kind = STRING;
+    record.id = id;
+    record.length = text.size();
+    put(buffer, record);
+    buffer.append(text.data(), text.size());
+    return id;
+}
+
+void BinaryLog::append(time_t time, int level, int pid, const string & message) {
+    bool too_big = rotate_bytes > 0 && written + buffer.size() >= rotate_bytes;
+    bool too_old = rotate_sec > 0 && time - opened >= rotate_sec;
+    // a full string table starts over in a new file
+    bool table_full = strings.size() + MAX_FIELDS + 1 > MAX_INTERNED;
+    // a clock set decades away does not fit the event
+    bool far = time - opened > INT32_MAX || opened - time > INT32_MAX;
+    if (fd < 0 || too_big || too_old || table_full || far) {
+        open(time);
+    }
+    split(message, pattern, fields);
+    uint32_t words[MAX_FIELDS];
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (!asNumber(fields[i], words[i])) {
+            words[i] = intern(fields[i], i);
+        }
+    }
+    EventRecord record{};
+    record.kind = EVENT;
+    record.level = level;
+    record.fields = fields.size();
+    record.pid = pid;
+    record.time = time - opened;
+    record.pattern = intern(pattern, PATTERN_SCRATCH);
+    put(buffer, record);
+    buffer.append(reinterpret_cast<const char *>(words), fields.size() * sizeof(uint32_t));
+    if (buffer.size() >= WRITE_CHUNK) {
+        flush();
+    }
+}
+
+void BinaryLog::flush() {
+    size_t done = 0;
+    while (fd >= 0 && done < buffer.size()) {
+        ssize_t n = write(fd, buffer.data() + done, buffer.size() - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    written += done;
+    buffer.clear();
+}
+
+bool BinaryLog::read(const string & file, const function<void(const Event &)> & visit) {
+    ifstream in(file, ios::binary);
+    FileHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 || header.byte_order != BYTE_ORDER_MARK) {
+        return false;
+    }
+    vector<string> table(FIRST_ID);
+    uint32_t words[MAX_FIELDS];
+    string message;
+    while (true) {
+        int kind = in.peek();
+        if (kind == EOF) {
+            return true;
+        }
+        if (kind == STRING) {
+            StringRecord record;
+            if (!in.read(reinterpret_cast<char *>(&record), sizeof(record)) || record.id > table.size()) {
+                return false;
+            }
+            string text(record.length, '\0');
+            if (!in.read(text.data(), record.length)) {
+                return false;
+            }
+            if (record.id == table.size()) {
+                table.push_back(move(text));
+            } else {
+                table[record.id] = move(text);
+            }
+        } else if (kind == EVENT) {
+            EventRecord record;
+            if (!in.read(reinterpret_cast<char *>(&record), sizeof(record)) || record.pattern >= table.size() ||
+                record.fields > MAX_FIELDS ||
+                !in.read(reinterpret_cast<char *>(words), record.fields * sizeof(uint32_t))) {
+                return false;
+            }
+            // put the fields back where the pattern marks them
+            message.clear();
+            size_t next = 0;
+            for (char c : table[record.pattern]) {
+                if (c != FIELD_MARK) {
+                    message += c;
+                    continue;
+                }
+                if (next == record.fields) {
+                    return false;
+                }
+                uint32_t word = words[next++];
+                if (word & NUMBER_BIT) {
+                    message += to_string(word & ~NUMBER_BIT);
+                } else if (word < table.size()) {
+                    message += table[word];
+                } else {
+                    return false;
+                }
+            }
+            if (next != record.fields) {
+                return false;
+            }
+            visit(Event{header.created + record.time, record.level, record.pid, message});
+        } else {
+            return false;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef BINARYLOG_HPP
+#define BINARYLOG_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+
+using namespace std;
+
+// Compact log file, the alternative to the four text logs: every record
+// is written once with its level, as a fixed 16 byte event plus a word per
+// field. A message is split into its pattern, the constant words, and its
+// fields, the hosts, path segments, numbers and such between them. Patterns
+// and fields are interned and numbers stored as such, so a string costs
+// its text only the first time a file sees it. Files rotate by size and
+// age, and when their string table fills; each one can be decoded on its
+// own (log_decode turns them back into text or JSON).
+//
+// Not thread safe, the logger's writer thread is its only user; it never
+// logs itself, a failed write loses records silently.
+class BinaryLog {
+public:
+    // one decoded event
+    struct Event {
+        int64_t time;
+        // Logger::Level: 0 debug, 1 info, 2 warning, 3 error
+        int level;
+        // -1 without a request id
+        int32_t pid;
+        const string & message;
+    };
+
+    // files are dir + "proxy.<local time>.<n>.bin"
+    BinaryLog(const string & dir, size_t rotate_bytes, int rotate_sec);
+    ~BinaryLog();
+
+    void append(time_t time, int level, int pid, const string & message);
+    // write what is buffered to the file
+    void flush();
+
+    const string & getPath() const { return path; }
+
+    // call visit for every event of file in order; false if it is no
+    // binary log or ends in a torn record (the events before it are visited)
+    static bool read(const string & file, const function<void(const Event &)> & visit);
+
+private:
+    // open a new file, the string table starts over
+    void open(time_t now);
+    // id of text, defining it in the file first if it is new; text too
+    // long to intern is defined under the scratch id
+    uint32_t intern(string_view text, uint32_t scratch);
+
+    string dir;
+    size_t rotate_bytes;
+    int rotate_sec;
+
+    int fd;
+    string path;
+    time_t opened;
+    size_t written;
+    unsigned sequence;
+    unordered_map<string, uint32_t> strings;
+    uint32_t next_id;
+    string buffer;
+    // reused for every record
+    string lookup_key;
+    string pattern;
+    vector<string_view> fields;
+};
+
+#endif
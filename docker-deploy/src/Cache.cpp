@@ -1,7 +1,8 @@
 #include "Cache.hpp"
+#include "Compression.hpp"
+#include "CacheStats.hpp"
 #include <sstream>
 #include <algorithm>
-#include <regex>
 #include <ctime>
 
 // singleton get instance
@@ -10,7 +11,32 @@
 //     return instance;
 // }
 
-Cache::Cache(size_t max_size) : max_size(max_size), current_size(0) {}
+Cache::Cache(size_t max_size)
+:   own_budget(max_size),
+    budget(&own_budget),
+    own_negative_budget(max_size / 8),
+    negative_budget(&own_negative_budget),
+    current_size(0),
+    arena(EntryArena::create()) {}
+
+Cache::Cache(CacheBudget * budget, CacheBudget * negative_budget, function<void(size_t, bool)> reclaim_hook)
+:   own_budget(0),
+    budget(budget),
+    own_negative_budget(0),
+    negative_budget(negative_budget),
+    current_size(0),
+    arena(EntryArena::create()),
+    reclaim_hook(reclaim_hook) {}
+
+string Cache::lookupKey(const Request& request) {
+    const string & url = request.getCacheUrl();
+    lock_guard<mutex> lock(cache_mutex);
+    auto it = variant_index.find(url);
+    if (it == variant_index.end()) {
+        return url;
+    }
+    return variantKey(url, it->second.vary, request);
+}
 
 Cache::CacheStatus Cache::checkStatus(const string& url) {
     lock_guard<mutex> lock(cache_mutex);
@@ -52,105 +78,335 @@ void Cache::addToCache(const string& url,
                        const string& response_headers, 
                        const string& response_body) {
     if (!isCacheable(response_line, response_headers)) {
-        logger.debug("Response not cacheable for URL: " + url);
+        LOG_DEBUG("Response not cacheable for URL: " + url);
         return;
     }
     
-    lock_guard<mutex> lock(cache_mutex);
-    
+    // create and add the new entry
+    CacheEntry entry(response_line, response_headers, response_body);
+    addEntry(url, entry);
+}
+
+void Cache::addEntry(const string& url, const CacheEntry& built) {
     // calculate the size of the new entry
-    size_t entry_size = response_line.size() + response_headers.size() + response_body.size();
+    size_t entry_size = built.getSize();
+    CacheBudget * target = budgetOf(built);
     
     // if the entry is too large, do not cache
-    if (entry_size > max_size) {
-        logger.warning("Response too large to cache: " + url + " (" + to_string(entry_size) + " bytes)");
+    if (entry_size > target->limit || (max_object_size > 0 && built.getBodyLength() > max_object_size)) {
+        LOG_WARNING("Response too large to cache: " + url + " (" + to_string(entry_size) + " bytes)");
         return;
     }
+
+    // a full cache only trades a victim for an url that is used more,
+    // updates of an entry we already hold always go in
+    if (admit_hook && target->used + entry_size > target->limit) {
+        bool present;
+        {
+            lock_guard<mutex> lock(cache_mutex);
+            present = cache_map.count(url) != 0;
+        }
+        if (!present && !admit_hook(url, built.isNegative())) {
+            LOG_DEBUG("Not admitted to cache: " + url);
+            CacheStats::getInstance().add(CacheStats::ADMISSION_REJECTED);
+            return;
+        }
+    }
+
+    // one block of our arena instead of the scattered staging copy, only
+    // for an entry that goes in
+    CacheEntry entry(built);
+    entry.packInto(*arena);
+
+    // make room across all shards first, other shard locks are never
+    // taken while holding ours
+    if (reclaim_hook) {
+        reclaim_hook(entry_size, entry.isNegative());
+    }
+
+    lock_guard<mutex> lock(cache_mutex);
     
     // if the entry already exists, remove the old entry
-    auto it = cache_map.find(url);
-    if (it != cache_map.end()) {
-        current_size -= (it->second.getResponseLine().size() + 
-                        it->second.getResponseHeaders().size() + 
-                        it->second.getResponseBody().size());
-        cache_map.erase(it);
+    removeEntryLocked(url);
+    // a plain entry and variants of the same url never live side by side
+    size_t variant_pos = url.find('\n');
+    if (variant_pos == string::npos) {
+        removeVariantsLocked(url);
+    } else {
+        removeEntryLocked(url.substr(0, variant_pos));
     }
     
-    // ensure there is enough space
-    while (current_size + entry_size > max_size && !cache_map.empty()) {
-        evictOldestEntry();
+    // ensure there is enough space, racing inserts may have used it up
+    size_t used;
+    while ((used = target->used) + entry_size > target->limit &&
+           evictOldestEntry(entry.isNegative(), used + entry_size - target->limit)) {
     }
     
-    // create and add the new entry
-    CacheEntry entry(response_line, response_headers, response_body);
-    
     // use insert instead of operator[]
     // cache_map.insert(std::make_pair(url, entry));
-    cache_map.insert_or_assign(url, entry);
+    auto stored = cache_map.insert_or_assign(url, entry).first;
+    key_index.insert(url);
+    if (variant_pos != string::npos) {
+        indexVariantLocked(url, entry);
+    }
 
     // or use emplace
     // cache_map.emplace(url, entry);
     
     current_size += entry_size;
+    target->used += entry_size;
     
     // update the expiry time map
-    updateExpiryMap(url, entry.getExpiresTime());
+    updateExpiryMap(stored->first, stored->second);
     
     time_t expires_time = entry.getExpiresTime();
-    logger.debug("Added to cache: " + url + " (expires: " + 
+    LOG_DEBUG("Added to cache: " + url + " (expires: " + 
                 string(ctime(&expires_time)) + ")");
-    logger.debug("now cache has "+to_string(cache_map.size())+" entries");
+    LOG_DEBUG("now cache has "+to_string(cache_map.size())+" entries");
 }
 
-CacheEntry* Cache::getEntry(const string& url) {
+optional<CacheEntry> Cache::copyEntry(const string& url) {
     lock_guard<mutex> lock(cache_mutex);
-    
     auto it = cache_map.find(url);
-    if (it != cache_map.end()) {
-        return &(it->second);
+    if (it == cache_map.end()) {
+        return nullopt;
     }
-    
-    return nullptr;
+    return it->second;
+}
+
+Cache::CacheStatus Cache::lookup(const string& url, optional<CacheEntry>& entry) {
+    lock_guard<mutex> lock(cache_mutex);
+    auto it = cache_map.find(url);
+    if (it == cache_map.end()) {
+        entry.reset();
+        return NOT_IN_CACHE;
+    }
+    entry = it->second;
+    if (entry->isExpired()) {
+        return IN_CACHE_EXPIRED;
+    }
+    if (entry->needsRevalidation()) {
+        return IN_CACHE_NEEDS_VALIDATION;
+    }
+    return IN_CACHE_VALID;
+}
+
+bool Cache::contains(const string& url) {
+    lock_guard<mutex> lock(cache_mutex);
+    return cache_map.count(url) != 0;
+}
+
+bool Cache::refreshEntry(const string& url, const string& not_modified_headers) {
+    lock_guard<mutex> lock(cache_mutex);
+    auto it = cache_map.find(url);
+    if (it == cache_map.end()) {
+        return false;
+    }
+    // only the headers change size, the body is left in place
+    size_t old_size = it->second.getSize();
+    expiry_map[it->second.isNegative()].erase({it->second.getExpiresTime(), &it->first});
+    it->second.refresh(not_modified_headers);
+    size_t new_size = it->second.getSize();
+    current_size = current_size - old_size + new_size;
+    budgetOf(it->second)->used += new_size;
+    budgetOf(it->second)->used -= old_size;
+    updateExpiryMap(it->first, it->second);
+    LOG_DEBUG("Refreshed in cache: " + url);
+    return true;
+}
+
+vector<pair<string, CacheEntry>> Cache::copyEntries() {
+    lock_guard<mutex> lock(cache_mutex);
+    return vector<pair<string, CacheEntry>>(cache_map.begin(), cache_map.end());
 }
 
 void Cache::removeEntry(const string& url) {
     lock_guard<mutex> lock(cache_mutex);
-    
+    removeEntryLocked(url);
+}
+
+size_t Cache::purge(const string& url) {
+    lock_guard<mutex> lock(cache_mutex);
+    // "url" and the variants indexed under it, never the keys below it
+    size_t before = cache_map.size();
+    removeEntryLocked(url);
+    removeVariantsLocked(url);
+    return before - cache_map.size();
+}
+
+size_t Cache::purgePrefix(const string& prefix) {
+    lock_guard<mutex> lock(cache_mutex);
+    vector<string> keys = key_index.withPrefix(prefix);
+    for (const auto& key : keys) {
+        removeEntryLocked(key);
+    }
+    return keys.size();
+}
+
+// caller holds cache_mutex
+void Cache::removeEntryLocked(const string& url, bool keep_vary) {
     auto it = cache_map.find(url);
     if (it != cache_map.end()) {
-        current_size -= (it->second.getResponseLine().size() + 
-                        it->second.getResponseHeaders().size() + 
-                        it->second.getResponseBody().size());
+        current_size -= it->second.getSize();
+        budgetOf(it->second)->used -= it->second.getSize();
+        expiry_map[it->second.isNegative()].erase({it->second.getExpiresTime(), &it->first});
         cache_map.erase(it);
-        logger.debug("Removed from cache: " + url);
+        key_index.erase(url);
+        LOG_DEBUG("Removed from cache: " + url);
+    }
+
+    size_t variant_pos = url.find('\n');
+    if (variant_pos == string::npos) {
+        return;
+    }
+    auto set = variant_index.find(url.substr(0, variant_pos));
+    if (set != variant_index.end()) {
+        vector<string> & keys = set->second.keys;
+        keys.erase(std::remove(keys.begin(), keys.end(), url), keys.end());
+        if (keys.empty() && !keep_vary) {
+            variant_index.erase(set);
+        }
+    }
+}
+
+// caller holds cache_mutex; the entry is already in cache_map
+void Cache::indexVariantLocked(const string& key, const CacheEntry& entry) {
+    string url = key.substr(0, key.find('\n'));
+    vector<string> vary = parseVary(entry.getResponseHeaders());
+
+    // the origin changed what it varies on, older variants are keyed wrong
+    auto set = variant_index.find(url);
+    if (set != variant_index.end() && set->second.vary != vary) {
+        vector<string> stale = set->second.keys;
+        for (const auto& old_key : stale) {
+            if (old_key != key) {
+                removeEntryLocked(old_key);
+            }
+        }
+    }
+
+    VariantSet & variants = variant_index[url];
+    variants.vary = vary;
+    if (find(variants.keys.begin(), variants.keys.end(), key) == variants.keys.end()) {
+        variants.keys.push_back(key);
+    }
+    // keep the set small, the oldest variant goes first
+    while (variants.keys.size() > MAX_VARIANTS) {
+        string oldest = variants.keys.front();
+        removeEntryLocked(oldest);
     }
 }
 
+// caller holds cache_mutex
+void Cache::removeVariantsLocked(const string& url) {
+    auto set = variant_index.find(url);
+    if (set == variant_index.end()) {
+        return;
+    }
+    vector<string> keys = set->second.keys;
+    for (const auto& key : keys) {
+        removeEntryLocked(key);
+    }
+    variant_index.erase(url);
+}
+
 size_t Cache::getCurrentSize() const {
     // do not use lock, because this is a simple getter method
     return current_size;
 }
 
-void Cache::evictOldestEntry() {
-    if (cache_map.empty()) {
-        return;
-    }
-    
-    // simple strategy: find the entry with the earliest expiry time
-    time_t oldest_time = time(nullptr) + 3600*24*365; // one year later
-    string oldest_url;
-    
-    for (const auto& pair : cache_map) {
-        if (pair.second.getExpiresTime() < oldest_time) {
-            oldest_time = pair.second.getExpiresTime();
-            oldest_url = pair.first;
+size_t Cache::getEntryNumber() {
+    lock_guard<mutex> lock(cache_mutex);
+    return cache_map.size();
+}
+
+Cache::MemoryUsage Cache::getMemoryUsage() {
+    lock_guard<mutex> lock(cache_mutex);
+    MemoryUsage usage{cache_map.size(), 0, 0};
+    for (const auto & [url, entry] : cache_map) {
+        usage.payload += entry.getSize();
+        // a hash node holds the pair and a next pointer, long keys live on the heap
+        usage.footprint += entry.getFootprint() - sizeof(CacheEntry) + sizeof(pair<const string, CacheEntry>) + sizeof(void *);
+        const char * inside = reinterpret_cast<const char *>(&url);
+        if (url.data() < inside || url.data() >= inside + sizeof(string)) {
+            usage.footprint += url.capacity() + 1;
         }
     }
-    
-    if (!oldest_url.empty()) {
-        logger.info("(no-id): NOTE evicted " + oldest_url + " from cache");
-        removeEntry(oldest_url);
+    usage.footprint += cache_map.bucket_count() * sizeof(void *);
+    // a tree node holds the pair, three links and its color
+    usage.footprint += (expiry_map[0].size() + expiry_map[1].size()) * (sizeof(pair<time_t, const string *>) + 4 * sizeof(void *));
+    return usage;
+}
+
+const EntryArena & Cache::getArena() const {
+    return *arena;
+}
+
+bool Cache::evictOne(bool negative, size_t need) {
+    lock_guard<mutex> lock(cache_mutex);
+    return evictOldestEntry(negative, need);
+}
+
+CacheBudget * Cache::budgetOf(const CacheEntry& entry) {
+    return entry.isNegative() ? negative_budget : budget;
+}
+
+void Cache::setEvictHook(function<void(const string&, const CacheEntry&)> hook) {
+    lock_guard<mutex> lock(cache_mutex);
+    evict_hook = hook;
+}
+
+void Cache::setAdmitHook(function<bool(const string&, bool)> hook) {
+    lock_guard<mutex> lock(cache_mutex);
+    admit_hook = hook;
+}
+
+void Cache::setMaxObjectSize(size_t bytes) {
+    max_object_size = bytes;
+}
+
+size_t Cache::getMaxObjectSize() {
+    return max_object_size;
+}
+
+// caller holds cache_mutex
+const string * Cache::oldestKeyLocked(bool negative) {
+    // simple strategy: the entry with the earliest expiry time
+    const auto & order = expiry_map[negative];
+    return order.empty() ? nullptr : order.begin()->second;
+}
+
+string Cache::peekVictim(bool negative) {
+    lock_guard<mutex> lock(cache_mutex);
+    const string * oldest_url = oldestKeyLocked(negative);
+    return oldest_url == nullptr ? "" : *oldest_url;
+}
+
+bool Cache::evictOldestEntry(bool negative, size_t need) {
+    const string * oldest_url = oldestKeyLocked(negative);
+    if (oldest_url == nullptr) {
+        return false;
+    }
+    string url = *oldest_url;
+    CacheEntry & victim = cache_map.at(url);
+    // a large body gives up its tail first, a Range request refills it
+    size_t body_size = victim.getBody().size();
+    if (need > 0 && victim.canTruncate() && body_size > need + SegmentedBody::SEGMENT_SIZE) {
+        size_t freed = victim.truncateBody(body_size - need);
+        current_size -= freed;
+        budgetOf(victim)->used -= freed;
+        CacheStats::getInstance().add(CacheStats::BODY_TRUNCATIONS);
+        LOG_INFO("(no-id): NOTE truncated " + url + " to " + to_string(victim.getBody().size()) + " bytes in cache");
+        return true;
     }
+    LOG_INFO("(no-id): NOTE evicted " + url + " from cache");
+    // demote to the next tier before dropping it, error pages are not worth
+    // the disk and a partial body cannot be served from there
+    if (evict_hook && !negative && !victim.isPartial()) {
+        evict_hook(url, victim);
+    }
+    removeEntryLocked(url, true);
+    return true;
 }
 
 void Cache::removeExpiredEntries() {
@@ -166,22 +422,25 @@ void Cache::removeExpiredEntries() {
     }
     
     for (const auto& url : to_remove) {
-        removeEntry(url);
+        removeEntryLocked(url);
     }
 }
 
-void Cache::updateExpiryMap(const string& url, time_t expires_time) {
-    expiry_map[expires_time] = url;
+// caller holds cache_mutex; key is the one stored in cache_map
+void Cache::updateExpiryMap(const string& key, const CacheEntry& entry) {
+    expiry_map[entry.isNegative()].emplace(entry.getExpiresTime(), &key);
 }
 
 bool Cache::isCacheable(const string& response_line, const string& response_headers) {
 
-    if (response_line.find("200") == string::npos) {
+    HeaderMeta meta = HeaderMeta::parse(response_headers);
+    int status = meta.status != 0 ? meta.status : atoi(response_line.c_str());
+    if (!isCacheableStatus(status, meta)) {
         return false;
     }
     
-    if (response_headers.find("Cache-Control: no-store") != string::npos ||
-        response_headers.find("Cache-Control: private") != string::npos) {
+    // Vary: * means no request can be matched to it
+    if (meta.no_store || meta.is_private || meta.vary_star) {
         return false;
     }
     
@@ -190,92 +449,81 @@ bool Cache::isCacheable(const string& response_line, const string& response_head
 
 bool Cache::isCacheable(const Response & response) {
 
-    if (response.getResult() != 200) {
-        logger.debug("not 200");
+    // found while the response was parsed, nothing is scanned again
+    const HeaderMeta & meta = response.getMeta();
+    if (!isCacheableStatus(response.getResult(), meta)) {
+        LOG_DEBUG("status " + to_string(response.getResult()) + " not cacheable");
         return false;
     }
 
-    if (response.getHeader("Cache-Control") == ""){
-        logger.debug("has no cache control in response");
-        return true;
+    if (meta.vary_star) {
+        LOG_DEBUG("varies on everything");
+        return false;
     }
-    
-    if (response.getHeader("Cache-Control").find("no-store") != std::string::npos||
-        response.getHeader("Cache-Control").find("private") != std::string::npos) {
-        logger.debug("cache not allowed");
+
+    if (meta.no_store || meta.is_private) {
+        LOG_DEBUG("cache not allowed");
         return false;
     }
     
     return true;
 }
 
-time_t Cache::parseExpiresTime(const string& response_headers) {
-    time_t now = time(nullptr);
-    time_t expires = now + 3600; // default 1 hour later
-    // time_t expires = now + 20; // default 20 seconds later
-    
-    // try to parse from Cache-Control: max-age
-    regex max_age_regex("Cache-Control:.*?max-age=(\\d+)");
-    smatch max_age_match;
-    if (regex_search(response_headers, max_age_match, max_age_regex)) {
-        int max_age = stoi(max_age_match[1]);
-        expires = now + max_age;
-        return expires;
+bool Cache::isCacheableStatus(int status, const HeaderMeta & meta) {
+    switch (status) {
+        case 200: case 203: case 204: case 300: case 301: case 308:
+        case 404: case 405: case 410: case 414: case 501:
+            return true;
+        // temporary redirects only when the origin says for how long
+        case 302: case 307:
+            return meta.hasExplicitFreshness();
+        default:
+            return false;
     }
-    
-    // try to parse from Expires header
-    regex expires_regex("Expires: (.+)");
-    smatch expires_match;
-    if (regex_search(response_headers, expires_match, expires_regex)) {
-        string expires_str = expires_match[1];
-        
-        // parse HTTP date format
-        struct tm tm = {};
-        strptime(expires_str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
-        time_t expires_time = mktime(&tm);
-        
-        // adjust to GMT
-        expires_time -= timezone;
-        
-        if (expires_time > now) {
-            expires = expires_time;
+}
+
+vector<string> Cache::parseVary(const string& response_headers) {
+    vector<string> names;
+    string vary = Compression::getHeader(response_headers, "Vary");
+    size_t start = 0;
+    while (start < vary.size()) {
+        size_t end = vary.find(',', start);
+        if (end == string::npos) {
+            end = vary.size();
+        }
+        string name;
+        for (size_t i = start; i < end; i++) {
+            if (vary[i] != ' ' && vary[i] != '\t') {
+                name += tolower(static_cast<unsigned char>(vary[i]));
+            }
+        }
+        // encodings are negotiated by the proxy itself: origins are always
+        // asked for gzip and the stored body is inflated per client
+        if (!name.empty() && name != "accept-encoding" &&
+            find(names.begin(), names.end(), name) == names.end()) {
+            names.push_back(name);
         }
+        start = end + 1;
     }
-    
-    return expires;
-}
-
-bool Cache::requiresRevalidation(const string& response_headers) {
-    return response_headers.find("must-revalidate") != string::npos ||
-           response_headers.find("no-cache") != string::npos;
-}
-
-string Cache::extractETag(const string& response_headers) {
-    regex etag_regex("ETag: \"?([^\"\r\n]+)\"?", std::regex_constants::icase);
-    smatch etag_match;
-    if (regex_search(response_headers, etag_match, etag_regex)) {
-        return etag_match[1];
-    }
-    return "";
-}
-
-time_t Cache::extractLastModified(const string& response_headers) {
-    regex last_modified_regex("Last-Modified: (.+)");
-    smatch last_modified_match;
-    if (regex_search(response_headers, last_modified_match, last_modified_regex)) {
-        string last_modified_str =  last_modified_match[1];
-        // parse HTTP date format
-        struct tm tm = {};
-        strptime(last_modified_str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
-        time_t last_modified_time = mktime(&tm);
-        
-        // adjust to GMT
-        last_modified_time -= timezone;
-        
-        if (last_modified_time > time(nullptr)) {
-            return time(nullptr);;
+    sort(names.begin(), names.end());
+    return names;
+}
+
+string Cache::variantKey(const string& url, const vector<string>& vary, const Request& request) {
+    if (vary.empty()) {
+        return url;
+    }
+    string key = url;
+    for (const auto& name : vary) {
+        key += '\n';
+        key += name;
+        key += '=';
+        // "en-US, fr" and "en-us,fr" select the same variant
+        for (char c : request.getHeader(name)) {
+            if (c != ' ' && c != '\t') {
+                key += tolower(static_cast<unsigned char>(c));
+            }
         }
-        return last_modified_time;
     }
-    return time(nullptr);;
+    return key;
 }
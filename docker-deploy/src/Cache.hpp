@@ -6,28 +6,90 @@
 #include <mutex>
 #include <ctime>
 #include <map>
+#include <set>
 #include <vector>
+#include <functional>
+#include <atomic>
+#include <optional>
 
 #include "Logger.hpp"
 #include "CacheEntry.hpp"
 #include "Response.hpp"
+#include "Request.hpp"
+#include "HeaderMeta.hpp"
+#include "PrefixIndex.hpp"
 
 using namespace std;
 
+// Memory budget shared by all shards, so a hot shard can grow
+// while cold ones shrink instead of each getting a fixed slice
+struct CacheBudget {
+    size_t limit;
+    atomic<size_t> used;
+
+    explicit CacheBudget(size_t limit) : limit(limit), used(0) {}
+};
+
 class Cache {
 private:
     unordered_map<string, CacheEntry> cache_map;
-    map<time_t, string> expiry_map;
+    // keys of each budget (negative or not) by expiry, the first is the
+    // next victim; they point into cache_map, whose nodes never move
+    set<pair<time_t, const string *>> expiry_map[2];
     mutex cache_mutex;
-    size_t max_size;
+    // own budget when used standalone, otherwise points to the shared one
+    CacheBudget own_budget;
+    CacheBudget * budget;
+    // 4xx/5xx entries are charged here, so they cannot push out content
+    CacheBudget own_negative_budget;
+    CacheBudget * negative_budget;
     size_t current_size;
+    // stored entries are packed into blocks of this shard's arena
+    shared_ptr<EntryArena> arena;
     static inline Logger & logger = Logger::getInstance();
+    // called with each evicted entry, e.g. to demote it to disk
+    function<void(const string&, const CacheEntry&)> evict_hook;
+    // asked to free bytes of one budget (negative or not) from any shard
+    // before an insert, without our lock
+    function<void(size_t, bool)> reclaim_hook;
+    // asked whether a new url is worth an eviction when the budget is full
+    function<bool(const string&, bool)> admit_hook;
     
-    void evictOldestEntry();
+    // Vary: the url maps to its variants, each stored under
+    // url + "\n" + the normalized request header values it varies on;
+    // the set outlives the eviction of its last key, whose variants the
+    // disk and shared tiers still find under those keys
+    struct VariantSet {
+        vector<string> vary;    // lower case header names
+        vector<string> keys;    // oldest first
+    };
+    unordered_map<string, VariantSet> variant_index;
+    static const size_t MAX_VARIANTS = 8;
+    // every key in cache_map, for purges by prefix
+    PrefixIndex key_index;
+
+    // bodies above this are not cached at all, 0 for no limit
+    static inline atomic<size_t> max_object_size{0};
+
+    // oldest entry of one budget, false if there is none; a large one
+    // only gives up enough of its body's tail to free need bytes
+    bool evictOldestEntry(bool negative, size_t need = 0);
+    const string * oldestKeyLocked(bool negative);
+    CacheBudget * budgetOf(const CacheEntry& entry);
+    void indexVariantLocked(const string& key, const CacheEntry& entry);
+    void removeVariantsLocked(const string& url);
+    // keep_vary leaves the url's Vary list behind with its last variant
+    void removeEntryLocked(const string& url, bool keep_vary = false);
     void removeExpiredEntries();
-    void updateExpiryMap(const string& url, time_t expires_time);
+    void updateExpiryMap(const string& key, const CacheEntry& entry);
     
 public:
+    struct MemoryUsage {
+        size_t entries;
+        size_t payload;     // bytes charged to the budgets
+        size_t footprint;   // bytes really taken, map nodes and keys included
+    };
+
     enum CacheStatus {
         NOT_IN_CACHE,
         IN_CACHE_VALID,
@@ -38,7 +100,13 @@ public:
     // static Cache & getInstance();
     
     Cache(size_t max_size = 10 * 1024 * 1024); // Default 10MB cache
+
+    // shard of a bigger cache, charged against shared budgets
+    Cache(CacheBudget * budget, CacheBudget * negative_budget, function<void(size_t, bool)> reclaim_hook);
     
+    // key of the variant this request selects, the url if it has none
+    string lookupKey(const Request& request);
+
     CacheStatus checkStatus(const string& url);
 
     CacheStatus checkExpiredByAge(const string& url, int age);
@@ -47,17 +115,48 @@ public:
                     const string& response_line, 
                     const string& response_headers, 
                     const string& response_body);
-    CacheEntry* getEntry(const string& url);
+    // insert an already built entry, keeping its timestamps
+    void addEntry(const string& url, const CacheEntry& entry);
+    // copy that stays valid after the entry is evicted or truncated, its
+    // body segments are shared rather than copied
+    optional<CacheEntry> copyEntry(const string& url);
+    // checkStatus and copyEntry under one lock, so both see the same entry
+    CacheStatus lookup(const string& url, optional<CacheEntry>& entry);
+    bool contains(const string& url);
+    // merge a 304 into the stored entry and restart its freshness,
+    // false if it is gone
+    bool refreshEntry(const string& url, const string& not_modified_headers);
+    // consistent copy of every entry, e.g. for a snapshot
+    vector<pair<string, CacheEntry>> copyEntries();
     void removeEntry(const string& url);
+    // drop url and all its variants, returns the entries removed
+    size_t purge(const string& url);
+    // drop every key starting with prefix, returns the entries removed
+    size_t purgePrefix(const string& prefix);
     size_t getCurrentSize() const;
+    size_t getEntryNumber();
+    MemoryUsage getMemoryUsage();
+    const EntryArena & getArena() const;
+    // evict one entry of a budget to free need bytes for another shard,
+    // false if there is none
+    bool evictOne(bool negative = false, size_t need = 0);
+    void setEvictHook(function<void(const string&, const CacheEntry&)> hook);
+    void setAdmitHook(function<bool(const string&, bool)> hook);
+    // key that evictOne would drop next, empty if there is none
+    string peekVictim(bool negative);
+    static void setMaxObjectSize(size_t bytes);
+    static size_t getMaxObjectSize();
     
     // Parse cache control headers to determine if the response is cacheable
     static bool isCacheable(const string& response_line, const string& response_headers);
     static bool isCacheable(const Response & response);
-    static time_t parseExpiresTime(const string& response_headers);
-    static bool requiresRevalidation(const string& response_headers);
-    static string extractETag(const string& response_headers);
-    static time_t extractLastModified(const string& response_headers);
+    // RFC 9110 15.1 heuristically cacheable codes, plus the rest of the
+    // redirects when the origin gave explicit freshness
+    static bool isCacheableStatus(int status, const HeaderMeta & meta);
+    // header names a response varies on, without Accept-Encoding
+    static vector<string> parseVary(const string& response_headers);
+    // cache key of the variant selected by request's values of vary
+    static string variantKey(const string& url, const vector<string>& vary, const Request& request);
 
 
 };
@@ -1,110 +1,126 @@
 #include "CacheDecision.hpp"
+#include "HttpDate.hpp"
 
-CacheDecision::Decision CacheDecision::makeDecision(const Request & request){
-    string cacheControl = request.getHeader("Cache-Control");
+CacheDecision::Decision CacheDecision::makeDecision(const Request & request, optional<CacheEntry> & entry){
+    Decision decision = decide(request, entry);
+    // the client already holds this version, the body need not travel again
+    if (decision == CacheDecision::RETURN_CACHE && entry && entry->getStatus() == 200 &&
+        clientCopyIsCurrent(request.getHeader("If-None-Match"), request.getHeader("If-Modified-Since"), *entry)){
+        LOG_INFO(request.getId(), "client copy is current, not modified");
+        return CacheDecision::RETURN_304;
+    }
+    return decision;
+}
+
+CacheDecision::Decision CacheDecision::decide(const Request & request, optional<CacheEntry> & entry){
+    const HeaderMeta & cacheControl = request.getCacheControl();
     
 
     // Cache & cache = Cache::getInstance();
-    Cache & cache = CacheMaster::getInstance().selectCache(request.getUrl());
+    Cache & cache = CacheMaster::getInstance().selectCache(request.getCacheUrl());
+    string key = cache.lookupKey(request);
     
-    Cache::CacheStatus cacheStatus = cache.checkStatus(request.getUrl());
-    CacheEntry * entry = cache.getEntry(request.getUrl());
+    // a copy, an eviction meanwhile cannot pull it away
+    Cache::CacheStatus cacheStatus = cache.lookup(key, entry);
  
-    // logger.info(request.getId(), "here to decision");
+    // LOG_INFO(request.getId(), "here to decision");
     // no entry
     if (cacheStatus == Cache::NOT_IN_CACHE){
-        logger.info(request.getId(), "not in cache");
+        LOG_INFO(request.getId(), "not in cache");
         return CacheDecision::DIRECT;
     }
 
     // no cache control
-    if (cacheControl == ""){
+    if (!cacheControl.has_cache_control){
         if (cacheStatus == Cache::IN_CACHE_VALID){
-            logger.info(request.getId(), "in cache, valid");
+            LOG_INFO(request.getId(), "in cache, valid");
             return CacheDecision::RETURN_CACHE;
+        }else if (cacheStatus == Cache::IN_CACHE_EXPIRED && entry->canServeStaleWhileRevalidate()){
+            LOG_INFO(request.getId(), "in cache, but expired at "+timeToStr(entry->getExpiresTime())+", serving stale while revalidating");
+            return CacheDecision::RETURN_STALE;
         }else{
-            logger.info(request.getId(), "in cache, requires validation");
+            LOG_INFO(request.getId(), "in cache, requires validation");
             return CacheDecision::REVALIDATE;
         }
     }
 
     // check every directive
-    if (cacheControl.find("no-store") != string::npos){
-        logger.info(request.getId(), "in cache, but has no-store in request");
+    if (cacheControl.no_store){
+        LOG_INFO(request.getId(), "in cache, but has no-store in request");
         return CacheDecision::DIRECT;
     }
-    if (cacheControl.find("no-cache") != string::npos){
-        logger.info(request.getId(), "in cache, requires validation");
+    if (cacheControl.no_cache){
+        LOG_INFO(request.getId(), "in cache, requires validation");
         return CacheDecision::REVALIDATE;
     }
-    if (cacheControl.find("only-if-cached") != string::npos){
+    if (cacheControl.only_if_cached){
         if (cacheStatus == Cache::IN_CACHE_VALID){
-            logger.info(request.getId(), "in cache, valid");
+            LOG_INFO(request.getId(), "in cache, valid");
             return CacheDecision::RETURN_CACHE;
         }else{
-            logger.info(request.getId(), "no valid cache, but has only-if-cached in request");
+            LOG_INFO(request.getId(), "no valid cache, but has only-if-cached in request");
             return CacheDecision::RETURN_504;
         }
     }
-    if (cacheControl.find("max-age") != string::npos){
-        return handle_max_age(cacheControl, entry, request.getId());
+    if (cacheControl.max_age != HeaderMeta::ABSENT){
+        return handle_max_age(cacheControl, &*entry, request.getId());
     }
-    if (cacheControl.find("min-fresh") != string::npos){
-        return handle_min_fresh(cacheControl, entry, request.getId());
+    if (cacheControl.min_fresh != HeaderMeta::ABSENT){
+        return handle_min_fresh(cacheControl, &*entry, request.getId());
     }
-    if (cacheControl.find("max-stale") != string::npos){
-        return handle_max_stale(cacheControl, entry, request.getId());
+    if (cacheControl.max_stale != HeaderMeta::ABSENT){
+        return handle_max_stale(cacheControl, &*entry, request.getId());
     }
-    if (cacheControl.find("no-transform") != string::npos){
+    if (cacheControl.no_transform){
         return CacheDecision::NO_TRANSFORM;
     }
     return CacheDecision::DIRECT;
 }
 
-CacheDecision::Decision CacheDecision::handle_max_age(const string & cacheControl, const CacheEntry * entry, int id){
-    int max_age = parseTime(cacheControl, "max-age");
+CacheDecision::Decision CacheDecision::handle_max_age(const HeaderMeta & cacheControl, const CacheEntry * entry, int id){
+    int max_age = cacheControl.max_age;
     int entryAge = entry->getAge();
-    logger.debug(id, "entryAge"+to_string(entryAge)+" max-age="+to_string(max_age));
+    LOG_DEBUG(id, "entryAge"+to_string(entryAge)+" max-age="+to_string(max_age));
     if (entryAge <= max_age){
-        if (cacheControl.find("min-fresh") != string::npos){
+        if (cacheControl.min_fresh != HeaderMeta::ABSENT){
             return handle_min_fresh(cacheControl, entry, id);
         }
-        logger.info(id, "in cache, valid(max-age)");
+        LOG_INFO(id, "in cache, valid(max-age)");
         return CacheDecision::RETURN_CACHE;
     }else{
-        if (cacheControl.find("max-stale") != string::npos){
+        if (cacheControl.max_stale != HeaderMeta::ABSENT){
             return handle_max_stale(cacheControl, entry, id);
         }
         time_t expiredTime = entry->getExpiresTime();
-        logger.info(id, "in cache, but expired at "+timeToStr(expiredTime));
+        LOG_INFO(id, "in cache, but expired at "+timeToStr(expiredTime));
         return CacheDecision::DIRECT;
     }
 }
 
-CacheDecision::Decision CacheDecision::handle_min_fresh(const string & cacheControl, const CacheEntry * entry, int id){
-    int min_fresh = parseTime(cacheControl, "min-fresh");
+CacheDecision::Decision CacheDecision::handle_min_fresh(const HeaderMeta & cacheControl, const CacheEntry * entry, int id){
+    int min_fresh = cacheControl.min_fresh;
     int restTime = entry->getRestTime();
 
     if (restTime <= min_fresh){
         time_t expiredTime = entry->getExpiresTime();
-        logger.info(id, "in cache, but expired at "+timeToStr(expiredTime));
+        LOG_INFO(id, "in cache, but expired at "+timeToStr(expiredTime));
         return CacheDecision::REVALIDATE;
     }else{
-        logger.info(id, "in cache, valid");
+        LOG_INFO(id, "in cache, valid");
         return CacheDecision::RETURN_CACHE;
     }
 }
 
-CacheDecision::Decision CacheDecision::handle_max_stale(const string & cacheControl, const CacheEntry * entry, int id){
-    int max_stale = parseTime(cacheControl, "max-stale");
+CacheDecision::Decision CacheDecision::handle_max_stale(const HeaderMeta & cacheControl, const CacheEntry * entry, int id){
+    int max_stale = cacheControl.max_stale;
     int staleTime = entry->getStaleTime();
 
     if (staleTime <= max_stale){
-        logger.info(id, "in cache, valid");
+        LOG_INFO(id, "in cache, valid");
         return CacheDecision::RETURN_CACHE;
     }else{
         time_t expiredTime = entry->getExpiresTime();
-        logger.info(id, "in cache, but expired at "+timeToStr(expiredTime));
+        LOG_INFO(id, "in cache, but expired at "+timeToStr(expiredTime));
         return CacheDecision::REVALIDATE;
     }
 }
@@ -129,20 +145,49 @@ CacheDecision::Decision CacheDecision::handle_max_stale(const string & cacheCont
 //     return CacheDecision::DIRECT;
 // }
 
-int CacheDecision::parseTime(const string & cacheControl, string directive){
-    regex time_regex(".*?"+directive+"=(\\d+)");
-    smatch time_match;
-    if (regex_search(cacheControl, time_match, time_regex)){
-        return stoi(time_match[1]);
+// RFC 9110 13.1: If-None-Match wins over If-Modified-Since, and
+// If-None-Match uses the weak comparison
+bool CacheDecision::clientCopyIsCurrent(string_view ifNoneMatch, string_view ifModifiedSince, const CacheEntry & entry){
+    if (!ifNoneMatch.empty()){
+        string etag = entry.getETag();
+        if (etag.empty()){
+            return false;
+        }
+        string_view opaque = weakTag(etag);
+        size_t start = 0;
+        while (start < ifNoneMatch.size()){
+            size_t end = ifNoneMatch.find(',', start);
+            if (end == string::npos){
+                end = ifNoneMatch.size();
+            }
+            string_view tag = ifNoneMatch.substr(start, end - start);
+            while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) tag.remove_prefix(1);
+            while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) tag.remove_suffix(1);
+            if (tag == "*" || (!tag.empty() && weakTag(tag) == opaque)){
+                return true;
+            }
+            start = end + 1;
+        }
+        return false;
     }
-    return -1;
-    
+    if (!ifModifiedSince.empty() && entry.hasLastModified()){
+        time_t since = HttpDate::parse(ifModifiedSince);
+        return since != 0 && entry.getLastModified() <= since;
+    }
+    return false;
+}
+
+// the opaque part of an entity tag, W/ and quotes removed
+string_view CacheDecision::weakTag(string_view tag){
+    if (tag.size() >= 2 && tag[0] == 'W' && tag[1] == '/'){
+        tag.remove_prefix(2);
+    }
+    if (tag.size() >= 2 && tag.front() == '"' && tag.back() == '"'){
+        tag = tag.substr(1, tag.size() - 2);
+    }
+    return tag;
 }
 
 string CacheDecision::timeToStr(time_t time){
-    time_t newtime = time;
-    struct tm* utc_time = std::gmtime(&newtime);
-    std::string time_str(std::asctime(utc_time));
-    time_str.pop_back();  
-    return time_str;
+    return HttpDate::toAsctime(time);
 }
\ No newline at end of file
@@ -5,12 +5,13 @@
 #include "Cache.hpp"
 #include "Request.hpp"
 #include "CacheMaster.hpp"
-#include <regex>
 #include <algorithm>
 #include <ctime>
 #include <string>
+#include <string_view>
 #include <iomanip>
 #include <sstream>
+#include <optional>
 using namespace std;
 class CacheDecision{
     public:
@@ -21,21 +22,29 @@ class CacheDecision{
             RETURN_CACHE,
             RETURN_504,
             RETURN_304,
-            NO_TRANSFORM
+            NO_TRANSFORM,
+            RETURN_STALE    // serve stale now, refresh in background
         };
 
-        Decision makeDecision(const Request & request);
+        // entry is set to the copy of the cached entry the decision was
+        // made on, empty if there is none
+        Decision makeDecision(const Request & request, optional<CacheEntry> & entry);
+
+        // does the client's If-None-Match / If-Modified-Since match the entry
+        static bool clientCopyIsCurrent(string_view ifNoneMatch, string_view ifModifiedSince, const CacheEntry & entry);
 
 
     private:
     
         static inline Logger & logger = Logger::getInstance();
 
-        Decision handle_max_age(const string & cacheControl, const CacheEntry * entry, int id);
-        Decision handle_min_fresh(const string & cacheControl, const CacheEntry * entry, int id);
-        Decision handle_max_stale(const string & cacheControl, const CacheEntry * entry, int id);
+        Decision decide(const Request & request, optional<CacheEntry> & entry);
+        static string_view weakTag(string_view tag);
+
+        Decision handle_max_age(const HeaderMeta & cacheControl, const CacheEntry * entry, int id);
+        Decision handle_min_fresh(const HeaderMeta & cacheControl, const CacheEntry * entry, int id);
+        Decision handle_max_stale(const HeaderMeta & cacheControl, const CacheEntry * entry, int id);
 
-        int parseTime(const string & cacheControl, string directive);
         string timeToStr(time_t time);
 
 };
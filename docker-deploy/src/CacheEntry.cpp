@@ -1,17 +1,140 @@
 #include "Cache.hpp"
+#include "Compression.hpp"
+#include <strings.h>
+#include <algorithm>
+#include <cstring>
+#include "HttpDate.hpp"
 
 CacheEntry::CacheEntry(const string& response_line, 
     const string& response_headers, 
-    const string& response_body
+    string_view response_body
     ) 
-:   response_line(response_line),
-    response_headers(response_headers),
-    response_body(response_body),
+:   line_length(0),
+    headers_length(0),
+    body_length(response_body.size()),
     creation_time(time(nullptr)),
-    requires_revalidation(Cache::requiresRevalidation(response_headers)) {
-    expires_time = Cache::parseExpiresTime(response_headers);
-    etag = Cache::extractETag(response_headers);
-    last_modified = Cache::extractLastModified(response_headers);
+    restored(false) {
+    if (response_body.size() <= SegmentedBody::SEGMENT_SIZE) {
+        pack(*EntryArena::heap(), response_line, response_headers, response_body);
+    } else {
+        this->response_body = SegmentedBody(response_body);
+        pack(*EntryArena::heap(), response_line, response_headers, "");
+    }
+    applyHeaders();
+}
+
+void CacheEntry::pack(EntryArena & arena, string_view line, string_view headers, string_view body) {
+    EntryArena::Block packed = arena.allocate(line.size() + headers.size() + body.size());
+    char * out = packed.data();
+    memcpy(out, line.data(), line.size());
+    memcpy(out + line.size(), headers.data(), headers.size());
+    memcpy(out + line.size() + headers.size(), body.data(), body.size());
+    if (!body.empty()) {
+        response_body = SegmentedBody(packed, line.size() + headers.size(), body.size());
+    }
+    // the views may point into the old block, it goes only now
+    block = move(packed);
+    line_length = line.size();
+    headers_length = headers.size();
+}
+
+string_view CacheEntry::inlineBody() const {
+    if (response_body.getSegmentNumber() != 1) {
+        return string_view();
+    }
+    vector<struct iovec> iov;
+    response_body.appendIovecs(iov);
+    return string_view(static_cast<const char *>(iov[0].iov_base), iov[0].iov_len);
+}
+
+void CacheEntry::packInto(EntryArena & arena) {
+    pack(arena, lineView(), headersView(), inlineBody());
+}
+
+string_view CacheEntry::lineView() const {
+    return string_view(block.data(), line_length);
+}
+
+string_view CacheEntry::headersView() const {
+    return string_view(block.data() + line_length, headers_length);
+}
+
+void CacheEntry::applyHeaders() {
+    // one pass over the headers gives everything below
+    string_view response_headers = headersView();
+    HeaderMeta meta = HeaderMeta::parse(response_headers);
+    requires_revalidation = meta.requiresRevalidation();
+    status = meta.status == 0 ? 200 : meta.status;
+    // broken links should not stick around for the default hour
+    expires_time = meta.expiresAt(creation_time, status >= 400 ? negative_ttl.load() : 3600);
+    etag_offset = meta.etag.empty() ? 0 : meta.etag.data() - response_headers.data();
+    etag_length = meta.etag.size();
+    // a missing or future Last-Modified counts as now
+    has_last_modified = meta.last_modified != HeaderMeta::ABSENT && meta.last_modified != 0;
+    last_modified = has_last_modified && meta.last_modified <= creation_time ? meta.last_modified : creation_time;
+    stale_while_revalidate = meta.forbidsStale() ? HeaderMeta::ABSENT : meta.stale_while_revalidate;
+    stale_if_error = meta.forbidsStale() ? HeaderMeta::ABSENT : meta.stale_if_error;
+    gzip = meta.gzip;
+}
+
+// RFC 9111 4.3.4: stored headers are replaced by the ones in the 304,
+// except those describing the stored body or this one connection
+void CacheEntry::refresh(const string& not_modified_headers) {
+    static const char * const keep[] = {
+        "Content-Length", "Content-Encoding", "Transfer-Encoding", "Content-Range",
+        "Connection", "Keep-Alive", "Vary", "Trailer", "Upgrade"
+    };
+    string response_headers(headersView());
+    vector<pair<string, string>> updates;
+    size_t pos = not_modified_headers.find("\r\n");
+    while (pos != string::npos && pos + 2 < not_modified_headers.size()) {
+        size_t line_start = pos + 2;
+        size_t line_end = not_modified_headers.find("\r\n", line_start);
+        if (line_end == string::npos || line_end == line_start) {
+            break;
+        }
+        size_t colon = not_modified_headers.find(':', line_start);
+        pos = line_end;
+        if (colon == string::npos || colon > line_end) {
+            continue;
+        }
+        string name = not_modified_headers.substr(line_start, colon - line_start);
+        bool skip = false;
+        for (const char * kept : keep) {
+            skip = skip || strcasecmp(name.c_str(), kept) == 0;
+        }
+        if (skip) {
+            continue;
+        }
+        size_t value_start = not_modified_headers.find_first_not_of(" \t", colon + 1);
+        string value = value_start < line_end ? not_modified_headers.substr(value_start, line_end - value_start) : "";
+        // a body we re-encoded keeps its weakened tag (Compression::compressForCache)
+        if (strcasecmp(name.c_str(), "ETag") == 0 && Compression::getHeader(response_headers, "ETag") == "W/" + value) {
+            value = "W/" + value;
+        }
+        updates.emplace_back(name, value);
+    }
+    // drop every old line of a name first, a 304 may repeat one
+    for (const auto & update : updates) {
+        Compression::removeHeader(response_headers, update.first);
+    }
+    for (const auto & update : updates) {
+        Compression::addHeader(response_headers, update.first, update.second);
+    }
+    pack(block.arena(), lineView(), response_headers, inlineBody());
+    creation_time = time(nullptr);
+    applyHeaders();
+}
+
+CacheEntry::CacheEntry(const string& response_line, 
+    const string& response_headers, 
+    string_view response_body,
+    time_t creation_time,
+    time_t expires_time
+    ) 
+:   CacheEntry(response_line, response_headers, response_body) {
+    this->creation_time = creation_time;
+    this->expires_time = expires_time;
 }
 
 bool CacheEntry::isExpired() const {
@@ -31,23 +154,52 @@ return requires_revalidation;
 }
 
 string CacheEntry::getFullResponse() const {
-return response_headers + response_body;
+    string full(headersView());
+    full += response_body.toString();
+    return full;
 }
 
 string CacheEntry::getResponseLine() const {
-return response_line;
+    return string(lineView());
 }
 
 string CacheEntry::getResponseHeaders() const {
-return response_headers;
+    return string(headersView());
 }
 
 string CacheEntry::getResponseBody() const {
-return response_body;
+return response_body.toString();
+}
+
+const SegmentedBody & CacheEntry::getBody() const {
+    return response_body;
+}
+
+bool CacheEntry::isPartial() const {
+    return response_body.size() < body_length;
+}
+
+size_t CacheEntry::getBodyLength() const {
+    return body_length;
+}
+
+// If-Range needs a strong validator to refill the tail
+bool CacheEntry::canTruncate() const {
+    string_view etag = headersView().substr(etag_offset, etag_length);
+    return status == 200 && !gzip && response_body.getSegmentNumber() > 1 &&
+           ((!etag.empty() && etag.rfind("W/", 0) != 0) || has_last_modified);
+}
+
+size_t CacheEntry::truncateBody(size_t keep) {
+    return response_body.truncate(keep);
+}
+
+void CacheEntry::appendBody(string_view data) {
+    response_body.append(data.data(), min(data.size(), body_length - response_body.size()));
 }
 
 string CacheEntry::getETag() const {
-return etag;
+    return string(headersView().substr(etag_offset, etag_length));
 }
 
 time_t CacheEntry::getLastModified() const {
@@ -58,6 +210,52 @@ time_t CacheEntry::getExpiresTime() const {
 return expires_time;
 }
 
+time_t CacheEntry::getCreationTime() const {
+    return creation_time;
+}
+
+bool CacheEntry::hasLastModified() const {
+    return has_last_modified;
+}
+
+void CacheEntry::markRestored() {
+    restored = true;
+}
+
+bool CacheEntry::isRestored() const {
+    return restored;
+}
+
+bool CacheEntry::isGzip() const {
+    return gzip;
+}
+
+int CacheEntry::getStatus() const {
+    return status;
+}
+
+bool CacheEntry::isNegative() const {
+    return status >= 400;
+}
+
+void CacheEntry::setNegativeTtl(int seconds) {
+    negative_ttl = seconds;
+}
+
+int CacheEntry::getNegativeTtl() {
+    return negative_ttl;
+}
+
+// bytes charged against the cache budget
+size_t CacheEntry::getSize() const {
+    return line_length + headers_length + response_body.size();
+}
+
+size_t CacheEntry::getFootprint() const {
+    size_t body = response_body.viewsInto(block) ? 0 : response_body.footprint();
+    return sizeof(CacheEntry) + block.footprint() + body;
+}
+
 int CacheEntry::getAge() const {
     return time(nullptr) - creation_time;
 }
@@ -70,10 +268,23 @@ int CacheEntry::getStaleTime() const {
     return - getRestTime();
 }
 
+// expired, but still inside the stale-while-revalidate window
+bool CacheEntry::canServeStaleWhileRevalidate() const {
+    if (!isExpired() || requires_revalidation) {
+        return false;
+    }
+    return getStaleTime() <= stale_while_revalidate;
+}
+
+// inside the stale-if-error window, a fresh entry qualifies unless it
+// must be revalidated before every use
+bool CacheEntry::canServeStaleIfError() const {
+    if (stale_if_error < 0 || requires_revalidation) {
+        return false;
+    }
+    return getStaleTime() <= stale_if_error;
+}
+
 string CacheEntry::getExpiresTimeStr() const{
-    time_t time = getExpiresTime();
-    struct tm* utc_time = std::gmtime(&time);
-    std::string time_str(std::asctime(utc_time));
-    time_str.pop_back();  
-    return time_str;
+    return HttpDate::toAsctime(getExpiresTime());
 }
@@ -7,28 +7,66 @@
 #include <ctime>
 #include <map>
 #include <vector>
+#include <atomic>
+#include <string_view>
 
 #include "Logger.hpp"
+#include "SegmentedBody.hpp"
 
 using namespace std;
 
 class CacheEntry {
 
     private:
-        string cacheKey;
-        string response_line;
-        string response_headers;
-        string response_body;
+        // status line, headers and a body of up to one segment, back to
+        // back in one arena block; copies share it
+        EntryArena::Block block;
+        uint32_t line_length;
+        uint32_t headers_length;
+        // the validator is a view into the headers
+        uint32_t etag_offset;
+        uint32_t etag_length;
+        SegmentedBody response_body;
+        // bytes of the whole body, more than response_body holds once its
+        // tail was evicted
+        size_t body_length;
         time_t creation_time;
         time_t expires_time;
         bool requires_revalidation;
-        string etag;
         time_t last_modified;
+        // RFC 5861 windows in seconds, -1 if absent
+        int stale_while_revalidate;
+        int stale_if_error;
+        bool has_last_modified;
+        // loaded from a snapshot rather than fetched by this process
+        bool restored;
+        // body is stored with Content-Encoding: gzip
+        bool gzip;
+        int status;
+        // freshness of negative responses the origin gave none
+        static inline atomic<int> negative_ttl{60};
+
+        // (re)read everything derived from the headers
+        void applyHeaders();
+
+        string_view lineView() const;
+        string_view headersView() const;
+        // line, headers and a body of at most one segment into a fresh
+        // block of arena; an empty body leaves response_body as it is
+        void pack(EntryArena & arena, string_view line, string_view headers, string_view body);
+        // the body if it is one segment, empty otherwise
+        string_view inlineBody() const;
         
     public:
         CacheEntry(const string& response_line, 
                    const string& response_headers, 
-                   const string& response_body);
+                   string_view response_body);
+        // rebuild an entry stored earlier, keeping its original age
+        CacheEntry(const string& response_line, 
+                   const string& response_headers, 
+                   string_view response_body,
+                   time_t creation_time,
+                   time_t expires_time);
         
         bool isExpired() const;
         bool isExpiredByAge(int maxAge) const;
@@ -38,13 +76,44 @@ class CacheEntry {
         string getResponseLine() const;
         string getResponseHeaders() const;
         string getResponseBody() const;
+        const SegmentedBody & getBody() const;
+        // the tail of the body was evicted, a Range request can get it back
+        bool isPartial() const;
+        size_t getBodyLength() const;
+        // a plain 200 with a strong validator can give up its tail under pressure
+        bool canTruncate() const;
+        // keep at most keep bytes of the body, returns the bytes freed
+        size_t truncateBody(size_t keep);
+        // add back bytes of a partial body, e.g. from a 206
+        void appendBody(string_view data);
         string getETag() const;
         time_t getLastModified() const;
         time_t getExpiresTime() const;
+        time_t getCreationTime() const;
+        bool hasLastModified() const;
+        void markRestored();
+        bool isRestored() const;
+        bool isGzip() const;
+        int getStatus() const;
+        // 4xx/5xx answers, kept under their own budget
+        bool isNegative() const;
+        static void setNegativeTtl(int seconds);
+        static int getNegativeTtl();
+        size_t getSize() const;
+        // memory the entry really takes: the object, its block and any
+        // body segments outside it
+        size_t getFootprint() const;
+        // move everything a shard keeps into one block of its arena
+        void packInto(EntryArena & arena);
         int getAge() const;
         int getRestTime() const;
         int getStaleTime() const;
+        bool canServeStaleWhileRevalidate() const;
+        bool canServeStaleIfError() const;
         string getExpiresTimeStr() const;
+        // a 304 came back: take its headers and start a new freshness
+        // lifetime, the body stays where it is
+        void refresh(const string& not_modified_headers);
 };
     
 
@@ -1,4 +1,6 @@
 #include "CacheHandler.hpp"
+#include "HttpDate.hpp"
+#include "Compression.hpp"
 
 bool CacheHandler::need_to_send(CacheDecision::Decision decision){
     if (decision == CacheDecision::DIRECT ||
@@ -9,21 +11,41 @@ bool CacheHandler::need_to_send(CacheDecision::Decision decision){
     return false;
 }
 
-string CacheHandler::build_forward_response(CacheDecision::Decision decision, CacheEntry * entry){
+string CacheHandler::build_forward_response(CacheDecision::Decision decision, const CacheEntry * entry){
     switch(decision){
         case CacheDecision::RETURN_CACHE:{
             return entry->getFullResponse();
         }
+        case CacheDecision::RETURN_STALE:{
+            return entry->getFullResponse();
+        }
         case CacheDecision::RETURN_304:{
-            return "HTTP/1.1 304 Not Modified\r\n\r\n";
+            return build_not_modified(entry);
         }
         case CacheDecision::RETURN_504:{
-            return "HTTP/1.1 504 Gateway Timeout\r\n\r\n";
+            return "HTTP/1.1 504 Gateway Timeout\r\nDate: " + HttpDate::now() + "\r\n\r\n";
         }
     }
     return "";
 }
 
+// RFC 9110 15.4.5: a 304 carries the headers a 200 would have for
+// updating the client's copy, and no body
+string CacheHandler::build_not_modified(const CacheEntry * entry){
+    static const char * const copied[] = {
+        "Cache-Control", "Content-Location", "ETag", "Expires", "Last-Modified", "Vary"
+    };
+    string response = "HTTP/1.1 304 Not Modified\r\nDate: " + HttpDate::now() + "\r\n";
+    string headers = entry->getResponseHeaders();
+    for (const char * name : copied){
+        string value = Compression::getHeader(headers, name);
+        if (!value.empty()){
+            response += string(name) + ": " + value + "\r\n";
+        }
+    }
+    return response + "\r\n";
+}
+
 // string CacheHandler::build_forward_request(CacheDecision::Decision decision, Request & request){
 //     switch(decision){
 //         case CacheDecision::DIRECT:{
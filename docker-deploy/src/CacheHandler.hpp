@@ -8,7 +8,9 @@ class CacheHandler{
     public:
         bool need_to_send(CacheDecision::Decision decision);
 
-        string build_forward_response(CacheDecision::Decision decision, CacheEntry * entry);
+        string build_forward_response(CacheDecision::Decision decision, const CacheEntry * entry);
+
+        string build_not_modified(const CacheEntry * entry);
 
         // string build_forward_request(CacheDecision::Decision decision, Request & request);
 };
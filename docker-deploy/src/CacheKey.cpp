@@ -0,0 +1,182 @@
+#include "CacheKey.hpp"
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+// parameters are compared as views into the url, no copies
+constexpr size_t INLINE_PARAMS = 16;
+
+bool isUnreserved(unsigned char c) {
+    return isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+int hexValue(unsigned char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = tolower(c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+bool matches(string_view name, const string & pattern) {
+    if (!pattern.empty() && pattern.back() == '*') {
+        return name.substr(0, pattern.size() - 1) == string_view(pattern).substr(0, pattern.size() - 1);
+    }
+    return name == pattern;
+}
+
+}
+
+// singleton get instance
+CacheKey & CacheKey::getInstance() {
+    static CacheKey instance;
+    return instance;
+}
+
+CacheKey::CacheKey() {}
+
+void CacheKey::configure(const Rules & rules) {
+    this->rules = rules;
+}
+
+const CacheKey::Rules & CacheKey::getRules() const {
+    return rules;
+}
+
+vector<string> CacheKey::parseList(const string & list) {
+    vector<string> items;
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        if (end == string::npos) {
+            end = list.size();
+        }
+        size_t first = list.find_first_not_of(" \t", start);
+        size_t last = list.find_last_not_of(" \t", end - 1);
+        if (first != string::npos && first < end && last >= first) {
+            items.push_back(list.substr(first, last - first + 1));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+bool CacheKey::keepParam(string_view name) const {
+    for (const auto & pattern : rules.drop_params) {
+        if (matches(name, pattern)) {
+            return false;
+        }
+    }
+    if (rules.keep_params.empty()) {
+        return true;
+    }
+    for (const auto & pattern : rules.keep_params) {
+        if (matches(name, pattern)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// decode %XX of unreserved characters, upper case the hex of the rest
+void CacheKey::appendNormalized(string & out, string_view part, bool lowercase) {
+    for (size_t i = 0; i < part.size(); i++) {
+        unsigned char c = part[i];
+        if (c == '%' && i + 2 < part.size() && hexValue(part[i + 1]) >= 0 && hexValue(part[i + 2]) >= 0) {
+            unsigned char decoded = hexValue(part[i + 1]) * 16 + hexValue(part[i + 2]);
+            if (isUnreserved(decoded)) {
+                out += lowercase ? tolower(decoded) : decoded;
+            } else {
+                out += '%';
+                out += toupper(static_cast<unsigned char>(part[i + 1]));
+                out += toupper(static_cast<unsigned char>(part[i + 2]));
+            }
+            i += 2;
+        } else {
+            out += lowercase ? tolower(c) : c;
+        }
+    }
+}
+
+string CacheKey::normalize(string_view url) const {
+    string key;
+    key.reserve(url.size());
+
+    // the fragment never reaches the origin
+    url = url.substr(0, url.find('#'));
+
+    string_view rest = url;
+    size_t scheme_end = url.find("://");
+    if (scheme_end != string_view::npos) {
+        string_view scheme = url.substr(0, scheme_end);
+        rest = url.substr(scheme_end + 3);
+        size_t host_end = min(rest.find('/'), rest.find('?'));
+        string_view host = rest.substr(0, host_end);
+        rest = host_end == string_view::npos ? string_view() : rest.substr(host_end);
+
+        for (char c : scheme) {
+            key += tolower(static_cast<unsigned char>(c));
+        }
+        key += "://";
+        // the default port names the same origin as no port
+        size_t colon = host.rfind(':');
+        if (colon != string_view::npos && host.find(']', colon) == string_view::npos) {
+            string_view port = host.substr(colon + 1);
+            if ((port == "80" && key == "http://") || (port == "443" && key == "https://") || port.empty()) {
+                host = host.substr(0, colon);
+            }
+        }
+        for (char c : host) {
+            key += tolower(static_cast<unsigned char>(c));
+        }
+    }
+
+    size_t query_start = rest.find('?');
+    string_view path = rest.substr(0, query_start);
+    if (path.empty()) {
+        key += '/';
+    } else {
+        appendNormalized(key, path, rules.lowercase_path);
+    }
+    if (query_start == string_view::npos) {
+        return key;
+    }
+
+    // collect the kept parameters, most urls fit the inline array
+    string_view query = rest.substr(query_start + 1);
+    string_view inline_params[INLINE_PARAMS];
+    vector<string_view> more_params;
+    size_t count = 0;
+    size_t start = 0;
+    while (start <= query.size()) {
+        size_t end = query.find('&', start);
+        if (end == string_view::npos) {
+            end = query.size();
+        }
+        string_view param = query.substr(start, end - start);
+        if (!param.empty() && keepParam(param.substr(0, param.find('=')))) {
+            if (count < INLINE_PARAMS) {
+                inline_params[count] = param;
+            } else {
+                if (more_params.empty()) {
+                    more_params.assign(inline_params, inline_params + INLINE_PARAMS);
+                }
+                more_params.push_back(param);
+            }
+            count++;
+        }
+        start = end + 1;
+    }
+    string_view * params = count <= INLINE_PARAMS ? inline_params : more_params.data();
+    if (rules.sort_params) {
+        // stable, repeated names keep their order
+        stable_sort(params, params + count, [](string_view a, string_view b) {
+            return a.substr(0, a.find('=')) < b.substr(0, b.find('='));
+        });
+    }
+    for (size_t i = 0; i < count; i++) {
+        key += i == 0 ? '?' : '&';
+        appendNormalized(key, params[i], false);
+    }
+    return key;
+}
@@ -0,0 +1,48 @@
+#ifndef CACHEKEY_HPP
+#define CACHEKEY_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Turns a request URL into the string the cache is keyed on, so
+// equivalent spellings of a URL share one entry. Always: lower case
+// scheme and host, no default port, canonical percent-encoding, no
+// fragment. Query handling and path case follow the configured rules.
+class CacheKey {
+public:
+    struct Rules {
+        // query parameters left out of the key, "utm_*" matches a prefix
+        vector<string> drop_params = {"utm_*", "fbclid", "gclid"};
+        // when not empty, only these parameters are kept
+        vector<string> keep_params;
+        bool sort_params = true;
+        bool lowercase_path = false;
+    };
+
+    static CacheKey & getInstance();
+
+    // set once at startup, before requests are parsed
+    void configure(const Rules & rules);
+
+    const Rules & getRules() const;
+
+    string normalize(string_view url) const;
+
+    // "a, b,c" -> {"a", "b", "c"}
+    static vector<string> parseList(const string & list);
+
+private:
+    CacheKey();
+    CacheKey(const CacheKey&) = delete;
+    CacheKey& operator=(const CacheKey&) = delete;
+
+    bool keepParam(string_view name) const;
+    static void appendNormalized(string & out, string_view part, bool lowercase);
+
+    Rules rules;
+};
+
+#endif
@@ -1,6 +1,6 @@
 #include "CacheMaster.hpp"
-
-#define CACHE_NUMBER 8
+#include "CacheStats.hpp"
+#include <algorithm>
 
 // singleton get instance
 CacheMaster & CacheMaster::getInstance() {
@@ -8,22 +8,225 @@ CacheMaster & CacheMaster::getInstance() {
     return instance;
 }
 
-CacheMaster::CacheMaster(){
-    for (int i = 0; i < CACHE_NUMBER; i++){
-        cacheList.push_back(new Cache());
-    }
+// 8 shards sharing 80MB until configured
+CacheMaster::CacheMaster() : hand(0), admission(true){
+    configure(8, 80 * 1024 * 1024);
 }
 
 CacheMaster::~CacheMaster() {
     for (auto& cache : cacheList) {
         delete cache; 
     }
+    delete diskCache;
+    delete sharedCache;
+}
+
+void CacheMaster::configure(size_t shard_number, size_t budget_bytes, size_t negative_bytes){
+    if (shard_number == 0) {
+        throw runtime_error("cache needs at least one shard");
+    }
+    vector<Cache*> oldList = cacheList;
+    unique_ptr<CacheBudget> oldBudget = move(budget);
+    unique_ptr<CacheBudget> oldNegativeBudget = move(negativeBudget);
+
+    budget = make_unique<CacheBudget>(budget_bytes);
+    negativeBudget = make_unique<CacheBudget>(negative_bytes);
+    // sized for the entries the budget holds at about 8KB each
+    sketch = make_unique<FrequencySketch>(budget_bytes / (8 * 1024));
+    ring = HashRing();
+    cacheList.clear();
+    for (size_t i = 0; i < shard_number; i++){
+        ring.addNode("shard-" + to_string(i));
+        cacheList.push_back(new Cache(budget.get(), negativeBudget.get(),
+                                      [this](size_t bytes, bool negative){ reclaim(bytes, negative); }));
+    }
+    installEvictHooks();
+
+    // with consistent hashing most entries land on a shard of the same name
+    size_t moved = 0;
+    for (size_t i = 0; i < oldList.size(); i++){
+        for (auto & [url, entry] : oldList[i]->copyEntries()){
+            size_t index = selectIndex(url);
+            moved += index != i;
+            cacheList[index]->addEntry(url, entry);
+        }
+        delete oldList[i];
+    }
+    // installed after the move, entries we already had are not re-judged
+    for (auto& cache : cacheList) {
+        cache->setAdmitHook([this](const string & url, bool negative){ return admit(url, negative); });
+    }
+    LOG_INFO("cache: " + to_string(shard_number) + " shards sharing " + to_string(budget_bytes) +
+                " bytes (" + to_string(negative_bytes) + " for negative answers), " + to_string(moved) + " entries changed shard");
+}
+
+void CacheMaster::reclaim(size_t bytes, bool negative){
+    CacheBudget * target = negative ? negativeBudget.get() : budget.get();
+    size_t idle = 0;
+    size_t used;
+    // stop after a full turn over empty shards, nothing left to free
+    while ((used = target->used) + bytes > target->limit && idle < cacheList.size()){
+        Cache * cache = cacheList[hand++ % cacheList.size()];
+        if (cache->evictOne(negative, used + bytes - target->limit)) {
+            idle = 0;
+        } else {
+            idle++;
+        }
+    }
+}
+
+void CacheMaster::recordAccess(const string & url){
+    sketch->increment(HashRing::hash(string_view(url).substr(0, url.find('\n'))));
+}
+
+void CacheMaster::setAdmission(bool enabled){
+    admission = enabled;
+}
+
+bool CacheMaster::admit(const string & url, bool negative){
+    if (!admission) {
+        return true;
+    }
+    // the victim is the oldest entry of the next shard under the hand
+    for (size_t i = 0; i < cacheList.size(); i++){
+        string victim = cacheList[(hand + i) % cacheList.size()]->peekVictim(negative);
+        if (!victim.empty()) {
+            return sketch->admit(HashRing::hash(string_view(url).substr(0, url.find('\n'))),
+                                 HashRing::hash(string_view(victim).substr(0, victim.find('\n'))));
+        }
+    }
+    return true;
 }
 
 Cache & CacheMaster::selectCache(const string & url){
-    return *(cacheList.at(hash<string>{}(url) % cacheList.size()));
+    return *(cacheList.at(selectIndex(url)));
 }
 
+// variants of a url share its shard, which holds their index
 int CacheMaster::selectIndex(const string & url){
-    return hash<string>{}(url) % cacheList.size();
+    return ring.selectIndex(string_view(url).substr(0, url.find('\n')));
+}
+
+size_t CacheMaster::getCacheNumber() const{
+    return cacheList.size();
+}
+
+Cache & CacheMaster::getCache(size_t index){
+    return *(cacheList.at(index));
+}
+
+size_t CacheMaster::getBudget() const{
+    return budget->limit;
+}
+
+size_t CacheMaster::getUsed() const{
+    return budget->used;
+}
+
+size_t CacheMaster::getNegativeUsed() const{
+    return negativeBudget->used;
+}
+
+size_t CacheMaster::purge(const string & url){
+    size_t removed = selectCache(url).purge(url);
+    if (diskCache != nullptr) {
+        removed += diskCache->purge(url);
+    }
+    if (sharedCache != nullptr) {
+        removed += sharedCache->purge(url);
+    }
+    CacheStats::getInstance().add(CacheStats::PURGED_ENTRIES, removed);
+    LOG_INFO("cache: purged " + url + ", " + to_string(removed) + " entries");
+    return removed;
+}
+
+size_t CacheMaster::purgePrefix(const string & prefix){
+    size_t removed = 0;
+    for (auto& cache : cacheList) {
+        removed += cache->purgePrefix(prefix);
+    }
+    if (diskCache != nullptr) {
+        removed += diskCache->removePrefix(prefix);
+    }
+    if (sharedCache != nullptr) {
+        removed += sharedCache->removePrefix(prefix);
+    }
+    CacheStats::getInstance().add(CacheStats::PURGED_ENTRIES, removed);
+    LOG_INFO("cache: purged prefix " + prefix + ", " + to_string(removed) + " entries");
+    return removed;
+}
+
+// keys are normalized: lower case host, no default port
+size_t CacheMaster::purgeHost(const string & host){
+    string lower = host;
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    return purgePrefix("http://" + lower + "/") + purgePrefix("http://" + lower + ":");
+}
+
+bool CacheMaster::enableDiskTier(const string & dir, size_t segment_size, int segment_number){
+    DiskCache * disk = new DiskCache(dir, segment_size, segment_number);
+    if (!disk->open()) {
+        delete disk;
+        return false;
+    }
+    delete diskCache;
+    diskCache = disk;
+    installEvictHooks();
+    return true;
+}
+
+void CacheMaster::installEvictHooks(){
+    DiskCache * disk = diskCache;
+    if (disk == nullptr) {
+        return;
+    }
+    for (auto& cache : cacheList) {
+        cache->setEvictHook([disk](const string & url, const CacheEntry & entry){
+            if (disk->store(url, entry)) {
+                CacheStats::getInstance().add(CacheStats::DISK_DEMOTIONS);
+            }
+        });
+    }
+}
+
+string CacheMaster::memoryReport(){
+    Cache::MemoryUsage total{0, 0, 0};
+    EntryArena::Usage heap = EntryArena::heap()->getUsage();
+    size_t mapped = heap.mapped;
+    size_t slack = 0;
+    for (Cache * cache : cacheList) {
+        Cache::MemoryUsage usage = cache->getMemoryUsage();
+        total.entries += usage.entries;
+        total.payload += usage.payload;
+        total.footprint += usage.footprint;
+        EntryArena::Usage arena = cache->getArena().getUsage();
+        mapped += arena.mapped;
+        slack += arena.mapped - arena.reserved;
+    }
+    size_t overhead = total.footprint - total.payload;
+    return "entries=" + to_string(total.entries) +
+           " payload_bytes=" + to_string(total.payload) +
+           " footprint_bytes=" + to_string(total.footprint) +
+           " overhead_per_entry=" + to_string(total.entries == 0 ? 0 : overhead / total.entries) +
+           " arena_mapped_bytes=" + to_string(mapped) +
+           " arena_free_bytes=" + to_string(slack);
+}
+
+DiskCache * CacheMaster::getDiskCache(){
+    return diskCache;
+}
+
+bool CacheMaster::enableSharedTier(const string & name, size_t size){
+    SharedCache * shared = new SharedCache(name, size);
+    if (!shared->open()) {
+        delete shared;
+        return false;
+    }
+    delete sharedCache;
+    sharedCache = shared;
+    return true;
+}
+
+SharedCache * CacheMaster::getSharedCache(){
+    return sharedCache;
 }
@@ -1,7 +1,14 @@
 #ifndef CACHEMASTER_HPP
 #define CACHEMASTER_HPP
 
+#include <atomic>
+#include <memory>
+
 #include "Cache.hpp"
+#include "DiskCache.hpp"
+#include "SharedCache.hpp"
+#include "HashRing.hpp"
+#include "FrequencySketch.hpp"
 using namespace std;
 
 
@@ -9,17 +16,82 @@ class CacheMaster{
     public:
         static CacheMaster & getInstance();
 
+        // rebuild with shard_number shards sharing budget bytes, and
+        // negative_budget bytes for 4xx/5xx answers on top of it.
+        // Entries are moved to their new shard; call it before serving.
+        void configure(size_t shard_number, size_t budget, size_t negative_budget = 8 * 1024 * 1024);
+
         Cache & selectCache(const string & url);
 
         int selectIndex(const string & url);
 
+        size_t getCacheNumber() const;
+
+        Cache & getCache(size_t index);
+
+        size_t getBudget() const;
+
+        size_t getUsed() const;
+
+        size_t getNegativeUsed() const;
+
+        // count one request for url in the admission sketch
+        void recordAccess(const string & url);
+
+        // TinyLFU admission when the budget is full, on by default
+        void setAdmission(bool enabled);
+
+        // drop url and its variants from memory and disk, returns the
+        // entries removed
+        size_t purge(const string & url);
+
+        // drop every key starting with prefix; each shard only walks the
+        // keys under the prefix in its index
+        size_t purgePrefix(const string & prefix);
+
+        // every url of host, on any port
+        size_t purgeHost(const string & host);
+
+        // one line of entries, payload and real footprint of all shards,
+        // with the overhead each entry costs on top of its bytes
+        string memoryReport();
+
+        // put a disk tier under the memory shards, evictions are demoted to it
+        bool enableDiskTier(const string & dir, size_t segment_size, int segment_number);
+
+        // nullptr when there is no disk tier
+        DiskCache * getDiskCache();
+
+        // share responses with other proxy processes through the named
+        // shared memory segment, attaching if it already exists
+        bool enableSharedTier(const string & name, size_t size);
+
+        // nullptr when there is no shared tier
+        SharedCache * getSharedCache();
+
         ~CacheMaster();
     private:
         CacheMaster();
 
+        // global clock: the hand walks the shards, each one it passes
+        // gives up its oldest entry until bytes fit in the budget
+        void reclaim(size_t bytes, bool negative);
+        void installEvictHooks();
+        // is url used more often than the entry the clock would evict for it
+        bool admit(const string & url, bool negative);
+
         vector<Cache*> cacheList;
+        HashRing ring;
+        unique_ptr<CacheBudget> budget;
+        unique_ptr<CacheBudget> negativeBudget;
+        atomic<size_t> hand;
+        unique_ptr<FrequencySketch> sketch;
+        atomic<bool> admission;
+        DiskCache * diskCache = nullptr;
+        SharedCache * sharedCache = nullptr;
+        static inline Logger & logger = Logger::getInstance();
 };
 
 
 
-#endif
\ No newline at end of file
+#endif
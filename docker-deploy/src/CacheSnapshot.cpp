@@ -0,0 +1,269 @@
+#include "CacheSnapshot.hpp"
+#include "CacheMaster.hpp"
+#include "CacheStats.hpp"
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+
+namespace {
+
+constexpr char SNAPSHOT_MAGIC[8] = {'P', 'X', 'S', 'N', 'A', 'P', '0', '1'};
+
+// file = header, records, then the FNV-1a checksum of the records
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t count;
+    uint32_t reserved;
+    int64_t created;
+};
+
+struct RecordHeader {
+    uint32_t key_len;
+    uint32_t line_len;
+    uint32_t headers_len;
+    uint32_t body_len;
+    int64_t creation_time;
+    int64_t expires_time;
+};
+
+void fnv(uint64_t & hash, const char * data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+}
+
+}
+
+CacheSnapshot::CacheSnapshot(const string & dir, int interval_sec)
+:   dir(dir),
+    interval_sec(interval_sec),
+    stopping(false) {}
+
+CacheSnapshot::~CacheSnapshot() {
+    {
+        lock_guard<mutex> lock(worker_mutex);
+        stopping = true;
+    }
+    worker_cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+string CacheSnapshot::shardPath(size_t index) const {
+    return dir + "/shard-" + to_string(index) + ".snap";
+}
+
+size_t CacheSnapshot::load() {
+    auto started = chrono::steady_clock::now();
+    CacheMaster & master = CacheMaster::getInstance();
+
+    // files are independent, read them all at once
+    vector<string> paths;
+    for (const auto & file : filesystem::directory_iterator(dir)) {
+        if (file.path().extension() == ".snap") {
+            paths.push_back(file.path().string());
+        }
+    }
+    atomic<size_t> loaded(0);
+    vector<thread> readers;
+    for (const auto & path : paths) {
+        readers.emplace_back([&master, &loaded, path]() {
+            // a bad file costs its entries, never the proxy
+            try {
+                vector<pair<string, CacheEntry>> entries;
+                readFile(path, entries);
+                for (auto & [key, entry] : entries) {
+                    // entries are routed by key, the shard count may have changed
+                    entry.markRestored();
+                    master.selectCache(key).addEntry(key, entry);
+                }
+                loaded += entries.size();
+            } catch (const exception & e) {
+                LOG_WARNING("snapshot: ignoring " + path + ": " + e.what());
+            }
+        });
+    }
+    for (auto & reader : readers) {
+        reader.join();
+    }
+
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+    CacheStats::getInstance().add(CacheStats::RESTORED_ENTRIES, loaded);
+    LOG_INFO("warm restart: restored " + to_string(loaded) + " entries from " + to_string(paths.size()) +
+                " snapshot files in " + to_string(elapsed) + " ms");
+    return loaded;
+}
+
+size_t CacheSnapshot::save() {
+    auto started = chrono::steady_clock::now();
+    CacheMaster & master = CacheMaster::getInstance();
+    filesystem::create_directories(dir);
+
+    size_t saved = 0;
+    for (size_t i = 0; i < master.getCacheNumber(); i++) {
+        saved += writeFile(shardPath(i), master.getCache(i).copyEntries());
+    }
+    // drop files of shards that no longer exist
+    for (size_t i = master.getCacheNumber(); filesystem::exists(shardPath(i)); i++) {
+        filesystem::remove(shardPath(i));
+    }
+
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+    LOG_INFO("snapshot: saved " + to_string(saved) + " entries in " + to_string(elapsed) + " ms");
+    return saved;
+}
+
+void CacheSnapshot::start() {
+    worker = thread([this]() { loop(); });
+}
+
+void CacheSnapshot::stop() {
+    {
+        lock_guard<mutex> lock(worker_mutex);
+        stopping = true;
+    }
+    worker_cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+    save();
+}
+
+void CacheSnapshot::loop() {
+    unique_lock<mutex> lock(worker_mutex);
+    while (!stopping) {
+        if (worker_cv.wait_for(lock, chrono::seconds(interval_sec), [this] { return stopping; })) {
+            break;
+        }
+        lock.unlock();
+        try {
+            save();
+            LOG_INFO("cache stats: " + CacheStats::getInstance().report());
+            LOG_INFO("cache memory: " + CacheMaster::getInstance().memoryReport());
+        } catch (const std::exception& e) {
+            LOG_ERROR("snapshot failed: " + string(e.what()));
+        }
+        lock.lock();
+    }
+}
+
+// write to a temp file and rename, a crash never leaves a half written snapshot
+size_t CacheSnapshot::writeFile(const string & path, const vector<pair<string, CacheEntry>> & entries) {
+    string tmp_path = path + ".tmp";
+    ofstream out(tmp_path, ios::binary | ios::trunc);
+    if (!out.is_open()) {
+        throw runtime_error("Failed to open snapshot file: " + tmp_path);
+    }
+
+    time_t now = time(nullptr);
+    SnapshotHeader header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.created = now;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    uint64_t hash = 1469598103934665603ULL;
+    uint32_t count = 0;
+    for (const auto & [key, entry] : entries) {
+        // an expired entry is only worth keeping if it can be revalidated
+        if (entry.isExpired() && entry.getETag().empty() && !entry.hasLastModified()) {
+            continue;
+        }
+        // the headers would promise bytes the record does not have
+        if (entry.isPartial()) {
+            continue;
+        }
+        const string & line = entry.getResponseLine();
+        const string & headers = entry.getResponseHeaders();
+        const string & body = entry.getResponseBody();
+        RecordHeader record{static_cast<uint32_t>(key.size()), static_cast<uint32_t>(line.size()),
+                            static_cast<uint32_t>(headers.size()), static_cast<uint32_t>(body.size()),
+                            entry.getCreationTime(), entry.getExpiresTime()};
+        const char * parts[] = {reinterpret_cast<const char *>(&record), key.data(), line.data(), headers.data(), body.data()};
+        size_t sizes[] = {sizeof(record), key.size(), line.size(), headers.size(), body.size()};
+        for (int i = 0; i < 5; i++) {
+            out.write(parts[i], sizes[i]);
+            fnv(hash, parts[i], sizes[i]);
+        }
+        count++;
+    }
+    out.write(reinterpret_cast<const char *>(&hash), sizeof(hash));
+
+    header.count = count;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.close();
+    if (!out) {
+        throw runtime_error("Failed to write snapshot file: " + tmp_path);
+    }
+    filesystem::rename(tmp_path, path);
+    return count;
+}
+
+// all or nothing: a file with a bad checksum contributes no entries
+size_t CacheSnapshot::readFile(const string & path, vector<pair<string, CacheEntry>> & entries) {
+    ifstream in(path, ios::binary);
+    SnapshotHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        LOG_WARNING("snapshot: ignoring unreadable file " + path);
+        return 0;
+    }
+
+    // counts and lengths are not covered by a checksum yet, they must fit
+    // in what the file holds before anything is allocated for them
+    error_code error;
+    uintmax_t file_size = filesystem::file_size(path, error);
+    if (error || file_size < sizeof(header) + sizeof(uint64_t)) {
+        LOG_WARNING("snapshot: truncated file " + path);
+        return 0;
+    }
+    uint64_t remaining = file_size - sizeof(header) - sizeof(uint64_t);
+    if (header.count > remaining / sizeof(RecordHeader)) {
+        LOG_WARNING("snapshot: truncated file " + path);
+        return 0;
+    }
+
+    vector<pair<string, CacheEntry>> loaded;
+    loaded.reserve(header.count);
+    uint64_t hash = 1469598103934665603ULL;
+    for (uint32_t i = 0; i < header.count; i++) {
+        RecordHeader record;
+        if (remaining < sizeof(record) || !in.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+            LOG_WARNING("snapshot: truncated file " + path);
+            return 0;
+        }
+        remaining -= sizeof(record);
+        fnv(hash, reinterpret_cast<const char *>(&record), sizeof(record));
+        string fields[4];
+        uint32_t lengths[] = {record.key_len, record.line_len, record.headers_len, record.body_len};
+        for (int f = 0; f < 4; f++) {
+            if (lengths[f] > remaining) {
+                LOG_WARNING("snapshot: truncated file " + path);
+                return 0;
+            }
+            remaining -= lengths[f];
+            fields[f].resize(lengths[f]);
+            if (!in.read(fields[f].data(), lengths[f])) {
+                LOG_WARNING("snapshot: truncated file " + path);
+                return 0;
+            }
+            fnv(hash, fields[f].data(), lengths[f]);
+        }
+        loaded.emplace_back(fields[0], CacheEntry(fields[1], fields[2], fields[3], record.creation_time, record.expires_time));
+    }
+
+    uint64_t stored_hash = 0;
+    if (!in.read(reinterpret_cast<char *>(&stored_hash), sizeof(stored_hash)) || stored_hash != hash) {
+        LOG_WARNING("snapshot: checksum mismatch in " + path);
+        return 0;
+    }
+    for (auto & item : loaded) {
+        entries.push_back(move(item));
+    }
+    return loaded.size();
+}
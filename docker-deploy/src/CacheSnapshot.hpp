@@ -0,0 +1,52 @@
+#ifndef CACHESNAPSHOT_HPP
+#define CACHESNAPSHOT_HPP
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "Logger.hpp"
+#include "Cache.hpp"
+
+using namespace std;
+
+// Warm restart support: writes the memory shards to one binary file per
+// shard (periodically and on shutdown) and loads them back in parallel
+// on startup.
+class CacheSnapshot {
+public:
+    CacheSnapshot(const string & dir, int interval_sec);
+    ~CacheSnapshot();
+
+    // load every snapshot file in parallel, returns the number of entries
+    size_t load();
+
+    // write every shard now
+    size_t save();
+
+    // save every interval_sec on a background thread
+    void start();
+
+    // stop the background thread and take a final snapshot
+    void stop();
+
+    // binary format of one shard, exposed for tests
+    static size_t writeFile(const string & path, const vector<pair<string, CacheEntry>> & entries);
+    static size_t readFile(const string & path, vector<pair<string, CacheEntry>> & entries);
+
+private:
+    void loop();
+    string shardPath(size_t index) const;
+
+    string dir;
+    int interval_sec;
+    thread worker;
+    mutex worker_mutex;
+    condition_variable worker_cv;
+    bool stopping;
+
+    static inline Logger & logger = Logger::getInstance();
+};
+
+#endif
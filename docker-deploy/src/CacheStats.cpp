@@ -0,0 +1,80 @@
+#include "CacheStats.hpp"
+
+// singleton get instance
+CacheStats & CacheStats::getInstance() {
+    static CacheStats instance;
+    return instance;
+}
+
+CacheStats::CacheStats() {
+    for (auto & counter : counters) {
+        counter.store(0, memory_order_relaxed);
+    }
+}
+
+void CacheStats::add(Counter counter, uint64_t n) {
+    counters[counter].fetch_add(n, memory_order_relaxed);
+}
+
+uint64_t CacheStats::get(Counter counter) const {
+    return counters[counter].load(memory_order_relaxed);
+}
+
+string CacheStats::report() const {
+    string line;
+    for (int i = 0; i < COUNTER_NUMBER; i++) {
+        if (!line.empty()) {
+            line += " ";
+        }
+        line += string(counterName(static_cast<Counter>(i))) + "=" + to_string(get(static_cast<Counter>(i)));
+    }
+    uint64_t lookups = get(CACHE_LOOKUPS);
+    uint64_t hits = get(CACHE_HITS);
+    line += " hit_ratio=" + to_string(lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups);
+    // share of hits that only happened because of the warm restart
+    line += " restored_hit_share=" + to_string(hits == 0 ? 0.0 : static_cast<double>(get(RESTORED_HITS)) / hits);
+    // bytes of memory kept per byte of body stored compressed
+    uint64_t gzip_in = get(GZIP_BYTES_IN);
+    line += " gzip_ratio=" + to_string(gzip_in == 0 ? 0.0 : static_cast<double>(get(GZIP_BYTES_OUT)) / gzip_in);
+    return line;
+}
+
+const char * CacheStats::counterName(Counter counter) {
+    switch (counter) {
+        case STALE_WHILE_REVALIDATE_SERVED: return "stale_while_revalidate_served";
+        case STALE_IF_ERROR_SERVED: return "stale_if_error_served";
+        case BACKGROUND_REFRESH_STARTED: return "background_refresh_started";
+        case BACKGROUND_REFRESH_SUCCEEDED: return "background_refresh_succeeded";
+        case BACKGROUND_REFRESH_FAILED: return "background_refresh_failed";
+        case DISK_HITS: return "disk_hits";
+        case DISK_PROMOTIONS: return "disk_promotions";
+        case DISK_DEMOTIONS: return "disk_demotions";
+        case CACHE_LOOKUPS: return "cache_lookups";
+        case CACHE_HITS: return "cache_hits";
+        case RESTORED_ENTRIES: return "restored_entries";
+        case RESTORED_HITS: return "restored_hits";
+        case GZIP_STORED: return "gzip_stored";
+        case GZIP_BYTES_IN: return "gzip_bytes_in";
+        case GZIP_BYTES_OUT: return "gzip_bytes_out";
+        case GZIP_SERVED: return "gzip_served";
+        case GZIP_DECODED: return "gzip_decoded";
+        case WIRE_BYTES_SAVED: return "wire_bytes_saved";
+        case REVALIDATIONS: return "revalidations";
+        case NOT_MODIFIED: return "not_modified";
+        case CLIENT_NOT_MODIFIED: return "client_not_modified";
+        case NEGATIVE_HITS: return "negative_hits";
+        case ADMISSION_REJECTED: return "admission_rejected";
+        case BODY_TRUNCATIONS: return "body_truncations";
+        case RANGE_REFILLS: return "range_refills";
+        case PURGED_ENTRIES: return "purged_entries";
+        case PEER_FETCHES: return "peer_fetches";
+        case PEER_FAILURES: return "peer_failures";
+        case PEER_REQUESTS: return "peer_requests";
+        case SHARED_HITS: return "shared_hits";
+        case SHARED_STORES: return "shared_stores";
+        case UPSTREAM_RESPONSES: return "upstream_responses";
+        case RESPONSE_PARSES: return "response_parses";
+        case RESPONSE_COPIES: return "response_copies";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef CACHESTATS_HPP
+#define CACHESTATS_HPP
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+// Process wide cache counters, cheap enough to bump on every request
+class CacheStats {
+public:
+    enum Counter {
+        STALE_WHILE_REVALIDATE_SERVED,
+        STALE_IF_ERROR_SERVED,
+        BACKGROUND_REFRESH_STARTED,
+        BACKGROUND_REFRESH_SUCCEEDED,
+        BACKGROUND_REFRESH_FAILED,
+        DISK_HITS,
+        DISK_PROMOTIONS,
+        DISK_DEMOTIONS,
+        CACHE_LOOKUPS,
+        CACHE_HITS,
+        RESTORED_ENTRIES,
+        RESTORED_HITS,
+        GZIP_STORED,
+        GZIP_BYTES_IN,
+        GZIP_BYTES_OUT,
+        GZIP_SERVED,
+        GZIP_DECODED,
+        WIRE_BYTES_SAVED,
+        REVALIDATIONS,
+        NOT_MODIFIED,
+        CLIENT_NOT_MODIFIED,
+        NEGATIVE_HITS,
+        ADMISSION_REJECTED,
+        BODY_TRUNCATIONS,
+        RANGE_REFILLS,
+        PURGED_ENTRIES,
+        PEER_FETCHES,
+        PEER_FAILURES,
+        PEER_REQUESTS,
+        SHARED_HITS,
+        SHARED_STORES,
+        UPSTREAM_RESPONSES,
+        RESPONSE_PARSES,
+        RESPONSE_COPIES,
+        COUNTER_NUMBER
+    };
+
+    static CacheStats & getInstance();
+
+    void add(Counter counter, uint64_t n = 1);
+    uint64_t get(Counter counter) const;
+
+    // one line "name=value" summary for the log
+    string report() const;
+
+private:
+    CacheStats();
+    CacheStats(const CacheStats&) = delete;
+    CacheStats& operator=(const CacheStats&) = delete;
+
+    static const char * counterName(Counter counter);
+
+    atomic<uint64_t> counters[COUNTER_NUMBER];
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "CollapsedForwarding.hpp"
+#include <chrono>
+
+CollapsedForwarding::CollapsedForwarding(size_t max_waiters) : max_waiters(max_waiters), waiters(0) {}
+
+shared_ptr<CollapsedForwarding::Flight> CollapsedForwarding::join(const string & key, bool & leader) {
+    lock_guard<mutex> lock(flights_mutex);
+
+    auto it = flights.find(key);
+    if (it == flights.end()) {
+        // first miss for this key, caller leads the fetch
+        auto flight = make_shared<Flight>();
+        flights[key] = flight;
+        leader = true;
+        return flight;
+    }
+
+    // waiters block worker threads, so keep some for the leaders
+    if (waiters >= max_waiters) {
+        LOG_DEBUG("too many collapsed waiters, fetch directly: " + key);
+        leader = false;
+        return nullptr;
+    }
+    waiters++;
+    leader = false;
+    return it->second;
+}
+
+shared_ptr<CollapsedForwarding::Flight> CollapsedForwarding::lead(const string & key) {
+    lock_guard<mutex> lock(flights_mutex);
+    if (flights.count(key) != 0) {
+        return nullptr;
+    }
+    auto flight = make_shared<Flight>();
+    flights[key] = flight;
+    return flight;
+}
+
+CollapsedForwarding::Outcome CollapsedForwarding::wait(const string & key, const shared_ptr<Flight> & flight, string & response, int timeout_sec) {
+    unique_lock<mutex> lock(flights_mutex);
+    bool done = flight->cv.wait_for(lock, chrono::seconds(timeout_sec), [&flight] { return flight->done; });
+    waiters--;
+    if (!done) {
+        auto it = flights.find(key);
+        if (it != flights.end() && it->second == flight) {
+            flights.erase(it);
+        }
+        return TIMED_OUT;
+    }
+    if (flight->outcome == SUCCEEDED) {
+        response = flight->response;
+    }
+    return flight->outcome;
+}
+
+void CollapsedForwarding::complete(const string & key, const shared_ptr<Flight> & flight, Outcome outcome, const string & response) {
+    {
+        lock_guard<mutex> lock(flights_mutex);
+        // the flight may have timed out and been replaced by a newer leader
+        auto it = flights.find(key);
+        if (it != flights.end() && it->second == flight) {
+            flights.erase(it);
+        }
+
+        flight->done = true;
+        flight->outcome = outcome;
+        if (outcome == SUCCEEDED) {
+            flight->response = response;
+        }
+    }
+    flight->cv.notify_all();
+}
+
+size_t CollapsedForwarding::getWaiters() const {
+    lock_guard<mutex> lock(flights_mutex);
+    return waiters;
+}
@@ -0,0 +1,59 @@
+#ifndef COLLAPSEDFORWARDING_HPP
+#define COLLAPSEDFORWARDING_HPP
+
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "Logger.hpp"
+
+using namespace std;
+
+// Coalesces concurrent misses for the same key: the first request becomes
+// the leader and fetches from the origin, later requests wait for its result
+class CollapsedForwarding {
+public:
+    enum Outcome {
+        SUCCEEDED,      // leader got a cacheable response, share it
+        UNCACHEABLE,    // leader got a response we must not share
+        FAILED,         // leader could not reach the origin
+        TIMED_OUT       // leader took too long
+    };
+
+    struct Flight {
+        bool done = false;
+        Outcome outcome = FAILED;
+        string response;
+        condition_variable cv;
+    };
+
+    explicit CollapsedForwarding(size_t max_waiters = 16);
+
+    // Join the flight for key. Sets leader to true if the caller must fetch.
+    // Returns nullptr if too many requests are already waiting.
+    shared_ptr<Flight> join(const string & key, bool & leader);
+
+    // Start a flight only if none is running, nullptr otherwise.
+    // Used by fetches that never wait, like background refreshes.
+    shared_ptr<Flight> lead(const string & key);
+
+    // Block until the leader publishes or timeout_sec elapses.
+    // A timed out flight is dropped so the next miss elects a new leader.
+    Outcome wait(const string & key, const shared_ptr<Flight> & flight, string & response, int timeout_sec);
+
+    // Leader publishes its result and wakes every waiter
+    void complete(const string & key, const shared_ptr<Flight> & flight, Outcome outcome, const string & response);
+
+    size_t getWaiters() const;
+
+private:
+    unordered_map<string, shared_ptr<Flight>> flights;
+    mutable mutex flights_mutex;
+    size_t max_waiters;
+    size_t waiters;
+    static inline Logger & logger = Logger::getInstance();
+};
+
+#endif
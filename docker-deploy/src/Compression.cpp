@@ -0,0 +1,261 @@
+#include "Compression.hpp"
+#include "CacheStats.hpp"
+#include "Parser.hpp"
+#include <zlib.h>
+#include <strings.h>
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace {
+
+// small bodies barely shrink and cost a header rewrite
+constexpr size_t MIN_COMPRESS_SIZE = 256;
+// refuse to inflate past this, a tiny gzip body can expand enormously
+constexpr size_t MAX_INFLATED_SIZE = 64 * 1024 * 1024;
+
+string toLower(string value) {
+    transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return tolower(c); });
+    return value;
+}
+
+string trim(const string & value) {
+    size_t begin = value.find_first_not_of(" \t");
+    if (begin == string::npos) {
+        return "";
+    }
+    size_t end = value.find_last_not_of(" \t");
+    return value.substr(begin, end - begin + 1);
+}
+
+}
+
+string Compression::gzip(string_view data) {
+    z_stream stream{};
+    // 15 window bits + 16 selects the gzip wrapper
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw runtime_error("deflateInit2 failed");
+    }
+    string out(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast<Bytef *>(out.data());
+    stream.avail_out = out.size();
+    int result = deflate(&stream, Z_FINISH);
+    size_t written = stream.total_out;
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        throw runtime_error("deflate failed");
+    }
+    out.resize(written);
+    return out;
+}
+
+bool Compression::gunzip(const string & data, string & out) {
+    z_stream stream{};
+    if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+        return false;
+    }
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = data.size();
+
+    string result;
+    result.reserve(max(identitySize(data), data.size()) + 1);
+    char buffer[16384];
+    int status = Z_OK;
+    while (status == Z_OK) {
+        stream.next_out = reinterpret_cast<Bytef *>(buffer);
+        stream.avail_out = sizeof(buffer);
+        status = inflate(&stream, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END) {
+            break;
+        }
+        result.append(buffer, sizeof(buffer) - stream.avail_out);
+        if (result.size() > MAX_INFLATED_SIZE) {
+            status = Z_MEM_ERROR;
+            break;
+        }
+    }
+    inflateEnd(&stream);
+    if (status != Z_STREAM_END) {
+        return false;
+    }
+    out = move(result);
+    return true;
+}
+
+bool Compression::acceptsGzip(string_view accept_encoding) {
+    // e.g. "gzip, deflate, br" or "gzip;q=0" or "*"
+    bool wildcard = false;
+    size_t start = 0;
+    while (start <= accept_encoding.size()) {
+        size_t end = accept_encoding.find(',', start);
+        if (end == string::npos) {
+            end = accept_encoding.size();
+        }
+        string item = toLower(trim(string(accept_encoding.substr(start, end - start))));
+        size_t semicolon = item.find(';');
+        string coding = trim(item.substr(0, semicolon));
+        bool refused = false;
+        if (semicolon != string::npos) {
+            size_t q = item.find("q=", semicolon);
+            refused = q != string::npos && atof(item.c_str() + q + 2) <= 0.0;
+        }
+        if (coding == "gzip" || coding == "x-gzip") {
+            return !refused;
+        }
+        if (coding == "*") {
+            wildcard = !refused;
+        }
+        start = end + 1;
+    }
+    return wildcard;
+}
+
+bool Compression::isGzip(const string & headers) {
+    return toLower(getHeader(headers, "Content-Encoding")).find("gzip") != string::npos;
+}
+
+size_t Compression::identitySize(const string & gzip_body) {
+    if (gzip_body.size() < 18) {
+        return 0;
+    }
+    const unsigned char * trailer = reinterpret_cast<const unsigned char *>(gzip_body.data() + gzip_body.size() - 4);
+    return trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (static_cast<size_t>(trailer[3]) << 24);
+}
+
+bool Compression::isCompressibleType(const string & content_type) {
+    string type = toLower(content_type);
+    return type.rfind("text/", 0) == 0 ||
+           type.find("json") != string::npos ||
+           type.find("javascript") != string::npos ||
+           type.find("xml") != string::npos;
+}
+
+bool Compression::compressForCache(string & headers, string_view body, string & compressed) {
+    if (body.size() < MIN_COMPRESS_SIZE || !getHeader(headers, "Content-Encoding").empty() ||
+        !isCompressibleType(getHeader(headers, "Content-Type"))) {
+        return false;
+    }
+    compressed = gzip(body);
+    if (compressed.size() >= body.size()) {
+        return false;
+    }
+
+    CacheStats & stats = CacheStats::getInstance();
+    stats.add(CacheStats::GZIP_STORED);
+    stats.add(CacheStats::GZIP_BYTES_IN, body.size());
+    stats.add(CacheStats::GZIP_BYTES_OUT, compressed.size());
+
+    removeHeader(headers, "Content-Length");
+    removeHeader(headers, "Transfer-Encoding");
+    addHeader(headers, "Content-Encoding", "gzip");
+    addHeader(headers, "Content-Length", to_string(compressed.size()));
+    if (getHeader(headers, "Vary").empty()) {
+        addHeader(headers, "Vary", "Accept-Encoding");
+    }
+    // RFC 9110 8.8.3: the gzip bytes are ours, not the origin's, so its
+    // strong tag no longer holds; a weak one still revalidates
+    string etag = getHeader(headers, "ETag");
+    if (!etag.empty() && etag.rfind("W/", 0) != 0) {
+        removeHeader(headers, "ETag");
+        addHeader(headers, "ETag", "W/" + etag);
+    }
+    return true;
+}
+
+bool Compression::prepareForClient(const string & full_response, bool accepts_gzip, string & rewritten) {
+    size_t header_end = full_response.find("\r\n\r\n");
+    if (header_end == string::npos) {
+        return false;
+    }
+    string headers = full_response.substr(0, header_end + 4);
+    if (!isGzip(headers)) {
+        return false;
+    }
+    bool chunked = !getHeader(headers, "Transfer-Encoding").empty();
+    if (accepts_gzip) {
+        CacheStats & stats = CacheStats::getInstance();
+        stats.add(CacheStats::GZIP_SERVED);
+        // the gzip trailer ends an unchunked response, no need to copy the body
+        size_t body_size = full_response.size() - header_end - 4;
+        size_t identity = (chunked || body_size < 18) ? 0 : identitySize(full_response);
+        if (identity > body_size) {
+            stats.add(CacheStats::WIRE_BYTES_SAVED, identity - body_size);
+        }
+        return false;
+    }
+
+    string body;
+    if (chunked) {
+        // raw origin response, join the chunks before inflating
+        try {
+            Parser parser;
+            Response response = parser.parseResponse(full_response);
+            headers = string(response.getHeadersStr());
+            body = string(response.getBody());
+        } catch (const std::exception& e) {
+            return false;
+        }
+        removeHeader(headers, "Transfer-Encoding");
+    } else {
+        body = full_response.substr(header_end + 4);
+    }
+
+    string identity;
+    if (!gunzip(body, identity)) {
+        LOG_WARNING("could not inflate a gzip response, sending it as is");
+        return false;
+    }
+    CacheStats::getInstance().add(CacheStats::GZIP_DECODED);
+    removeHeader(headers, "Content-Encoding");
+    removeHeader(headers, "Content-Length");
+    addHeader(headers, "Content-Length", to_string(identity.size()));
+    rewritten = headers + identity;
+    return true;
+}
+
+string Compression::getHeader(const string & headers, const string & name) {
+    size_t pos = headers.find("\r\n");
+    while (pos != string::npos && pos + 2 < headers.size()) {
+        size_t line_start = pos + 2;
+        size_t line_end = headers.find("\r\n", line_start);
+        if (line_end == string::npos) {
+            line_end = headers.size();
+        }
+        if (line_end - line_start > name.size() && headers[line_start + name.size()] == ':' &&
+            strncasecmp(headers.data() + line_start, name.data(), name.size()) == 0) {
+            return trim(headers.substr(line_start + name.size() + 1, line_end - line_start - name.size() - 1));
+        }
+        pos = line_end < headers.size() ? line_end : string::npos;
+    }
+    return "";
+}
+
+void Compression::removeHeader(string & headers, const string & name) {
+    size_t pos = headers.find("\r\n");
+    while (pos != string::npos && pos + 2 < headers.size()) {
+        size_t line_start = pos + 2;
+        size_t line_end = headers.find("\r\n", line_start);
+        if (line_end == string::npos) {
+            return;
+        }
+        if (line_end - line_start > name.size() && headers[line_start + name.size()] == ':' &&
+            strncasecmp(headers.data() + line_start, name.data(), name.size()) == 0) {
+            headers.erase(line_start, line_end + 2 - line_start);
+            continue;
+        }
+        pos = line_end;
+    }
+}
+
+// insert before the blank line that ends the block
+void Compression::addHeader(string & headers, const string & name, const string & value) {
+    size_t end = headers.rfind("\r\n\r\n");
+    string line = name + ": " + value + "\r\n";
+    if (end == string::npos) {
+        headers += line;
+    } else {
+        headers.insert(end + 2, line);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <string>
+#include <string_view>
+
+#include "Logger.hpp"
+
+using namespace std;
+
+// gzip support for the cache: text responses are stored compressed and
+// only inflated on the way out for clients that cannot take gzip
+class Compression {
+public:
+    static string gzip(string_view data);
+
+    // false if data is not a valid gzip stream
+    static bool gunzip(const string & data, string & out);
+
+    // true if an Accept-Encoding value allows gzip
+    static bool acceptsGzip(string_view accept_encoding);
+
+    // true if the raw header block says Content-Encoding: gzip
+    static bool isGzip(const string & headers);
+
+    // uncompressed size from the gzip trailer (mod 2^32), 0 if unknown
+    static size_t identitySize(const string & gzip_body);
+
+    // compress an identity body of a text type into compressed, fixing the
+    // headers. Returns false and leaves the headers alone if it is not worth it.
+    static bool compressForCache(string & headers, string_view body, string & compressed);
+
+    // turn a full gzip response into an identity one in rewritten for
+    // clients that do not accept gzip; false if it goes out as it is
+    static bool prepareForClient(const string & full_response, bool accepts_gzip, string & rewritten);
+
+    // header block helpers, name matched case-insensitively
+    static string getHeader(const string & headers, const string & name);
+    static void removeHeader(string & headers, const string & name);
+    static void addHeader(string & headers, const string & name, const string & value);
+
+private:
+    static bool isCompressibleType(const string & content_type);
+
+    static inline Logger & logger = Logger::getInstance();
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "Config.hpp"
+#include <cstdlib>
+#include <stdexcept>
+
+// singleton get instance
+Config & Config::getInstance() {
+    static Config instance;
+    return instance;
+}
+
+Config::Config()
+:   cache_shard_number(8),
+    cache_budget(80 * 1024 * 1024),
+    negative_cache_budget(8 * 1024 * 1024),
+    negative_ttl_sec(60),
+    cache_admission(true),
+    max_object_size(32 * 1024 * 1024),
+    arena_huge_pages(false),
+    key_drop_params("utm_*,fbclid,gclid"),
+    key_keep_params(""),
+    key_sort_params(true),
+    key_lowercase_path(false),
+    disk_cache_dir(""),
+    disk_segment_size(64 * 1024 * 1024),
+    disk_segment_number(16),
+    shared_cache_name(""),
+    shared_cache_size(256 * 1024 * 1024),
+    port(12345),
+    admin_port(12346),
+    peers(""),
+    peer_self(""),
+    peer_check_interval_sec(5),
+    snapshot_dir(""),
+    snapshot_interval_sec(300),
+    log_ring_size(4096),
+    log_overflow("block"),
+    log_level("debug"),
+    log_format("text"),
+    log_rotate_bytes(64 * 1024 * 1024),
+    log_rotate_sec(3600) {}
+
+void Config::loadFromEnv() {
+    cache_shard_number = getNumber("PROXY_CACHE_SHARDS", cache_shard_number);
+    cache_budget = getNumber("PROXY_CACHE_MB", cache_budget / (1024 * 1024)) * 1024 * 1024;
+    negative_cache_budget = getNumber("PROXY_NEGATIVE_CACHE_MB", negative_cache_budget / (1024 * 1024)) * 1024 * 1024;
+    negative_ttl_sec = getNumber("PROXY_NEGATIVE_TTL_SEC", negative_ttl_sec);
+    cache_admission = getNumber("PROXY_CACHE_ADMISSION", cache_admission) != 0;
+    max_object_size = getNumber("PROXY_MAX_OBJECT_MB", max_object_size / (1024 * 1024)) * 1024 * 1024;
+    arena_huge_pages = getNumber("PROXY_ARENA_HUGE_PAGES", arena_huge_pages) != 0;
+    key_drop_params = getString("PROXY_KEY_DROP_PARAMS", key_drop_params);
+    key_keep_params = getString("PROXY_KEY_KEEP_PARAMS", key_keep_params);
+    key_sort_params = getNumber("PROXY_KEY_SORT_PARAMS", key_sort_params) != 0;
+    key_lowercase_path = getNumber("PROXY_KEY_LOWERCASE_PATH", key_lowercase_path) != 0;
+    disk_cache_dir = getString("PROXY_DISK_CACHE_DIR", disk_cache_dir);
+    disk_segment_size = getNumber("PROXY_DISK_SEGMENT_MB", disk_segment_size / (1024 * 1024)) * 1024 * 1024;
+    disk_segment_number = getNumber("PROXY_DISK_SEGMENTS", disk_segment_number);
+    shared_cache_name = getString("PROXY_SHARED_CACHE", shared_cache_name);
+    shared_cache_size = getNumber("PROXY_SHARED_CACHE_MB", shared_cache_size / (1024 * 1024)) * 1024 * 1024;
+    port = getNumber("PROXY_PORT", port);
+    admin_port = getNumber("PROXY_ADMIN_PORT", admin_port);
+    peers = getString("PROXY_PEERS", peers);
+    peer_self = getString("PROXY_PEER_SELF", peer_self);
+    peer_check_interval_sec = getNumber("PROXY_PEER_CHECK_SEC", peer_check_interval_sec);
+    snapshot_dir = getString("PROXY_SNAPSHOT_DIR", snapshot_dir);
+    snapshot_interval_sec = getNumber("PROXY_SNAPSHOT_INTERVAL_SEC", snapshot_interval_sec);
+    log_ring_size = getNumber("PROXY_LOG_RING", log_ring_size);
+    log_overflow = getString("PROXY_LOG_OVERFLOW", log_overflow);
+    log_level = getString("PROXY_LOG_LEVEL", log_level);
+    log_format = getString("PROXY_LOG_FORMAT", log_format);
+    log_rotate_bytes = getNumber("PROXY_LOG_ROTATE_MB", log_rotate_bytes / (1024 * 1024)) * 1024 * 1024;
+    log_rotate_sec = getNumber("PROXY_LOG_ROTATE_SEC", log_rotate_sec);
+}
+
+string Config::getString(const char * name, const string & fallback) {
+    const char * value = getenv(name);
+    return value == nullptr ? fallback : string(value);
+}
+
+long Config::getNumber(const char * name, long fallback) {
+    const char * value = getenv(name);
+    if (value == nullptr || *value == '\0') {
+        return fallback;
+    }
+    try {
+        return stol(value);
+    } catch (const std::exception& e) {
+        throw std::runtime_error(string("Invalid number in ") + name + ": " + value);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+// Startup settings, read once from PROXY_* environment variables
+class Config {
+public:
+    static Config & getInstance();
+
+    void loadFromEnv();
+
+    // memory shards and the budget they share
+    int cache_shard_number;
+    size_t cache_budget;
+    // 4xx/5xx answers: their own budget, and freshness when the origin gave none
+    size_t negative_cache_budget;
+    int negative_ttl_sec;
+    // TinyLFU admission filter in front of eviction
+    bool cache_admission;
+    // largest body worth caching, 0 for anything the budget holds
+    size_t max_object_size;
+    // back the entry arenas with huge pages
+    bool arena_huge_pages;
+
+    // cache key normalization, comma separated parameter lists
+    string key_drop_params;
+    string key_keep_params;
+    bool key_sort_params;
+    bool key_lowercase_path;
+
+    // disk tier below the memory cache, disabled when the dir is empty
+    string disk_cache_dir;
+    size_t disk_segment_size;
+    int disk_segment_number;
+
+    // shared memory tier for several processes, disabled when the name is empty
+    string shared_cache_name;
+    size_t shared_cache_size;
+
+    // proxy port, and the local purge endpoint (disabled when 0)
+    int port;
+    int admin_port;
+
+    // sibling proxies as host:port, this node's own entry among them
+    string peers;
+    string peer_self;
+    int peer_check_interval_sec;
+
+    // warm restart snapshots, disabled when the dir is empty
+    string snapshot_dir;
+    int snapshot_interval_sec;
+
+    // per thread log rings: records each, and "block" or "drop" when full
+    size_t log_ring_size;
+    string log_overflow;
+    // lowest level written: debug, info, warning or error
+    string log_level;
+    // "text" or "binary"; binary files rotate at this size and age (0 never)
+    string log_format;
+    size_t log_rotate_bytes;
+    int log_rotate_sec;
+
+private:
+    Config();
+    Config(const Config&) = delete;
+    Config& operator=(const Config&) = delete;
+
+    static string getString(const char * name, const string & fallback);
+    static long getNumber(const char * name, long fallback);
+};
+
+#endif
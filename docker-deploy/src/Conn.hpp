@@ -1,8 +1,16 @@
 #include "Request.hpp"
+#include "CollapsedForwarding.hpp"
+#include <atomic>
 
 struct Conn {
     int client_fd;
     int server_fd;
     Request request;
     bool https;
-};
\ No newline at end of file
+    // a request was sent to server_fd and is not answered yet; read when
+    // another thread closes the client
+    std::atomic<bool> pending{false};
+    // set when this connection leads a collapsed fetch
+    std::string flight_key;
+    std::shared_ptr<CollapsedForwarding::Flight> flight;
+};
@@ -0,0 +1,436 @@
+#include "DiskCache.hpp"
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+constexpr char SEGMENT_MAGIC[8] = {'P', 'X', 'S', 'E', 'G', '0', '0', '1'};
+constexpr uint32_t RECORD_MAGIC = 0x44525843;
+constexpr uint32_t FLAG_TOMBSTONE = 1;
+constexpr uint32_t FLAG_GZIP = 2;
+constexpr size_t SEGMENT_HEADER_SIZE = 64;
+
+struct SegmentHeader {
+    char magic[8];
+    uint64_t sequence;
+};
+
+// record = header, key, response bytes, padded to 8 bytes.
+// magic is written last, so a torn append is never picked up on recovery.
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t flags;
+    uint32_t key_len;
+    uint32_t data_len;
+    uint64_t sequence;
+    uint32_t checksum;
+    uint32_t reserved;
+    int64_t creation_time;
+    int64_t expires_time;
+};
+
+size_t align8(size_t n) {
+    return (n + 7) & ~static_cast<size_t>(7);
+}
+
+}
+
+DiskCache::DiskCache(const string & dir, size_t segment_size, int segment_number)
+:   dir(dir),
+    segment_size(min(segment_size, static_cast<size_t>(UINT32_MAX))),
+    segment_number(max(segment_number, 2)),
+    active(0),
+    next_sequence(1) {}
+
+DiskCache::~DiskCache() {
+    for (auto & segment : segments) {
+        if (segment->base != nullptr) {
+            munmap(segment->base, segment_size);
+        }
+        if (segment->fd >= 0) {
+            close(segment->fd);
+        }
+    }
+}
+
+bool DiskCache::open() {
+    try {
+        filesystem::create_directories(dir);
+    } catch (const std::exception& e) {
+        LOG_ERROR("Failed to create disk cache dir " + dir + ": " + e.what());
+        return false;
+    }
+
+    for (int i = 0; i < segment_number; i++) {
+        segments.push_back(make_unique<Segment>());
+        if (!openSegment(i)) {
+            return false;
+        }
+    }
+
+    // replay segments oldest first so newer records win
+    vector<int> order;
+    for (int i = 0; i < segment_number; i++) {
+        if (segments[i]->sequence != 0) {
+            order.push_back(i);
+        }
+    }
+    sort(order.begin(), order.end(), [this](int a, int b) {
+        return segments[a]->sequence < segments[b]->sequence;
+    });
+    for (int i : order) {
+        scanSegment(i);
+    }
+
+    if (order.empty()) {
+        // fresh cache, start writing at segment 0
+        active = segment_number - 1;
+        recycleNextSegment();
+    } else {
+        active = order.back();
+        next_sequence = segments[active]->sequence + 1;
+    }
+    LOG_INFO("disk cache ready at " + dir + ": " + to_string(index.size()) + " entries recovered");
+    return true;
+}
+
+bool DiskCache::openSegment(int i) {
+    Segment & segment = *segments[i];
+    string path = dir + "/segment-" + to_string(i) + ".dat";
+
+    segment.fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (segment.fd < 0) {
+        LOG_ERROR("Failed to open disk cache segment " + path + ": " + strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    bool resized = fstat(segment.fd, &st) == 0 && static_cast<size_t>(st.st_size) != segment_size;
+    if (resized && ftruncate(segment.fd, segment_size) < 0) {
+        LOG_ERROR("Failed to size disk cache segment " + path + ": " + strerror(errno));
+        return false;
+    }
+
+    void * base = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+    if (base == MAP_FAILED) {
+        LOG_ERROR("Failed to map disk cache segment " + path + ": " + strerror(errno));
+        return false;
+    }
+    segment.base = static_cast<char *>(base);
+
+    // a segment of another size is from an old layout, start it over
+    SegmentHeader header;
+    memcpy(&header, segment.base, sizeof(header));
+    if (resized || memcmp(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0) {
+        memset(segment.base, 0, SEGMENT_HEADER_SIZE);
+        segment.sequence = 0;
+    } else {
+        segment.sequence = header.sequence;
+    }
+    segment.write_offset = SEGMENT_HEADER_SIZE;
+    return true;
+}
+
+// rebuild index entries from one segment, stopping at the first bad record
+void DiskCache::scanSegment(int i) {
+    Segment & segment = *segments[i];
+    size_t offset = SEGMENT_HEADER_SIZE;
+
+    while (offset + sizeof(RecordHeader) <= segment_size) {
+        RecordHeader header;
+        memcpy(&header, segment.base + offset, sizeof(header));
+        if (header.magic != RECORD_MAGIC || header.sequence != segment.sequence) {
+            break;
+        }
+        size_t record_size = align8(sizeof(header) + header.key_len + header.data_len);
+        if (offset + record_size > segment_size) {
+            break;
+        }
+        const char * key = segment.base + offset + sizeof(header);
+        const char * data = key + header.key_len;
+        if (checksum(key, header.key_len, data, header.data_len) != header.checksum) {
+            LOG_WARNING("disk cache: corrupt record in segment " + to_string(i) + " at " + to_string(offset));
+            break;
+        }
+
+        string key_str(key, header.key_len);
+        uint64_t hash = hashKey(key_str);
+        if (header.flags & FLAG_TOMBSTONE) {
+            forgetLocked(key_str, hash);
+        } else {
+            rememberLocked(key_str, hash);
+            index[hash] = Location{static_cast<uint32_t>(i), static_cast<uint32_t>(offset), header.key_len,
+                                   header.data_len, segment.sequence, header.creation_time, header.expires_time, 0,
+                                   (header.flags & FLAG_GZIP) != 0};
+        }
+        offset += record_size;
+    }
+    segment.write_offset = offset;
+}
+
+bool DiskCache::store(const string & key, const CacheEntry & entry) {
+    if (entry.isExpired() || entry.isPartial()) {
+        return false;
+    }
+    string data = entry.getFullResponse();
+
+    lock_guard<mutex> lock(index_mutex);
+    return append(key, data.data(), data.size(), entry.getCreationTime(), entry.getExpiresTime(),
+                  entry.isGzip() ? FLAG_GZIP : 0);
+}
+
+// caller holds index_mutex
+bool DiskCache::append(const string & key, const char * data, uint32_t data_len,
+                       int64_t creation_time, int64_t expires_time, uint32_t flags) {
+    size_t record_size = align8(sizeof(RecordHeader) + key.size() + data_len);
+    if (record_size > segment_size - SEGMENT_HEADER_SIZE) {
+        LOG_DEBUG("disk cache: record too large for a segment: " + key);
+        return false;
+    }
+    if (segments[active]->write_offset + record_size > segment_size) {
+        recycleNextSegment();
+    }
+
+    Segment & segment = *segments[active];
+    uint32_t offset = segment.write_offset;
+    char * record = segment.base + offset;
+
+    RecordHeader header{};
+    header.magic = 0;
+    header.flags = flags;
+    header.key_len = key.size();
+    header.data_len = data_len;
+    header.sequence = segment.sequence;
+    header.checksum = checksum(key.data(), key.size(), data, data_len);
+    header.creation_time = creation_time;
+    header.expires_time = expires_time;
+
+    memcpy(record + sizeof(header), key.data(), key.size());
+    memcpy(record + sizeof(header) + key.size(), data, data_len);
+    memcpy(record, &header, sizeof(header));
+    __atomic_store_n(reinterpret_cast<uint32_t *>(record), RECORD_MAGIC, __ATOMIC_RELEASE);
+    segment.write_offset = offset + record_size;
+
+    uint64_t hash = hashKey(key);
+    if (flags & FLAG_TOMBSTONE) {
+        forgetLocked(key, hash);
+    } else {
+        rememberLocked(key, hash);
+        index[hash] = Location{static_cast<uint32_t>(active), offset, static_cast<uint32_t>(key.size()),
+                               data_len, segment.sequence, creation_time, expires_time, 0,
+                               (flags & FLAG_GZIP) != 0};
+    }
+    return true;
+}
+
+// caller holds index_mutex; drops everything in the oldest segment
+void DiskCache::recycleNextSegment() {
+    int next = (active + 1) % segment_number;
+    Segment & segment = *segments[next];
+
+    unique_lock<shared_mutex> segment_lock(segment.lock);
+    size_t dropped = 0;
+    for (auto it = index.begin(); it != index.end();) {
+        if (it->second.segment == static_cast<uint32_t>(next)) {
+            unlinkVariantLocked(keyOf(it->second), it->first);
+            it = index.erase(it);
+            dropped++;
+        } else {
+            ++it;
+        }
+    }
+
+    segment.sequence = next_sequence++;
+    SegmentHeader header;
+    memcpy(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    header.sequence = segment.sequence;
+    memcpy(segment.base, &header, sizeof(header));
+    segment.write_offset = SEGMENT_HEADER_SIZE;
+    active = next;
+    LOG_DEBUG("disk cache: recycled segment " + to_string(next) + ", dropped " + to_string(dropped) + " entries");
+}
+
+bool DiskCache::lookup(const string & key, Location & location) {
+    {
+        lock_guard<mutex> lock(index_mutex);
+        auto it = index.find(hashKey(key));
+        if (it == index.end()) {
+            return false;
+        }
+        if (it->second.expires_time <= time(nullptr)) {
+            return false;
+        }
+        it->second.hits++;
+        location = it->second;
+    }
+
+    shared_lock<shared_mutex> segment_lock(segments[location.segment]->lock);
+    return validate(location, key);
+}
+
+// caller holds the segment lock; the record must still be ours
+bool DiskCache::validate(const Location & location, const string & key) {
+    Segment & segment = *segments[location.segment];
+    if (segment.sequence != location.sequence || location.key_len != key.size()) {
+        return false;
+    }
+    return memcmp(segment.base + location.offset + sizeof(RecordHeader), key.data(), key.size()) == 0;
+}
+
+bool DiskCache::sendTo(int fd, const string & key, const Location & location) {
+    Segment & segment = *segments[location.segment];
+    shared_lock<shared_mutex> segment_lock(segment.lock);
+    if (!validate(location, key)) {
+        return false;
+    }
+
+    // the response goes from page cache to socket without a user space copy
+    off_t offset = location.offset + sizeof(RecordHeader) + location.key_len;
+    size_t remaining = location.data_len;
+    while (remaining > 0) {
+        ssize_t sent = sendfile(fd, segment.fd, &offset, remaining);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                this_thread::yield();
+                continue;
+            }
+            throw runtime_error("sendfile failed: " + string(strerror(errno)));
+        }
+        if (sent == 0) {
+            throw runtime_error("sendfile wrote nothing");
+        }
+        remaining -= sent;
+    }
+    return true;
+}
+
+bool DiskCache::read(const string & key, const Location & location, string & response) {
+    Segment & segment = *segments[location.segment];
+    shared_lock<shared_mutex> segment_lock(segment.lock);
+    if (!validate(location, key)) {
+        return false;
+    }
+    response.assign(segment.base + location.offset + sizeof(RecordHeader) + location.key_len, location.data_len);
+    return true;
+}
+
+bool DiskCache::remove(const string & key) {
+    lock_guard<mutex> lock(index_mutex);
+    if (index.count(hashKey(key)) == 0) {
+        return false;
+    }
+    append(key, "", 0, 0, 0, FLAG_TOMBSTONE);
+    return true;
+}
+
+size_t DiskCache::purge(const string & url) {
+    lock_guard<mutex> lock(index_mutex);
+    vector<string> matched;
+    uint64_t hash = hashKey(url);
+    if (index.count(hash) != 0) {
+        matched.push_back(url);
+    }
+    string variant_prefix = url + "\n";
+    auto range = variants.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        auto found = index.find(it->second);
+        if (found != index.end()) {
+            string key = keyOf(found->second);
+            if (key.compare(0, variant_prefix.size(), variant_prefix) == 0) {
+                matched.push_back(key);
+            }
+        }
+    }
+    // appending may recycle a segment, the keys are copied out first
+    for (const auto & key : matched) {
+        append(key, "", 0, 0, 0, FLAG_TOMBSTONE);
+    }
+    return matched.size();
+}
+
+size_t DiskCache::removePrefix(const string & prefix) {
+    lock_guard<mutex> lock(index_mutex);
+    // keys only live on disk, compare them in place in the mapped segments
+    vector<string> matched;
+    for (const auto & [hash, location] : index) {
+        const char * key = segments[location.segment]->base + location.offset + sizeof(RecordHeader);
+        if (location.key_len >= prefix.size() && memcmp(key, prefix.data(), prefix.size()) == 0) {
+            matched.push_back(keyOf(location));
+        }
+    }
+    for (const auto & key : matched) {
+        append(key, "", 0, 0, 0, FLAG_TOMBSTONE);
+    }
+    return matched.size();
+}
+
+string DiskCache::keyOf(const Location & location) const {
+    return string(segments[location.segment]->base + location.offset + sizeof(RecordHeader), location.key_len);
+}
+
+void DiskCache::rememberLocked(const string & key, uint64_t hash) {
+    size_t variant = key.find('\n');
+    if (variant != string::npos && index.count(hash) == 0) {
+        variants.emplace(hashKey(key.substr(0, variant)), hash);
+    }
+}
+
+void DiskCache::forgetLocked(const string & key, uint64_t hash) {
+    if (index.erase(hash) != 0) {
+        unlinkVariantLocked(key, hash);
+    }
+}
+
+void DiskCache::unlinkVariantLocked(const string & key, uint64_t hash) {
+    size_t variant = key.find('\n');
+    if (variant == string::npos) {
+        return;
+    }
+    auto range = variants.equal_range(hashKey(key.substr(0, variant)));
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == hash) {
+            variants.erase(it);
+            return;
+        }
+    }
+}
+
+size_t DiskCache::getEntryNumber() const {
+    lock_guard<mutex> lock(index_mutex);
+    return index.size();
+}
+
+// FNV-1a, stable across builds unlike std::hash
+uint64_t DiskCache::hashKey(const string & key) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint32_t DiskCache::checksum(const char * key, uint32_t key_len, const char * data, uint32_t data_len) {
+    uint32_t hash = 2166136261U;
+    for (uint32_t i = 0; i < key_len; i++) {
+        hash ^= static_cast<unsigned char>(key[i]);
+        hash *= 16777619U;
+    }
+    for (uint32_t i = 0; i < data_len; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619U;
+    }
+    return hash;
+}
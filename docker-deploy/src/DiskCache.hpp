@@ -0,0 +1,113 @@
+#ifndef DISKCACHE_HPP
+#define DISKCACHE_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <cstdint>
+#include <ctime>
+
+#include "Logger.hpp"
+#include "CacheEntry.hpp"
+
+using namespace std;
+
+// Second cache tier on SSD. Responses are appended to a ring of
+// fixed size mmap'd segment files; when the ring wraps, the oldest
+// segment is recycled with everything in it. Only a small location
+// per key stays in memory, and the index is rebuilt by scanning the
+// segments on startup. Keys themselves stay on disk: a purge by prefix
+// reads them from the mapped segments.
+class DiskCache {
+public:
+    struct Location {
+        uint32_t segment;
+        uint32_t offset;        // of the record header in the segment
+        uint32_t key_len;
+        uint32_t data_len;
+        uint64_t sequence;      // generation of the segment when written
+        int64_t creation_time;
+        int64_t expires_time;
+        uint32_t hits;
+        bool gzip;              // response has Content-Encoding: gzip
+    };
+
+    DiskCache(const string & dir, size_t segment_size, int segment_number);
+    ~DiskCache();
+
+    // create or map the segment files and rebuild the index from them
+    bool open();
+
+    // append an evicted entry, replacing any older copy of key
+    bool store(const string & key, const CacheEntry & entry);
+
+    // find key, counting the hit; false if not on disk
+    bool lookup(const string & key, Location & location);
+
+    // write the stored response to fd with sendfile, false if it was recycled
+    bool sendTo(int fd, const string & key, const Location & location);
+
+    // copy the stored response out, used to promote it to memory
+    bool read(const string & key, const Location & location, string & response);
+
+    // forget key, with a tombstone so it stays gone after a restart;
+    // false if it was not on disk
+    bool remove(const string & key);
+
+    // remove url and every variant of it (url + "\n" + ...), returns how many
+    size_t purge(const string & url);
+
+    // remove every key starting with prefix, returns how many; compares
+    // the key of every entry
+    size_t removePrefix(const string & prefix);
+
+    size_t getEntryNumber() const;
+
+private:
+    struct Segment {
+        int fd = -1;
+        char * base = nullptr;
+        uint64_t sequence = 0;
+        uint32_t write_offset = 0;
+        // readers share it, recycling the segment takes it exclusively
+        shared_mutex lock;
+    };
+
+    bool openSegment(int index);
+    void scanSegment(int index);
+    bool append(const string & key, const char * data, uint32_t data_len,
+                int64_t creation_time, int64_t expires_time, uint32_t flags);
+    void recycleNextSegment();
+    bool validate(const Location & location, const string & key);
+    // the following are called with index_mutex held, under which no
+    // indexed record is recycled
+    string keyOf(const Location & location) const;
+    // key is about to be indexed under hash
+    void rememberLocked(const string & key, uint64_t hash);
+    void forgetLocked(const string & key, uint64_t hash);
+    void unlinkVariantLocked(const string & key, uint64_t hash);
+
+    static uint64_t hashKey(const string & key);
+    static uint32_t checksum(const char * key, uint32_t key_len, const char * data, uint32_t data_len);
+
+    string dir;
+    size_t segment_size;
+    int segment_number;
+    vector<unique_ptr<Segment>> segments;
+    int active;
+    uint64_t next_sequence;
+
+    // key hash to location, keys themselves only live on disk
+    unordered_map<uint64_t, Location> index;
+    // url hash to the key hashes of its variants, so purging a url does
+    // not compare every key
+    unordered_multimap<uint64_t, uint64_t> variants;
+    mutable mutex index_mutex;
+
+    static inline Logger & logger = Logger::getInstance();
+};
+
+#endif
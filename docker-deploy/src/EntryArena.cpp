@@ -0,0 +1,241 @@
+#include "EntryArena.hpp"
+#include <sys/mman.h>
+#include <algorithm>
+#include <new>
+
+namespace {
+
+// the largest class holds a whole 64 KB body segment
+const size_t SMALLEST_CLASS = 64;
+const size_t LARGEST_PAYLOAD = 64 * 1024;
+
+}
+
+EntryArena::Block::Block(const Block & other) : header(other.header) {
+    if (header != nullptr) {
+        header->refs.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+EntryArena::Block::Block(Block && other) noexcept : header(other.header) {
+    other.header = nullptr;
+}
+
+EntryArena::Block & EntryArena::Block::operator=(Block other) noexcept {
+    swap(header, other.header);
+    return *this;
+}
+
+EntryArena::Block::~Block() {
+    if (header != nullptr && header->refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+        header->arena->release(header);
+    }
+}
+
+char * EntryArena::Block::data() const {
+    return header == nullptr ? nullptr : reinterpret_cast<char *>(header) + HEADER_SIZE;
+}
+
+size_t EntryArena::Block::capacity() const {
+    return header == nullptr ? 0 : header->size - HEADER_SIZE;
+}
+
+size_t EntryArena::Block::footprint() const {
+    return header == nullptr ? 0 : header->size;
+}
+
+bool EntryArena::Block::shared() const {
+    return header != nullptr && header->refs.load(memory_order_acquire) > 1;
+}
+
+EntryArena & EntryArena::Block::arena() const {
+    return *header->arena;
+}
+
+EntryArena::EntryArena()
+:   free_lists(classes().size(), nullptr),
+    current(nullptr),
+    bump(nullptr),
+    bump_left(0),
+    huge_pages(use_huge_pages),
+    usage{0, 0, 0, 0} {}
+
+EntryArena::~EntryArena() {
+    for (const unique_ptr<Chunk> & chunk : chunks) {
+        munmap(chunk->base, CHUNK_SIZE);
+    }
+}
+
+shared_ptr<EntryArena> EntryArena::create() {
+    return shared_ptr<EntryArena>(new EntryArena());
+}
+
+const shared_ptr<EntryArena> & EntryArena::heap() {
+    static const shared_ptr<EntryArena> arena = create();
+    return arena;
+}
+
+void EntryArena::setHugePages(bool enabled) {
+    use_huge_pages = enabled;
+}
+
+const vector<size_t> & EntryArena::classes() {
+    static const vector<size_t> sizes = []() {
+        vector<size_t> out;
+        size_t largest = LARGEST_PAYLOAD + HEADER_SIZE;
+        for (size_t size = SMALLEST_CLASS; size < largest; size = (size + size / 4 + 15) / 16 * 16) {
+            out.push_back(size);
+        }
+        out.push_back(largest);
+        return out;
+    }();
+    return sizes;
+}
+
+size_t EntryArena::classSize(size_t size) {
+    const vector<size_t> & sizes = classes();
+    auto it = lower_bound(sizes.begin(), sizes.end(), size + HEADER_SIZE);
+    return it == sizes.end() ? 0 : *it;
+}
+
+EntryArena::Block EntryArena::allocate(size_t size) {
+    const vector<size_t> & sizes = classes();
+    size_t block_size = size + HEADER_SIZE;
+    auto it = lower_bound(sizes.begin(), sizes.end(), block_size);
+    int size_class = it == sizes.end() ? -1 : static_cast<int>(it - sizes.begin());
+    char * memory = nullptr;
+    Chunk * chunk = nullptr;
+    {
+        lock_guard<mutex> lock(arena_mutex);
+        if (size_class >= 0) {
+            block_size = *it;
+            FreeBlock * free = free_lists[size_class];
+            if (free != nullptr) {
+                unlink(free);
+                chunk = free->chunk;
+                memory = reinterpret_cast<char *>(free);
+            } else {
+                memory = carve(block_size, chunk);
+            }
+            chunk->live++;
+        }
+        usage.blocks++;
+        usage.requested += size;
+        usage.reserved += block_size;
+    }
+    // too big for any class, e.g. a huge header block
+    if (memory == nullptr) {
+        memory = static_cast<char *>(::operator new(block_size));
+    }
+    Header * header = new (memory) Header();
+    header->refs.store(1, memory_order_relaxed);
+    header->requested = static_cast<uint32_t>(size);
+    header->size = block_size;
+    header->size_class = size_class;
+    header->arena = shared_from_this();
+    header->chunk = chunk;
+    return Block(header);
+}
+
+void EntryArena::release(Header * header) {
+    // the block holds a reference to this arena, it goes last
+    shared_ptr<EntryArena> self = move(header->arena);
+    size_t size = header->size;
+    size_t requested = header->requested;
+    int size_class = header->size_class;
+    Chunk * chunk = header->chunk;
+    header->~Header();
+    char * memory = reinterpret_cast<char *>(header);
+    if (size_class < 0) {
+        ::operator delete(memory);
+    }
+    lock_guard<mutex> lock(arena_mutex);
+    usage.blocks--;
+    usage.requested -= requested;
+    usage.reserved -= size;
+    if (size_class < 0) {
+        return;
+    }
+    FreeBlock * free = new (memory) FreeBlock{free_lists[size_class], nullptr, chunk, size, size_class};
+    if (free->next != nullptr) {
+        free->next->prev = free;
+    }
+    free_lists[size_class] = free;
+    if (--chunk->live == 0) {
+        dropChunk(chunk);
+    }
+}
+
+// caller holds arena_mutex
+void EntryArena::unlink(FreeBlock * block) {
+    if (block->prev != nullptr) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[block->size_class] = block->next;
+    }
+    if (block->next != nullptr) {
+        block->next->prev = block->prev;
+    }
+}
+
+// caller holds arena_mutex; every block of chunk is free
+void EntryArena::dropChunk(Chunk * chunk) {
+    for (char * at = chunk->base; at < chunk->base + chunk->carved;) {
+        FreeBlock * block = reinterpret_cast<FreeBlock *>(at);
+        at += block->size;
+        unlink(block);
+    }
+    // the one blocks are carved from starts over instead
+    if (chunk == current) {
+        chunk->carved = 0;
+        bump = chunk->base;
+        bump_left = CHUNK_SIZE;
+        return;
+    }
+    munmap(chunk->base, CHUNK_SIZE);
+    usage.mapped -= CHUNK_SIZE;
+    for (unique_ptr<Chunk> & mapped : chunks) {
+        if (mapped.get() == chunk) {
+            mapped = move(chunks.back());
+            chunks.pop_back();
+            break;
+        }
+    }
+}
+
+// caller holds arena_mutex
+char * EntryArena::carve(size_t size, Chunk *& chunk) {
+    if (bump_left < size) {
+        void * mapped = MAP_FAILED;
+        if (huge_pages) {
+            mapped = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+        if (mapped == MAP_FAILED) {
+            mapped = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapped == MAP_FAILED) {
+                throw bad_alloc();
+            }
+            // no reserved huge pages, transparent ones may still back it
+            if (huge_pages) {
+                madvise(mapped, CHUNK_SIZE, MADV_HUGEPAGE);
+            }
+        }
+        // the tail of the old chunk is too small for this class, it stays unused
+        chunks.push_back(make_unique<Chunk>(Chunk{static_cast<char *>(mapped), 0, 0}));
+        current = chunks.back().get();
+        bump = current->base;
+        bump_left = CHUNK_SIZE;
+        usage.mapped += CHUNK_SIZE;
+    }
+    chunk = current;
+    char * memory = bump;
+    bump += size;
+    bump_left -= size;
+    chunk->carved += size;
+    return memory;
+}
+
+EntryArena::Usage EntryArena::getUsage() const {
+    lock_guard<mutex> lock(arena_mutex);
+    return usage;
+}
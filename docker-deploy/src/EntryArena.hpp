@@ -0,0 +1,120 @@
+#ifndef ENTRYARENA_HPP
+#define ENTRYARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+// Size classed slab allocator for cache entries. Memory is mapped in 2 MB
+// chunks (huge pages when enabled); a freed block goes on the free list of
+// its class and the next entry of about that size reuses it, so small
+// entries cost no malloc and do not fragment the heap. A chunk whose last
+// block is freed is unmapped, the arena shrinks when the cache does.
+// Classes grow by a quarter, rounding wastes at most 20% of a block.
+// Blocks are refcounted and keep their arena alive, so a copy of an entry
+// may outlive the shard it came from.
+class EntryArena : public enable_shared_from_this<EntryArena> {
+    struct Header;
+
+public:
+    // refcounted handle to one block, copies share the bytes
+    class Block {
+    public:
+        Block() : header(nullptr) {}
+        Block(const Block & other);
+        Block(Block && other) noexcept;
+        Block & operator=(Block other) noexcept;
+        ~Block();
+
+        char * data() const;
+        size_t capacity() const;
+        // bytes the block takes from its arena, header and rounding included
+        size_t footprint() const;
+        // another handle holds it too, writers copy first
+        bool shared() const;
+        EntryArena & arena() const;
+        explicit operator bool() const { return header != nullptr; }
+        bool operator==(const Block & other) const { return header == other.header; }
+
+    private:
+        friend class EntryArena;
+        explicit Block(Header * header) : header(header) {}
+        Header * header;
+    };
+
+    struct Usage {
+        size_t blocks;      // live blocks
+        size_t requested;   // bytes asked for
+        size_t reserved;    // bytes those blocks take, headers and rounding included
+        size_t mapped;      // bytes of chunks, free blocks included
+    };
+
+    static constexpr size_t CHUNK_SIZE = 2 * 1024 * 1024;
+
+    static shared_ptr<EntryArena> create();
+    ~EntryArena();
+
+    // a block with room for at least size bytes
+    Block allocate(size_t size);
+
+    Usage getUsage() const;
+
+    // arena of entries not (yet) stored in a shard
+    static const shared_ptr<EntryArena> & heap();
+
+    // map chunks as huge pages, for arenas created afterwards
+    static void setHugePages(bool enabled);
+
+    // size of the class a request of size bytes lands in, 0 past the last class
+    static size_t classSize(size_t size);
+
+private:
+    struct Chunk {
+        char * base;
+        size_t carved;                  // blocks are cut from the front
+        size_t live;
+    };
+    struct Header {
+        atomic<uint32_t> refs;
+        uint32_t requested;
+        size_t size;                    // whole block, header included
+        int size_class;                 // -1 for blocks bigger than every class
+        shared_ptr<EntryArena> arena;
+        Chunk * chunk;
+    };
+    // what a free block holds instead of its header
+    struct FreeBlock {
+        FreeBlock * next;
+        FreeBlock * prev;
+        Chunk * chunk;
+        size_t size;
+        int size_class;
+    };
+    static constexpr size_t HEADER_SIZE = (sizeof(Header) + 15) / 16 * 16;
+
+    EntryArena();
+    void release(Header * header);
+    char * carve(size_t size, Chunk *& chunk);
+    void unlink(FreeBlock * block);
+    void dropChunk(Chunk * chunk);
+    static const vector<size_t> & classes();
+
+    mutable mutex arena_mutex;
+    vector<FreeBlock *> free_lists;
+    vector<unique_ptr<Chunk>> chunks;
+    // the chunk blocks are carved from
+    Chunk * current;
+    char * bump;
+    size_t bump_left;
+    bool huge_pages;
+    Usage usage;
+
+    static inline atomic<bool> use_huge_pages{false};
+};
+
+#endif
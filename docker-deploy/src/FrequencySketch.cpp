@@ -0,0 +1,104 @@
+#include "FrequencySketch.hpp"
+#include <algorithm>
+
+namespace {
+
+const uint64_t SEEDS[4] = {
+    0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+};
+
+// spread one key hash into independent ones
+inline uint64_t rehash(uint64_t hash, uint64_t seed) {
+    hash = (hash ^ seed) * 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 32);
+}
+
+}
+
+FrequencySketch::FrequencySketch(size_t capacity) : additions(0) {
+    // small tables collide so much that everything looks popular
+    width = 1024;
+    while (width < capacity) {
+        width <<= 1;
+    }
+    sample_size = 10 * width;
+    counters.assign(DEPTH * width, 0);
+    doorkeeper.assign(width * 8 / 64, 0);
+}
+
+size_t FrequencySketch::indexOf(uint64_t hash, int row) const {
+    return row * width + (rehash(hash, SEEDS[row]) & (width - 1));
+}
+
+bool FrequencySketch::doorkeeperContains(uint64_t hash) const {
+    size_t bits = doorkeeper.size() * 64;
+    for (int i = 0; i < 2; i++) {
+        size_t bit = rehash(hash, SEEDS[i + 2] + 1) % bits;
+        if ((doorkeeper[bit / 64] & (1ULL << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FrequencySketch::doorkeeperPut(uint64_t hash) {
+    bool present = true;
+    size_t bits = doorkeeper.size() * 64;
+    for (int i = 0; i < 2; i++) {
+        size_t bit = rehash(hash, SEEDS[i + 2] + 1) % bits;
+        uint64_t mask = 1ULL << (bit % 64);
+        present = present && (doorkeeper[bit / 64] & mask) != 0;
+        doorkeeper[bit / 64] |= mask;
+    }
+    return present;
+}
+
+void FrequencySketch::increment(uint64_t hash) {
+    lock_guard<mutex> lock(sketch_mutex);
+    // first sighting only marks the doorkeeper
+    if (doorkeeperPut(hash)) {
+        // conservative update: raise only the smallest counters
+        int minimum = estimateLocked(hash) - 1;
+        for (int row = 0; row < DEPTH; row++) {
+            uint8_t & counter = counters[indexOf(hash, row)];
+            if (counter == minimum && counter < MAX_COUNT) {
+                counter++;
+            }
+        }
+    }
+    if (++additions >= sample_size) {
+        age();
+    }
+}
+
+int FrequencySketch::estimate(uint64_t hash) {
+    lock_guard<mutex> lock(sketch_mutex);
+    return estimateLocked(hash);
+}
+
+// caller holds sketch_mutex
+int FrequencySketch::estimateLocked(uint64_t hash) const {
+    uint8_t minimum = MAX_COUNT;
+    for (int row = 0; row < DEPTH; row++) {
+        minimum = min(minimum, counters[indexOf(hash, row)]);
+    }
+    return minimum + (doorkeeperContains(hash) ? 1 : 0);
+}
+
+bool FrequencySketch::admit(uint64_t candidate, uint64_t victim) {
+    lock_guard<mutex> lock(sketch_mutex);
+    return estimateLocked(candidate) > estimateLocked(victim);
+}
+
+size_t FrequencySketch::getSampleSize() const {
+    return sample_size;
+}
+
+// caller holds sketch_mutex
+void FrequencySketch::age() {
+    for (auto & counter : counters) {
+        counter >>= 1;
+    }
+    fill(doorkeeper.begin(), doorkeeper.end(), 0);
+    additions /= 2;
+}
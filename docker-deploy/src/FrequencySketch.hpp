@@ -0,0 +1,50 @@
+#ifndef FREQUENCYSKETCH_HPP
+#define FREQUENCYSKETCH_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
+using namespace std;
+
+// TinyLFU: approximate access counts of recent keys in a few KB.
+// A doorkeeper Bloom filter absorbs the first access of every key, so
+// one-hit wonders never reach the count-min sketch. After sample_size
+// accesses all counters are halved and the doorkeeper is cleared, so old
+// popularity fades out.
+class FrequencySketch {
+public:
+    // capacity is about how many entries the cache can hold, at least 1024
+    explicit FrequencySketch(size_t capacity = 4096);
+
+    void increment(uint64_t hash);
+
+    // 0..MAX_COUNT + 1
+    int estimate(uint64_t hash);
+
+    // admit the candidate only if it is used more than the victim it replaces
+    bool admit(uint64_t candidate, uint64_t victim);
+
+    size_t getSampleSize() const;
+
+private:
+    static const int DEPTH = 4;
+    static const uint8_t MAX_COUNT = 15;
+
+    size_t width;       // counters per row, a power of two
+    size_t sample_size;
+    size_t additions;
+    vector<uint8_t> counters;       // DEPTH rows of width counters
+    vector<uint64_t> doorkeeper;    // width * 8 bits
+    mutex sketch_mutex;
+
+    size_t indexOf(uint64_t hash, int row) const;
+    bool doorkeeperContains(uint64_t hash) const;
+    // true if it was already there
+    bool doorkeeperPut(uint64_t hash);
+    int estimateLocked(uint64_t hash) const;
+    void age();
+};
+
+#endif
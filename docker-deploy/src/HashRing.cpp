@@ -0,0 +1,48 @@
+#include "HashRing.hpp"
+#include <stdexcept>
+
+HashRing::HashRing(int virtual_nodes) : virtual_nodes(virtual_nodes > 0 ? virtual_nodes : 1) {}
+
+size_t HashRing::addNode(const string & node) {
+    size_t index = nodes.size();
+    nodes.push_back(node);
+    for (int i = 0; i < virtual_nodes; i++) {
+        // on a collision the earlier node keeps the point
+        ring.emplace(hash(node + "#" + to_string(i)), index);
+    }
+    return index;
+}
+
+size_t HashRing::selectIndex(string_view key) const {
+    if (ring.empty()) {
+        throw runtime_error("HashRing has no nodes");
+    }
+    auto it = ring.lower_bound(hash(key));
+    if (it == ring.end()) {
+        it = ring.begin();
+    }
+    return it->second;
+}
+
+const string & HashRing::selectNode(string_view key) const {
+    return nodes.at(selectIndex(key));
+}
+
+size_t HashRing::getNodeNumber() const {
+    return nodes.size();
+}
+
+// FNV-1a with a final mix, similar names like "shard-1#2" spread evenly
+uint64_t HashRing::hash(string_view key) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
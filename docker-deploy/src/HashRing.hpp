@@ -0,0 +1,38 @@
+#ifndef HASHRING_HPP
+#define HASHRING_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+using namespace std;
+
+// Consistent hashing: every node owns many points on a 64 bit ring and a
+// key belongs to the first point at or after its hash. Adding a node only
+// takes over about 1/n of the keys instead of reshuffling all of them.
+class HashRing {
+public:
+    explicit HashRing(int virtual_nodes = 128);
+
+    // returns the index of the new node
+    size_t addNode(const string & node);
+
+    // index of the node that owns key, the ring must not be empty
+    size_t selectIndex(string_view key) const;
+
+    const string & selectNode(string_view key) const;
+
+    size_t getNodeNumber() const;
+
+    // stable across builds and processes, unlike std::hash
+    static uint64_t hash(string_view key);
+
+private:
+    int virtual_nodes;
+    vector<string> nodes;
+    map<uint64_t, size_t> ring;
+};
+
+#endif
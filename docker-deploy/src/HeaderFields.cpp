@@ -0,0 +1,224 @@
+#include "HeaderFields.hpp"
+#include "HeaderScanner.hpp"
+#include <cstring>
+#include <strings.h>
+#include <stdexcept>
+
+namespace {
+
+string_view trim(string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+    return value;
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// hex size of a chunk-size line, extensions after a ';' are ignored
+size_t chunkSize(string_view line) {
+    size_t chunk = 0;
+    size_t digits = 0;
+    for (; digits < line.size() && hexValue(line[digits]) >= 0; digits++) {
+        chunk = chunk * 16 + hexValue(line[digits]);
+        if (digits > 15) {
+            throw runtime_error("chunk too large");
+        }
+    }
+    char after = digits < line.size() ? line[digits] : ';';
+    if (digits == 0 || (after != ';' && after != ' ' && after != '\t')) {
+        throw runtime_error("malformed chunk size");
+    }
+    return chunk;
+}
+
+}
+
+bool HeaderFields::Field::is(string_view other) const {
+    return name.size() == other.size() && strncasecmp(name.data(), other.data(), other.size()) == 0;
+}
+
+size_t HeaderFields::parse(string_view data, size_t offset) {
+    count = 0;
+    const char * base = data.data();
+    const char * end = base + data.size();
+    const char * p = base + offset;
+    while (true) {
+        if (end - p < 2) {
+            return 0;
+        }
+        if (*p == '\r') {
+            if (p[1] != '\n') {
+                throw runtime_error("malformed end of head");
+            }
+            return p + 2 - base;
+        }
+        // no obsolete line folding, and no space before the colon
+        const char * name_end = HeaderScanner::skipToken(p, end);
+        if (name_end == end) {
+            return 0;
+        }
+        if (name_end == p || *name_end != ':') {
+            throw runtime_error("malformed header name");
+        }
+        size_t line_end = lineEnd(data, name_end + 1 - base);
+        if (line_end == string_view::npos) {
+            return 0;
+        }
+        if (count == MAX_FIELDS) {
+            throw runtime_error("too many header fields");
+        }
+        fields[count++] = {string_view(p, name_end - p), trim(string_view(name_end + 1, base + line_end - name_end - 1))};
+        p = base + line_end + 2;
+    }
+}
+
+size_t HeaderFields::lineEnd(string_view data, size_t offset) {
+    const char * end = data.data() + data.size();
+    const char * cr = HeaderScanner::findControl(data.data() + offset, end);
+    if (cr == end || (*cr == '\r' && cr + 1 == end)) {
+        return string_view::npos;
+    }
+    if (*cr != '\r' || cr[1] != '\n') {
+        throw runtime_error("control character in line");
+    }
+    return cr - data.data();
+}
+
+string_view HeaderFields::get(string_view name) const {
+    for (const Field & field : *this) {
+        if (field.is(name)) {
+            return field.value;
+        }
+    }
+    return string_view();
+}
+
+bool HeaderFields::has(string_view name) const {
+    for (const Field & field : *this) {
+        if (field.is(name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HeaderFields::isChunked() const {
+    string_view last;
+    for (const Field & field : *this) {
+        if (field.is("Transfer-Encoding")) {
+            last = field.value;
+        }
+    }
+    size_t comma = last.rfind(',');
+    string_view coding = trim(comma == string_view::npos ? last : last.substr(comma + 1));
+    return coding.size() == 7 && strncasecmp(coding.data(), "chunked", 7) == 0;
+}
+
+long long HeaderFields::contentLength() const {
+    if (!has("Content-Length")) {
+        return -1;
+    }
+    string_view value = get("Content-Length");
+    if (value.empty()) {
+        throw runtime_error("empty Content-Length");
+    }
+    long long length = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9' || length > (1LL << 50)) {
+            throw runtime_error("malformed Content-Length");
+        }
+        length = length * 10 + (c - '0');
+    }
+    return length;
+}
+
+void HeaderFields::rebase(const char * from, const char * to) {
+    for (size_t i = 0; i < count; i++) {
+        Field & field = fields[i];
+        field.name = string_view(to + (field.name.data() - from), field.name.size());
+        field.value = string_view(to + (field.value.data() - from), field.value.size());
+    }
+}
+
+size_t HeaderFields::decodeChunked(char * data, size_t size, size_t & consumed) {
+    string_view encoded(data, size);
+    size_t in = 0;
+    size_t out = 0;
+    while (true) {
+        size_t line_end = encoded.find("\r\n", in);
+        if (line_end == string_view::npos) {
+            throw runtime_error("incomplete chunked body");
+        }
+        size_t chunk = chunkSize(encoded.substr(in, line_end - in));
+        in = line_end + 2;
+        if (chunk == 0) {
+            break;
+        }
+        // never chunk + 2, a size near 2^64 wraps around
+        if (chunk > size - in || size - in - chunk < 2) {
+            throw runtime_error("incomplete chunked body");
+        }
+        memmove(data + out, data + in, chunk);
+        out += chunk;
+        in += chunk;
+        if (data[in] != '\r' || data[in + 1] != '\n') {
+            throw runtime_error("malformed chunk");
+        }
+        in += 2;
+    }
+    // trailer fields are dropped, up to the empty line
+    while (true) {
+        size_t line_end = encoded.find("\r\n", in);
+        if (line_end == string_view::npos) {
+            throw runtime_error("incomplete chunked body");
+        }
+        bool last = line_end == in;
+        in = line_end + 2;
+        if (last) {
+            break;
+        }
+    }
+    consumed = in;
+    return out;
+}
+
+bool HeaderFields::walkChunks(string_view data, size_t & pos, string & body) {
+    while (true) {
+        size_t line_end = data.find("\r\n", pos);
+        if (line_end == string_view::npos) {
+            return false;
+        }
+        size_t chunk = chunkSize(data.substr(pos, line_end - pos));
+        size_t start = line_end + 2;
+        if (chunk == 0) {
+            // trailer fields are dropped, up to the empty line
+            size_t end = start;
+            while (true) {
+                size_t trailer_end = data.find("\r\n", end);
+                if (trailer_end == string_view::npos) {
+                    return false;
+                }
+                bool last = trailer_end == end;
+                end = trailer_end + 2;
+                if (last) {
+                    pos = end;
+                    return true;
+                }
+            }
+        }
+        // never chunk + 2, a size near 2^64 wraps around
+        if (chunk > data.size() - start || data.size() - start - chunk < 2) {
+            return false;
+        }
+        if (data[start + chunk] != '\r' || data[start + chunk + 1] != '\n') {
+            throw runtime_error("malformed chunk");
+        }
+        body.append(data.data() + start, chunk);
+        pos = start + chunk + 2;
+    }
+}
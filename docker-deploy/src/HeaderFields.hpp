@@ -0,0 +1,68 @@
+#ifndef HEADERFIELDS_HPP
+#define HEADERFIELDS_HPP
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+using namespace std;
+
+// The fields of an HTTP head as views into the bytes they were parsed
+// from, kept in a fixed array so parsing allocates nothing. Nothing is
+// copied, whoever owns those bytes keeps them alive and in place for as
+// long as the fields are used.
+class HeaderFields {
+public:
+    struct Field {
+        string_view name;
+        string_view value;
+        // field names compare without case
+        bool is(string_view other) const;
+    };
+
+    // a head with more fields is refused
+    static constexpr size_t MAX_FIELDS = 128;
+
+    HeaderFields() : count(0) {}
+
+    // split the field lines of data from offset on, i.e. after the start
+    // line, up to the empty line ending the head. Returns the length of
+    // the head, 0 if it has not arrived completely; throws runtime_error
+    // on a line that is not "name: value"
+    size_t parse(string_view data, size_t offset);
+
+    // value of the first field called name, empty if there is none
+    string_view get(string_view name) const;
+    bool has(string_view name) const;
+    // the last transfer coding is chunked
+    bool isChunked() const;
+    // Content-Length, -1 if absent; throws runtime_error if it is no number
+    long long contentLength() const;
+
+    const Field * begin() const { return fields; }
+    const Field * end() const { return fields + count; }
+    size_t size() const { return count; }
+
+    // point the views at a copy of the bytes that starts at to
+    void rebase(const char * from, const char * to);
+
+    // end of the line starting at offset, i.e. its CR; npos if the line
+    // has not arrived completely, throws runtime_error on a stray control
+    // character
+    static size_t lineEnd(string_view data, size_t offset);
+    // decode the chunked body at data in place, the decoded bytes start at
+    // data; returns their number and sets consumed to the encoded length.
+    // throws runtime_error if the body is malformed or not complete
+    static size_t decodeChunked(char * data, size_t size, size_t & consumed);
+    // walk a chunked body arriving in data from pos on, appending the
+    // payload of every complete chunk to body; pos stays at the first
+    // chunk not complete yet. True once the last chunk and the trailers
+    // are in, pos is then the end of the message
+    static bool walkChunks(string_view data, size_t & pos, string & body);
+
+private:
+    Field fields[MAX_FIELDS];
+    size_t count;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include "HeaderMeta.hpp"
+#include "HttpDate.hpp"
+#include <cstring>
+#include <strings.h>
+
+namespace {
+
+bool equalsIgnoreCase(string_view a, const char * b, size_t b_len) {
+    return a.size() == b_len && strncasecmp(a.data(), b, b_len) == 0;
+}
+
+#define NAME_IS(name, literal) equalsIgnoreCase(name, literal, sizeof(literal) - 1)
+
+string_view trim(string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+    return value;
+}
+
+// delta-seconds, clamped instead of overflowing; ABSENT if not a number
+int32_t parseSeconds(string_view value) {
+    if (!value.empty() && value.front() == '"') {
+        value = value.substr(1, value.find('"', 1) == string_view::npos ? string_view::npos : value.find('"', 1) - 1);
+    }
+    if (value.empty()) {
+        return HeaderMeta::ABSENT;
+    }
+    int64_t seconds = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') {
+            return HeaderMeta::ABSENT;
+        }
+        seconds = seconds * 10 + (c - '0');
+        if (seconds >= HeaderMeta::UNLIMITED) {
+            return HeaderMeta::UNLIMITED;
+        }
+    }
+    return static_cast<int32_t>(seconds);
+}
+
+}
+
+void HeaderMeta::parseCacheControl(string_view value) {
+    has_cache_control = true;
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        string_view directive = trim(value.substr(0, comma));
+        value = comma == string_view::npos ? string_view() : value.substr(comma + 1);
+
+        size_t equals = directive.find('=');
+        string_view name = trim(directive.substr(0, equals));
+        string_view argument = equals == string_view::npos ? string_view() : trim(directive.substr(equals + 1));
+
+        if (NAME_IS(name, "no-store")) no_store = true;
+        else if (NAME_IS(name, "no-cache")) no_cache = true;
+        else if (NAME_IS(name, "must-revalidate")) must_revalidate = true;
+        else if (NAME_IS(name, "proxy-revalidate")) proxy_revalidate = true;
+        else if (NAME_IS(name, "private")) is_private = true;
+        else if (NAME_IS(name, "public")) is_public = true;
+        else if (NAME_IS(name, "only-if-cached")) only_if_cached = true;
+        else if (NAME_IS(name, "no-transform")) no_transform = true;
+        else if (NAME_IS(name, "max-age")) max_age = parseSeconds(argument);
+        else if (NAME_IS(name, "s-maxage")) s_maxage = parseSeconds(argument);
+        else if (NAME_IS(name, "min-fresh")) min_fresh = parseSeconds(argument);
+        else if (NAME_IS(name, "max-stale")) max_stale = argument.empty() ? UNLIMITED : parseSeconds(argument);
+        else if (NAME_IS(name, "stale-while-revalidate")) stale_while_revalidate = parseSeconds(argument);
+        else if (NAME_IS(name, "stale-if-error")) stale_if_error = parseSeconds(argument);
+    }
+}
+
+// one field of a head, Pragma is applied by the caller once all are in
+void HeaderMeta::addField(string_view name, string_view value, bool & pragma_no_cache) {
+    // dispatch on the first letter, most headers are skipped after one compare
+    switch (name.empty() ? 0 : (name[0] | 0x20)) {
+        case 'c':
+            if (NAME_IS(name, "Cache-Control")) parseCacheControl(value);
+            else if (NAME_IS(name, "Content-Encoding")) gzip = value.find("gzip") != string_view::npos;
+            break;
+        case 'd':
+            if (NAME_IS(name, "Date")) date = HttpDate::parse(value);
+            break;
+        case 'e':
+            if (NAME_IS(name, "Expires")) expires = HttpDate::parse(value);
+            else if (NAME_IS(name, "ETag")) {
+                if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+                    value = value.substr(1, value.size() - 2);
+                }
+                etag = value;
+            }
+            break;
+        case 'l':
+            if (NAME_IS(name, "Last-Modified")) last_modified = HttpDate::parse(value);
+            break;
+        case 'p':
+            if (NAME_IS(name, "Pragma")) pragma_no_cache = value.find("no-cache") != string_view::npos;
+            break;
+        case 'v':
+            if (NAME_IS(name, "Vary")) vary_star = vary_star || value.find('*') != string_view::npos;
+            break;
+    }
+}
+
+HeaderMeta HeaderMeta::fromFields(int status, const HeaderFields & fields) {
+    HeaderMeta meta;
+    meta.status = status;
+    bool pragma_no_cache = false;
+    for (const HeaderFields::Field & field : fields) {
+        meta.addField(field.name, field.value, pragma_no_cache);
+    }
+    if (pragma_no_cache && !meta.has_cache_control) {
+        meta.parseCacheControl("no-cache");
+    }
+    return meta;
+}
+
+HeaderMeta HeaderMeta::parse(string_view headers) {
+    HeaderMeta meta;
+    bool pragma_no_cache = false;
+    size_t pos = 0;
+    while (pos < headers.size()) {
+        size_t end = headers.find("\r\n", pos);
+        if (end == string_view::npos) {
+            end = headers.size();
+        }
+        string_view line = headers.substr(pos, end - pos);
+        pos = end + 2;
+        if (line.empty()) {
+            break;      // end of the header block
+        }
+
+        size_t colon = line.find(':');
+        if (colon == string_view::npos) {
+            // status line, "HTTP/1.1 404 Not Found"
+            size_t space = line.find(' ');
+            if (meta.status == 0 && line.substr(0, 5) == "HTTP/" && space != string_view::npos && line.size() >= space + 4) {
+                string_view code = line.substr(space + 1, 3);
+                if (code.find_first_not_of("0123456789") == string_view::npos) {
+                    meta.status = (code[0] - '0') * 100 + (code[1] - '0') * 10 + (code[2] - '0');
+                }
+            }
+            continue;
+        }
+        meta.addField(line.substr(0, colon), trim(line.substr(colon + 1)), pragma_no_cache);
+    }
+    // HTTP/1.0 caches, ignored when there is a Cache-Control
+    if (pragma_no_cache && !meta.has_cache_control) {
+        meta.parseCacheControl("no-cache");
+    }
+    return meta;
+}
+
+time_t HeaderMeta::expiresAt(time_t now, int heuristic_ttl) const {
+    // a shared cache honors s-maxage over max-age
+    if (s_maxage != ABSENT) {
+        return now + s_maxage;
+    }
+    if (max_age != ABSENT) {
+        return now + max_age;
+    }
+    if (expires > now) {
+        return expires;
+    }
+    // no usable freshness from the origin
+    return now + heuristic_ttl;
+}
+
+bool HeaderMeta::hasExplicitFreshness() const {
+    return s_maxage != ABSENT || max_age != ABSENT || expires != ABSENT;
+}
+
+bool HeaderMeta::requiresRevalidation() const {
+    return must_revalidate || proxy_revalidate || no_cache;
+}
+
+// RFC 9111 5.2.2.10: s-maxage carries proxy-revalidate for a shared cache
+bool HeaderMeta::forbidsStale() const {
+    return requiresRevalidation() || s_maxage != ABSENT;
+}
@@ -0,0 +1,73 @@
+#ifndef HEADERMETA_HPP
+#define HEADERMETA_HPP
+
+#include <string_view>
+#include <cstdint>
+#include <ctime>
+#include "HeaderFields.hpp"
+
+using namespace std;
+
+// Everything caching needs from a header block, found in one pass without
+// allocating. Works for a response header block (status line first) and
+// for the Cache-Control value of a request.
+struct HeaderMeta {
+    static constexpr int32_t ABSENT = -1;
+    // "max-stale" with no value accepts any staleness
+    static constexpr int32_t UNLIMITED = INT32_MAX;
+
+    // Cache-Control
+    bool has_cache_control = false;
+    bool no_store = false;
+    bool no_cache = false;
+    bool must_revalidate = false;
+    bool proxy_revalidate = false;
+    bool is_private = false;
+    bool is_public = false;
+    bool only_if_cached = false;
+    bool no_transform = false;
+    int32_t max_age = ABSENT;
+    int32_t s_maxage = ABSENT;
+    int32_t min_fresh = ABSENT;
+    int32_t max_stale = ABSENT;
+    int32_t stale_while_revalidate = ABSENT;
+    int32_t stale_if_error = ABSENT;
+
+    // dates, ABSENT if missing, 0 if present but unparsable
+    time_t date = ABSENT;
+    time_t expires = ABSENT;
+    time_t last_modified = ABSENT;
+
+    // status code of the status line, 0 if there is none
+    int status = 0;
+
+    // validators and the rest, views point into the parsed block
+    string_view etag;           // without the quotes
+    bool vary_star = false;
+    bool gzip = false;
+
+    // parse a full header block, e.g. Response::getHeadersStr()
+    static HeaderMeta parse(string_view headers);
+    // the same from fields a parser already split, nothing is scanned again
+    static HeaderMeta fromFields(int status, const HeaderFields & fields);
+
+    // add the directives of one Cache-Control value
+    void parseCacheControl(string_view value);
+
+    // when a response stops being fresh for a shared cache, heuristic_ttl
+    // seconds after now if the origin did not say
+    time_t expiresAt(time_t now, int heuristic_ttl = 3600) const;
+
+    // max-age, s-maxage or Expires present
+    bool hasExplicitFreshness() const;
+
+    bool requiresRevalidation() const;
+
+    // no stale copy may be served, whatever stale-* windows say
+    bool forbidsStale() const;
+
+private:
+    void addField(string_view name, string_view value, bool & pragma_no_cache);
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include "HeaderScanner.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86 1
+#endif
+
+namespace {
+
+struct TokenTable {
+    bool token[256];
+    // for AVX2: bit h of low[c & 15] is set if (h << 4 | c & 15) is a
+    // token char, high[c >> 4] holds bit c >> 4
+    alignas(16) uint8_t low[16];
+    alignas(16) uint8_t high[16];
+
+    TokenTable() : token(), low(), high() {
+        for (int c = 0; c < 128; c++) {
+            token[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                       (c != 0 && strchr("!#$%&'*+-.^_`|~", c) != nullptr);
+            if (token[c]) {
+                low[c & 15] |= 1 << (c >> 4);
+            }
+        }
+        for (int h = 0; h < 8; h++) {
+            high[h] = 1 << h;
+        }
+    }
+};
+
+const TokenTable & table() {
+    static const TokenTable tokens;
+    return tokens;
+}
+
+bool isControl(unsigned char c) {
+    return (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+const char * skipTokenScalar(const char * p, const char * end) {
+    const TokenTable & tokens = table();
+    while (p < end && tokens.token[static_cast<unsigned char>(*p)]) {
+        p++;
+    }
+    return p;
+}
+
+const char * findControlScalar(const char * p, const char * end) {
+    while (p < end && !isControl(static_cast<unsigned char>(*p))) {
+        p++;
+    }
+    return p;
+}
+
+#ifdef SCANNER_X86
+
+// every byte that is not a token char lies in one of these ranges; the
+// last one also holds '|' and '~', a hit there is checked again
+alignas(16) const char NON_TOKEN_RANGES[16] = {
+    '\x00', ' ', '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{', '\xff'
+};
+alignas(16) const char CONTROL_RANGES[16] = {'\x00', '\x08', '\x0a', '\x1f', '\x7f', '\x7f'};
+
+__attribute__((target("sse4.2")))
+const char * skipTokenSse42(const char * p, const char * end) {
+    const TokenTable & tokens = table();
+    __m128i ranges = _mm_load_si128(reinterpret_cast<const __m128i *>(NON_TOKEN_RANGES));
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int found = _mm_cmpestri(ranges, 16, block, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (found == 16) {
+            p += 16;
+            continue;
+        }
+        p += found;
+        if (!tokens.token[static_cast<unsigned char>(*p)]) {
+            return p;
+        }
+        p++;
+    }
+    return skipTokenScalar(p, end);
+}
+
+__attribute__((target("sse4.2")))
+const char * findControlSse42(const char * p, const char * end) {
+    __m128i ranges = _mm_load_si128(reinterpret_cast<const __m128i *>(CONTROL_RANGES));
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int found = _mm_cmpestri(ranges, 6, block, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (found != 16) {
+            return p + found;
+        }
+        p += 16;
+    }
+    return findControlScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+const char * skipTokenAvx2(const char * p, const char * end) {
+    const TokenTable & tokens = table();
+    __m256i low = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(tokens.low)));
+    __m256i high = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(tokens.high)));
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    while (end - p >= 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i low_bits = _mm256_shuffle_epi8(low, _mm256_and_si256(block, nibble));
+        __m256i high_bits = _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble));
+        __m256i outside = _mm256_cmpeq_epi8(_mm256_and_si256(low_bits, high_bits), _mm256_setzero_si256());
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(outside));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    // every CPU with AVX2 has SSE4.2, shorter tails go 16 bytes at a time
+    return skipTokenSse42(p, end);
+}
+
+__attribute__((target("avx2")))
+const char * findControlAvx2(const char * p, const char * end) {
+    __m256i space = _mm256_set1_epi8(0x20);
+    __m256i tab = _mm256_set1_epi8('\t');
+    __m256i del = _mm256_set1_epi8(0x7f);
+    while (end - p >= 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        // unsigned block >= 0x20, bytes past 0x7f are obs-text and allowed
+        __m256i printable = _mm256_cmpeq_epi8(_mm256_max_epu8(block, space), block);
+        __m256i allowed = _mm256_or_si256(printable, _mm256_cmpeq_epi8(block, tab));
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(allowed)) |
+                        static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, del)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return findControlSse42(p, end);
+}
+
+#endif
+
+struct Scanners {
+    const char * (*skipToken)(const char *, const char *);
+    const char * (*findControl)(const char *, const char *);
+};
+
+const Scanners SCANNERS[] = {
+    {skipTokenScalar, findControlScalar},
+#ifdef SCANNER_X86
+    {skipTokenSse42, findControlSse42},
+    {skipTokenAvx2, findControlAvx2},
+#endif
+};
+
+HeaderScanner::Level detect() {
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return HeaderScanner::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return HeaderScanner::SSE42;
+    }
+#endif
+    return HeaderScanner::SCALAR;
+}
+
+atomic<HeaderScanner::Level> & current() {
+    static atomic<HeaderScanner::Level> level(detect());
+    return level;
+}
+
+}
+
+const char * HeaderScanner::skipToken(const char * p, const char * end) {
+    return SCANNERS[current().load(memory_order_relaxed)].skipToken(p, end);
+}
+
+const char * HeaderScanner::findControl(const char * p, const char * end) {
+    return SCANNERS[current().load(memory_order_relaxed)].findControl(p, end);
+}
+
+bool HeaderScanner::isToken(char c) {
+    return table().token[static_cast<unsigned char>(c)];
+}
+
+HeaderScanner::Level HeaderScanner::getLevel() {
+    return current().load();
+}
+
+HeaderScanner::Level HeaderScanner::setLevel(Level level) {
+    Level widest = supported();
+    current().store(level < widest ? level : widest);
+    return current().load();
+}
+
+HeaderScanner::Level HeaderScanner::supported() {
+    static const Level widest = detect();
+    return widest;
+}
+
+const char * HeaderScanner::levelName(Level level) {
+    switch (level) {
+        case SSE42: return "sse4.2";
+        case AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
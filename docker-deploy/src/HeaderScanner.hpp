@@ -0,0 +1,34 @@
+#ifndef HEADERSCANNER_HPP
+#define HEADERSCANNER_HPP
+
+using namespace std;
+
+// Finds the delimiters of an HTTP head 16 or 32 bytes at a time, in the
+// spirit of picohttpparser: SSE4.2 compares a block against ranges of
+// characters at once, AVX2 looks every byte up in a nibble table. The
+// widest variant the CPU supports is picked at startup, every variant
+// returns exactly what the scalar loop does.
+class HeaderScanner {
+public:
+    enum Level { SCALAR, SSE42, AVX2 };
+
+    // first byte from p on that cannot be part of a token (RFC 9110
+    // 5.6.2), i.e. the end of a method or a field name; end if none
+    static const char * skipToken(const char * p, const char * end);
+
+    // first control character other than HTAB from p on, i.e. the CR
+    // ending a start line or a field value; end if none
+    static const char * findControl(const char * p, const char * end);
+
+    static bool isToken(char c);
+
+    static Level getLevel();
+    // use level, or the widest one the CPU has below it; returns the
+    // level now in use
+    static Level setLevel(Level level);
+    // widest level the CPU has
+    static Level supported();
+    static const char * levelName(Level level);
+};
+
+#endif
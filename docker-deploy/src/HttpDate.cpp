@@ -0,0 +1,192 @@
+#include "HttpDate.hpp"
+#include <cstring>
+#include <cstdio>
+
+namespace {
+
+const char DAY_NAMES[7][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+const char MONTH_NAMES[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                 "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+struct Civil {
+    int64_t year;
+    unsigned month;     // 1..12
+    unsigned day;       // 1..31
+    unsigned weekday;   // 0 is Sunday
+    unsigned hour, minute, second;
+};
+
+// inverse of HttpDate::daysFromCivil
+Civil toCivil(time_t time) {
+    int64_t days = time / 86400;
+    int64_t rest = time % 86400;
+    if (rest < 0) {
+        rest += 86400;
+        days--;
+    }
+    Civil civil;
+    civil.hour = rest / 3600;
+    civil.minute = rest / 60 % 60;
+    civil.second = rest % 60;
+    // 1970-01-01 was a Thursday
+    civil.weekday = static_cast<unsigned>((days % 7 + 11) % 7);
+
+    int64_t z = days + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = static_cast<unsigned>(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    civil.day = doy - (153 * mp + 2) / 5 + 1;
+    civil.month = mp < 10 ? mp + 3 : mp - 9;
+    civil.year = yoe + era * 400 + (civil.month <= 2);
+    return civil;
+}
+
+inline void put2(char * out, unsigned value) {
+    out[0] = '0' + value / 10;
+    out[1] = '0' + value % 10;
+}
+
+// two ascii digits, sets bad if either is not a digit
+inline unsigned digits2(const char * in, unsigned & bad) {
+    unsigned a = static_cast<unsigned char>(in[0]) - '0';
+    unsigned b = static_cast<unsigned char>(in[1]) - '0';
+    bad |= (a > 9) | (b > 9);
+    return a * 10 + b;
+}
+
+// 1..12, 0 if unknown; case-insensitive
+unsigned monthFromName(const char * in) {
+    uint32_t key = (in[0] | 0x20) << 16 | (in[1] | 0x20) << 8 | (in[2] | 0x20);
+    for (unsigned i = 0; i < 12; i++) {
+        const char * name = MONTH_NAMES[i];
+        if (key == static_cast<uint32_t>((name[0] | 0x20) << 16 | (name[1] | 0x20) << 8 | (name[2] | 0x20))) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+time_t toTime(int year, unsigned month, unsigned day, unsigned hour, unsigned minute, unsigned second) {
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return 0;
+    }
+    return static_cast<time_t>(HttpDate::daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second);
+}
+
+}
+
+int64_t HttpDate::daysFromCivil(int year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yoe = static_cast<unsigned>(year - era * 400);
+    unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+time_t HttpDate::parse(string_view value) {
+    // "Sun, 06 Nov 1994 08:49:37 GMT", every field sits at a fixed offset
+    if (value.size() != IMF_LENGTH || value[3] != ',' || value[4] != ' ' || value[7] != ' ' ||
+        value[11] != ' ' || value[16] != ' ' || value[19] != ':' || value[22] != ':' ||
+        value.substr(25) != " GMT") {
+        return parseObsolete(value);
+    }
+    const char * in = value.data();
+    unsigned bad = 0;
+    unsigned day = digits2(in + 5, bad);
+    int year = digits2(in + 12, bad) * 100 + digits2(in + 14, bad);
+    unsigned hour = digits2(in + 17, bad);
+    unsigned minute = digits2(in + 20, bad);
+    unsigned second = digits2(in + 23, bad);
+    unsigned month = monthFromName(in + 8);
+    if (bad) {
+        return 0;
+    }
+    return toTime(year, month, day, hour, minute, second);
+}
+
+// RFC 850 "Sunday, 06-Nov-94 08:49:37 GMT" and asctime "Sun Nov  6 08:49:37 1994",
+// rare enough that strptime is fine; only the fields are taken from it
+time_t HttpDate::parseObsolete(string_view value) {
+    char buffer[64];
+    if (value.size() >= sizeof(buffer)) {
+        return 0;
+    }
+    memcpy(buffer, value.data(), value.size());
+    buffer[value.size()] = '\0';
+    struct tm tm = {};
+    if (strptime(buffer, "%A, %d-%b-%y %H:%M:%S GMT", &tm) == nullptr &&
+        strptime(buffer, "%a %b %e %H:%M:%S %Y", &tm) == nullptr) {
+        return 0;
+    }
+    return toTime(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+void HttpDate::format(time_t time, char * out) {
+    Civil civil = toCivil(time);
+    memcpy(out, DAY_NAMES[civil.weekday], 3);
+    out[3] = ',';
+    out[4] = ' ';
+    put2(out + 5, civil.day);
+    out[7] = ' ';
+    memcpy(out + 8, MONTH_NAMES[civil.month - 1], 3);
+    out[11] = ' ';
+    unsigned year = static_cast<unsigned>(civil.year) % 10000;
+    put2(out + 12, year / 100);
+    put2(out + 14, year % 100);
+    out[16] = ' ';
+    put2(out + 17, civil.hour);
+    out[19] = ':';
+    put2(out + 20, civil.minute);
+    out[22] = ':';
+    put2(out + 23, civil.second);
+    memcpy(out + 25, " GMT", 4);
+}
+
+string HttpDate::format(time_t time) {
+    string out(IMF_LENGTH, ' ');
+    format(time, &out[0]);
+    return out;
+}
+
+string HttpDate::toAsctime(time_t time) {
+    Civil civil = toCivil(time);
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%s %s %2u %02u:%02u:%02u %lld",
+             DAY_NAMES[civil.weekday], MONTH_NAMES[civil.month - 1], civil.day,
+             civil.hour, civil.minute, civil.second, static_cast<long long>(civil.year));
+    return buffer;
+}
+
+const string & HttpDate::now() {
+    thread_local time_t cached_second = -1;
+    thread_local string cached(IMF_LENGTH, ' ');
+    time_t second = time(nullptr);
+    if (second != cached_second) {
+        format(second, &cached[0]);
+        cached_second = second;
+    }
+    return cached;
+}
+
+string HttpDate::toLocal(time_t time) {
+    struct tm local;
+    localtime_r(&time, &local);
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local);
+    return buffer;
+}
+
+const string & HttpDate::nowLocal() {
+    thread_local time_t cached_second = -1;
+    thread_local string cached;
+    time_t second = time(nullptr);
+    if (second != cached_second) {
+        // the zone offset can change (DST), so ask once per second
+        cached = toLocal(second);
+        cached_second = second;
+    }
+    return cached;
+}
@@ -0,0 +1,44 @@
+#ifndef HTTPDATE_HPP
+#define HTTPDATE_HPP
+
+#include <string>
+#include <string_view>
+#include <ctime>
+
+using namespace std;
+
+// HTTP dates without strptime/mktime: calendar math is done on UTC days
+// so the TZ of the host never leaks in. The current time is formatted at
+// most once per second per thread.
+class HttpDate {
+public:
+    // length of "Sun, 06 Nov 1994 08:49:37 GMT"
+    static constexpr size_t IMF_LENGTH = 29;
+
+    // IMF-fixdate, also the obsolete RFC 850 and asctime forms;
+    // 0 if the value is none of them
+    static time_t parse(string_view value);
+
+    // IMF-fixdate for Date/Expires/Last-Modified headers
+    static string format(time_t time);
+    // writes IMF_LENGTH chars, no terminator
+    static void format(time_t time, char * out);
+
+    // "Sun Nov  6 08:49:37 1994", the form the logs use
+    static string toAsctime(time_t time);
+
+    // the current second as IMF-fixdate, cached per second
+    static const string & now();
+    // "1994-11-06 08:49:37" local time, the form of the log timestamps
+    static string toLocal(time_t time);
+    // the current second as toLocal(), cached per second
+    static const string & nowLocal();
+
+    // days since 1970-01-01 of a proleptic Gregorian date
+    static int64_t daysFromCivil(int year, unsigned month, unsigned day);
+
+private:
+    static time_t parseObsolete(string_view value);
+};
+
+#endif
@@ -1,53 +1,154 @@
 #include "Logger.hpp"
-#include <chrono>
-#include <iomanip>
-#include <sstream>
+#include "HttpDate.hpp"
 #include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 using namespace std;
+
+// the writer looks at the rings this often even when nobody wakes it
+constexpr auto WRITE_INTERVAL = chrono::milliseconds(20);
+// a buffer this large is written out before the batch ends
+constexpr size_t WRITE_CHUNK = 256 * 1024;
+
+// single producer (the owning thread), single consumer (whoever holds
+// files_mtx); the indexes only grow, a slot is index % size
+struct Logger::Ring {
+    explicit Ring(size_t size) : slots(size), head(0), tail(0), orphaned(false) {}
+
+    vector<Record> slots;
+    alignas(64) atomic<size_t> head;
+    alignas(64) atomic<size_t> tail;
+    // the owning thread is gone, the ring goes once it is empty
+    atomic<bool> orphaned;
+
+    // record is only moved from if there was room
+    bool push(Record && record) {
+        size_t at = tail.load(memory_order_relaxed);
+        if (at - head.load(memory_order_acquire) == slots.size()) {
+            return false;
+        }
+        slots[at % slots.size()] = move(record);
+        tail.store(at + 1, memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return tail.load(memory_order_acquire) - head.load(memory_order_acquire);
+    }
+};
+
+// marks the ring of a thread orphaned when the thread exits
+struct Logger::RingHolder {
+    shared_ptr<Ring> ring;
+    ~RingHolder() {
+        if (ring) {
+            ring->orphaned = true;
+        }
+    }
+};
+
+namespace {
+
+const char * levelName(Logger::Level level) {
+    switch (level) {
+        case Logger::Level::DEBUG: return "DEBUG";
+        case Logger::Level::INFO: return "INFO";
+        case Logger::Level::WARNING: return "WARNING";
+        default: return "ERROR";
+    }
+}
+
+void writeAll(int fd, string & buffer) {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // a full disk loses log lines, never the proxy
+            break;
+        }
+        written += n;
+    }
+    buffer.clear();
+}
+
+}
+
 // singleton get instance
 Logger & Logger::getInstance() {
     static Logger instance;
     return instance;
 }
 
+Logger::Logger()
+:   isInitialized(false),
+    threshold(DEBUG_COMPILED ? Level::DEBUG : Level::INFO),
+    binary_format(false),
+    binary_rotate_bytes(0),
+    binary_rotate_sec(0),
+    ring_size(DEFAULT_RING_SIZE),
+    overflow(Overflow::BLOCK),
+    dropped(0),
+    dropped_reported(0),
+    running(true),
+    wake_pending(false),
+    flush_requested(0),
+    flush_done(0),
+    formatted_second(-1) {
+    for (int & fd : files) {
+        fd = -1;
+    }
+    writer = thread([this]() { writerLoop(); });
+}
+
 void Logger::setLogPath(const std::string & path) {
-    std::lock_guard<std::mutex> lock(mtx);
-    if (isInitialized) {
-        if (logFileInfo.is_open()) logFileInfo.close();
-        if (logFileWarning.is_open()) logFileWarning.close();
-        if (logFileDebug.is_open()) logFileDebug.close();
-        if (logFileError.is_open()) logFileError.close();
-    }
-    
-    try {
-        // Create parent directory if it doesn't exist
-        std::filesystem::path log_path(path);
-        if (!log_path.parent_path().empty()) {
-            std::filesystem::create_directories(log_path.parent_path());
-        }
-        
-        // Open the log file
-        logFileInfo.open(path+"proxy.log", std::ios::app);
-        if (!logFileInfo.is_open()) {
-            throw std::runtime_error("Failed to open log file: " + path);
-        }
+    // whatever is waiting goes to the old files
+    flush();
+    std::lock_guard<std::mutex> lock(files_mtx);
+    log_path = path;
+    openFiles();
+}
 
-        // Open the log file
-        logFileWarning.open(path+"WARNING.log", std::ios::app);
-        if (!logFileInfo.is_open()) {
-            throw std::runtime_error("Failed to open log file: " + path);
+void Logger::setFormat(Format format, size_t rotate_bytes, int rotate_sec) {
+    flush();
+    std::lock_guard<std::mutex> lock(files_mtx);
+    binary_format = format == Format::BINARY;
+    binary_rotate_bytes = rotate_bytes;
+    binary_rotate_sec = rotate_sec;
+    openFiles();
+}
+
+void Logger::openFiles() {
+    for (int & fd : files) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
         }
+    }
+    isInitialized = false;
+    binary.reset();
 
-        // Open the log file
-        logFileDebug.open(path+"DEBUG.log", std::ios::app);
-        if (!logFileInfo.is_open()) {
-            throw std::runtime_error("Failed to open log file: " + path);
+    try {
+        // Create parent directory if it doesn't exist
+        std::filesystem::path parent(log_path);
+        if (!parent.parent_path().empty()) {
+            std::filesystem::create_directories(parent.parent_path());
         }
 
-        // Open the log file
-        logFileError.open(path+"ERROR.log", std::ios::app);
-        if (!logFileInfo.is_open()) {
-            throw std::runtime_error("Failed to open log file: " + path);
+        if (binary_format) {
+            // one file for every level, opened with the first record
+            binary = std::make_unique<BinaryLog>(log_path, binary_rotate_bytes, binary_rotate_sec);
+            return;
+        }
+        const char * names[FILE_NUMBER] = {"proxy.log", "WARNING.log", "DEBUG.log", "ERROR.log"};
+        for (int i = 0; i < FILE_NUMBER; i++) {
+            files[i] = open((log_path + names[i]).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (files[i] < 0) {
+                throw std::runtime_error("Failed to open log file: " + log_path + names[i]);
+            }
         }
         isInitialized = true;
     }
@@ -58,93 +159,259 @@ void Logger::setLogPath(const std::string & path) {
     }
 }
 
+Logger::Level Logger::parseLevel(const std::string & name) {
+    if (name == "debug") return Level::DEBUG;
+    if (name == "info") return Level::INFO;
+    if (name == "warning") return Level::WARNING;
+    if (name == "error") return Level::ERROR;
+    throw std::runtime_error("unknown log level: " + name);
+}
+
+void Logger::setOverflow(Overflow policy) {
+    overflow = policy;
+}
+
+void Logger::setRingSize(size_t records) {
+    ring_size = records > 0 ? records : 1;
+}
+
 // destructor
 Logger::~Logger() {
-    if (logFileInfo.is_open()) logFileInfo.close();
-    if (logFileWarning.is_open()) logFileWarning.close();
-    if (logFileDebug.is_open()) logFileDebug.close();
+    shutdown();
+    binary.reset();
+    for (int fd : files) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+void Logger::shutdown() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    wake();
+    if (writer.joinable()) {
+        writer.join();
+    }
+    // anything pushed while the writer made its last round
+    std::lock_guard<std::mutex> lock(files_mtx);
+    drainAll();
+}
+
+void Logger::flush() {
+    if (!running) {
+        return;
+    }
+    uint64_t generation = ++flush_requested;
+    wake();
+    std::unique_lock<std::mutex> lock(wake_mtx);
+    while (!flush_cv.wait_for(lock, WRITE_INTERVAL, [this, generation] { return flush_done >= generation || !running; })) {
+    }
+}
+
+void Logger::wake() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mtx);
+        wake_pending = true;
+    }
+    wake_cv.notify_one();
+}
+
+Logger::Ring & Logger::ringOfThread() {
+    thread_local RingHolder holder;
+    if (!holder.ring) {
+        holder.ring = make_shared<Ring>(ring_size.load());
+        std::lock_guard<std::mutex> lock(rings_mtx);
+        rings.push_back(holder.ring);
+    }
+    return *holder.ring;
+}
+
+void Logger::log(Level level, int pid, const std::string & message) {
+    if (!enabled(level)) {
+        return;
+    }
+    Record record{time(nullptr), level, pid, message};
+    if (running) {
+        Ring & ring = ringOfThread();
+        while (!ring.push(std::move(record))) {
+            if (overflow == Overflow::DROP) {
+                dropped++;
+                return;
+            }
+            wake();
+            this_thread::yield();
+            if (!running) {
+                // the writer is gone, it will not make room
+                std::lock_guard<std::mutex> lock(files_mtx);
+                format(record);
+                writePending();
+                return;
+            }
+        }
+        // well before it overflows
+        if (ring.size() * 2 >= ring.slots.size()) {
+            wake();
+        }
+        return;
+    }
+    // no writer (any more), write it ourselves
+    std::lock_guard<std::mutex> lock(files_mtx);
+    format(record);
+    writePending();
 }
 
-void Logger::log(ofstream & logFile, const std::string & level, const std::string & message) {
-    std::lock_guard<std::mutex> lock(mtx);
-    std::string timestamp = getCurrentTime();
-    std::cout << timestamp << " [" << level << "] " << message << std::endl;
-    if (isInitialized) {
-        logFile << timestamp << " [" << level << "] " << message << std::endl;
-        logFile.flush();
+void Logger::writerLoop() {
+    while (true) {
+        bool stopping = !running;
+        uint64_t generation = flush_requested;
+        {
+            std::lock_guard<std::mutex> lock(files_mtx);
+            drainAll();
+        }
+        {
+            std::unique_lock<std::mutex> lock(wake_mtx);
+            flush_done = generation;
+            flush_cv.notify_all();
+            if (stopping) {
+                break;
+            }
+            wake_cv.wait_for(lock, WRITE_INTERVAL, [this] { return wake_pending; });
+            wake_pending = false;
+        }
     }
 }
 
-void Logger::log(ofstream & logFile, const std::string & level, int pid, const std::string & message) {
-    std::lock_guard<std::mutex> lock(mtx);
-    std::string timestamp = getCurrentTime();
-    std::cout << timestamp<<" [" << level << "] " << pid<<": " << message << std::endl;
-    if (isInitialized) {
-        logFile << timestamp<<" [" << level << "] " << pid<<": " << message << std::endl;
-        logFile.flush();
+void Logger::drainAll() {
+    vector<shared_ptr<Ring>> current;
+    {
+        std::lock_guard<std::mutex> lock(rings_mtx);
+        current = rings;
+    }
+    for (const shared_ptr<Ring> & ring : current) {
+        // per thread order is kept, threads interleave batch by batch
+        size_t at = ring->head.load(memory_order_relaxed);
+        size_t end = ring->tail.load(memory_order_acquire);
+        for (; at < end; at++) {
+            Record & record = ring->slots[at % ring->slots.size()];
+            format(record);
+            // give the memory back, a long line should not stay pinned
+            record.message = string();
+            if (pending[DEBUG_FILE].size() >= WRITE_CHUNK) {
+                ring->head.store(at + 1, memory_order_release);
+                writePending();
+            }
+        }
+        ring->head.store(end, memory_order_release);
+    }
+    uint64_t lost = dropped;
+    if (lost != dropped_reported) {
+        format(Record{time(nullptr), Level::WARNING, -1,
+                      "logger dropped " + to_string(lost - dropped_reported) + " records, its rings were full"});
+        dropped_reported = lost;
+    }
+    writePending();
+
+    // rings of threads that are gone
+    std::lock_guard<std::mutex> lock(rings_mtx);
+    for (size_t i = 0; i < rings.size();) {
+        if (rings[i]->orphaned && rings[i]->size() == 0) {
+            rings[i] = rings.back();
+            rings.pop_back();
+        } else {
+            i++;
+        }
+    }
+}
+
+void Logger::format(const Record & record) {
+    if (binary) {
+        binary->append(record.time, static_cast<int>(record.level), record.pid, record.message);
+        return;
+    }
+    if (record.time != formatted_second) {
+        formatted_time = HttpDate::toLocal(record.time);
+        formatted_second = record.time;
+    }
+    string line = formatted_time + " [" + levelName(record.level) + "] ";
+    if (record.pid >= 0) {
+        line += to_string(record.pid) + ": ";
+    }
+    line += record.message;
+    line += '\n';
+
+    // each level also goes to every file of the levels below it
+    pending[FILE_NUMBER] += line;
+    switch (record.level) {
+        case Level::ERROR:
+            pending[ERROR_FILE] += line;
+            [[fallthrough]];
+        case Level::WARNING:
+            pending[WARNING_FILE] += line;
+            [[fallthrough]];
+        case Level::INFO:
+            pending[INFO_FILE] += line;
+            [[fallthrough]];
+        case Level::DEBUG:
+            pending[DEBUG_FILE] += line;
+    }
+}
+
+void Logger::writePending() {
+    if (binary) {
+        // no console copy either, the point is writing less
+        binary->flush();
+        return;
+    }
+    writeAll(STDOUT_FILENO, pending[FILE_NUMBER]);
+    for (int i = 0; i < FILE_NUMBER; i++) {
+        if (isInitialized) {
+            writeAll(files[i], pending[i]);
+        } else {
+            pending[i].clear();
+        }
     }
 }
 
 void Logger::info(const std::string & message) {
-    log(logFileInfo, "INFO", message);
-    log(logFileDebug, "INFO", message);
+    log(Level::INFO, -1, message);
 }
 
 void Logger::warning(const std::string & message) {
-    log(logFileWarning, "WARNING", message);
-    log(logFileInfo, "WARNING", message);
-    log(logFileDebug, "WARNING", message);
+    log(Level::WARNING, -1, message);
 }
 
 void Logger::debug(const std::string & message) {
-    log(logFileDebug, "DEBUG", message);
+    log(Level::DEBUG, -1, message);
 }
 
 void Logger::info(int pid, const std::string & message) {
-    log(logFileInfo, "INFO", pid, message);
-    log(logFileDebug, "INFO", pid, message);
+    log(Level::INFO, pid, message);
 }
 
 void Logger::warning(int pid, const std::string & message) {
-    log(logFileWarning, "WARNING", pid, message);
-    log(logFileInfo, "WARNING", pid, message);
-    log(logFileDebug, "WARNING", pid, message);
+    log(Level::WARNING, pid, message);
 }
 
 void Logger::debug(int pid, const std::string & message) {
-    log(logFileDebug, "DEBUG", pid, message);
+    log(Level::DEBUG, pid, message);
 }
 
 void Logger::error(const std::string & message) {
-    log(logFileError, "ERROR", message);
-    log(logFileWarning, "ERROR", message);
-    log(logFileInfo, "ERROR", message);
-    log(logFileDebug, "ERROR", message);
+    log(Level::ERROR, -1, message);
 }
 
 void Logger::error(int pid, const std::string & message) {
-    log(logFileError, "ERROR", pid, message);
-    log(logFileWarning, "ERROR", pid, message);
-    log(logFileInfo, "ERROR", pid, message);
-    log(logFileDebug, "ERROR", pid, message);
+    log(Level::ERROR, pid, message);
 }
 
 
 
 
 std::string Logger::getCurrentTimeUTC() {
-    auto now = std::chrono::system_clock::now();
-    time_t newtime = std::chrono::system_clock::to_time_t(now);;
-    struct tm* utc_time = std::gmtime(&newtime);
-    std::string time_str(std::asctime(utc_time));
-    time_str.pop_back();  
-    return time_str;
+    return HttpDate::toAsctime(time(nullptr));
 }
 
 std::string Logger::getCurrentTime() {
-    auto now = std::chrono::system_clock::now();
-    auto in_time_t = std::chrono::system_clock::to_time_t(now);
-    std::stringstream ss;
-    ss << std::put_time(std::localtime(&in_time_t), "%Y-%m-%d %H:%M:%S");
-    return ss.str();
+    // formatted once a second, not per line
+    return HttpDate::nowLocal();
 }
@@ -3,13 +3,69 @@
 
 #include <iostream>
 #include <string>
-#include <fstream>
+#include <vector>
+#include <memory>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <ctime>
+#include <cstdint>
+#include "BinaryLog.hpp"
 using namespace std;
+
+// Log through these rather than the methods: the arguments, i.e. building
+// the message, are only evaluated if the level is on, so a disabled level
+// costs one branch. They use the logger in scope, every class keeps one.
+#define LOG_DEBUG(...) do { if (logger.enabled(Logger::Level::DEBUG)) logger.debug(__VA_ARGS__); } while (0)
+#define LOG_INFO(...) do { if (logger.enabled(Logger::Level::INFO)) logger.info(__VA_ARGS__); } while (0)
+#define LOG_WARNING(...) do { if (logger.enabled(Logger::Level::WARNING)) logger.warning(__VA_ARGS__); } while (0)
+#define LOG_ERROR(...) do { if (logger.enabled(Logger::Level::ERROR)) logger.error(__VA_ARGS__); } while (0)
+
+// Logging without a lock on the caller's path: every thread pushes its
+// records into a ring of its own, and one writer thread collects them,
+// formats them and writes each file with one write() per batch.
 class Logger {
 public:
+    enum class Level { DEBUG, INFO, WARNING, ERROR };
+    // what a thread does when its ring is full
+    enum class Overflow {
+        // wait for the writer, nothing is lost
+        BLOCK,
+        // count the record and go on, the writer notes how many were lost
+        DROP
+    };
+
+    enum class Format {
+        // proxy.log, WARNING.log, DEBUG.log and ERROR.log, plus the console
+        TEXT,
+        // a single BinaryLog file for every level, see log_decode
+        BINARY
+    };
+
+    // records per thread ring, unless setRingSize says otherwise
+    static constexpr size_t DEFAULT_RING_SIZE = 4096;
+
+    // built with PROXY_NO_DEBUG_LOG (cmake -DPROXY_DEBUG_LOG=OFF), debug
+    // records are compiled out: LOG_DEBUG folds to nothing
+#ifdef PROXY_NO_DEBUG_LOG
+    static constexpr bool DEBUG_COMPILED = false;
+#else
+    static constexpr bool DEBUG_COMPILED = true;
+#endif
+
     static Logger & getInstance();
 
+    // true if records of level are written at all
+    bool enabled(Level level) const {
+        return (level != Level::DEBUG || DEBUG_COMPILED) && level >= threshold.load(memory_order_relaxed);
+    }
+    // records below level are skipped
+    void setLevel(Level level) { threshold = level; }
+    Level getLevel() const { return threshold; }
+    // "debug", "info", "warning" or "error"; throws runtime_error otherwise
+    static Level parseLevel(const std::string & name);
+
 
 
     // log info level message
@@ -42,26 +98,89 @@ public:
     std::string getCurrentTimeUTC();
 
     void setLogPath(const std::string & path);
+    // rotate_bytes and rotate_sec (0 for never) only apply to BINARY
+    void setFormat(Format format, size_t rotate_bytes = 0, int rotate_sec = 0);
+
+    void setOverflow(Overflow policy);
+    // rings of threads that log for the first time from now on
+    void setRingSize(size_t records);
+
+    // returns once every record logged before the call is written
+    void flush();
+    // drain every ring and stop the writer; records logged afterwards are
+    // written by the calling thread itself
+    void shutdown();
+
+    // records the DROP policy has thrown away so far
+    uint64_t getDropped() const { return dropped.load(); }
 
     ~Logger();
 
 private:
-    std::ofstream logFileInfo;
-    std::ofstream logFileWarning;
-    std::ofstream logFileDebug;
-    std::ofstream logFileError;
-    std::mutex mtx;
+    struct Record {
+        time_t time;
+        Level level;
+        // -1 without a request id
+        int pid;
+        std::string message;
+    };
+    struct Ring;
+    struct RingHolder;
+
+    // the files a level goes to: proxy.log, WARNING.log, DEBUG.log, ERROR.log
+    enum File { INFO_FILE, WARNING_FILE, DEBUG_FILE, ERROR_FILE, FILE_NUMBER };
+
+    int files[FILE_NUMBER];
+    // held while a batch is written and while files are reopened
+    std::mutex files_mtx;
     bool isInitialized;
-
-    Logger() : isInitialized(false) {}
+    std::atomic<Level> threshold;
+    std::string log_path;
+    // set in the BINARY format, the text files are closed then
+    std::unique_ptr<BinaryLog> binary;
+    bool binary_format;
+    size_t binary_rotate_bytes;
+    int binary_rotate_sec;
+
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::mutex rings_mtx;
+    std::atomic<size_t> ring_size;
+    std::atomic<Overflow> overflow;
+    std::atomic<uint64_t> dropped;
+    // dropped records the log already told about
+    uint64_t dropped_reported;
+
+    std::thread writer;
+    std::atomic<bool> running;
+    std::mutex wake_mtx;
+    std::condition_variable wake_cv;
+    bool wake_pending;
+    // flush() asks for a generation, the writer reports the last one done
+    std::atomic<uint64_t> flush_requested;
+    uint64_t flush_done;
+    std::condition_variable flush_cv;
+
+    // formatted lines waiting for write(), one buffer per file and stdout
+    std::string pending[FILE_NUMBER + 1];
+    time_t formatted_second;
+    std::string formatted_time;
+
+    Logger();
     Logger(const Logger&) = delete;
     Logger& operator=(const Logger&) = delete;
 
     // Generic log method for any level
-    void log(ofstream & logFile, const std::string & level, const std::string & message);
-
-    // log info level message with pid
-    void log(ofstream & logFile, const std::string & level, int pid, const std::string & message);
+    void log(Level level, int pid, const std::string & message);
+
+    // (re)open the files of the format under log_path, with files_mtx held
+    void openFiles();
+    Ring & ringOfThread();
+    void wake();
+    void writerLoop();
+    // move every waiting record into the buffers and write them out
+    void drainAll();
+    void format(const Record & record);
+    void writePending();
 };
 
 #endif
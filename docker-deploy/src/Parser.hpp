@@ -1,21 +1,19 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
-#include <boost/asio.hpp>
-#include <boost/beast.hpp>
+#include <string_view>
+#include <vector>
 #include "Logger.hpp"
 #include "Request.hpp"
 #include "Response.hpp"
 
-namespace beast = boost::beast;
-namespace http = boost::beast::http;
-namespace asio = boost::asio;
-
 class Parser{
     public:
     
-        Request parseRequest(const std::vector<char> & data);
-        Response parseResponse(const std::vector<char> & data);
+        // the request takes the buffer over, size it to the bytes received
+        Request parseRequest(std::vector<char> && data);
+        // the response views data, keep it alive as long as the response
+        Response parseResponse(std::string_view data);
 
     private:
 
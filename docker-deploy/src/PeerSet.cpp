@@ -0,0 +1,153 @@
+#include "PeerSet.hpp"
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <stdexcept>
+
+PeerSet::PeerSet(const vector<string> & names, const string & self, int check_interval_sec)
+:   self_index(0),
+    check_interval_sec(check_interval_sec > 0 ? check_interval_sec : 1),
+    stopping(false) {
+    bool found = false;
+    for (const string & name : names) {
+        if (find(name) != nullptr) {
+            continue;
+        }
+        auto member = make_unique<Member>();
+        member->name = name;
+        member->address = parseMember(name);
+        size_t index = ring.addNode(name);
+        if (name == self) {
+            self_index = index;
+            found = true;
+        }
+        members.push_back(move(member));
+    }
+    if (!found) {
+        throw runtime_error("peer list does not contain this node: " + self);
+    }
+}
+
+PeerSet::~PeerSet() {
+    stop();
+}
+
+optional<PeerSet::Peer> PeerSet::ownerOf(string_view key) const {
+    size_t index = ring.selectIndex(key);
+    if (index == self_index || !members[index]->up) {
+        return nullopt;
+    }
+    return members[index]->address;
+}
+
+const string & PeerSet::ownerName(string_view key) const {
+    return ring.selectNode(key);
+}
+
+const string & PeerSet::getSelf() const {
+    return members[self_index]->name;
+}
+
+void PeerSet::markDown(const Peer & peer) {
+    for (auto & member : members) {
+        if (member->address.host == peer.host && member->address.port == peer.port && member->up.exchange(false)) {
+            LOG_WARNING("peer " + member->name + " is down");
+        }
+    }
+}
+
+bool PeerSet::isUp(const string & name) const {
+    Member * member = find(name);
+    return member != nullptr && member->up;
+}
+
+void PeerSet::checkNow() {
+    for (size_t i = 0; i < members.size(); i++) {
+        if (i == self_index) {
+            continue;
+        }
+        Member & member = *members[i];
+        bool up = probe(member.address);
+        if (member.up.exchange(up) != up) {
+            LOG_INFO("peer " + member.name + (up ? " is up" : " is down"));
+        }
+    }
+}
+
+void PeerSet::start() {
+    checker = thread([this]() { loop(); });
+}
+
+void PeerSet::stop() {
+    {
+        lock_guard<mutex> lock(checker_mutex);
+        stopping = true;
+    }
+    checker_cv.notify_all();
+    if (checker.joinable()) {
+        checker.join();
+    }
+}
+
+void PeerSet::loop() {
+    unique_lock<mutex> lock(checker_mutex);
+    while (!stopping) {
+        if (checker_cv.wait_for(lock, chrono::seconds(check_interval_sec), [this] { return stopping; })) {
+            break;
+        }
+        lock.unlock();
+        checkNow();
+        lock.lock();
+    }
+}
+
+PeerSet::Member * PeerSet::find(const string & name) const {
+    for (const auto & member : members) {
+        if (member->name == name) {
+            return member.get();
+        }
+    }
+    return nullptr;
+}
+
+bool PeerSet::probe(const Peer & peer) {
+    struct addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo * result = nullptr;
+    if (getaddrinfo(peer.host.c_str(), to_string(peer.port).c_str(), &hints, &result) != 0) {
+        return false;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    bool up = false;
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        if (connect(fd, result->ai_addr, result->ai_addrlen) == 0) {
+            up = true;
+        } else if (errno == EINPROGRESS) {
+            struct pollfd pfd{fd, POLLOUT, 0};
+            int error = 0;
+            socklen_t len = sizeof(error);
+            up = poll(&pfd, 1, 1000) == 1 &&
+                 getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0;
+        }
+        close(fd);
+    }
+    freeaddrinfo(result);
+    return up;
+}
+
+PeerSet::Peer PeerSet::parseMember(const string & member) {
+    size_t colon = member.rfind(':');
+    if (colon == string::npos || colon == 0) {
+        throw runtime_error("peer must be host:port: " + member);
+    }
+    try {
+        return Peer{member.substr(0, colon), stoi(member.substr(colon + 1))};
+    } catch (const std::exception& e) {
+        throw runtime_error("peer must be host:port: " + member);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef PEERSET_HPP
+#define PEERSET_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "HashRing.hpp"
+#include "Logger.hpp"
+
+using namespace std;
+
+// Sibling proxies sharing one logical cache. Every url has one owner on a
+// consistent hash ring over all members, this node included. The others
+// ask the owner before the origin, so a popular object leaves the origin
+// once per cluster instead of once per node. A member that fails a fetch
+// is skipped (its urls go straight to the origin) until a health check
+// can connect to it again.
+class PeerSet {
+public:
+    struct Peer {
+        string host;
+        int port;
+    };
+
+    // members are "host:port" and must list the same nodes on every node,
+    // self is this node's own entry
+    PeerSet(const vector<string> & members, const string & self, int check_interval_sec);
+    ~PeerSet();
+
+    // the peer to ask for key, nullopt when this node owns it or the owner is down
+    optional<Peer> ownerOf(string_view key) const;
+
+    // "host:port" of the owner of key, whether it is up or not
+    const string & ownerName(string_view key) const;
+
+    const string & getSelf() const;
+
+    void markDown(const Peer & peer);
+    bool isUp(const string & member) const;
+
+    // probe every member once, the checker thread does this each interval
+    void checkNow();
+
+    void start();
+    void stop();
+
+private:
+    struct Member {
+        string name;
+        Peer address;
+        atomic<bool> up{true};
+    };
+
+    void loop();
+    Member * find(const string & name) const;
+    // tcp connect within a second
+    static bool probe(const Peer & peer);
+    static Peer parseMember(const string & member);
+
+    HashRing ring;
+    vector<unique_ptr<Member>> members;
+    size_t self_index;
+    int check_interval_sec;
+
+    thread checker;
+    mutex checker_mutex;
+    condition_variable checker_cv;
+    bool stopping;
+
+    static inline Logger & logger = Logger::getInstance();
+};
+
+#endif
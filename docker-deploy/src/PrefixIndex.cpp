@@ -0,0 +1,142 @@
+#include "PrefixIndex.hpp"
+#include <algorithm>
+
+PrefixIndex::PrefixIndex() : count(0) {}
+
+void PrefixIndex::insert(const string & key) {
+    Node * node = &root;
+    size_t i = 0;
+    while (i < key.size()) {
+        auto it = node->children.find(key[i]);
+        if (it == node->children.end()) {
+            auto leaf = make_unique<Node>();
+            leaf->label = key.substr(i);
+            leaf->terminal = true;
+            node->children[key[i]] = move(leaf);
+            count++;
+            return;
+        }
+        Node * child = it->second.get();
+        size_t common = 0;
+        while (common < child->label.size() && i + common < key.size() &&
+               child->label[common] == key[i + common]) {
+            common++;
+        }
+        // the key leaves the edge halfway, split it there
+        if (common < child->label.size()) {
+            auto middle = make_unique<Node>();
+            middle->label = child->label.substr(0, common);
+            unique_ptr<Node> rest = move(it->second);
+            rest->label.erase(0, common);
+            char first = rest->label[0];
+            middle->children[first] = move(rest);
+            it->second = move(middle);
+            child = it->second.get();
+        }
+        node = child;
+        i += common;
+    }
+    if (!node->terminal) {
+        node->terminal = true;
+        count++;
+    }
+}
+
+void PrefixIndex::erase(const string & key) {
+    Node * parent = nullptr;
+    Node * node = &root;
+    size_t i = 0;
+    while (i < key.size()) {
+        auto it = node->children.find(key[i]);
+        if (it == node->children.end() || key.compare(i, it->second->label.size(), it->second->label) != 0) {
+            return;
+        }
+        parent = node;
+        node = it->second.get();
+        i += node->label.size();
+    }
+    if (!node->terminal) {
+        return;
+    }
+    node->terminal = false;
+    count--;
+    if (parent == nullptr) {
+        return;
+    }
+    // keep the tree compressed: no leaves that are not keys, no
+    // non-key nodes with a single child
+    if (node->children.empty()) {
+        parent->children.erase(node->label[0]);
+        if (parent != &root && !parent->terminal && parent->children.size() == 1) {
+            mergeChild(parent);
+        }
+    } else if (node->children.size() == 1) {
+        mergeChild(node);
+    }
+}
+
+bool PrefixIndex::contains(const string & key) const {
+    const Node * node = find(key);
+    return node != nullptr && node->terminal;
+}
+
+vector<string> PrefixIndex::withPrefix(const string & prefix) const {
+    vector<string> out;
+    const Node * node = &root;
+    string path;
+    size_t i = 0;
+    while (i < prefix.size()) {
+        auto it = node->children.find(prefix[i]);
+        if (it == node->children.end()) {
+            return out;
+        }
+        // the prefix may end inside this edge
+        const Node * child = it->second.get();
+        size_t n = min(child->label.size(), prefix.size() - i);
+        if (prefix.compare(i, n, child->label, 0, n) != 0) {
+            return out;
+        }
+        path += child->label;
+        node = child;
+        i += child->label.size();
+    }
+    collect(*node, path, out);
+    return out;
+}
+
+size_t PrefixIndex::size() const {
+    return count;
+}
+
+const PrefixIndex::Node * PrefixIndex::find(const string & key) const {
+    const Node * node = &root;
+    size_t i = 0;
+    while (i < key.size()) {
+        auto it = node->children.find(key[i]);
+        if (it == node->children.end() || key.compare(i, it->second->label.size(), it->second->label) != 0) {
+            return nullptr;
+        }
+        node = it->second.get();
+        i += node->label.size();
+    }
+    return node;
+}
+
+void PrefixIndex::mergeChild(Node * node) {
+    unique_ptr<Node> child = move(node->children.begin()->second);
+    node->children.clear();
+    node->label += child->label;
+    node->terminal = child->terminal;
+    node->children = move(child->children);
+}
+
+void PrefixIndex::collect(const Node & node, string & path, vector<string> & out) {
+    if (node.terminal) {
+        out.push_back(path);
+    }
+    for (const auto & [first, child] : node.children) {
+        path += child->label;
+        collect(*child, path, out);
+        path.resize(path.size() - child->label.size());
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef PREFIXINDEX_HPP
+#define PREFIXINDEX_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+using namespace std;
+
+// Radix tree over cache keys. A prefix query walks down the prefix once
+// and then visits only the keys below it, however many keys live
+// elsewhere. Not thread safe, owners lock around it.
+class PrefixIndex {
+public:
+    PrefixIndex();
+
+    void insert(const string & key);
+    void erase(const string & key);
+    bool contains(const string & key) const;
+
+    // every key starting with prefix
+    vector<string> withPrefix(const string & prefix) const;
+
+    size_t size() const;
+
+private:
+    struct Node {
+        string label;       // edge from the parent, empty only at the root
+        bool terminal = false;
+        map<char, unique_ptr<Node>> children;
+    };
+
+    // the node key ends at, nullptr if the tree has no such path
+    const Node * find(const string & key) const;
+    // fold the only child of a non-key node into it
+    static void mergeChild(Node * node);
+    static void collect(const Node & node, string & path, vector<string> & out);
+
+    Node root;
+    size_t count;
+};
+
+#endif
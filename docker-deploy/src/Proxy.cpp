@@ -5,18 +5,25 @@
 #include <cstring>
 #include <sys/select.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <climits>
 #include <arpa/inet.h>
 #include <algorithm>
 #include <ctime>
 #include <thread>
 #include <chrono>
 #include "Cache.hpp"
+#include "CacheStats.hpp"
 
-namespace beast = boost::beast;
-namespace http = boost::beast::http;
 namespace asio = boost::asio;
 
 constexpr int MAX_EVENTS = 1024;
+// wake up from epoll_wait periodically to notice stop()
+constexpr int EPOLL_TIMEOUT_MS = 1000;
+// connect timeout + receive timeout of the leader
+constexpr int COLLAPSE_TIMEOUT_SEC = 15;
+// set on requests between siblings, the owner never forwards them again
+const std::string PEER_HEADER = "X-Proxy-Peer";
 
 Proxy::Proxy(int port) : 
     listen_fd(-1), 
@@ -34,7 +41,7 @@ Proxy::~Proxy() {
     // }
     if (listen_fd >= 0) {
         close(listen_fd);
-        logger.debug("closed server fd: "+to_string(listen_fd));
+        LOG_DEBUG("closed server fd: "+to_string(listen_fd));
     }
 }
 
@@ -47,7 +54,7 @@ void Proxy::run() {
 
 // Setup server socket with proper configurations
 void Proxy::setup_server() {
-    logger.info("setting up server...");
+    LOG_INFO("setting up server...");
     listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (listen_fd < 0) {
         throw std::runtime_error("Failed to create socket");
@@ -87,7 +94,7 @@ void Proxy::setup_server() {
     fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK);
 
     running = true;
-    logger.info("successfully set up server on port " + std::to_string(port));
+    LOG_INFO("successfully set up server on port " + std::to_string(port));
 }
 
 // Init epoll fd and add listen fd
@@ -108,7 +115,7 @@ int Proxy::init_epoll(int listen_fd) {
         return -1;
     }
 
-    logger.info("successfully init epoll fd:" + std::to_string(epfd));
+    LOG_INFO("successfully init epoll fd:" + std::to_string(epfd));
     return epfd;
 }
 
@@ -116,12 +123,15 @@ int Proxy::init_epoll(int listen_fd) {
 void Proxy::wait_on_epoll(int epfd) {
     std::vector<epoll_event> events(MAX_EVENTS);
 
-    while (1) {
-        int n = epoll_wait(epfd, events.data(), MAX_EVENTS, -1);
-        logger.debug("Got " + to_string(n) + " events on epoll");
+    while (running) {
+        int n = epoll_wait(epfd, events.data(), MAX_EVENTS, EPOLL_TIMEOUT_MS);
+        if (n <= 0) {
+            continue;
+        }
+        LOG_DEBUG("Got " + to_string(n) + " events on epoll");
         for (int i = 0; i < n; ++i) {
             int fd = events[i].data.fd;
-            logger.debug("process event on fd:" + to_string(fd));
+            LOG_DEBUG("process event on fd:" + to_string(fd));
 
             if (fd == listen_fd) {
                 // Get fd of new connection
@@ -148,7 +158,7 @@ void Proxy::wait_on_epoll(int epfd) {
                     conn->https = false;
                     fd_to_conn[conn_fd] = conn;
                 }
-                logger.debug("Add new client fd:" + to_string(conn_fd));
+                LOG_DEBUG("Add new client fd:" + to_string(conn_fd));
 
                 // Register this fd to epoll event
                 register_to_epoll(conn_fd);
@@ -160,7 +170,7 @@ void Proxy::wait_on_epoll(int epfd) {
                     std::lock_guard<std::mutex> lock(fd_map_mtx);
                     auto it = fd_to_conn.find(fd);
                     if (it == fd_to_conn.end()){
-                        logger.error("fd:" + to_string(fd) + " not found in fd map");
+                        LOG_ERROR("fd:" + to_string(fd) + " not found in fd map");
                         continue;
                     } 
                 }
@@ -170,18 +180,21 @@ void Proxy::wait_on_epoll(int epfd) {
 
                 // If is client fd
                 if (fd == conn->client_fd){
-                    logger.debug("Dispatch a client fd:" + to_string(fd) + " to worker thread");
+                    LOG_DEBUG("Dispatch a client fd:" + to_string(fd) + " to worker thread");
                     threadpool.enqueue([this, fd](){Proxy::client_thread(this, fd);});
                 } else { // If is server fd
-                    logger.debug("Dispatch a server fd:" + to_string(fd) + " to worker thread");
+                    LOG_DEBUG("Dispatch a server fd:" + to_string(fd) + " to worker thread");
                     threadpool.enqueue([this, fd](){Proxy::server_thread(this, fd);});
                 }
-                auto status = threadpool.get_status();
-                logger.debug("=== 线程池状态 ==="\
-                            "\n总线程数: " + to_string(status.total_threads)
-                            + "\n空闲线程: " + to_string(status.idle_threads)
-                            + "\n等待任务: " + to_string(status.pending_tasks)
-                            + "\n=================");
+                // get_status locks the pool, only for someone reading DEBUG.log
+                if (logger.enabled(Logger::Level::DEBUG)) {
+                    auto status = threadpool.get_status();
+                    LOG_DEBUG("=== 线程池状态 ==="\
+                                "\n总线程数: " + to_string(status.total_threads)
+                                + "\n空闲线程: " + to_string(status.idle_threads)
+                                + "\n等待任务: " + to_string(status.pending_tasks)
+                                + "\n=================");
+                }
             }
         }
     }
@@ -196,7 +209,7 @@ void Proxy::register_to_epoll(int conn_fd){
         perror("epoll_ctl: conn_fd");
         close_fd(conn_fd);
     }
-    logger.debug("Register fd:" + to_string(conn_fd) + " to epoll");
+    LOG_DEBUG("Register fd:" + to_string(conn_fd) + " to epoll");
 }
 
 // disbale fd from epoll
@@ -220,19 +233,19 @@ void Proxy::enable_fd(int fd) {
 
 void Proxy::client_thread(Proxy* proxy, int client_fd) {
     proxy->handle_client(client_fd);
-    // logger.debug("handle client fd "+to_string(client_fd));
+    // LOG_DEBUG("handle client fd "+to_string(client_fd));
     proxy->enable_fd(client_fd);
 }
 
 void Proxy::server_thread(Proxy* proxy, int server_fd) {
     proxy->handle_server(server_fd);
-    // logger.debug("handle server fd "+to_string(server_fd));
+    // LOG_DEBUG("handle server fd "+to_string(server_fd));
     proxy->enable_fd(server_fd);
 }
 
 // Main request handler - parses request and routes to appropriate handler
 void Proxy::handle_client(int client_fd) {
-    logger.debug("handle client fd "+to_string(client_fd));
+    LOG_DEBUG("handle client fd "+to_string(client_fd));
 
     Conn * conn = get_conn(client_fd);
     if (conn == NULL) {
@@ -252,63 +265,64 @@ void Proxy::handle_client(int client_fd) {
     
     std::vector<char> buffer(8192);
     ssize_t bytes_received = recv(client_fd, buffer.data(), buffer.size(), 0);
-    logger.debug("received "+to_string(bytes_received)+" bytes from client "+to_string(client_fd));
+    LOG_DEBUG("received "+to_string(bytes_received)+" bytes from client "+to_string(client_fd));
     if (bytes_received <= 0) {
         if (bytes_received < 0) {
-            logger.debug("Failed to receive request: " + std::string(strerror(errno)));
+            LOG_DEBUG("Failed to receive request: " + std::string(strerror(errno)));
         }
         close_fd(client_fd);
-        logger.debug("closed client fd: "+to_string(client_fd));
+        LOG_DEBUG("closed client fd: "+to_string(client_fd));
         return;
     }
     
     
-    // parse buffer to request
-    Request request = conn->request;
+    // parse buffer to request, the request takes the buffer over
+    buffer.resize(bytes_received);
+    const Request & request = conn->request;
     try{
         Parser parser;
-        conn->request = parser.parseRequest(buffer);
-        request = conn->request;
-        logger.debug(request.getId()," on client fd "+to_string(client_fd)+" parse success "+request.getMethod());
+        conn->request = parser.parseRequest(std::move(buffer));
+        LOG_DEBUG(request.getId()," on client fd "+to_string(client_fd)+" parse success "+std::string(request.getMethodName()));
     }catch(std::runtime_error & e){
         std::string response = "HTTP/1.1 400 Bad Request\r\n"
+                              "Date: " + HttpDate::now() + "\r\n"
                               "Content-Length: 15\r\n\r\n"
                               "400 Bad Request";
         send(client_fd, response.c_str(), response.length(), 0);
-        logger.warning(request.getId(), "Responding \"HTTP/1.1 400 Bad Request\"");
+        LOG_WARNING(request.getId(), "Responding \"HTTP/1.1 400 Bad Request\"");
         close_fd(client_fd);
-        logger.debug(request.getId(),"closed client fd: "+to_string(client_fd));
+        LOG_DEBUG(request.getId(),"closed client fd: "+to_string(client_fd));
         return;
     }
     
     // Log the request with client IP and time
-    logger.info(request.getId(), "\"" + request.getMethod() + " " + request.getUrl() + 
-               " " + request.getVersion() + "\" from " + client_ip + " @ " + 
+    LOG_INFO(request.getId(), "\"" + std::string(request.getRequestLine()) + "\" from " + client_ip + " @ " + 
                logger.getCurrentTimeUTC());
-    if (request.getMethod() == "GET") {
+    if (request.isGet()) {
         handle_cache(client_fd, request);
         // handle_get(client_fd, request);
     }
-    else if (request.getMethod() == "POST") {
+    else if (isUnsafe(request.getMethod())) {
         handle_post(client_fd, request);
     }
-    else if (request.getMethod() == "CONNECT") {
-        logger.debug(request.getId(), "handle connect start");
+    else if (request.isConnect()) {
+        LOG_DEBUG(request.getId(), "handle connect start");
         handle_connect(client_fd, request);
-        logger.debug(request.getId(), "handle connect done");
+        LOG_DEBUG(request.getId(), "handle connect done");
     }
     else {
         std::string response = "HTTP/1.1 405 Method Not Allowed\r\n"
-                              "Allow: GET, POST, CONNECT\r\n"
+                              "Date: " + HttpDate::now() + "\r\n"
+                              "Allow: GET, POST, PUT, DELETE, PATCH, CONNECT\r\n"
                               "Content-Length: 21\r\n\r\n"
                               "405 Method Not Allowed";
         send(client_fd, response.c_str(), response.length(), 0);
-        logger.warning(request.getId(), "Responding \"HTTP/1.1 405 Method Not Allowed\" for method \"" + 
-                  request.getMethod() + "\"");
+        LOG_WARNING(request.getId(), "Responding \"HTTP/1.1 405 Method Not Allowed\" for method \"" + 
+                  std::string(request.getMethodName()) + "\"");
     }
-    // logger.debug(request.getId(),"ready to close fd "+to_string(client_fd));
+    // LOG_DEBUG(request.getId(),"ready to close fd "+to_string(client_fd));
     // close(client_fd);
-    // logger.debug(request.getId(),"handle client2 closed client fd: "+to_string(client_fd));
+    // LOG_DEBUG(request.getId(),"handle client2 closed client fd: "+to_string(client_fd));
 }
 
 void Proxy::handle_server(int server_fd){
@@ -328,62 +342,96 @@ void Proxy::handle_server(int server_fd){
     // If http, parse content to cache
     try{
         // receive full response from server
-        std::string full_response = receive(server_fd, request.getId());
+        // parsed and judged for caching in the same pass
+        Response response = receive(server_fd, request.getId());
+        const std::string & full_response = response.getRaw();
         std::string host = extract_host(request.getUrl());
-        
-        // if ok, send response to client
-        if (!full_response.empty()) {
-            logger.debug(request.getId(), "From " + host);
-            send_all(client_fd, full_response, request.getId());
-        } else {
+
+        if (full_response.empty()) {
+            if (!conn->pending) {
+                // server closed a connection we already answered on
+                close_fd(server_fd);
+                LOG_DEBUG(request.getId(),"closed idle server fd: "+to_string(server_fd));
+                return;
+            }
             throw std::runtime_error("Empty response from server");
         }
-        
-        // Parse message
-        Parser parser;
-        Response response = parser.parseResponse(vector<char>(full_response.begin(),full_response.end()));
-        logger.info(request.getId(), "Received \""+response.getFirstLine()+"\" from "+host);
-        logger.info(request.getId(), "Responding \""+response.getFirstLine()+"\"");
+        conn->pending = false;
+        LOG_INFO(request.getId(), "Received \""+std::string(response.getFirstLine())+"\" from "+host);
+
+        // origin error, a stale copy may be allowed instead
+        if (request.isGet() && isServerError(response.getResult()) &&
+            serve_stale_if_error(client_fd, request)){
+            finish_flight(server_fd, CollapsedForwarding::UNCACHEABLE, "");
+            return;
+        }
+
+        // if ok, send response to client
+        LOG_DEBUG(request.getId(), "From " + host);
+        send_to_client(client_fd, request, full_response);
+        LOG_INFO(request.getId(), "Responding \""+std::string(response.getFirstLine())+"\"");
         
         // cache it if ok
-        if (request.getMethod() != "GET"){
+        if (!request.isGet()){
+            if (isUnsafe(request.getMethod()) && response.getResult() < 400){
+                invalidate(request, response);
+            }
             return;
         }
         if (Cache::isCacheable(response)){
-            logger.debug(request.getId(), "response cacheable");
+            LOG_DEBUG(request.getId(), "response cacheable");
             // Cache & cache = Cache::getInstance();
-            Cache & cache = CacheMaster::getInstance().selectCache(request.getUrl());
-            CacheEntry cacheEntry("200", response.getHeadersStr(), response.getBody());
-            logger.debug(request.getId(),"try to cache: "+request.getUrl()+" to cache "+to_string(CacheMaster::getInstance().selectIndex(request.getUrl())));
-            cache.addToCache(request.getUrl(), "200", response.getHeadersStr(), response.getBody());
-            if (cacheEntry.needsRevalidation()){
-                logger.info(request.getId(), "cached, but requires re-validation");
-            }else{
-                logger.info(request.getId(), "cached, expires at "+cacheEntry.getExpiresTimeStr());
-            }
+            LOG_DEBUG(request.getId(),"try to cache: "+std::string(request.getUrl())+" to cache "+to_string(CacheMaster::getInstance().selectIndex(request.getCacheUrl())));
+            cache_response(request, response);
             
+            finish_flight(server_fd, CollapsedForwarding::SUCCEEDED, full_response);
         }else if (response.getResult() != 200){
-            logger.info(request.getId(), "not cacheable because response result is "+to_string(response.getResult()));
+            LOG_INFO(request.getId(), "not cacheable because response result is "+to_string(response.getResult()));
+            finish_flight(server_fd, CollapsedForwarding::UNCACHEABLE, "");
         }else {
-            logger.info(request.getId(), "not cacheable because response cache control contains \"no-store\" or \"private\"");
+            LOG_INFO(request.getId(), "not cacheable because response cache control contains \"no-store\" or \"private\"");
+            finish_flight(server_fd, CollapsedForwarding::UNCACHEABLE, "");
         }
     } catch (const std::exception& e) {
-        logger.error(request.getId(), "ERROR in handle_get: " + std::string(e.what()));
-        std::string error_response = "HTTP/1.1 502 Bad Gateway\r\n\r\n";
-        send(client_fd, error_response.c_str(), error_response.length(), 0);
-        logger.error(request.getId(), "Responding \"HTTP/1.1 502 Bad Gateway\"");
+        LOG_ERROR(request.getId(), "ERROR in handle_get: " + std::string(e.what()));
+        conn->pending = false;
+        if (!request.isGet() || !serve_stale_if_error(client_fd, request)){
+            std::string error_response = "HTTP/1.1 502 Bad Gateway\r\nDate: " + HttpDate::now() + "\r\n\r\n";
+            send(client_fd, error_response.c_str(), error_response.length(), 0);
+            LOG_ERROR(request.getId(), "Responding \"HTTP/1.1 502 Bad Gateway\"");
+        }
+        finish_flight(server_fd, CollapsedForwarding::FAILED, "");
         // close it
         close_fd(server_fd);
-        logger.debug(request.getId(),"closed server fd: "+to_string(server_fd));
+        LOG_DEBUG(request.getId(),"closed server fd: "+to_string(server_fd));
     }
 }
 
 // close fd
 void Proxy::close_fd(int fd){
-    std::lock_guard<std::mutex> lk(fd_map_mtx);
-    close(fd);
-    fd_to_conn.erase(fd);
-    // logger.debug(request.getId(),"closed fd: "+to_string(fd));
+    std::string key;
+    std::shared_ptr<CollapsedForwarding::Flight> flight;
+    {
+        std::lock_guard<std::mutex> lk(fd_map_mtx);
+        close(fd);
+        auto it = fd_to_conn.find(fd);
+        if (it != fd_to_conn.end()) {
+            // a leader torn down while its origin has not answered: its
+            // followers fetch themselves now instead of waiting out the
+            // timeout; once the answer is in, its handler publishes it
+            if (it->second->flight != nullptr && (it->second->pending || fd == it->second->server_fd)) {
+                key = std::move(it->second->flight_key);
+                flight = std::move(it->second->flight);
+                it->second->flight_key.clear();
+                it->second->flight.reset();
+            }
+            fd_to_conn.erase(it);
+        }
+    }
+    if (flight != nullptr) {
+        collapser.complete(key, flight, CollapsedForwarding::FAILED, "");
+    }
+    // LOG_DEBUG(request.getId(),"closed fd: "+to_string(fd));
 }
 
 Conn * Proxy::get_conn(int fd){
@@ -400,14 +448,14 @@ ssize_t Proxy::forward(int from_fd, int to_fd) {
 
     while (true) {
         ssize_t n = read(from_fd, buffer.data(), BUF_SIZE);
-        // logger.debug("read " + to_string(n) + " bytes");
+        // LOG_DEBUG("read " + to_string(n) + " bytes");
         if (n > 0) {
             total += n;
 
             ssize_t written = 0;
             while (written < n) {
                 ssize_t w = write(to_fd, buffer.data() + written, n - written);
-                // logger.debug("write " + to_string(n) + " bytes");
+                // LOG_DEBUG("write " + to_string(n) + " bytes");
                 if (w < 0) {
                     if (errno == EAGAIN || errno == EWOULDBLOCK) {
                         // 非阻塞写满了，稍后再写
@@ -425,7 +473,7 @@ ssize_t Proxy::forward(int from_fd, int to_fd) {
             disable_fd(to_fd);
             close_fd(from_fd);
             close_fd(to_fd);
-            logger.debug("Tunnel between " + to_string(from_fd) + " - " + to_string(to_fd) + " closed");
+            LOG_DEBUG("Tunnel between " + to_string(from_fd) + " - " + to_string(to_fd) + " closed");
             break;
         } else {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -443,8 +491,8 @@ ssize_t Proxy::forward(int from_fd, int to_fd) {
     return total;
 }
 // from URL
-std::string Proxy::extract_host(const std::string& url) {
-    std::string host = url;
+std::string Proxy::extract_host(std::string_view url) {
+    std::string host(url);
     if (host.substr(0, 7) == "http://") {
         host = host.substr(7);
     }
@@ -456,8 +504,8 @@ std::string Proxy::extract_host(const std::string& url) {
 }
 
 std::string Proxy::build_get_request(const Request& request) {
-    std::string url = request.getUrl();
-    // logger.debug(request.getId(),"url is "+request.getUrl());
+    std::string url(request.getUrl());
+    // LOG_DEBUG(request.getId(),"url is "+request.getUrl());
     size_t pos = url.find("://");
     std::string path;
     
@@ -472,10 +520,10 @@ std::string Proxy::build_get_request(const Request& request) {
         path = url;
     }
     
-    std::string req = "GET " + path + " " + request.getVersion() + "\r\n";
+    std::string req = "GET " + path + " " + std::string(request.getVersion()) + "\r\n";
     req += "Host: " + extract_host(url) + "\r\n";
     req += "Connection: close\r\n";
-    req += "Accept: */*\r\n";
+    req += build_negotiation_headers(request);
     req += "User-Agent: Mozilla/5.0\r\n";
     req += "\r\n";
     
@@ -488,8 +536,7 @@ void Proxy::handle_get(int client_fd, const Request& request) {
     auto [host, server_port] = parse_host_and_port(host_with_port);
 
     std::string request_get = build_get_request(request);
-    logger.info(request.getId(), "Requesting \"" + request.getMethod() + " " + 
-               request.getUrl() + " " + request.getVersion() + "\" from " + host_with_port);
+    LOG_INFO(request.getId(), "Requesting \"" + std::string(request.getRequestLine()) + "\" from " + host_with_port);
     int server_fd = -1;
     try {
         server_fd = connect_to_server(host, server_port);
@@ -507,28 +554,31 @@ void Proxy::handle_get(int client_fd, const Request& request) {
             std::lock_guard<std::mutex> lk(fd_map_mtx);
             Conn * conn = fd_to_conn[client_fd];
             conn->server_fd = server_fd;
-            conn->request = request;
+            conn->pending = true;
             fd_to_conn[server_fd] = conn;
         }
-        logger.debug("Add new server fd:" + to_string(server_fd));
+        LOG_DEBUG("Add new server fd:" + to_string(server_fd));
         register_to_epoll(server_fd);
 
         // Send the request in chunks to handle large requests
         send_all(server_fd, request_get, request.getId());
 
     } catch (const std::exception& e) {
-        logger.error(request.getId(), "ERROR in handle_get: " + std::string(e.what()));
-        std::string error_response = "HTTP/1.1 502 Bad Gateway\r\n\r\n";
-        send(client_fd, error_response.c_str(), error_response.length(), 0);
-        logger.error(request.getId(), "Responding \"HTTP/1.1 502 Bad Gateway\"");
+        LOG_ERROR(request.getId(), "ERROR in handle_get: " + std::string(e.what()));
+        if (!serve_stale_if_error(client_fd, request)){
+            std::string error_response = "HTTP/1.1 502 Bad Gateway\r\nDate: " + HttpDate::now() + "\r\n\r\n";
+            send(client_fd, error_response.c_str(), error_response.length(), 0);
+            LOG_ERROR(request.getId(), "Responding \"HTTP/1.1 502 Bad Gateway\"");
+        }
+        finish_flight(client_fd, CollapsedForwarding::FAILED, "");
         // close it
         close_fd(client_fd);
-        logger.debug(request.getId(),"closed client fd: "+to_string(client_fd));
+        LOG_DEBUG(request.getId(),"closed client fd: "+to_string(client_fd));
     }
 }
 
 std::string Proxy::build_post_request(const Request& request) {
-    std::string url = request.getUrl();
+    std::string url(request.getUrl());
     size_t pos = url.find("://");
     std::string path;
     
@@ -543,23 +593,22 @@ std::string Proxy::build_post_request(const Request& request) {
         path = url;
     }
     
-    std::string req = "POST " + path + " " + request.getVersion() + "\r\n";
+    std::string req = std::string(request.getMethodName()) + " " + path + " " + std::string(request.getVersion()) + "\r\n";
     req += "Host: " + extract_host(url) + "\r\n";
     req += "Connection: close\r\n";
     
     bool has_content_length = false;
     bool has_content_type = false;
     
-    // copy all original headers, but skip Host and Connection
+    // copy all original headers, but skip Host and Connection; a chunked
+    // body was decoded, it goes out with a Content-Length
     for (const auto& header : request.getHeaders()) {
-        logger.debug(std::string(header.name_string())+to_string(std::string(header.name_string()) != "Host"));
-        if (std::string(header.name_string()) != "Host" && std::string(header.name_string()) != "Connection") {
-            logger.debug(std::string(header.name_string()));
-            req += std::string(header.name_string()) + ": " + std::string(header.value()) + "\r\n";
-            if (std::string(header.name_string()) == "Content-Length") {
+        if (!header.is("Host") && !header.is("Connection") && !header.is("Transfer-Encoding")) {
+            req.append(header.name).append(": ").append(header.value).append("\r\n");
+            if (header.is("Content-Length")) {
                 has_content_length = true;
             }
-            if (std::string(header.name_string()) == "Content-Type") {
+            if (header.is("Content-Type")) {
                 has_content_type = true;
             }
         }
@@ -576,28 +625,28 @@ std::string Proxy::build_post_request(const Request& request) {
     }
     
     req += "\r\n";
-    logger.debug("body"+request.getBody());
+    LOG_DEBUG("body"+std::string(request.getBody()));
     if (request.hasBody()) {
         req += request.getBody();
     }
-    logger.debug("get req:"+req);
+    LOG_DEBUG("get req:"+req);
     return req;
 }
 
-// POST: no need to cache
+// POST and the other unsafe methods: no need to cache
 void Proxy::handle_post(int client_fd, const Request& request) {
     std::string host = extract_host(request.getUrl());
     auto [host_name, server_port] = parse_host_and_port(host);
     
-    logger.info(request.getId(), "Requesting \"POST " + request.getUrl() + "\" from " + host);
+    LOG_INFO(request.getId(), "Requesting \"" + std::string(request.getRequestLine()) + "\" from " + host);
 
     // build post request
     std::string request_post = build_post_request(request);
-    logger.debug(request.getId(), "Sending request:\n" + request_post);
+    LOG_DEBUG(request.getId(), "Sending request:\n" + request_post);
     int server_fd = -1;
     try {
         server_fd = connect_to_server(host_name, server_port);
-        logger.debug(request.getId(), "Successfully connected to server " + host_name + ":" + std::to_string(server_port));
+        LOG_DEBUG(request.getId(), "Successfully connected to server " + host_name + ":" + std::to_string(server_port));
         
         // Set receive timeout to 10 seconds (same as test)
         struct timeval timeout;
@@ -612,10 +661,10 @@ void Proxy::handle_post(int client_fd, const Request& request) {
             std::lock_guard<std::mutex> lk(fd_map_mtx);
             Conn * conn = fd_to_conn[client_fd];
             conn->server_fd = server_fd;
-            conn->request = request;
+            conn->pending = true;
             fd_to_conn[server_fd] = conn;
         }
-        logger.debug("Add new server fd:" + to_string(server_fd));
+        LOG_DEBUG("Add new server fd:" + to_string(server_fd));
         register_to_epoll(server_fd);
         
         // Send the request in chunks to handle large requests
@@ -623,96 +672,95 @@ void Proxy::handle_post(int client_fd, const Request& request) {
         
     }
     catch (const std::exception& e) {
-        logger.error(request.getId(), "ERROR in handle_post: " + std::string(e.what()));
-        std::string error_response = "HTTP/1.1 502 Bad Gateway\r\n\r\n";
+        LOG_ERROR(request.getId(), "ERROR in handle_post: " + std::string(e.what()));
+        std::string error_response = "HTTP/1.1 502 Bad Gateway\r\nDate: " + HttpDate::now() + "\r\n\r\n";
         send(client_fd, error_response.c_str(), error_response.length(), 0);
-        logger.error(request.getId(), "Responding \"HTTP/1.1 502 Bad Gateway\"");
+        LOG_ERROR(request.getId(), "Responding \"HTTP/1.1 502 Bad Gateway\"");
         // close it
         close_fd(client_fd);
-        logger.debug(request.getId(),"closed client fd: "+to_string(client_fd));
+        LOG_DEBUG(request.getId(),"closed client fd: "+to_string(client_fd));
     }
 }
 
 int Proxy::connect_to_server(const std::string& host, int port) {
-    logger.debug("Attempting to connect to " + host + ":" + std::to_string(port));
+    LOG_DEBUG("Attempting to connect to " + host + ":" + std::to_string(port));
     
     struct hostent *server = gethostbyname(host.c_str());
     if (server == NULL) {
-        logger.error("Failed to resolve hostname " + host + ": " + std::string(hstrerror(h_errno)));
+        LOG_ERROR("Failed to resolve hostname " + host + ": " + std::string(hstrerror(h_errno)));
         throw std::runtime_error("Failed to resolve hostname");
     }
-    logger.debug("Successfully resolved hostname " + host);
+    LOG_DEBUG("Successfully resolved hostname " + host);
 
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
-        logger.error("Failed to create socket: " + std::string(strerror(errno)));
+        LOG_ERROR("Failed to create socket: " + std::string(strerror(errno)));
         throw std::runtime_error("Failed to create socket");
     }
-    logger.debug("Successfully created socket");
+    LOG_DEBUG("Successfully created socket");
 
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(port);
     memcpy(&server_addr.sin_addr.s_addr, server->h_addr, server->h_length);
-    logger.debug("memcpy done");
+    LOG_DEBUG("memcpy done");
     // Set connect timeout
     struct timeval tv;
     tv.tv_sec = 5;  // 5 seconds timeout
     tv.tv_usec = 0;
     if (setsockopt(server_fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv)) < 0) {
-        logger.error("Failed to set receive timeout: " + std::string(strerror(errno)));
+        LOG_ERROR("Failed to set receive timeout: " + std::string(strerror(errno)));
     }
     if (setsockopt(server_fd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof(tv)) < 0) {
-        logger.error("Failed to set send timeout: " + std::string(strerror(errno)));
+        LOG_ERROR("Failed to set send timeout: " + std::string(strerror(errno)));
     }
-    logger.debug("socket set done");
+    LOG_DEBUG("socket set done");
 
     // Convert IP to string for logging
     char ip_str[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &(server_addr.sin_addr), ip_str, INET_ADDRSTRLEN);
-    logger.debug("Attempting to connect to IP: " + std::string(ip_str) + ":" + std::to_string(port));
+    LOG_DEBUG("Attempting to connect to IP: " + std::string(ip_str) + ":" + std::to_string(port));
 
     if (connect(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         close(server_fd);
-        logger.debug("closed server fd: "+to_string(server_fd));
-        logger.error("Failed to connect to server: " + std::string(strerror(errno)));
+        LOG_DEBUG("closed server fd: "+to_string(server_fd));
+        LOG_ERROR("Failed to connect to server: " + std::string(strerror(errno)));
         throw std::runtime_error("Failed to connect to server");
     }
-    logger.debug("Successfully connected to server");
+    LOG_DEBUG("Successfully connected to server");
 
     return server_fd;
 }
 
 void Proxy::handle_connect(int client_fd, const Request& request) {
     // Extract host and port from CONNECT request
-    std::string url = request.getUrl();
+    std::string url(request.getUrl());
     auto [host, port] = parse_host_and_port(url);
 
     // Log the CONNECT request
-    logger.info(request.getId(), "Requesting \"CONNECT " + url + " " + request.getVersion() + "\" from " + host);
+    LOG_INFO(request.getId(), "Requesting \"" + std::string(request.getRequestLine()) + "\" from " + host);
     int server_fd = -1;
     try {
         // Connect to the destination server
         server_fd = connect_to_server(host, port);
-        logger.debug(request.getId(), "Successfully connected to destination server " + host + ":" + std::to_string(port)+" on fd "+to_string(server_fd));
+        LOG_DEBUG(request.getId(), "Successfully connected to destination server " + host + ":" + std::to_string(port)+" on fd "+to_string(server_fd));
 
         // Add server fd and request to fd map
         {
             std::lock_guard<std::mutex> lk(fd_map_mtx);
             Conn * conn = fd_to_conn[client_fd];
             conn->server_fd = server_fd;
-            conn->request = request;
             conn->https = true;
             fd_to_conn[server_fd] = conn;
         }
-        logger.debug("Add new server fd:" + to_string(server_fd));
+        LOG_DEBUG("Add new server fd:" + to_string(server_fd));
         register_to_epoll(server_fd);
 
         // Send 200 OK to client
         std::string response = "HTTP/1.1 200 Connection established\r\n\r\n";
         ssize_t sent = send(client_fd, response.c_str(), response.length(), 0);
-        logger.debug(request.getId(), "send response "+to_string(sent)+"/"+to_string(response.size()));
+        LOG_DEBUG(request.getId(), "send response "+to_string(sent)+"/"+to_string(response.size()));
         if (sent < 0) {
             throw std::runtime_error("Failed to send connection established response: " + std::string(strerror(errno)));
         }
@@ -721,25 +769,25 @@ void Proxy::handle_connect(int client_fd, const Request& request) {
         }
         
         // Log the response
-        logger.info(request.getId(), "Responding \"HTTP/1.1 200 Connection established\"");
-        logger.info(request.getId(), "Starting CONNECT tunnel");
+        LOG_INFO(request.getId(), "Responding \"HTTP/1.1 200 Connection established\"");
+        LOG_INFO(request.getId(), "Starting CONNECT tunnel");
         
     }
     catch (const std::exception& e) {
-        logger.error(request.getId(), "ERROR in handle_connect: " + std::string(e.what()));
-        std::string error_response = "HTTP/1.1 502 Bad Gateway\r\n\r\n";
+        LOG_ERROR(request.getId(), "ERROR in handle_connect: " + std::string(e.what()));
+        std::string error_response = "HTTP/1.1 502 Bad Gateway\r\nDate: " + HttpDate::now() + "\r\n\r\n";
         send(client_fd, error_response.c_str(), error_response.length(), 0);
-        logger.error(request.getId(), "Responding \"HTTP/1.1 502 Bad Gateway\"");
+        LOG_ERROR(request.getId(), "Responding \"HTTP/1.1 502 Bad Gateway\"");
         // close it
         close_fd(client_fd);
-        logger.debug(request.getId(),"closed client fd: "+to_string(client_fd));
+        LOG_DEBUG(request.getId(),"closed client fd: "+to_string(client_fd));
     }
 }
 
 void Proxy::stop() {
     if (!running) return;
     
-    logger.info("Initiating proxy shutdown...");
+    LOG_INFO("Initiating proxy shutdown...");
     running = false;
     shutdown_requested = true;
 
@@ -747,7 +795,7 @@ void Proxy::stop() {
     if (listen_fd >= 0) {
         shutdown(listen_fd, SHUT_RDWR);
         close(listen_fd);
-        logger.debug("closed listen fd: "+to_string(listen_fd));
+        LOG_DEBUG("closed listen fd: "+to_string(listen_fd));
         listen_fd = -1;
     }
 
@@ -762,7 +810,8 @@ void Proxy::stop() {
     //     threads.clear();
     // }
 
-    logger.info("Proxy shutdown complete");
+    LOG_INFO("cache stats: " + CacheStats::getInstance().report());
+    LOG_INFO("Proxy shutdown complete");
 }
 
 std::pair<std::string, int> Proxy::parse_host_and_port(const std::string& host_str) {
@@ -776,76 +825,48 @@ std::pair<std::string, int> Proxy::parse_host_and_port(const std::string& host_s
 }
 
 
-// receive full response by recv and beast parser
-std::string Proxy::receive(int server_fd, int id){
-    std::string full_response;
+// receive one full response, parsed as its bytes come in
+Response Proxy::receive(int server_fd, int id){
+    Response response;
     char buffer[8192];
-    ssize_t bytes_received;
-
-    beast::flat_buffer dynamic_buffer;
-    http::response_parser<http::string_body> parser;
-    boost::system::error_code ec;
 
-    while (true) {
-        // keep recv ing if not fet full response
-        ssize_t bytes_received = recv(server_fd, buffer, sizeof(buffer), 0);
-        full_response.append(buffer, bytes_received);
-        if (bytes_received <= 0) {
-            if (bytes_received == 0) {
-                logger.debug(id, "connection closed");
-            } else {
-                logger.error(id, "recv failed!");
-            }
-            break;
-        }
-        logger.debug(id, "get "+to_string(bytes_received));
-
-        // append data to buffer
-        dynamic_buffer.commit(
-            boost::asio::buffer_copy(
-                dynamic_buffer.prepare(bytes_received),  
-                boost::asio::buffer(buffer, bytes_received)  
-            )
-        ); 
-
-        // try to parse data
-        while(dynamic_buffer.size() > 0){
-            size_t bytes_rest = dynamic_buffer.size();
-            size_t bytes_parsed = parser.put(dynamic_buffer.data(), ec);
-            dynamic_buffer.consume(bytes_parsed); // clear processed data
-            // logger.debug(id, "parsed "+to_string(bytes_parsed)+"/"+to_string(bytes_rest));
-
-            if (ec) {
-                if (ec == http::error::need_more) {
-                    logger.debug(id, "need more");
-                    break;
+    try {
+        while (true) {
+            // keep recv ing if not fet full response
+            ssize_t bytes_received = recv(server_fd, buffer, sizeof(buffer), 0);
+            if (bytes_received <= 0) {
+                if (bytes_received == 0) {
+                    LOG_DEBUG(id, "connection closed");
                 } else {
-                    logger.error(id, "failed to parse received data from server, ec:"+ec.message()+" code: "+to_string(ec.value()));
-                    throw runtime_error(to_string(id)+": failed to parse received data from server. "+ec.message());
+                    LOG_ERROR(id, "recv failed!");
                 }
+                // a body without a length ends with the connection
+                response.finish();
+                break;
+            }
+            LOG_DEBUG(id, "get "+to_string(bytes_received));
+            if (response.feed(buffer, bytes_received)) {
+                break;
             }
         }
-
-        // get all data
-        if (parser.is_done()) {
-            http::response<http::string_body>  res = parser.release();
-            logger.debug(id, "successfully parsed response code("
-                            +to_string(res.result_int())+") bodyLen("+to_string(res.body().size())+")");
-            // logger.debug(full_response);
-            break;
-        }
+    } catch (const std::runtime_error& e) {
+        LOG_ERROR(id, "failed to parse received data from server: "+std::string(e.what()));
+        throw runtime_error(to_string(id)+": failed to parse received data from server. "+e.what());
     }
-    return full_response;
+    if (response.isComplete()) {
+        CacheStats::getInstance().add(CacheStats::UPSTREAM_RESPONSES);
+        LOG_DEBUG(id, "successfully parsed response code("
+                        +to_string(response.getResult())+") bodyLen("+to_string(response.getBody().size())+")");
+    }
+    return response;
 }
 
 
 // send full data to fd
-void Proxy::send_all(int target_fd, std::string full_message, int id){
+void Proxy::send_all(int target_fd, const std::string & full_message, int id){
     size_t pos = full_message.find("\r\n");
     if (pos != std::string::npos) {
-        std::string response_line = full_message.substr(0, pos);
-        
-        logger.debug(id, "Full message length to send: " + 
+        LOG_DEBUG(id, "Full message length to send: " + 
                     std::to_string(full_message.length()) + " bytes");
         
         // Send response to target in chunks
@@ -859,30 +880,85 @@ void Proxy::send_all(int target_fd, std::string full_message, int id){
             }
             total_sent += sent;
         }
-        logger.debug(id, "Successfully sent "+to_string(total_sent)+" bytes to target");
+        LOG_DEBUG(id, "Successfully sent "+to_string(total_sent)+" bytes to target");
     } else {
         throw std::runtime_error("Invalid message format");
     }
 }
 
+// send a cached response without joining its body into one string
+void Proxy::send_entry(int target_fd, const CacheEntry & entry, int id){
+    const std::string & headers = entry.getResponseHeaders();
+    std::vector<struct iovec> iov;
+    iov.push_back({const_cast<char *>(headers.data()), headers.size()});
+    entry.getBody().appendIovecs(iov);
+
+    size_t total_sent = 0;
+    size_t first = 0;
+    while (first < iov.size()) {
+        ssize_t sent = writev(target_fd, iov.data() + first, std::min(iov.size() - first, size_t(IOV_MAX)));
+        if (sent < 0) {
+            throw std::runtime_error("Failed to send message to target: " + 
+                                    std::string(strerror(errno)));
+        }
+        total_sent += sent;
+        // skip what went out, a short write may stop inside a segment
+        size_t left = sent;
+        while (first < iov.size() && left >= iov[first].iov_len) {
+            left -= iov[first].iov_len;
+            first++;
+        }
+        if (first < iov.size()) {
+            iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + left;
+            iov[first].iov_len -= left;
+        }
+    }
+    LOG_DEBUG(id, "Successfully sent "+to_string(total_sent)+" bytes to target in "+to_string(iov.size())+" pieces");
+}
+
 void Proxy::handle_cache(int client_fd, const Request& request){
-    logger.debug(request.getId(),"handle cache");
+    LOG_DEBUG(request.getId(),"handle cache");
     // Cache & cache = Cache::getInstance();
-    Cache & cache = CacheMaster::getInstance().selectCache(request.getUrl());
-
+    Cache & cache = CacheMaster::getInstance().selectCache(request.getCacheUrl());
+    std::string key = cache.lookupKey(request);
     
-    Cache::CacheStatus status = cache.checkStatus(request.getUrl());
-    CacheEntry * entry = cache.getEntry(request.getUrl());
+    Cache::CacheStatus status = cache.checkStatus(key);
+
+    CacheStats & stats = CacheStats::getInstance();
+    stats.add(CacheStats::CACHE_LOOKUPS);
+    if (!request.getHeader(PEER_HEADER).empty()){
+        stats.add(CacheStats::PEER_REQUESTS);
+    }
+    CacheMaster::getInstance().recordAccess(request.getCacheUrl());
+
+    // memory miss, another proxy process may have stored it
+    if (status == Cache::NOT_IN_CACHE && fill_from_shared(key)){
+        status = cache.checkStatus(key);
+    }
+
+    // memory miss, try the disk tier
+    if (status == Cache::NOT_IN_CACHE && serve_from_disk(client_fd, request)){
+        stats.add(CacheStats::CACHE_HITS);
+        return;
+    }
 
     // judge cache decision
     CacheDecision cacheDecision;
     CacheHandler cacheHandler;
-    CacheDecision::Decision decision = cacheDecision.makeDecision(request);
+    // a copy shares the body segments, eviction cannot pull them away mid-send
+    std::optional<CacheEntry> copy;
+    CacheDecision::Decision decision = cacheDecision.makeDecision(request, copy);
     // if need to send 
     if (cacheHandler.need_to_send(decision)){
+        // let one request fetch, the rest wait for its response
+        if (decision != CacheDecision::NO_TRANSFORM && wait_for_leader(client_fd, request)){
+            return;
+        }
         switch(decision){
             case CacheDecision::DIRECT:{
-                handle_get(client_fd, request);
+                if (!fetch_from_peer(client_fd, request)){
+                    handle_get(client_fd, request);
+                }
                 break;
             }
             case CacheDecision::REVALIDATE:{
@@ -893,40 +969,74 @@ void Proxy::handle_cache(int client_fd, const Request& request){
                 handle_get(client_fd, request);
                 break;
             }
+            default:
+                // need_to_send holds only for the decisions above
+                break;
         }
     }else{// if just return
-        string response = cacheHandler.build_forward_response(decision, entry);
-        send_all(client_fd, response, request.getId());
+        if (copy && decision != CacheDecision::RETURN_304 && copy->isPartial() &&
+            !complete_partial(request, key, *copy)){
+            // the origin would not fill the gap, fetch it whole
+            handle_get(client_fd, request);
+            return;
+        }
+        const CacheEntry * served = copy ? &*copy : nullptr;
+        if (decision != CacheDecision::RETURN_504){
+            stats.add(CacheStats::CACHE_HITS);
+            if (served != nullptr && served->isRestored()){
+                stats.add(CacheStats::RESTORED_HITS);
+            }
+            if (served != nullptr && served->isNegative()){
+                stats.add(CacheStats::NEGATIVE_HITS);
+            }
+        }
+        if (copy && decision != CacheDecision::RETURN_304 && !copy->isGzip()){
+            send_entry(client_fd, *copy, request.getId());
+        }else{
+            send_to_client(client_fd, request, cacheHandler.build_forward_response(decision, served));
+        }
+        if (decision == CacheDecision::RETURN_304){
+            stats.add(CacheStats::CLIENT_NOT_MODIFIED);
+        }
+        if (decision == CacheDecision::RETURN_STALE){
+            stats.add(CacheStats::STALE_WHILE_REVALIDATE_SERVED);
+            refresh_in_background(request);
+        }
     }
     
 
 }
 
 void Proxy::revalid(int client_fd, const Request& request){
-    logger.debug(request.getId(),"revalid");
+    LOG_DEBUG(request.getId(),"revalid");
     // Cache & cache = Cache::getInstance();
-    Cache & cache = CacheMaster::getInstance().selectCache(request.getUrl());
+    Cache & cache = CacheMaster::getInstance().selectCache(request.getCacheUrl());
 
-    CacheEntry * cacheEntry = cache.getEntry(request.getUrl());
-    string eTag = Cache::extractETag(cacheEntry->getResponseHeaders());
-    if (eTag == ""){// no etag
-        logger.debug(request.getId(),"has no etag, reget");
+    std::optional<CacheEntry> cacheEntry = cache.copyEntry(cache.lookupKey(request));
+    string eTag = cacheEntry ? cacheEntry->getETag() : "";
+    time_t lastModified = cacheEntry && cacheEntry->hasLastModified() ? cacheEntry->getLastModified() : 0;
+    if (eTag == "" && lastModified == 0){// no validator
+        LOG_DEBUG(request.getId(),"has no etag or last-modified, reget");
         handle_get(client_fd, request);
-    }else{// has etag
-        logger.debug(request.getId(),"has etag: "+eTag+" revalid it");
-        handle_revalid(client_fd,request,eTag);
+    }else{// conditional get
+        LOG_DEBUG(request.getId(),"has etag: "+eTag+" last-modified: "+to_string(lastModified)+" revalid it");
+        handle_revalid(client_fd,request,eTag,lastModified);
     }
 }
 
-void Proxy::returnCache(int client_fd, const Request& request){
-    logger.debug(request.getId(),"return by cache");
+std::string Proxy::returnCache(int client_fd, const Request& request){
+    LOG_DEBUG(request.getId(),"return by cache");
     // Cache & cache = Cache::getInstance();
-    Cache & cache = CacheMaster::getInstance().selectCache(request.getUrl());
-
-    CacheEntry * cacheEntry = cache.getEntry(request.getUrl());
-    send_all(client_fd, cacheEntry->getFullResponse(), request.getId());
-    logger.debug(request.getId(),"done return cache");
+    Cache & cache = CacheMaster::getInstance().selectCache(request.getCacheUrl());
 
+    std::optional<CacheEntry> cacheEntry = cache.copyEntry(cache.lookupKey(request));
+    if (!cacheEntry) {
+        throw std::runtime_error("cached entry evicted while revalidating");
+    }
+    std::string response = cacheEntry->getFullResponse();
+    send_to_client(client_fd, request, response);
+    LOG_DEBUG(request.getId(),"done return cache");
+    return response;
 }
 
 // bool Peoxy::revalid_eTag(const Request& request, string & eTag){
@@ -936,8 +1046,8 @@ void Proxy::returnCache(int client_fd, const Request& request){
 //     }else if(response.getResult() == 200)
 // }
 
-std::string Proxy::build_revalid_request(const Request& request, string & eTag) {
-    std::string url = request.getUrl();
+std::string Proxy::build_revalid_request(const Request& request, const string & eTag, time_t lastModified) {
+    std::string url(request.getUrl());
     size_t pos = url.find("://");
     std::string path;
     
@@ -952,10 +1062,17 @@ std::string Proxy::build_revalid_request(const Request& request, string & eTag)
         path = url;
     }
     
-    std::string req = "GET " + path + " " + request.getVersion() + "\r\n";
+    std::string req = "GET " + path + " " + std::string(request.getVersion()) + "\r\n";
     req += "Host: " + extract_host(url) + "\r\n";
-    req += "If-None-Match: "+eTag+"\r\n";
-    req += "Accept: */*\r\n";
+    // the origin prefers If-None-Match when both are sent
+    if (!eTag.empty()) {
+        // the entry keeps a strong tag without its quotes, a weak one with them
+        req += "If-None-Match: " + (eTag.rfind("W/", 0) == 0 ? eTag : "\"" + eTag + "\"") + "\r\n";
+    }
+    if (lastModified != 0) {
+        req += "If-Modified-Since: "+HttpDate::format(lastModified)+"\r\n";
+    }
+    req += build_negotiation_headers(request);
     req += "User-Agent: Mozilla/5.0\r\n";
     req += "\r\n";
     
@@ -963,17 +1080,69 @@ std::string Proxy::build_revalid_request(const Request& request, string & eTag)
 }
 
 
-void Proxy::handle_revalid(int client_fd, const Request& request, string & eTag) {
+void Proxy::handle_revalid(int client_fd, const Request& request, const string & eTag, time_t lastModified) {
     std::string host_with_port = extract_host(request.getUrl());
-    auto [host, server_port] = parse_host_and_port(host_with_port);
 
-    std::string request_get = build_revalid_request(request, eTag);
-    logger.info(request.getId(), "Requesting \"" + request.getMethod() + " " + 
-               request.getUrl() + " " + request.getVersion() + "\" from " + host_with_port);
+    std::string request_get = build_revalid_request(request, eTag, lastModified);
+    CacheStats::getInstance().add(CacheStats::REVALIDATIONS);
+    LOG_INFO(request.getId(), "Requesting \"" + std::string(request.getRequestLine()) + "\" from " + host_with_port);
 
     try {
-        int server_fd = connect_to_server(host, server_port);
-        
+        // receive full response from server
+        Response response = fetch_from_origin(request, request_get);
+        const std::string & full_response = response.getRaw();
+
+        // if 304, just use cache
+        if (response.getResult() == 304){
+            LOG_DEBUG(request.getId(),"304 not modified, just use cache");
+            Cache & cache = CacheMaster::getInstance().selectCache(request.getCacheUrl());
+            // fresh again, the next request will not revalidate
+            if (cache.refreshEntry(cache_key(request), std::string(response.getHeadersStr()))){
+                CacheStats::getInstance().add(CacheStats::NOT_MODIFIED);
+            }
+            std::string cached = returnCache(client_fd, request);
+            finish_flight(client_fd, CollapsedForwarding::SUCCEEDED, cached);
+            return;
+        }else if(isServerError(response.getResult())){
+            throw std::runtime_error("server answered " + to_string(response.getResult()));
+        }else {// modified (or gone), send the new response to client
+            LOG_DEBUG(request.getId(),to_string(response.getResult())+" modified, use new response");
+            send_to_client(client_fd, request, full_response);
+        }
+
+        // cache it if ok
+        if (Cache::isCacheable(response)){
+            LOG_DEBUG(request.getId(), "response cacheable");
+            // Cache & cache = Cache::getInstance();
+            LOG_DEBUG(request.getId(),"try to cache: "+std::string(request.getUrl()));
+            cache_response(request, response);
+            finish_flight(client_fd, CollapsedForwarding::SUCCEEDED, full_response);
+        }else{
+            LOG_DEBUG(request.getId(), "not cacheable");
+            finish_flight(client_fd, CollapsedForwarding::UNCACHEABLE, "");
+        }
+    }
+    catch (const std::exception& e) {
+        LOG_ERROR(request.getId(), "ERROR in handle_get: " + std::string(e.what()));
+        if (!serve_stale_if_error(client_fd, request)){
+            std::string error_response = "HTTP/1.1 502 Bad Gateway\r\nDate: " + HttpDate::now() + "\r\n\r\n";
+            send(client_fd, error_response.c_str(), error_response.length(), 0);
+            LOG_ERROR(request.getId(), "Responding \"HTTP/1.1 502 Bad Gateway\"");
+        }
+        finish_flight(client_fd, CollapsedForwarding::FAILED, "");
+    }
+}
+
+// fetch on a dedicated blocking connection
+Response Proxy::fetch_from_origin(const Request& request, const std::string & request_str) {
+    std::string host_with_port = extract_host(request.getUrl());
+    auto [host, server_port] = parse_host_and_port(host_with_port);
+    return fetch_from(host, server_port, request_str, request.getId());
+}
+
+Response Proxy::fetch_from(const std::string& host, int server_port, const std::string & request_str, int id) {
+    int server_fd = connect_to_server(host, server_port);
+    try {
         // Set receive timeout to 10 seconds (same as test)
         struct timeval timeout;
         timeout.tv_sec = 10;
@@ -983,48 +1152,419 @@ void Proxy::handle_revalid(int client_fd, const Request& request, string & eTag)
         }
 
         // Send the request in chunks to handle large requests
-        send_all(server_fd, request_get, request.getId());
+        send_all(server_fd, request_str, id);
+        Response response = receive(server_fd, id);
+        close(server_fd);
+        LOG_DEBUG(id,"closed server fd: "+to_string(server_fd));
+        if (response.getRaw().empty()) {
+            throw std::runtime_error("Empty response from server");
+        }
+        return response;
+    } catch (const std::exception& e) {
+        close(server_fd);
+        throw;
+    }
+}
 
-        // receive full response from server
-        std::string full_response = receive(server_fd, request.getId());
+std::string Proxy::build_peer_request(const Request& request) {
+    std::string req = "GET " + std::string(request.getUrl()) + " " + std::string(request.getVersion()) + "\r\n";
+    req += "Host: " + extract_host(request.getUrl()) + "\r\n";
+    req += "Connection: close\r\n";
+    req += build_negotiation_headers(request);
+    req += PEER_HEADER + ": " + peers->getSelf() + "\r\n";
+    req += "User-Agent: Mozilla/5.0\r\n";
+    req += "\r\n";
+    return req;
+}
 
-        Parser parser;
-        Response response = parser.parseResponse(vector<char>(full_response.begin(),full_response.end()));
+bool Proxy::fetch_from_peer(int client_fd, const Request& request){
+    // a sibling's request is ours to fetch, passing it on could loop
+    if (peers == nullptr || !request.getHeader(PEER_HEADER).empty()) {
+        return false;
+    }
+    std::optional<PeerSet::Peer> owner = peers->ownerOf(request.getCacheUrl());
+    if (!owner) {
+        return false;
+    }
+    std::string peer_name = owner->host + ":" + to_string(owner->port);
+    LOG_INFO(request.getId(), "Requesting \"" + std::string(request.getRequestLine()) + "\" from peer " + peer_name);
+    CacheStats & stats = CacheStats::getInstance();
+    stats.add(CacheStats::PEER_FETCHES);
+    Response response;
+    try {
+        response = fetch_from(owner->host, owner->port, build_peer_request(request), request.getId());
+    } catch (const std::exception& e) {
+        LOG_WARNING(request.getId(), "peer " + peer_name + " failed: " + std::string(e.what()));
+        stats.add(CacheStats::PEER_FAILURES);
+        peers->markDown(*owner);
+        return false;
+    }
 
+    const std::string & full_response = response.getRaw();
+    // the owner could not reach the origin either, let the normal path decide
+    if (isServerError(response.getResult())) {
+        LOG_WARNING(request.getId(), "peer " + peer_name + " answered " + to_string(response.getResult()));
+        stats.add(CacheStats::PEER_FAILURES);
+        return false;
+    }
+    LOG_INFO(request.getId(), "Received \"" + std::string(response.getFirstLine()) + "\" from peer " + peer_name);
+    send_to_client(client_fd, request, full_response);
+    LOG_INFO(request.getId(), "Responding \""+std::string(response.getFirstLine())+"\"");
+
+    // keep a copy here as well, the next hit needs no hop
+    if (Cache::isCacheable(response)){
+        cache_response(request, response);
+        finish_flight(client_fd, CollapsedForwarding::SUCCEEDED, full_response);
+    }else{
+        finish_flight(client_fd, CollapsedForwarding::UNCACHEABLE, "");
+    }
+    return true;
+}
 
-        // if 304, just use cache
-        if (response.getResult() == 304){
-            logger.debug(request.getId(),"304 not modified, just use cache");
-            returnCache(client_fd, request);
-            return;
-        }else if(response.getResult() == 200){// if 200, send response to client
-            logger.debug(request.getId(),"200  modified, use new response");
-            send_all(client_fd, full_response, request.getId());
-        }else {
-            throw std::runtime_error("Empty response from server");
+// refresh a stale entry on the thread pool, at most one refresh per url
+void Proxy::refresh_in_background(const Request& request){
+    std::string key = cache_key(request);
+    auto flight = collapser.lead(key);
+    if (flight == nullptr) {
+        LOG_DEBUG(request.getId(), "refresh of " + key + " already in flight");
+        return;
+    }
+    CacheStats::getInstance().add(CacheStats::BACKGROUND_REFRESH_STARTED);
+    LOG_DEBUG(request.getId(), "background refresh of " + key);
+
+    // the refresh outlives the connection, it works on its own copy
+    auto copy = std::make_shared<const Request>(request.clone());
+    threadpool.enqueue([this, copy, key, flight](){
+        const Request & request = *copy;
+        Cache & cache = CacheMaster::getInstance().selectCache(key);
+        try {
+            std::string eTag;
+            time_t lastModified = 0;
+            std::optional<CacheEntry> entry = cache.copyEntry(key);
+            if (entry) {
+                eTag = entry->getETag();
+                lastModified = entry->hasLastModified() ? entry->getLastModified() : 0;
+            }
+            bool conditional = !eTag.empty() || lastModified != 0;
+            std::string request_str = conditional ? build_revalid_request(request, eTag, lastModified) : build_get_request(request);
+            if (conditional) {
+                CacheStats::getInstance().add(CacheStats::REVALIDATIONS);
+            }
+            Response response = fetch_from_origin(request, request_str);
+            const std::string & full_response = response.getRaw();
+            if (response.getResult() == 304 && conditional && cache.refreshEntry(key, std::string(response.getHeadersStr()))) {
+                // unchanged, merged in place
+                CacheStats::getInstance().add(CacheStats::NOT_MODIFIED);
+                entry = cache.copyEntry(key);
+                std::string cached = entry ? entry->getFullResponse() : "";
+                collapser.complete(key, flight, entry ? shareable(entry->getResponseHeaders()) : CollapsedForwarding::FAILED, cached);
+            } else if (isServerError(response.getResult())) {
+                throw std::runtime_error("server answered " + to_string(response.getResult()));
+            } else if (Cache::isCacheable(response)) {
+                cache_response(request, response);
+                collapser.complete(key, flight, shareable(full_response), full_response);
+            } else {
+                cache.removeEntry(key);
+                collapser.complete(key, flight, CollapsedForwarding::UNCACHEABLE, "");
+            }
+            CacheStats::getInstance().add(CacheStats::BACKGROUND_REFRESH_SUCCEEDED);
+            LOG_DEBUG(request.getId(), "background refresh of " + key + " done");
+        } catch (const std::exception& e) {
+            CacheStats::getInstance().add(CacheStats::BACKGROUND_REFRESH_FAILED);
+            LOG_WARNING(request.getId(), "background refresh of " + key + " failed: " + std::string(e.what()));
+            collapser.complete(key, flight, CollapsedForwarding::FAILED, "");
         }
-        
-        // close it
-        close(server_fd);
-        logger.debug(request.getId(),"closed server fd: "+to_string(server_fd));
+    });
+}
 
-        // cache it if ok
-        if (Cache::isCacheable(response)){
-            logger.debug(request.getId(), "response cacheable");
-            // Cache & cache = Cache::getInstance();
-            Cache & cache = CacheMaster::getInstance().selectCache(request.getUrl());
+// sendfile a fresh response from the disk tier, promote it on its second hit
+bool Proxy::serve_from_disk(int client_fd, const Request& request){
+    DiskCache * disk = CacheMaster::getInstance().getDiskCache();
+    // requests with their own cache directives take the normal path
+    if (disk == nullptr || request.getCacheControl().has_cache_control) {
+        return false;
+    }
+    std::string key = cache_key(request);
+    DiskCache::Location location;
+    if (!disk->lookup(key, location)) {
+        return false;
+    }
 
-            CacheEntry cacheEntry("200", response.getHeadersStr(), response.getBody());
-            logger.debug(request.getId(),"try to cache: "+request.getUrl());
-            cache.addToCache(request.getUrl(), "200", response.getHeadersStr(), response.getBody());
-        }else{
-            logger.debug(request.getId(), "not cacheable");
+    LOG_INFO(request.getId(), "in cache, valid");
+    try {
+        // sendfile only works when the stored bytes suit the client
+        if (location.gzip && !Compression::acceptsGzip(request.getHeader("Accept-Encoding"))) {
+            std::string stored;
+            if (!disk->read(key, location, stored)) {
+                return false;
+            }
+            send_to_client(client_fd, request, stored);
+        } else if (!disk->sendTo(client_fd, key, location)) {
+            return false;
         }
+    } catch (const std::exception& e) {
+        LOG_ERROR(request.getId(), "ERROR in serve_from_disk: " + std::string(e.what()));
+        close_fd(client_fd);
+        return true;
     }
-    catch (const std::exception& e) {
-        logger.error(request.getId(), "ERROR in handle_get: " + std::string(e.what()));
-        std::string error_response = "HTTP/1.1 502 Bad Gateway\r\n\r\n";
-        send(client_fd, error_response.c_str(), error_response.length(), 0);
-        logger.error(request.getId(), "Responding \"HTTP/1.1 502 Bad Gateway\"");
+    CacheStats::getInstance().add(CacheStats::DISK_HITS);
+
+    std::string response;
+    if (location.hits >= 2 && disk->read(key, location, response)) {
+        size_t header_end = response.find("\r\n\r\n");
+        if (header_end != std::string::npos) {
+            CacheEntry entry("200", response.substr(0, header_end + 4), response.substr(header_end + 4),
+                             location.creation_time, location.expires_time);
+            CacheMaster::getInstance().selectCache(key).addEntry(key, entry);
+            CacheStats::getInstance().add(CacheStats::DISK_PROMOTIONS);
+            LOG_DEBUG(request.getId(), "promoted " + key + " from disk");
+        }
+    }
+    return true;
+}
+
+bool Proxy::fill_from_shared(const std::string & key){
+    SharedCache * shared = CacheMaster::getInstance().getSharedCache();
+    std::string response;
+    SharedCache::Meta meta;
+    if (shared == nullptr || !shared->lookup(key, response, meta)) {
+        return false;
+    }
+    size_t header_end = response.find("\r\n\r\n");
+    if (header_end == std::string::npos) {
+        return false;
+    }
+    CacheEntry entry("200", response.substr(0, header_end + 4), response.substr(header_end + 4),
+                     meta.creation_time, meta.expires_time);
+    Cache & cache = CacheMaster::getInstance().selectCache(key);
+    cache.addEntry(key, entry);
+    // admission may have turned it away
+    if (!cache.contains(key)) {
+        return false;
+    }
+    CacheStats::getInstance().add(CacheStats::SHARED_HITS);
+    LOG_DEBUG("filled " + key + " from the shared tier");
+    return true;
+}
+
+// on an origin error answer from a copy allowed by stale-if-error
+bool Proxy::serve_stale_if_error(int client_fd, const Request& request){
+    Cache & cache = CacheMaster::getInstance().selectCache(request.getCacheUrl());
+    std::optional<CacheEntry> entry = cache.copyEntry(cache.lookupKey(request));
+    if (!entry || !entry->canServeStaleIfError()) {
+        return false;
+    }
+    std::string response = entry->getFullResponse();
+    CacheStats::getInstance().add(CacheStats::STALE_IF_ERROR_SERVED);
+    LOG_WARNING(request.getId(), "origin failed, serving stale copy (stale-if-error)");
+    LOG_INFO(request.getId(), "Responding \"" + response.substr(0, response.find("\r\n")) + "\"");
+    try {
+        send_to_client(client_fd, request, response);
+    } catch (const std::exception& e) {
+        LOG_ERROR(request.getId(), "ERROR in serve_stale_if_error: " + std::string(e.what()));
+    }
+    return true;
+}
+
+bool Proxy::isUnsafe(Request::Method method){
+    return method == Request::Method::POST || method == Request::Method::PUT ||
+           method == Request::Method::DELETE || method == Request::Method::PATCH;
+}
+
+// RFC 9111 4.4: the target, and Location/Content-Location on the same
+// host, may have changed
+void Proxy::invalidate(const Request& request, const Response& response){
+    CacheMaster & master = CacheMaster::getInstance();
+    // only GET requests carry a normalized cache url
+    std::string target = CacheKey::getInstance().normalize(request.getUrl());
+    master.purge(target);
+
+    size_t host_end = target.find('/', target.find("://") + 3);
+    std::string origin = target.substr(0, host_end);
+    for (const char * name : {"Location", "Content-Location"}) {
+        std::string value(response.getHeader(name));
+        if (value.empty()) {
+            continue;
+        }
+        std::string url = CacheKey::getInstance().normalize(value[0] == '/' ? origin + value : value);
+        // another host cannot make us drop its entries
+        if (url != target && url.compare(0, origin.size() + 1, origin + "/") == 0) {
+            master.purge(url);
+        }
+    }
+    LOG_DEBUG(request.getId(), "invalidated " + target + " after " + std::string(request.getMethodName()));
+}
+
+// errors a stale-if-error copy may stand in for (RFC 5861)
+bool Proxy::isServerError(int status){
+    return status == 500 || status == 502 || status == 503 || status == 504;
+}
+
+bool Proxy::wait_for_leader(int client_fd, const Request& request){
+    std::string key = cache_key(request);
+    bool leader = false;
+    auto flight = collapser.join(key, leader);
+    if (flight == nullptr) {
+        return false;
+    }
+
+    // first miss: remember the flight on the conn so the response is published
+    if (leader) {
+        std::lock_guard<std::mutex> lk(fd_map_mtx);
+        auto it = fd_to_conn.find(client_fd);
+        if (it == fd_to_conn.end()) {
+            collapser.complete(key, flight, CollapsedForwarding::FAILED, "");
+            return false;
+        }
+        it->second->flight_key = key;
+        it->second->flight = flight;
+        return false;
+    }
+
+    LOG_INFO(request.getId(), "waiting on in-flight fetch of " + key);
+    std::string response;
+    CollapsedForwarding::Outcome outcome = collapser.wait(key, flight, response, COLLAPSE_TIMEOUT_SEC);
+    switch (outcome) {
+        case CollapsedForwarding::SUCCEEDED:{
+            try {
+                send_to_client(client_fd, request, response);
+                LOG_INFO(request.getId(), "Responding \"" + response.substr(0, response.find("\r\n")) + "\" (collapsed)");
+            } catch (const std::exception& e) {
+                LOG_ERROR(request.getId(), "ERROR in wait_for_leader: " + std::string(e.what()));
+                close_fd(client_fd);
+            }
+            return true;
+        }
+        case CollapsedForwarding::UNCACHEABLE:{
+            LOG_DEBUG(request.getId(), "collapsed response not shareable, fetch directly");
+            return false;
+        }
+        case CollapsedForwarding::FAILED:{
+            LOG_WARNING(request.getId(), "collapsed fetch failed, fetch directly");
+            return false;
+        }
+        case CollapsedForwarding::TIMED_OUT:{
+            LOG_WARNING(request.getId(), "collapsed fetch timed out, fetch directly");
+            return false;
+        }
+    }
+    return false;
+}
+
+void Proxy::cache_response(const Request& request, Response & response){
+    std::string headers(response.getHeadersStr());
+    // the body goes from the response buffer straight into the entry
+    std::string_view body = response.getBody();
+    std::string compressed;
+    std::string key = Cache::variantKey(request.getCacheUrl(), Cache::parseVary(headers), request);
+    // the parser already joined the chunks, describe the body we keep
+    if (Compression::getHeader(headers, "Transfer-Encoding") != "") {
+        Compression::removeHeader(headers, "Transfer-Encoding");
+        Compression::removeHeader(headers, "Content-Length");
+        Compression::addHeader(headers, "Content-Length", to_string(body.size()));
+    }
+    if (Compression::compressForCache(headers, body, compressed)) {
+        LOG_DEBUG("stored " + key + " compressed, " + to_string(body.size()) + " -> " + to_string(compressed.size()) + " bytes");
+        body = compressed;
+    }
+    // callers checked isCacheable, the entry parses the headers once more and that is all
+    CacheEntry entry(to_string(response.getResult()), headers, body);
+    CacheMaster::getInstance().selectCache(key).addEntry(key, entry);
+    // and for the other proxy processes on this host
+    SharedCache * shared = CacheMaster::getInstance().getSharedCache();
+    if (shared != nullptr && shared->store(key, entry)){
+        CacheStats::getInstance().add(CacheStats::SHARED_STORES);
+    }
+    if (entry.needsRevalidation()){
+        LOG_INFO(request.getId(), "cached, but requires re-validation");
+    }else{
+        LOG_INFO(request.getId(), "cached, expires at "+entry.getExpiresTimeStr());
+    }
+}
+
+std::string Proxy::build_range_request(const Request& request, size_t offset, const std::string & validator){
+    std::string req = build_get_request(request);
+    // before the empty line that ends the headers
+    req.insert(req.size() - 2, "Range: bytes=" + to_string(offset) + "-\r\nIf-Range: " + validator + "\r\n");
+    return req;
+}
+
+bool Proxy::complete_partial(const Request& request, const std::string & key, CacheEntry & entry){
+    size_t offset = entry.getBody().size();
+    std::string etag = entry.getETag();
+    // the entry keeps a strong tag without its quotes
+    std::string validator = !etag.empty() && etag.rfind("W/", 0) != 0 ? "\"" + etag + "\"" : HttpDate::format(entry.getLastModified());
+    LOG_DEBUG(request.getId(), "cached body ends at " + to_string(offset) + " of " + to_string(entry.getBodyLength()) + ", fetch the rest");
+    try {
+        Response response = fetch_from_origin(request, build_range_request(request, offset, validator));
+        // a changed resource (If-Range) or an origin without ranges sends it all
+        if (response.getResult() != 206 || !response.getHeader("Content-Encoding").empty() ||
+            response.getHeader("Content-Range").rfind("bytes " + to_string(offset) + "-", 0) != 0) {
+            LOG_INFO(request.getId(), "origin did not send the missing range, answered " + to_string(response.getResult()));
+            return false;
+        }
+        entry.appendBody(response.getBody());
+    } catch (const std::exception& e) {
+        LOG_WARNING(request.getId(), "ERROR in complete_partial: " + std::string(e.what()));
+        return false;
+    }
+    if (entry.isPartial()) {
+        return false;
+    }
+    CacheMaster::getInstance().selectCache(key).addEntry(key, entry);
+    CacheStats::getInstance().add(CacheStats::RANGE_REFILLS);
+    return true;
+}
+
+std::string Proxy::cache_key(const Request& request){
+    return CacheMaster::getInstance().selectCache(request.getCacheUrl()).lookupKey(request);
+}
+
+// content negotiation headers of the client, so origin variants are real
+std::string Proxy::build_negotiation_headers(const Request& request){
+    std::string accept(request.getHeader("Accept"));
+    std::string headers = "Accept: " + (accept.empty() ? std::string("*/*") : accept) + "\r\n";
+    std::string language(request.getHeader("Accept-Language"));
+    if (!language.empty()) {
+        headers += "Accept-Language: " + language + "\r\n";
+    }
+    // whatever the client takes, gzip is what we store
+    headers += "Accept-Encoding: gzip\r\n";
+    return headers;
+}
+
+// a response that varies on request headers only fits requests like the leader's
+CollapsedForwarding::Outcome Proxy::shareable(const std::string & response){
+    std::string headers = response.substr(0, response.find("\r\n\r\n") + 4);
+    return Cache::parseVary(headers).empty() ? CollapsedForwarding::SUCCEEDED : CollapsedForwarding::UNCACHEABLE;
+}
+
+void Proxy::send_to_client(int client_fd, const Request& request, const std::string & response){
+    std::string rewritten;
+    if (!Compression::prepareForClient(response, Compression::acceptsGzip(request.getHeader("Accept-Encoding")), rewritten)) {
+        send_all(client_fd, response, request.getId());
+        return;
+    }
+    CacheStats::getInstance().add(CacheStats::RESPONSE_COPIES);
+    send_all(client_fd, rewritten, request.getId());
+}
+
+void Proxy::finish_flight(int fd, CollapsedForwarding::Outcome outcome, const std::string & response){
+    std::string key;
+    std::shared_ptr<CollapsedForwarding::Flight> flight;
+    {
+        std::lock_guard<std::mutex> lk(fd_map_mtx);
+        auto it = fd_to_conn.find(fd);
+        if (it == fd_to_conn.end() || it->second->flight == nullptr) {
+            return;
+        }
+        key = it->second->flight_key;
+        flight = it->second->flight;
+        it->second->flight_key.clear();
+        it->second->flight.reset();
+    }
+    if (outcome == CollapsedForwarding::SUCCEEDED) {
+        outcome = shareable(response);
     }
+    collapser.complete(key, flight, outcome, response);
 }
\ No newline at end of file
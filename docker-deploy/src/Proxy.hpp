@@ -14,11 +14,15 @@
 #include "CacheDecision.hpp"
 #include "CacheHandler.hpp"
 #include "CacheMaster.hpp"
+#include "CollapsedForwarding.hpp"
 #include "ThreadPool.cpp"
 #include "Conn.hpp"
+#include "Compression.hpp"
+#include "HttpDate.hpp"
+#include "PeerSet.hpp"
+#include <memory>
 #include <condition_variable>
 #include <boost/asio.hpp>
-#include <boost/beast.hpp>
 #include <cerrno>
 
 class Proxy {
@@ -41,6 +45,9 @@ public:
     // Get the current port
     int getPort() const { return port; }
 
+    // ask sibling proxies before the origin, set before traffic starts
+    void setPeers(std::shared_ptr<PeerSet> peer_set) { peers = peer_set; }
+
 private:
     // Setup server socket
     void setup_server();
@@ -83,26 +90,89 @@ private:
     int connect_to_server(const std::string& host, int port);
     
     // Extract host from URL
-    std::string extract_host(const std::string& url);
+    std::string extract_host(std::string_view url);
     
     // Parse host and port
     std::pair<std::string, int> parse_host_and_port(const std::string& host_str);
 
-    // receive full response by recv and beast parser
-    std::string receive(int server_fd, int id);
+    // receive one full response, parsed as its bytes come in
+    Response receive(int server_fd, int id);
 
     // send full data to fd
-    void send_all(int client_fd, std::string full_response, int id);
+    void send_all(int client_fd, const std::string & full_response, int id);
+
+    // send a cached response with writev, straight from its body segments
+    void send_entry(int client_fd, const CacheEntry & entry, int id);
 
     void handle_cache(int client_fd, const Request& request);
 
     void revalid(int client_fd, const Request& request);
 
-    void returnCache(int client_fd, const Request& request);
+    // sends the cached entry and returns it; throws if it is gone
+    std::string returnCache(int client_fd, const Request& request);
+
+    std::string build_revalid_request(const Request& request, const string & eTag, time_t lastModified);
+
+    void handle_revalid(int client_fd, const Request& request, const string & eTag, time_t lastModified);
+
+    // fetch synchronously on a dedicated connection
+    Response fetch_from_origin(const Request& request, const std::string & request_str);
+
+    Response fetch_from(const std::string& host, int port, const std::string & request_str, int id);
+
+    // absolute-form GET for the owning sibling, marked so it goes no further
+    std::string build_peer_request(const Request& request);
+
+    // a miss another node owns: get it from that node, false to go to the origin
+    bool fetch_from_peer(int client_fd, const Request& request);
+
+    // refresh a stale entry on the thread pool, at most once per url
+    void refresh_in_background(const Request& request);
+
+    // answer from a stale entry allowed by stale-if-error, true if served
+    bool serve_stale_if_error(int client_fd, const Request& request);
+
+    static bool isServerError(int status);
+
+    // methods that may change the resource: forwarded, never cached
+    static bool isUnsafe(Request::Method method);
 
-    std::string build_revalid_request(const Request& request, string & eTag);
+    // a successful unsafe request drops the cached copies it may have changed
+    void invalidate(const Request& request, const Response& response);
 
-    void handle_revalid(int client_fd, const Request& request, string & eTag);
+    // answer a memory miss from the disk tier, true if served
+    bool serve_from_disk(int client_fd, const Request& request);
+
+    // copy a response another process put in the shared tier into our
+    // memory tier, true if it is there now
+    bool fill_from_shared(const std::string & key);
+
+    // wait on an in-flight fetch of the same url, true if the client was served
+    bool wait_for_leader(int client_fd, const Request& request);
+
+    // GET for the bytes of url from offset on, if it still matches validator
+    std::string build_range_request(const Request& request, size_t offset, const std::string & validator);
+
+    // fetch the evicted tail of a partial body, true once entry is whole again
+    bool complete_partial(const Request& request, const std::string & key, CacheEntry & entry);
+
+    // store a cacheable origin response under its variant, compressing text bodies
+    void cache_response(const Request& request, Response & response);
+
+    // cache key of the variant this request selects
+    std::string cache_key(const Request& request);
+
+    std::string build_negotiation_headers(const Request& request);
+
+    // SUCCEEDED unless waiters could need another variant
+    static CollapsedForwarding::Outcome shareable(const std::string & response);
+
+    // send a (possibly gzip) response the way this client accepts it,
+    // copied only if it has to be inflated
+    void send_to_client(int client_fd, const Request& request, const std::string & response);
+
+    // publish the leader's result to collapsed waiters
+    void finish_flight(int fd, CollapsedForwarding::Outcome outcome, const std::string & response);
 
     void close_fd(int fd);
 
@@ -119,12 +189,18 @@ private:
     int listen_fd;
     int port;
     Logger& logger;
-    bool running;
+    std::atomic<bool> running;
     // std::vector<std::thread> threads;
     std::mutex thread_mutex;
     std::condition_variable shutdown_cv;
     bool shutdown_requested;
 
+    // concurrent misses waiting on one origin fetch
+    CollapsedForwarding collapser;
+
+    // sibling proxies, nullptr when running alone
+    std::shared_ptr<PeerSet> peers;
+
     ThreadPool threadpool;
     int epfd = -1;
     // fd to its conn
@@ -1,15 +1,121 @@
 #include "Request.hpp"
-#include <sstream>
-#include <algorithm>
-
-namespace beast = boost::beast;
-namespace http = boost::beast::http;
-namespace asio = boost::asio;
+#include "HeaderScanner.hpp"
+#include <stdexcept>
+#include <cstring>
+#include <cctype>
 
 std::atomic<int> Request::next_id(0);
 
+namespace {
+
+const std::pair<std::string_view, Request::Method> METHODS[] = {
+    {"GET", Request::Method::GET},
+    {"HEAD", Request::Method::HEAD},
+    {"POST", Request::Method::POST},
+    {"PUT", Request::Method::PUT},
+    {"DELETE", Request::Method::DELETE},
+    {"PATCH", Request::Method::PATCH},
+    {"OPTIONS", Request::Method::OPTIONS},
+    {"TRACE", Request::Method::TRACE},
+    {"CONNECT", Request::Method::CONNECT},
+};
+
+bool isVersion(std::string_view version) {
+    return version.size() == 8 && version.substr(0, 5) == "HTTP/" &&
+           isdigit(static_cast<unsigned char>(version[5])) && version[6] == '.' &&
+           isdigit(static_cast<unsigned char>(version[7]));
+}
+
+}
+
+Request::Request(std::vector<char> && data) : id(-1), data(std::move(data)), method(Method::OTHER) {
+    parse();
+    id = next_id++;
+}
+
+Request::Method Request::toMethod(std::string_view name) {
+    for (const auto & [method_name, method] : METHODS) {
+        if (name == method_name) {
+            return method;
+        }
+    }
+    return Method::OTHER;
+}
+
+void Request::parse() {
+    std::string_view received(data.data(), data.size());
+    const char * end = data.data() + data.size();
+
+    // request-line = method SP request-target SP HTTP-version
+    const char * method_end = HeaderScanner::skipToken(data.data(), end);
+    size_t line_end = method_end == end ? std::string_view::npos : HeaderFields::lineEnd(received, method_end - data.data());
+    if (line_end == std::string_view::npos) {
+        throw std::runtime_error("incomplete request head");
+    }
+    requestLine = received.substr(0, line_end);
+    methodName = requestLine.substr(0, method_end - data.data());
+    size_t last = requestLine.rfind(' ');
+    if (methodName.empty() || *method_end != ' ' || last <= methodName.size()) {
+        throw std::runtime_error("malformed request line");
+    }
+    url = requestLine.substr(methodName.size() + 1, last - methodName.size() - 1);
+    version = requestLine.substr(last + 1);
+    if (url.empty() || url.find_first_of(" \t") != std::string_view::npos || !isVersion(version)) {
+        throw std::runtime_error("malformed request line");
+    }
+    method = toMethod(methodName);
+
+    size_t head_length = headers.parse(received, line_end + 2);
+    if (head_length == 0) {
+        throw std::runtime_error("incomplete request head");
+    }
+
+    char * rest = data.data() + head_length;
+    size_t rest_length = data.size() - head_length;
+    if (headers.isChunked()) {
+        size_t consumed = 0;
+        body = std::string_view(rest, HeaderFields::decodeChunked(rest, rest_length, consumed));
+    } else {
+        long long length = headers.contentLength();
+        if (length > static_cast<long long>(rest_length)) {
+            throw std::runtime_error("incomplete request body");
+        }
+        body = std::string_view(rest, length < 0 ? 0 : length);
+    }
+
+    cacheUrl = method == Method::GET ? CacheKey::getInstance().normalize(url) : std::string(url);
+    parseCacheControl();
+}
+
+Request Request::clone() const {
+    Request copy;
+    copy.id = id;
+    copy.data = data;
+    const char * from = data.data();
+    const char * to = copy.data.data();
+    auto rebase = [from, to](std::string_view view) {
+        return view.empty() ? view : std::string_view(to + (view.data() - from), view.size());
+    };
+    copy.method = method;
+    copy.methodName = rebase(methodName);
+    copy.url = rebase(url);
+    copy.version = rebase(version);
+    copy.requestLine = rebase(requestLine);
+    copy.headers = headers;
+    copy.headers.rebase(from, to);
+    copy.body = rebase(body);
+    copy.cacheUrl = cacheUrl;
+    copy.cacheControl = cacheControl;
+    return copy;
+}
 
-std::string Request::getHeader(const std::string& key) const {
-    auto it = headers.find(key);
-    return (it != headers.end()) ? std::string(it->value()) : "";
+void Request::parseCacheControl() {
+    std::string_view value = headers.get("Cache-Control");
+    if (!value.empty()) {
+        cacheControl.parseCacheControl(value);
+        return;
+    }
+    if (headers.get("Pragma").find("no-cache") != std::string_view::npos) {
+        cacheControl.parseCacheControl("no-cache");
+    }
 }
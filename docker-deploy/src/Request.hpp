@@ -2,52 +2,80 @@
 #define REQUEST_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <map>
 #include <atomic>
-#include <boost/asio.hpp>
-#include <boost/beast.hpp>
 #include "Logger.hpp"
+#include "CacheKey.hpp"
+#include "HeaderMeta.hpp"
+#include "HeaderFields.hpp"
 
-namespace beast = boost::beast;
-namespace http = boost::beast::http;
-namespace asio = boost::asio;
+// A client request parsed in place. The request owns the bytes it was
+// received in, every getter returns a view into them, so passing a request
+// through the proxy copies no header. Move-only: moving keeps the bytes
+// where they are, clone() makes the one deep copy for work that outlives
+// the connection.
+class Request {
+public:
+    enum class Method { GET, HEAD, POST, PUT, DELETE, PATCH, OPTIONS, TRACE, CONNECT, OTHER };
 
+    Request() : id(-1), method(Method::OTHER) {}
+    // data holds exactly the bytes received; throws runtime_error if they
+    // are not one complete request
+    explicit Request(std::vector<char> && data);
 
-class Request {
-private:
-    static std::atomic<int> next_id;
-    int id;
-    http::fields headers;
-    std::string body;
-    static inline Logger & logger = Logger::getInstance();
-    http::request<http::string_body> request;
-    std::string requestStr;
+    Request(Request && other) = default;
+    Request & operator=(Request && other) = default;
+    Request(const Request & other) = delete;
+    Request & operator=(const Request & other) = delete;
 
-public:
-    Request() : id(-1){}
-    Request(http::request<http::string_body> req):id(next_id++),request(req),headers(req.base()),body(req.body()){}
+    // same id, own copy of the bytes
+    Request clone() const;
 
     int getId() const { return id; }
-    
-    std::string getMethod() const { return std::string(request.method_string()); }
-    std::string getUrl() const { return std::string(request.target()); }
-    std::string getVersion() const { 
-        return "HTTP/" 
-        + std::to_string(request.version() / 10) 
-        + "." 
-        + std::to_string(request.version() % 10); 
-    }
-    std::string getHeader(const std::string& key) const;
-
-    bool isGet() const { return getMethod() == "GET"; }
-    bool isPost() const { return getMethod() == "POST"; }
-    bool isConnect() const { return getMethod() == "CONNECT"; }
-
-    const http::fields & getHeaders() const { return headers; }
+
+    Method getMethod() const { return method; }
+    std::string_view getMethodName() const { return methodName; }
+    std::string_view getUrl() const { return url; }
+    // key of the url in the cache, see CacheKey
+    const std::string & getCacheUrl() const { return cacheUrl; }
+    std::string_view getVersion() const { return version; }
+    // "GET http://host/ HTTP/1.1", as logged
+    std::string_view getRequestLine() const { return requestLine; }
+    std::string_view getHeader(std::string_view key) const { return headers.get(key); }
+    // Cache-Control of the request, Pragma: no-cache counts as no-cache
+    const HeaderMeta & getCacheControl() const { return cacheControl; }
+
+    bool isGet() const { return method == Method::GET; }
+    bool isPost() const { return method == Method::POST; }
+    bool isConnect() const { return method == Method::CONNECT; }
+
+    const HeaderFields & getHeaders() const { return headers; }
     bool hasBody() const { return !body.empty(); }
-    std::string getBody() const { return body; }
+    std::string_view getBody() const { return body; }
+
+    static Method toMethod(std::string_view name);
+
+private:
+    void parse();
+    void parseCacheControl();
+
+    static std::atomic<int> next_id;
+    int id;
+    // the request as received, a chunked body is decoded in place
+    std::vector<char> data;
+    Method method;
+    std::string_view methodName;
+    std::string_view url;
+    std::string_view version;
+    std::string_view requestLine;
+    HeaderFields headers;
+    std::string_view body;
+    // normalized once here, every cache lookup of the request reuses it
+    std::string cacheUrl;
+    // request directives, parsed once
+    HeaderMeta cacheControl;
+    static inline Logger & logger = Logger::getInstance();
 };
 
 #endif
-
@@ -1,14 +1,173 @@
 #include "Response.hpp"
-#include <sstream>
+#include "CacheStats.hpp"
+#include "Cache.hpp"
+#include <stdexcept>
+#include <cctype>
+#include <cstring>
 #include <algorithm>
 
-namespace beast = boost::beast;
-namespace http = boost::beast::http;
-namespace asio = boost::asio;
+namespace {
 
+// Content-Length is only a claim: room for at most this much is made up
+// front when objects have no size limit, the rest as the bytes arrive
+constexpr size_t MAX_RESERVE = 1024 * 1024;
 
+std::string_view shift(std::string_view view, const char * from, const char * to) {
+    return view.data() == nullptr ? view : std::string_view(to + (view.data() - from), view.size());
+}
+
+}
+
+Response::Response(std::string_view data) : Response() {
+    if (!parseHead(data)) {
+        throw std::runtime_error("incomplete response head");
+    }
+    frameBody(data, true);
+}
+
+Response::Response(Response && other) noexcept : Response() {
+    *this = std::move(other);
+}
+
+Response & Response::operator=(Response && other) noexcept {
+    const char * from = other.raw.data();
+    id = other.id;
+    result = other.result;
+    version = other.version;
+    firstLine = other.firstLine;
+    head = other.head;
+    headers = other.headers;
+    body = other.body;
+    chunked = other.chunked;
+    decoded = std::move(other.decoded);
+    meta = other.meta;
+    raw = std::move(other.raw);
+    head_length = other.head_length;
+    head_scan = other.head_scan;
+    content_length = other.content_length;
+    scan = other.scan;
+    complete = other.complete;
+    // a short raw lives inside the string and moves with it
+    if (head_length > 0 && !raw.empty() && raw.data() != from) {
+        rebase(from, raw.data());
+    }
+    return *this;
+}
+
+bool Response::parseHead(std::string_view data) {
+    // status-line = HTTP-version SP status-code SP [ reason-phrase ]
+    size_t line_end = HeaderFields::lineEnd(data, 0);
+    if (line_end == std::string_view::npos) {
+        return false;
+    }
+    std::string_view line = data.substr(0, line_end);
+    size_t space = line.find(' ');
+    if (space != 8 || line.substr(0, 5) != "HTTP/" || line.size() < 12 ||
+        (line.size() > 12 && line[12] != ' ')) {
+        throw std::runtime_error("malformed status line");
+    }
+    int status = 0;
+    for (char c : line.substr(9, 3)) {
+        if (!isdigit(static_cast<unsigned char>(c))) {
+            throw std::runtime_error("malformed status code");
+        }
+        status = status * 10 + (c - '0');
+    }
+
+    size_t length = headers.parse(data, line_end + 2);
+    if (length == 0) {
+        return false;
+    }
+    result = status;
+    firstLine = line;
+    version = line.substr(0, space);
+    head = data.substr(0, length);
+    head_length = length;
+    scan = length;
+    chunked = headers.isChunked();
+    content_length = chunked ? -1 : headers.contentLength();
+    meta = HeaderMeta::fromFields(result, headers);
+    CacheStats::getInstance().add(CacheStats::RESPONSE_PARSES);
+    return true;
+}
+
+bool Response::frameBody(std::string_view data, bool eof) {
+    // RFC 9112 6.3: these never carry a body, whatever the headers say
+    if (result < 200 || result == 204 || result == 304) {
+        complete = true;
+    } else if (chunked) {
+        complete = HeaderFields::walkChunks(data, scan, decoded);
+        if (!complete && eof) {
+            throw std::runtime_error("incomplete chunked body");
+        }
+    } else if (content_length >= 0) {
+        if (content_length <= static_cast<long long>(data.size() - head_length)) {
+            body = data.substr(head_length, content_length);
+            complete = true;
+        } else if (eof) {
+            throw std::runtime_error("incomplete response body");
+        }
+    } else if (eof) {
+        // no length, the body ran until the server closed
+        body = data.substr(head_length);
+        complete = true;
+    }
+    return complete;
+}
+
+bool Response::feed(const char * data, size_t size) {
+    if (complete) {
+        return true;
+    }
+    const char * from = raw.data();
+    raw.append(data, size);
+    if (head_length > 0) {
+        if (raw.data() != from) {
+            rebase(from, raw.data());
+        }
+    } else {
+        // parsed once, when the empty line is in; the search goes on
+        // from where the last one stopped
+        size_t start = head_scan > 3 ? head_scan - 3 : 0;
+        head_scan = raw.size();
+        if (raw.find("\r\n\r\n", start) == std::string::npos || !parseHead(raw)) {
+            return false;
+        }
+        // room for the body, up to what could be worth caching
+        if (content_length > 0) {
+            size_t limit = Cache::getMaxObjectSize();
+            size_t room = std::min<size_t>(content_length, limit > 0 ? limit : MAX_RESERVE);
+            from = raw.data();
+            raw.reserve(head_length + room);
+            if (raw.data() != from) {
+                rebase(from, raw.data());
+            }
+        }
+    }
+    if (!frameBody(raw, false)) {
+        return false;
+    }
+    // bytes after the message are not part of it, the views stay put
+    size_t end = chunked ? scan : body.data() != nullptr ? body.data() + body.size() - raw.data() : head_length;
+    raw.resize(end);
+    return true;
+}
+
+void Response::finish() {
+    if (complete || raw.empty()) {
+        return;
+    }
+    if (head_length == 0 && !parseHead(raw)) {
+        throw std::runtime_error("incomplete response head");
+    }
+    frameBody(raw, true);
+}
 
-std::string Response::getHeader(const std::string& key) const {
-    auto it = headers.find(key);
-    return (it != headers.end()) ? std::string(it->value()) : "";
+void Response::rebase(const char * from, const char * to) {
+    version = shift(version, from, to);
+    firstLine = shift(firstLine, from, to);
+    head = shift(head, from, to);
+    body = shift(body, from, to);
+    meta.etag = shift(meta.etag, from, to);
+    headers.rebase(from, to);
 }
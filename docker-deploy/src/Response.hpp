@@ -2,56 +2,84 @@
 #define RESPONSE_HPP
 
 #include <string>
-#include <vector>
-#include <map>
-#include <atomic>
-#include <boost/asio.hpp>
-#include <boost/beast.hpp>
-#include <boost/lexical_cast.hpp>
+#include <string_view>
 #include "Logger.hpp"
 #include "Request.hpp"
+#include "HeaderFields.hpp"
+#include "HeaderMeta.hpp"
 
-namespace beast = boost::beast;
-namespace http = boost::beast::http;
-namespace asio = boost::asio;
-
-
+// An origin response parsed in place. The head and a plain body are views
+// into the bytes it was parsed from; only a chunked body is joined into a
+// string of its own. Either it views bytes the caller keeps alive, or it
+// is fed the bytes as they arrive and owns them, parsing each byte once.
 class Response {
 private:
     int id;
-    http::fields headers;
-    std::string body;
+    int result;
+    std::string_view version;
+    std::string_view firstLine;
+    // status line and header block as received, up to the empty line
+    std::string_view head;
+    HeaderFields headers;
+    std::string_view body;
+    bool chunked;
+    std::string decoded;
+    // what caching needs from the head, found while it was parsed
+    HeaderMeta meta;
+    // the bytes fed so far, empty if the response views the caller's
+    std::string raw;
+    // 0 until the head is in
+    size_t head_length;
+    // raw was searched for the end of the head up to here
+    size_t head_scan;
+    long long content_length;
+    // where the chunked body goes on
+    size_t scan;
+    bool complete;
     static inline Logger & logger = Logger::getInstance();
-    http::response<http::string_body> response;
-    std::string requestStr;
+
+    // false if the head has not arrived completely
+    bool parseHead(std::string_view data);
+    // true once the body is in; at eof a body without framing is, and a
+    // cut short one throws
+    bool frameBody(std::string_view data, bool eof);
+    // point the views at raw after it moved
+    void rebase(const char * from, const char * to);
 
 public:
-    Response() : id(-1){}
-    Response(http::response<http::string_body> res):id(id),response(res),headers(res.base()),body(res.body()){}
+    Response() : id(-1), result(0), chunked(false), head_length(0), head_scan(0), content_length(-1), scan(0), complete(false) {}
+    // data holds one whole response; throws runtime_error if it is not
+    explicit Response(std::string_view data);
+
+    Response(Response && other) noexcept;
+    Response & operator=(Response && other) noexcept;
+    Response(const Response & other) = delete;
+    Response & operator=(const Response & other) = delete;
+
+    // append the next bytes from the server; true once the response is
+    // complete, bytes past its end are dropped. Throws runtime_error if they
+    // cannot be part of a response
+    bool feed(const char * data, size_t size);
+    // the server closed the connection: a body without a length ends here.
+    // Throws runtime_error if the response is cut short; nothing fed at
+    // all is no error, getRaw() stays empty
+    void finish();
+    bool isComplete() const { return complete; }
+    // every byte fed, as it goes to the client and the cache
+    const std::string & getRaw() const { return raw; }
 
     int getId() const { return id; }
-    
-    // std::string getMethod() const { return request.method_string().to_string(); }
-    // std::string getUrl() const { return request.target().to_string(); }
-    std::string getVersion() const { 
-        return "HTTP/" 
-        + std::to_string(response.version() / 10) 
-        + "." 
-        + std::to_string(response.version() % 10); 
-    }
-    std::string getHeader(const std::string& key) const;
-
-    // bool isGet() const { return getMethod() == "GET"; }
-    // bool isPost() const { return getMethod() == "POST"; }
-    // bool isConnect() const { return getMethod() == "CONNECT"; }
-
-    const http::fields & getHeaders() const { return headers; }
-    bool hasBody() const { return !body.empty(); }
-    std::string getHeadersStr(){return boost::lexical_cast<std::string>(response.base());}
-    std::string getBody() const { return body; }
-    int getResult() const { return response.result_int();}
-    std::string getFirstLine() const {return getVersion()+" "+to_string(response.result_int())+" "+boost::lexical_cast<std::string>(response.reason());}
+
+    std::string_view getVersion() const { return version; }
+    std::string_view getHeader(std::string_view key) const { return headers.get(key); }
+
+    const HeaderFields & getHeaders() const { return headers; }
+    const HeaderMeta & getMeta() const { return meta; }
+    bool hasBody() const { return !getBody().empty(); }
+    std::string_view getHeadersStr() const { return head; }
+    std::string_view getBody() const { return chunked ? std::string_view(decoded) : body; }
+    int getResult() const { return result; }
+    std::string_view getFirstLine() const { return firstLine; }
 };
 
 #endif
-
@@ -0,0 +1,97 @@
+#include "SegmentedBody.hpp"
+#include <algorithm>
+#include <cstring>
+
+SegmentedBody::SegmentedBody(string_view data) : length(0) {
+    append(data.data(), data.size());
+}
+
+SegmentedBody::SegmentedBody(const EntryArena::Block & block, size_t offset, size_t size) : length(size) {
+    if (size > 0) {
+        segments.push_back(Segment{block, offset, size});
+    }
+}
+
+void SegmentedBody::append(const char * data, size_t size) {
+    while (size > 0) {
+        if (segments.empty() || segments.back().size == SEGMENT_SIZE) {
+            segments.push_back(Segment{EntryArena::heap()->allocate(min(size, SEGMENT_SIZE)), 0, 0});
+        }
+        Segment & last = segments.back();
+        size_t want = min(size, SEGMENT_SIZE - last.size);
+        // another copy still sends this segment, or it is full: move to a
+        // block of our own with room for the new bytes
+        if (last.block.shared() || last.block.capacity() - last.offset - last.size < want) {
+            // at least double, appending in small pieces stays linear
+            size_t room = max(last.size + want, min(last.size * 2, SEGMENT_SIZE));
+            EntryArena::Block grown = EntryArena::heap()->allocate(room);
+            memcpy(grown.data(), last.data(), last.size);
+            last.block = move(grown);
+            last.offset = 0;
+        }
+        memcpy(last.block.data() + last.offset + last.size, data, want);
+        last.size += want;
+        data += want;
+        size -= want;
+        length += want;
+    }
+}
+
+void SegmentedBody::append(const string & data) {
+    append(data.data(), data.size());
+}
+
+size_t SegmentedBody::size() const {
+    return length;
+}
+
+size_t SegmentedBody::getSegmentNumber() const {
+    return segments.size();
+}
+
+bool SegmentedBody::empty() const {
+    return length == 0;
+}
+
+size_t SegmentedBody::truncate(size_t keep) {
+    size_t freed = 0;
+    while (!segments.empty() && length > keep) {
+        size_t last = segments.back().size;
+        segments.pop_back();
+        length -= last;
+        freed += last;
+    }
+    return freed;
+}
+
+string SegmentedBody::toString() const {
+    string data;
+    data.reserve(length);
+    for (const auto & segment : segments) {
+        data.append(segment.data(), segment.size);
+    }
+    return data;
+}
+
+void SegmentedBody::appendIovecs(vector<struct iovec> & iov, size_t offset) const {
+    for (const auto & segment : segments) {
+        if (offset >= segment.size) {
+            offset -= segment.size;
+            continue;
+        }
+        iov.push_back({const_cast<char *>(segment.data()) + offset, segment.size - offset});
+        offset = 0;
+    }
+}
+
+size_t SegmentedBody::footprint() const {
+    size_t total = 0;
+    for (const auto & segment : segments) {
+        total += segment.block.footprint();
+    }
+    return total;
+}
+
+bool SegmentedBody::viewsInto(const EntryArena::Block & block) const {
+    return segments.size() == 1 && segments[0].block == block;
+}
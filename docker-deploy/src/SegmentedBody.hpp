@@ -0,0 +1,64 @@
+#ifndef SEGMENTEDBODY_HPP
+#define SEGMENTEDBODY_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <sys/uio.h>
+
+#include "EntryArena.hpp"
+
+using namespace std;
+
+// A response body kept as refcounted arena segments of at most 64 KB
+// instead of one string. Copies share the segments, so handing an entry to
+// a sender or to another shard never copies the bytes, and a sender keeps
+// its segments alive even if the entry is evicted meanwhile. A segment is
+// only as big as the bytes it holds, small bodies take small blocks.
+class SegmentedBody {
+public:
+    static constexpr size_t SEGMENT_SIZE = 64 * 1024;
+
+    SegmentedBody() : length(0) {}
+    explicit SegmentedBody(string_view data);
+    // one segment viewing size bytes of block from offset on, no copy
+    SegmentedBody(const EntryArena::Block & block, size_t offset, size_t size);
+
+    // fill the last segment, then start new ones; usable while streaming
+    void append(const char * data, size_t size);
+    void append(const string & data);
+
+    size_t size() const;
+    size_t getSegmentNumber() const;
+    bool empty() const;
+
+    // drop whole segments from the end until at most keep bytes are left,
+    // returns the bytes freed
+    size_t truncate(size_t keep);
+
+    // one contiguous copy, for the paths that need a string
+    string toString() const;
+
+    // point iov at the bytes from offset on, nothing is copied
+    void appendIovecs(vector<struct iovec> & iov, size_t offset = 0) const;
+
+    // bytes of the blocks behind the segments, headers and rounding included
+    size_t footprint() const;
+    // the body is a single segment inside block
+    bool viewsInto(const EntryArena::Block & block) const;
+
+private:
+    struct Segment {
+        EntryArena::Block block;
+        size_t offset;
+        size_t size;
+        const char * data() const { return block.data() + offset; }
+    };
+
+    // never changed while shared, append copies a shared last segment first
+    vector<Segment> segments;
+    size_t length;
+};
+
+#endif
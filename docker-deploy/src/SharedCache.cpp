@@ -0,0 +1,459 @@
+#include "SharedCache.hpp"
+#include "HashRing.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <new>
+
+namespace {
+
+const uint64_t MAGIC = 0x4850524f58594348ULL;   // "HPROXYCH"
+const uint32_t VERSION = 2;
+const size_t STRIPES = 64;
+const size_t MIN_CLASS = 256;
+const int CLASS_NUMBER = 16;                    // 256 B up to 8 MB
+const size_t MIN_SIZE = 1024 * 1024;
+// buckets an eviction looks at before it gives up, so a store that cannot
+// be placed costs a bounded number of stripe locks, not the whole index
+const uint64_t EVICT_SCAN = 256;
+// how long an attaching process waits for the creator to finish
+const int ATTACH_WAIT_MS = 5000;
+
+size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// a robust mutex comes back from a dead owner; every update is a single
+// offset store, so whatever it was doing is either done or not started
+class ShmLock {
+public:
+    explicit ShmLock(pthread_mutex_t * mutex) : mutex(mutex) {
+        if (pthread_mutex_lock(mutex) == EOWNERDEAD) {
+            pthread_mutex_consistent(mutex);
+        }
+    }
+    ~ShmLock() {
+        pthread_mutex_unlock(mutex);
+    }
+private:
+    pthread_mutex_t * mutex;
+};
+
+}
+
+struct SharedCache::Header {
+    uint64_t magic;
+    uint32_t version;
+    atomic<uint32_t> ready;
+    uint64_t total_size;
+    uint64_t bucket_number;     // a power of two
+    uint64_t data_offset;
+    uint64_t bump;              // first byte of the data area never handed out
+    uint64_t free_lists[CLASS_NUMBER];
+    atomic<uint64_t> used;
+    atomic<uint64_t> entries;
+    atomic<uint64_t> clock_hand;
+    pthread_mutex_t alloc_mutex;
+    pthread_mutex_t stripes[STRIPES];
+};
+
+struct SharedCache::Record {
+    uint64_t next;              // offset of the next record of the bucket, 0 ends it
+    uint64_t hash;
+    uint32_t key_len;
+    uint32_t data_len;
+    int64_t creation_time;
+    int64_t expires_time;
+    uint32_t size_class;
+    uint32_t padding;
+
+    char * key() { return reinterpret_cast<char *>(this + 1); }
+    char * data() { return key() + key_len; }
+};
+
+SharedCache::SharedCache(const string & name, size_t size)
+:   name(name),
+    size(max(size, MIN_SIZE)),
+    base(nullptr) {}
+
+SharedCache::~SharedCache() {
+    if (base != nullptr) {
+        munmap(base, size);
+    }
+}
+
+bool SharedCache::open() {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    bool creator = fd >= 0;
+    if (!creator) {
+        if (errno != EEXIST) {
+            LOG_ERROR("shared cache: cannot create " + name + ": " + strerror(errno));
+            return false;
+        }
+        fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0) {
+            LOG_ERROR("shared cache: cannot open " + name + ": " + strerror(errno));
+            return false;
+        }
+    }
+    if (creator && ftruncate(fd, size) != 0) {
+        LOG_ERROR("shared cache: cannot size " + name + ": " + strerror(errno));
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    // the creator may not have sized it yet
+    struct stat st{};
+    for (int waited = 0; !creator && (fstat(fd, &st) != 0 || st.st_size == 0) && waited < ATTACH_WAIT_MS; waited += 10) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    if (!creator) {
+        size = st.st_size;
+    }
+    if (size < sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+    void * mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR("shared cache: cannot map " + name + ": " + strerror(errno));
+        return false;
+    }
+    base = static_cast<char *>(mapped);
+
+    if (creator) {
+        initialize();
+        LOG_INFO("shared cache: created " + name + " (" + to_string(size) + " bytes)");
+        return true;
+    }
+    for (int waited = 0; header()->ready.load(memory_order_acquire) == 0 && waited < ATTACH_WAIT_MS; waited += 10) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    if (header()->ready.load(memory_order_acquire) == 0 || header()->magic != MAGIC || header()->version != VERSION) {
+        LOG_ERROR("shared cache: " + name + " is not a cache segment of this version");
+        munmap(base, size);
+        base = nullptr;
+        return false;
+    }
+    LOG_INFO("shared cache: attached to " + name + " with " + to_string(getEntryNumber()) + " entries");
+    return true;
+}
+
+void SharedCache::initialize() {
+    Header * h = new (base) Header();
+    h->magic = MAGIC;
+    h->version = VERSION;
+    h->total_size = size;
+    // about one bucket per 4 KB of data
+    uint64_t buckets = 1024;
+    while (buckets * 4096 < size) {
+        buckets *= 2;
+    }
+    h->bucket_number = buckets;
+    size_t buckets_offset = alignUp(sizeof(Header), 64);
+    h->data_offset = alignUp(buckets_offset + buckets * sizeof(uint64_t), 4096);
+    h->bump = h->data_offset;
+    memset(base + buckets_offset, 0, buckets * sizeof(uint64_t));
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&h->alloc_mutex, &attr);
+    for (auto & stripe : h->stripes) {
+        pthread_mutex_init(&stripe, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+    h->ready.store(1, memory_order_release);
+}
+
+bool SharedCache::store(const string & key, const CacheEntry & entry) {
+    if (base == nullptr || entry.isPartial()) {
+        return false;
+    }
+    string data = entry.getFullResponse();
+    int size_class = classOf(sizeof(Record) + key.size() + data.size());
+    if (size_class < 0) {
+        return false;
+    }
+    uint64_t offset = allocate(size_class);
+    // full: take a block of this class from an older record
+    for (int attempt = 0; offset == 0 && attempt < 4; attempt++) {
+        if (!evictFor(size_class)) {
+            break;
+        }
+        offset = allocate(size_class);
+    }
+    if (offset == 0) {
+        LOG_DEBUG("shared cache: no room for " + key);
+        return false;
+    }
+
+    // nobody else sees the block before it is linked
+    Record * r = record(offset);
+    r->hash = HashRing::hash(key);
+    r->key_len = key.size();
+    r->data_len = data.size();
+    r->creation_time = entry.getCreationTime();
+    r->expires_time = entry.getExpiresTime();
+    r->size_class = size_class;
+    memcpy(r->key(), key.data(), key.size());
+    memcpy(r->data(), data.data(), data.size());
+
+    uint64_t index = bucketOf(key, r->hash);
+    uint64_t old;
+    {
+        ShmLock lock(stripeOf(index));
+        old = unlinkLocked(&buckets()[index], key, r->hash);
+        r->next = buckets()[index];
+        buckets()[index] = offset;
+    }
+    header()->entries++;
+    header()->used += MIN_CLASS << size_class;
+    if (old != 0) {
+        drop(old);
+    }
+    return true;
+}
+
+bool SharedCache::lookup(const string & key, string & response, Meta & meta) {
+    if (base == nullptr) {
+        return false;
+    }
+    uint64_t hash = HashRing::hash(key);
+    uint64_t index = bucketOf(key, hash);
+    ShmLock lock(stripeOf(index));
+    for (uint64_t offset = buckets()[index]; offset != 0; offset = record(offset)->next) {
+        Record * r = record(offset);
+        if (r->hash == hash && r->key_len == key.size() && memcmp(r->key(), key.data(), key.size()) == 0) {
+            response.assign(r->data(), r->data_len);
+            meta.creation_time = r->creation_time;
+            meta.expires_time = r->expires_time;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SharedCache::remove(const string & key) {
+    if (base == nullptr) {
+        return false;
+    }
+    uint64_t hash = HashRing::hash(key);
+    uint64_t index = bucketOf(key, hash);
+    uint64_t old;
+    {
+        ShmLock lock(stripeOf(index));
+        old = unlinkLocked(&buckets()[index], key, hash);
+    }
+    if (old == 0) {
+        return false;
+    }
+    drop(old);
+    return true;
+}
+
+size_t SharedCache::purge(const string & url) {
+    if (base == nullptr) {
+        return 0;
+    }
+    // url and its variants share a bucket, one chain holds them all
+    uint64_t index = bucketOf(url, HashRing::hash(url));
+    vector<uint64_t> dropped;
+    {
+        ShmLock lock(stripeOf(index));
+        uint64_t * link = &buckets()[index];
+        while (*link != 0) {
+            Record * r = record(*link);
+            bool match = r->key_len >= url.size() && memcmp(r->key(), url.data(), url.size()) == 0 &&
+                         (r->key_len == url.size() || r->key()[url.size()] == '\n');
+            if (match) {
+                dropped.push_back(*link);
+                *link = r->next;
+            } else {
+                link = &r->next;
+            }
+        }
+    }
+    for (uint64_t offset : dropped) {
+        drop(offset);
+    }
+    return dropped.size();
+}
+
+size_t SharedCache::removePrefix(const string & prefix) {
+    if (base == nullptr) {
+        return 0;
+    }
+    size_t removed = 0;
+    for (uint64_t index = 0; index < header()->bucket_number; index++) {
+        vector<uint64_t> dropped;
+        {
+            ShmLock lock(stripeOf(index));
+            uint64_t * link = &buckets()[index];
+            while (*link != 0) {
+                Record * r = record(*link);
+                if (r->key_len >= prefix.size() && memcmp(r->key(), prefix.data(), prefix.size()) == 0) {
+                    dropped.push_back(*link);
+                    *link = r->next;
+                } else {
+                    link = &r->next;
+                }
+            }
+        }
+        for (uint64_t offset : dropped) {
+            drop(offset);
+        }
+        removed += dropped.size();
+    }
+    return removed;
+}
+
+size_t SharedCache::getEntryNumber() const {
+    return base == nullptr ? 0 : header()->entries.load();
+}
+
+size_t SharedCache::getUsed() const {
+    return base == nullptr ? 0 : header()->used.load();
+}
+
+size_t SharedCache::getSize() const {
+    return size;
+}
+
+size_t SharedCache::getMaxRecordSize() {
+    return (MIN_CLASS << (CLASS_NUMBER - 1)) - sizeof(Record);
+}
+
+void SharedCache::unlink(const string & name) {
+    shm_unlink(name.c_str());
+}
+
+SharedCache::Header * SharedCache::header() const {
+    return reinterpret_cast<Header *>(base);
+}
+
+SharedCache::Record * SharedCache::record(uint64_t offset) const {
+    return reinterpret_cast<Record *>(base + offset);
+}
+
+uint64_t * SharedCache::buckets() const {
+    return reinterpret_cast<uint64_t *>(base + alignUp(sizeof(Header), 64));
+}
+
+uint64_t SharedCache::bucketOf(const string & key, uint64_t hash) const {
+    // a variant goes where its url goes, so purging a url is one chain
+    size_t variant = key.find('\n');
+    if (variant != string::npos) {
+        hash = HashRing::hash(string_view(key).substr(0, variant));
+    }
+    return hash & (header()->bucket_number - 1);
+}
+
+pthread_mutex_t * SharedCache::stripeOf(uint64_t bucket) const {
+    return &header()->stripes[bucket % STRIPES];
+}
+
+uint64_t SharedCache::allocate(int size_class) {
+    Header * h = header();
+    size_t block = MIN_CLASS << size_class;
+    ShmLock lock(&h->alloc_mutex);
+    uint64_t offset = h->free_lists[size_class];
+    if (offset != 0) {
+        h->free_lists[size_class] = *reinterpret_cast<uint64_t *>(base + offset);
+        return offset;
+    }
+    if (h->bump + block <= h->total_size) {
+        offset = h->bump;
+        h->bump += block;
+        return offset;
+    }
+    // split the smallest larger free block: the front is ours, the upper
+    // halves go to the free lists of the classes in between
+    for (int larger = size_class + 1; larger < CLASS_NUMBER; larger++) {
+        offset = h->free_lists[larger];
+        if (offset == 0) {
+            continue;
+        }
+        h->free_lists[larger] = *reinterpret_cast<uint64_t *>(base + offset);
+        for (int half = larger - 1; half >= size_class; half--) {
+            uint64_t upper = offset + (MIN_CLASS << half);
+            *reinterpret_cast<uint64_t *>(base + upper) = h->free_lists[half];
+            h->free_lists[half] = upper;
+        }
+        return offset;
+    }
+    return 0;
+}
+
+void SharedCache::release(uint64_t offset, int size_class) {
+    Header * h = header();
+    ShmLock lock(&h->alloc_mutex);
+    *reinterpret_cast<uint64_t *>(base + offset) = h->free_lists[size_class];
+    h->free_lists[size_class] = offset;
+}
+
+// the record is out of the index, nobody can reach it any more
+void SharedCache::drop(uint64_t offset) {
+    int size_class = record(offset)->size_class;
+    header()->entries--;
+    header()->used -= MIN_CLASS << size_class;
+    release(offset, size_class);
+}
+
+bool SharedCache::evictFor(int size_class) {
+    Header * h = header();
+    uint64_t steps = min(h->bucket_number, EVICT_SCAN);
+    for (uint64_t step = 0; step < steps; step++) {
+        uint64_t index = h->clock_hand++ & (h->bucket_number - 1);
+        uint64_t victim = 0;
+        {
+            ShmLock lock(stripeOf(index));
+            uint64_t * link = &buckets()[index];
+            while (*link != 0 && victim == 0) {
+                Record * r = record(*link);
+                // a larger block is split by allocate
+                if (static_cast<int>(r->size_class) >= size_class) {
+                    victim = *link;
+                    *link = r->next;
+                } else {
+                    link = &r->next;
+                }
+            }
+        }
+        if (victim != 0) {
+            drop(victim);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t SharedCache::unlinkLocked(uint64_t * head, const string & key, uint64_t hash) {
+    for (uint64_t * link = head; *link != 0; link = &record(*link)->next) {
+        Record * r = record(*link);
+        if (r->hash == hash && r->key_len == key.size() && memcmp(r->key(), key.data(), key.size()) == 0) {
+            uint64_t offset = *link;
+            *link = r->next;
+            return offset;
+        }
+    }
+    return 0;
+}
+
+int SharedCache::classOf(size_t size) {
+    for (int size_class = 0; size_class < CLASS_NUMBER; size_class++) {
+        if ((MIN_CLASS << size_class) >= size) {
+            return size_class;
+        }
+    }
+    return -1;
+}
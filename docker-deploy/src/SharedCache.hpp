@@ -0,0 +1,98 @@
+#ifndef SHAREDCACHE_HPP
+#define SHAREDCACHE_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <pthread.h>
+
+#include "Logger.hpp"
+#include "CacheEntry.hpp"
+
+using namespace std;
+
+// Cache tier in a POSIX shared memory segment, shared by every proxy
+// process on the host that opens the same name. The segment outlives the
+// processes, so a restarted proxy attaches to a warm cache at once.
+// Inside: a header, a chained hash index and a slab allocator with power
+// of two size classes; everything is addressed by offsets, each process
+// maps the segment wherever it likes. A class that runs dry splits a
+// larger free block. Buckets and the allocator are guarded by process-
+// shared robust mutexes; the next process to lock one whose holder died
+// marks it consistent and carries on. That is safe because a record or
+// block is written in full before the store that links it, and unlinked
+// before it is reused: a process dying mid-update, e.g. while a split
+// hands out its halves one by one, at worst leaks the blocks it held.
+class SharedCache {
+public:
+    struct Meta {
+        int64_t creation_time;
+        int64_t expires_time;
+    };
+
+    // name as for shm_open, e.g. "/proxy-cache"; size is only used by the
+    // process that creates the segment
+    SharedCache(const string & name, size_t size);
+    ~SharedCache();
+
+    // create the segment, or attach to the one another process created
+    bool open();
+
+    // copy a whole response in, replacing any older copy of key; false if
+    // it is too large or no block of its class could be freed
+    bool store(const string & key, const CacheEntry & entry);
+
+    // copy the stored response out, false if key is not there
+    bool lookup(const string & key, string & response, Meta & meta);
+
+    bool remove(const string & key);
+
+    // remove url and every variant of it (url + "\n" + ...), which share
+    // its bucket
+    size_t purge(const string & url);
+
+    // remove every key starting with prefix, walks the whole index
+    size_t removePrefix(const string & prefix);
+
+    size_t getEntryNumber() const;
+    size_t getUsed() const;
+    size_t getSize() const;
+
+    // largest response a block can hold
+    static size_t getMaxRecordSize();
+
+    // drop the name, processes that mapped it keep their view
+    static void unlink(const string & name);
+
+private:
+    struct Header;
+    struct Record;
+
+    Header * header() const;
+    Record * record(uint64_t offset) const;
+    uint64_t * buckets() const;
+    // hash is that of key; variants of a url are placed by the url's
+    uint64_t bucketOf(const string & key, uint64_t hash) const;
+    pthread_mutex_t * stripeOf(uint64_t bucket) const;
+
+    void initialize();
+    uint64_t allocate(int size_class);
+    void release(uint64_t offset, int size_class);
+    // free one block of size_class or larger, walking a bounded number of
+    // buckets like a clock hand; blocks are split, never merged
+    bool evictFor(int size_class);
+    // caller holds the stripe of the bucket; returns the record it took
+    // out of the chain, 0 if key was not there
+    uint64_t unlinkLocked(uint64_t * head, const string & key, uint64_t hash);
+    void drop(uint64_t offset);
+
+    static int classOf(size_t size);
+
+    string name;
+    size_t size;
+    char * base;
+
+    static inline Logger & logger = Logger::getInstance();
+};
+
+#endif
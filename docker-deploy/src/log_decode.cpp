@@ -0,0 +1,95 @@
+// Prints binary proxy logs (PROXY_LOG_FORMAT=binary) as the text log
+// lines, or as JSON lines with --json.
+//
+// usage: log_decode [--json] [--level debug|info|warning|error] file...
+#include "BinaryLog.hpp"
+#include "HttpDate.hpp"
+#include "Logger.hpp"
+#include <iostream>
+#include <cstdio>
+
+static const char * LEVEL_NAMES[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+static string jsonEscape(const string & text) {
+    string escaped;
+    escaped.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char code[8];
+                    snprintf(code, sizeof(code), "\\u%04x", c);
+                    escaped += code;
+                } else {
+                    escaped += c;
+                }
+        }
+    }
+    return escaped;
+}
+
+static void usage() {
+    cerr << "usage: log_decode [--json] [--level debug|info|warning|error] file..." << endl;
+}
+
+int main(int argc, char ** argv) {
+    bool json = false;
+    int lowest = 0;
+    vector<string> files;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--json") {
+            json = true;
+        } else if (arg == "--level" && i + 1 < argc) {
+            try {
+                lowest = static_cast<int>(Logger::parseLevel(argv[++i]));
+            } catch (const exception & e) {
+                cerr << e.what() << endl;
+                return 2;
+            }
+        } else if (!arg.empty() && arg[0] == '-') {
+            usage();
+            return 2;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.empty()) {
+        usage();
+        return 2;
+    }
+
+    int status = 0;
+    for (const string & file : files) {
+        bool whole = BinaryLog::read(file, [&](const BinaryLog::Event & event) {
+            if (event.level < lowest) {
+                return;
+            }
+            const char * level = event.level >= 0 && event.level <= 3 ? LEVEL_NAMES[event.level] : "UNKNOWN";
+            if (json) {
+                cout << "{\"time\":" << event.time << ",\"level\":\"" << level << "\"";
+                if (event.pid >= 0) {
+                    cout << ",\"id\":" << event.pid;
+                }
+                cout << ",\"message\":\"" << jsonEscape(event.message) << "\"}\n";
+            } else {
+                cout << HttpDate::toLocal(event.time) << " [" << level << "] ";
+                if (event.pid >= 0) {
+                    cout << event.pid << ": ";
+                }
+                cout << event.message << '\n';
+            }
+        });
+        if (!whole) {
+            // a log still being written may end in half a record
+            cerr << file << ": not a binary log, or cut off" << endl;
+            status = 1;
+        }
+    }
+    return status;
+}
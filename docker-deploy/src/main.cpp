@@ -1,13 +1,103 @@
 #include "Proxy.hpp"
+#include "Config.hpp"
+#include "CacheSnapshot.hpp"
+#include "AdminServer.hpp"
+#include <csignal>
+#include <memory>
+#include <filesystem>
+#include <thread>
 
 int main() {
     try {
         Logger& logger = Logger::getInstance();
         logger.setLogPath("/var/log/erss/");
-        logger.info("starting proxy...");
+        LOG_INFO("starting proxy...");
+
+        // SIGINT/SIGTERM are taken by a waiter thread so shutdown runs normally
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+        Config & config = Config::getInstance();
+        config.loadFromEnv();
+        if (config.cache_shard_number <= 0) {
+            throw std::runtime_error("PROXY_CACHE_SHARDS must be positive");
+        }
+        if (config.log_overflow != "block" && config.log_overflow != "drop") {
+            throw std::runtime_error("PROXY_LOG_OVERFLOW must be block or drop");
+        }
+        if (config.log_format != "text" && config.log_format != "binary") {
+            throw std::runtime_error("PROXY_LOG_FORMAT must be text or binary");
+        }
+        if (config.log_format == "binary") {
+            logger.setFormat(Logger::Format::BINARY, config.log_rotate_bytes, config.log_rotate_sec);
+        }
+        logger.setLevel(Logger::parseLevel(config.log_level));
+        logger.setRingSize(config.log_ring_size);
+        logger.setOverflow(config.log_overflow == "drop" ? Logger::Overflow::DROP : Logger::Overflow::BLOCK);
+        EntryArena::setHugePages(config.arena_huge_pages);
+        CacheMaster::getInstance().configure(config.cache_shard_number, config.cache_budget, config.negative_cache_budget);
+        CacheEntry::setNegativeTtl(config.negative_ttl_sec);
+        CacheMaster::getInstance().setAdmission(config.cache_admission);
+        Cache::setMaxObjectSize(config.max_object_size);
+
+        CacheKey::Rules key_rules;
+        key_rules.drop_params = CacheKey::parseList(config.key_drop_params);
+        key_rules.keep_params = CacheKey::parseList(config.key_keep_params);
+        key_rules.sort_params = config.key_sort_params;
+        key_rules.lowercase_path = config.key_lowercase_path;
+        CacheKey::getInstance().configure(key_rules);
+        if (!config.disk_cache_dir.empty() &&
+            !CacheMaster::getInstance().enableDiskTier(config.disk_cache_dir, config.disk_segment_size, config.disk_segment_number)) {
+            LOG_WARNING("disk cache disabled, could not open " + config.disk_cache_dir);
+        }
+        if (!config.shared_cache_name.empty() &&
+            !CacheMaster::getInstance().enableSharedTier(config.shared_cache_name, config.shared_cache_size)) {
+            LOG_WARNING("shared cache disabled, could not open " + config.shared_cache_name);
+        }
+
+        std::unique_ptr<CacheSnapshot> snapshot;
+        if (!config.snapshot_dir.empty()) {
+            snapshot = std::make_unique<CacheSnapshot>(config.snapshot_dir, config.snapshot_interval_sec);
+            if (std::filesystem::exists(config.snapshot_dir)) {
+                snapshot->load();
+            }
+            snapshot->start();
+        }
+        
+        std::unique_ptr<AdminServer> admin;
+        if (config.admin_port > 0) {
+            admin = std::make_unique<AdminServer>(config.admin_port);
+            admin->start();
+        }
         
-        Proxy proxy(12345);
+        Proxy proxy(config.port);
+        std::shared_ptr<PeerSet> peers;
+        if (!config.peers.empty()) {
+            peers = std::make_shared<PeerSet>(CacheKey::parseList(config.peers), config.peer_self, config.peer_check_interval_sec);
+            peers->start();
+            proxy.setPeers(peers);
+        }
+        std::thread([&proxy, stop_signals]() {
+            int signal = 0;
+            sigwait(&stop_signals, &signal);
+            proxy.stop();
+        }).detach();
         proxy.run();
+
+        if (peers) {
+            peers->stop();
+        }
+        if (admin) {
+            admin->stop();
+        }
+        if (snapshot) {
+            snapshot->stop();
+        }
+        // everything still in the rings reaches the files
+        logger.shutdown();
         
         return EXIT_SUCCESS;
     } catch (const std::exception& e) {
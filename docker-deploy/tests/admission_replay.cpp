@@ -0,0 +1,110 @@
+// Replays requests through the memory cache with and without the TinyLFU
+// admission filter and reports the hit ratio of both.
+//
+// usage: admission_replay [file] [cache_kb]
+//   file      one URL per line, or a proxy.log to pick the
+//             "GET <url> HTTP/1.1" requests out of; without it a synthetic
+//             trace is used: a Zipf hot set interrupted by crawler sweeps
+//   cache_kb  memory budget, default 8192
+#include "../src/CacheMaster.hpp"
+#include "../src/CacheStats.hpp"
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <cmath>
+
+static bool extract_url(const std::string & line, std::string & url) {
+    size_t get = line.find("\"GET ");
+    if (get == std::string::npos) {
+        if (line.find("://") == std::string::npos) return false;
+        url = line;
+        return true;
+    }
+    size_t start = get + 5;
+    size_t end = line.find(' ', start);
+    if (end == std::string::npos) return false;
+    url = line.substr(start, end - start);
+    return true;
+}
+
+static std::vector<std::string> synthetic_trace() {
+    const int objects = 20000;
+    const int requests = 300000;
+    const int sweep_every = 30000;
+    const int sweep_size = 6000;
+    std::mt19937 rng(568);
+
+    // Zipf(0.9) over the hot set
+    std::vector<double> cdf(objects);
+    double sum = 0;
+    for (int i = 0; i < objects; i++) {
+        sum += 1.0 / std::pow(i + 1, 0.9);
+        cdf[i] = sum;
+    }
+    std::uniform_real_distribution<double> uniform(0, sum);
+
+    std::vector<std::string> trace;
+    int crawled = 0;
+    for (int i = 0; i < requests; i++) {
+        if (i % sweep_every == sweep_every - 1) {
+            // a crawler walks pages nobody will ask for again
+            for (int j = 0; j < sweep_size; j++) {
+                trace.push_back("http://site/archive/" + std::to_string(crawled++));
+            }
+        }
+        size_t rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        trace.push_back("http://site/page/" + std::to_string(rank));
+    }
+    return trace;
+}
+
+static double replay(const std::vector<std::string> & trace, size_t budget, bool admission) {
+    CacheMaster & master = CacheMaster::getInstance();
+    master.configure(8, budget);
+    master.setAdmission(admission);
+    std::string headers = "HTTP/1.1 200 OK\r\nCache-Control: max-age=86400\r\n\r\n";
+    std::string body(8 * 1024 - headers.size() - 3, 'x');
+
+    size_t hits = 0;
+    for (const auto & url : trace) {
+        master.recordAccess(url);
+        Cache & cache = master.selectCache(url);
+        if (cache.contains(url)) {
+            hits++;
+        } else {
+            cache.addToCache(url, "200", headers, body);
+        }
+    }
+    return trace.empty() ? 0.0 : 100.0 * hits / trace.size();
+}
+
+int main(int argc, char ** argv) {
+    std::vector<std::string> trace;
+    if (argc > 1) {
+        std::ifstream in(argv[1]);
+        if (!in.is_open()) {
+            std::cerr << "cannot open " << argv[1] << std::endl;
+            return 1;
+        }
+        std::string line, url;
+        while (std::getline(in, line)) {
+            if (extract_url(line, url)) trace.push_back(url);
+        }
+    } else {
+        trace = synthetic_trace();
+    }
+    size_t budget = (argc > 2 ? std::stoul(argv[2]) : 8192) * 1024;
+
+    // the cache logs every eviction to stdout, mute it while replaying
+    std::streambuf * out = std::cout.rdbuf(nullptr);
+    double without = replay(trace, budget, false);
+    double with = replay(trace, budget, true);
+    std::cout.rdbuf(out);
+    std::cout.clear();
+    std::cout << "requests:               " << trace.size() << std::endl;
+    std::cout << "budget:                 " << budget / 1024 << " KB (8 KB objects)" << std::endl;
+    std::cout << "hit ratio, admit all:   " << without << "%" << std::endl;
+    std::cout << "hit ratio, TinyLFU:     " << with << "%" << std::endl;
+    std::cout << "rejected admissions:    " << CacheStats::getInstance().get(CacheStats::ADMISSION_REJECTED) << std::endl;
+    return 0;
+}
@@ -0,0 +1,130 @@
+// Times the header metadata a cache entry needs, extracted the old way
+// (one std::regex per field) and with the single pass HeaderMeta::parse.
+//
+// usage: header_bench [iterations]
+#include "../src/HeaderMeta.hpp"
+#include <regex>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <ctime>
+
+// the regex extraction the cache used before HeaderMeta, kept for comparison
+namespace regex_path {
+
+time_t parseExpiresTime(const std::string& response_headers, time_t now) {
+    std::regex max_age_regex("Cache-Control:.*?max-age=(\\d+)");
+    std::smatch max_age_match;
+    if (std::regex_search(response_headers, max_age_match, max_age_regex)) {
+        return now + std::stoi(max_age_match[1]);
+    }
+    time_t expires = now + 3600;
+    std::regex expires_regex("Expires: (.+)");
+    std::smatch expires_match;
+    if (std::regex_search(response_headers, expires_match, expires_regex)) {
+        std::string expires_str = expires_match[1];
+        struct tm tm = {};
+        strptime(expires_str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        time_t expires_time = timegm(&tm);
+        if (expires_time > now) {
+            expires = expires_time;
+        }
+    }
+    return expires;
+}
+
+std::string extractETag(const std::string& response_headers) {
+    std::regex etag_regex("ETag: \"?([^\"\r\n]+)\"?", std::regex_constants::icase);
+    std::smatch etag_match;
+    if (std::regex_search(response_headers, etag_match, etag_regex)) {
+        return etag_match[1];
+    }
+    return "";
+}
+
+time_t extractLastModified(const std::string& response_headers, time_t now) {
+    std::regex last_modified_regex("Last-Modified: (.+)");
+    std::smatch last_modified_match;
+    if (std::regex_search(response_headers, last_modified_match, last_modified_regex)) {
+        std::string last_modified_str = last_modified_match[1];
+        struct tm tm = {};
+        strptime(last_modified_str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        time_t last_modified_time = timegm(&tm);
+        return last_modified_time > now ? now : last_modified_time;
+    }
+    return now;
+}
+
+int parseCacheControlSeconds(const std::string& response_headers, const std::string& directive) {
+    std::regex directive_regex("Cache-Control:[^\r\n]*?" + directive + "=(\\d+)", std::regex_constants::icase);
+    std::smatch directive_match;
+    if (std::regex_search(response_headers, directive_match, directive_regex)) {
+        return std::stoi(directive_match[1]);
+    }
+    return -1;
+}
+
+}
+
+static const std::vector<std::string> samples = {
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Mon, 19 Oct 2026 10:00:00 GMT\r\n"
+    "Server: nginx\r\n"
+    "Content-Type: text/html; charset=utf-8\r\n"
+    "Content-Length: 5120\r\n"
+    "Cache-Control: public, max-age=600, stale-while-revalidate=30\r\n"
+    "ETag: \"5f3a-6b1c\"\r\n"
+    "Last-Modified: Sun, 18 Oct 2026 08:49:37 GMT\r\n"
+    "Vary: Accept-Encoding\r\n"
+    "Connection: keep-alive\r\n\r\n",
+
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Mon, 19 Oct 2026 10:00:00 GMT\r\n"
+    "Content-Type: application/json\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Expires: Tue, 20 Oct 2026 10:00:00 GMT\r\n"
+    "X-Request-Id: 8c1e2a4f-91b7-4d0e-a6c2-3f5b9d7e1a20\r\n"
+    "Set-Cookie: session=abc123; Path=/; HttpOnly\r\n\r\n",
+
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: image/png\r\n"
+    "Content-Length: 48213\r\n"
+    "Cache-Control: no-cache, must-revalidate, stale-if-error=86400\r\n"
+    "ETag: W/\"a1b2c3\"\r\n\r\n",
+};
+
+int main(int argc, char ** argv) {
+    long iterations = argc > 1 ? std::stol(argv[1]) : 20000;
+    time_t now = 1760868000;
+    // keep the compiler from dropping the work
+    long sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        const std::string & headers = samples[i % samples.size()];
+        sink += regex_path::parseExpiresTime(headers, now);
+        sink += regex_path::extractETag(headers).size();
+        sink += regex_path::extractLastModified(headers, now);
+        sink += regex_path::parseCacheControlSeconds(headers, "stale-while-revalidate");
+        sink += regex_path::parseCacheControlSeconds(headers, "stale-if-error");
+    }
+    double regex_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        HeaderMeta meta = HeaderMeta::parse(samples[i % samples.size()]);
+        sink += meta.expiresAt(now);
+        sink += meta.etag.size();
+        sink += meta.last_modified;
+        sink += meta.stale_while_revalidate;
+        sink += meta.stale_if_error;
+    }
+    double meta_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+    std::cout << "iterations:   " << iterations << std::endl;
+    std::cout << "regex path:   " << regex_ns << " ns/response" << std::endl;
+    std::cout << "HeaderMeta:   " << meta_ns << " ns/response" << std::endl;
+    std::cout << "speedup:      " << regex_ns / meta_ns << "x" << std::endl;
+    return sink == 42 ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+// Replays request URLs through the cache key normalization and reports
+// the hit ratio an unbounded cache would reach with raw and normalized keys.
+//
+// usage: key_replay <file>   one URL per line, or a proxy.log to pick
+//                            the "GET <url> HTTP/1.1" requests out of
+#include "../src/CacheKey.hpp"
+#include "../src/Config.hpp"
+#include <fstream>
+#include <iostream>
+#include <unordered_set>
+#include <chrono>
+
+static bool extract_url(const std::string & line, std::string & url) {
+    size_t get = line.find("\"GET ");
+    if (get == std::string::npos) {
+        // plain list of urls
+        if (line.find("://") == std::string::npos) return false;
+        url = line;
+        return true;
+    }
+    size_t start = get + 5;
+    size_t end = line.find(' ', start);
+    if (end == std::string::npos) return false;
+    url = line.substr(start, end - start);
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " <url list or proxy.log>" << std::endl;
+        return 1;
+    }
+    std::ifstream in(argv[1]);
+    if (!in.is_open()) {
+        std::cerr << "cannot open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    // same rules the proxy would use
+    Config & config = Config::getInstance();
+    config.loadFromEnv();
+    CacheKey::Rules rules;
+    rules.drop_params = CacheKey::parseList(config.key_drop_params);
+    rules.keep_params = CacheKey::parseList(config.key_keep_params);
+    rules.sort_params = config.key_sort_params;
+    rules.lowercase_path = config.key_lowercase_path;
+    CacheKey & cacheKey = CacheKey::getInstance();
+    cacheKey.configure(rules);
+
+    std::vector<std::string> urls;
+    std::string line, url;
+    while (std::getline(in, line)) {
+        if (extract_url(line, url)) urls.push_back(url);
+    }
+
+    std::unordered_set<std::string> raw, normalized;
+    size_t raw_hits = 0, normalized_hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto & u : urls) {
+        raw_hits += !raw.insert(u).second;
+        normalized_hits += !normalized.insert(cacheKey.normalize(u)).second;
+    }
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    size_t n = urls.size();
+    std::cout << "requests:             " << n << std::endl;
+    std::cout << "distinct raw:         " << raw.size() << std::endl;
+    std::cout << "distinct normalized:  " << normalized.size() << std::endl;
+    std::cout << "hit ratio raw:        " << (n ? 100.0 * raw_hits / n : 0.0) << "%" << std::endl;
+    std::cout << "hit ratio normalized: " << (n ? 100.0 * normalized_hits / n : 0.0) << "%" << std::endl;
+    std::cout << "ns per request:       " << (n ? elapsed / n : 0.0) << std::endl;
+    return 0;
+}
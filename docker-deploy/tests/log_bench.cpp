@@ -0,0 +1,129 @@
+// Requests per second through a proxy answering cache hits, with the log
+// level at debug and at info. Build with -DPROXY_DEBUG_LOG=OFF to see what
+// compiling the debug records out adds on top.
+//
+// usage: log_bench [seconds per level] [client threads]
+// log lines also go to stdout, which is sent to /dev/null while measuring;
+// the results are printed on stderr.
+#include "../src/Proxy.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+static const std::string RESPONSE =
+    "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nCache-Control: max-age=3600\r\n"
+    "Content-Length: 5\r\n\r\nhello";
+
+static int listen_on_loopback(int & port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr*)&addr, &len);
+    port = ntohs(addr.sin_port);
+    listen(fd, 128);
+    return fd;
+}
+
+// one GET through the proxy, true if a whole response came back
+static bool get(int proxy_port, const std::string & request) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(proxy_port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    bool ok = false;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+        send(fd, request.data(), request.size(), 0) == static_cast<ssize_t>(request.size())) {
+        std::string response;
+        char buffer[4096];
+        ssize_t n;
+        while (response.size() < RESPONSE.size() && (n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            response.append(buffer, n);
+        }
+        ok = response.size() >= RESPONSE.size();
+    }
+    close(fd);
+    return ok;
+}
+
+static double requests_per_second(int proxy_port, const std::string & request, int seconds, int clients) {
+    std::atomic<bool> running(true);
+    std::atomic<long> done(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++) {
+        threads.emplace_back([&]() {
+            while (running) {
+                done += get(proxy_port, request);
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+    return done / static_cast<double>(seconds);
+}
+
+int main(int argc, char ** argv) {
+    int seconds = argc > 1 ? std::stoi(argv[1]) : 5;
+    int clients = argc > 2 ? std::stoi(argv[2]) : 8;
+
+    Logger & logger = Logger::getInstance();
+    logger.setLogPath("log_bench_logs/");
+    int console = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+
+    int origin_port = 0;
+    int origin_fd = listen_on_loopback(origin_port);
+    std::thread origin([origin_fd]() {
+        int fd;
+        while ((fd = accept(origin_fd, nullptr, nullptr)) >= 0) {
+            char buffer[4096];
+            recv(fd, buffer, sizeof(buffer), 0);
+            send(fd, RESPONSE.data(), RESPONSE.size(), 0);
+            close(fd);
+        }
+    });
+
+    Proxy proxy(0);
+    std::thread proxy_thread([&proxy]() { proxy.run(); });
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    std::string url = "http://127.0.0.1:" + std::to_string(origin_port) + "/bench";
+    std::string request = "GET " + url + " HTTP/1.1\r\nHost: 127.0.0.1:" + std::to_string(origin_port) + "\r\n\r\n";
+    // the first one fills the cache, every later one is a hit
+    get(proxy.getPort(), request);
+
+    std::cerr << "clients: " << clients << ", " << seconds << " s per level, debug records "
+              << (Logger::DEBUG_COMPILED ? "compiled in" : "compiled out") << std::endl;
+    std::cerr << std::fixed << std::setprecision(0);
+    for (Logger::Level level : {Logger::Level::DEBUG, Logger::Level::INFO}) {
+        logger.setLevel(level);
+        double rate = requests_per_second(proxy.getPort(), request, seconds, clients);
+        logger.flush();
+        std::cerr << (level == Logger::Level::DEBUG ? "level debug: " : "level info:  ") << rate << " requests/s" << std::endl;
+    }
+
+    proxy.stop();
+    proxy_thread.join();
+    shutdown(origin_fd, SHUT_RDWR);
+    close(origin_fd);
+    origin.join();
+    logger.shutdown();
+    dup2(console, STDOUT_FILENO);
+    return 0;
+}
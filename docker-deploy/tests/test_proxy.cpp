@@ -9,12 +9,127 @@
 #include <atomic>
 #include <vector>
 #include "../src/Logger.hpp"
+#include "../src/CacheStats.hpp"
+#include "../src/DiskCache.hpp"
+#include "../src/CacheSnapshot.hpp"
+#include "../src/HashRing.hpp"
+#include "../src/FrequencySketch.hpp"
+#include "../src/SegmentedBody.hpp"
+#include "../src/PrefixIndex.hpp"
+#include "../src/AdminServer.hpp"
+#include "../src/PeerSet.hpp"
+#include "../src/EntryArena.hpp"
+#include "../src/SharedCache.hpp"
+#include "../src/Compression.hpp"
+#include "../src/HeaderMeta.hpp"
+#include "../src/HttpDate.hpp"
+#include "../src/HeaderScanner.hpp"
+#include "../src/BinaryLog.hpp"
+#include <boost/beast/http.hpp>
 #include <iostream>
 #include <cstring>
 #include <filesystem>
 #include <future>
 #include <sys/wait.h>
 #include <signal.h>
+#include <functional>
+#include <fstream>
+#include <random>
+
+// Minimal origin server on localhost, counts every request it answers
+class LocalOrigin {
+public:
+    explicit LocalOrigin(std::function<std::string(const std::string &)> handler, int delay_ms = 0)
+        : handler(handler), delay_ms(delay_ms), hits(0), running(true) {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int opt = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        struct sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = 0;
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(listen_fd, (struct sockaddr*)&addr, &len);
+        port = ntohs(addr.sin_port);
+        listen(listen_fd, 64);
+        acceptor = std::thread([this]() { serve(); });
+    }
+
+    ~LocalOrigin() {
+        running = false;
+        shutdown(listen_fd, SHUT_RDWR);
+        close(listen_fd);
+        if (acceptor.joinable()) acceptor.join();
+        for (auto & t : workers) {
+            if (t.joinable()) t.join();
+        }
+    }
+
+    std::string url(const std::string & path) const {
+        return "http://127.0.0.1:" + std::to_string(port) + path;
+    }
+
+    int getHits() const { return hits; }
+
+private:
+    void serve() {
+        while (running) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) break;
+            workers.emplace_back([this, fd]() {
+                std::string request;
+                char buffer[4096];
+                while (request.find("\r\n\r\n") == std::string::npos) {
+                    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                    if (n <= 0) break;
+                    request.append(buffer, n);
+                }
+                hits++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+                std::string response = handler(request);
+                send(fd, response.c_str(), response.size(), 0);
+                close(fd);
+            });
+        }
+    }
+
+    std::function<std::string(const std::string &)> handler;
+    int delay_ms;
+    std::atomic<int> hits;
+    std::atomic<bool> running;
+    int listen_fd;
+    int port;
+    std::thread acceptor;
+    std::vector<std::thread> workers;
+};
+
+// Read exactly one response (headers + Content-Length body)
+static std::string read_one_response(int sock) {
+    struct timeval tv;
+    tv.tv_sec = 10;
+    tv.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+
+    std::string response;
+    char buffer[4096];
+    size_t expected = std::string::npos;
+    while (expected == std::string::npos || response.size() < expected) {
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n <= 0) break;
+        response.append(buffer, n);
+        size_t header_end = response.find("\r\n\r\n");
+        if (expected == std::string::npos && header_end != std::string::npos) {
+            size_t cl = response.find("Content-Length: ");
+            size_t body_len = 0;
+            if (cl != std::string::npos && cl < header_end) {
+                body_len = std::stoul(response.substr(cl + 16));
+            }
+            expected = header_end + 4 + body_len;
+        }
+    }
+    return response;
+}
 
 class ProxyTest : public ::testing::Test {
 protected:
@@ -866,6 +981,1759 @@ TEST_F(ProxyTest, TestConcurrentRequests) {
     std::cout << "=== Completed TestConcurrentRequests ===" << std::endl;
 }
 
+// ============== Test #14: Collapsed Forwarding ==============
+TEST_F(ProxyTest, TestCollapsedForwarding) {
+    std::cout << "\n=== Starting TestCollapsedForwarding ===" << std::endl;
+
+    LocalOrigin origin([](const std::string &) {
+        return std::string("HTTP/1.1 200 OK\r\n"
+                           "Cache-Control: max-age=60\r\n"
+                           "Content-Length: 9\r\n\r\n"
+                           "collapsed");
+    }, 1000);
+    std::string url = origin.url("/collapse");
+
+    const int NUM_REQUESTS = 5;
+    std::vector<std::thread> threads;
+    std::atomic<int> success_count(0);
+    for (int i = 0; i < NUM_REQUESTS; i++) {
+        threads.emplace_back([this, &url, &success_count]() {
+            int client_sock = create_client_socket();
+            std::string get_request = "GET " + url + " HTTP/1.1\r\n"
+                                      "Host: 127.0.0.1\r\n\r\n";
+            send(client_sock, get_request.c_str(), get_request.size(), 0);
+            std::string response = read_one_response(client_sock);
+            if (response.find("HTTP/1.1 200") == 0 && response.find("collapsed") != std::string::npos) {
+                success_count++;
+            }
+            close(client_sock);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    for (auto & t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(success_count, NUM_REQUESTS) << "Not every collapsed request got the response";
+    EXPECT_EQ(origin.getHits(), 1) << "Concurrent misses were not coalesced";
+
+    // a leader whose client goes away does not hold its followers until
+    // its own fetch ends or the collapse timeout runs out
+    std::atomic<int> asked(0);
+    LocalOrigin slow([&asked](const std::string &) {
+        if (asked++ == 0) {
+            std::this_thread::sleep_for(std::chrono::seconds(5));
+        }
+        return std::string("HTTP/1.1 200 OK\r\nCache-Control: max-age=60\r\nContent-Length: 4\r\n\r\nslow");
+    });
+    std::string slow_url = slow.url("/abandoned");
+    std::string slow_request = "GET " + slow_url + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    int leader_sock = create_client_socket();
+    send(leader_sock, slow_request.c_str(), slow_request.size(), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::future<std::string>> followers;
+    for (int i = 0; i < 2; i++) {
+        followers.push_back(std::async(std::launch::async, [this, &slow_request]() {
+            int client_sock = create_client_socket();
+            send(client_sock, slow_request.c_str(), slow_request.size(), 0);
+            std::string response = read_one_response(client_sock);
+            close(client_sock);
+            return response;
+        }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    close(leader_sock);
+    for (auto & follower : followers) {
+        EXPECT_NE(follower.get().find("slow"), std::string::npos);
+    }
+    double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    EXPECT_LT(waited, 3.0) << "Followers waited on an abandoned leader";
+
+    std::cout << "=== Completed TestCollapsedForwarding ===" << std::endl;
+}
+
+// Send one GET for url through the proxy and return the response
+static std::string proxy_get(int client_sock, const std::string & url, const std::string & extra_headers = "") {
+    std::string get_request = "GET " + url + " HTTP/1.1\r\n"
+                              "Host: 127.0.0.1\r\n" + extra_headers + "\r\n";
+    send(client_sock, get_request.c_str(), get_request.size(), 0);
+    std::string response = read_one_response(client_sock);
+    close(client_sock);
+    return response;
+}
+
+// ============== Test #15: stale-while-revalidate ==============
+TEST_F(ProxyTest, TestStaleWhileRevalidate) {
+    std::cout << "\n=== Starting TestStaleWhileRevalidate ===" << std::endl;
+
+    std::atomic<int> version(0);
+    LocalOrigin origin([&version](const std::string &) {
+        std::string body = "v" + std::to_string(++version);
+        return "HTTP/1.1 200 OK\r\n"
+               "Cache-Control: max-age=1, stale-while-revalidate=30\r\n"
+               "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    });
+    std::string url = origin.url("/swr");
+    uint64_t refreshed = CacheStats::getInstance().get(CacheStats::BACKGROUND_REFRESH_SUCCEEDED);
+
+    EXPECT_NE(proxy_get(create_client_socket(), url).find("v1"), std::string::npos);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+
+    // expired but inside the window: stale copy now, refresh behind it
+    EXPECT_NE(proxy_get(create_client_socket(), url).find("v1"), std::string::npos);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    EXPECT_EQ(origin.getHits(), 2) << "Background refresh did not reach the origin";
+    EXPECT_EQ(CacheStats::getInstance().get(CacheStats::BACKGROUND_REFRESH_SUCCEEDED), refreshed + 1);
+
+    EXPECT_NE(proxy_get(create_client_socket(), url).find("v2"), std::string::npos)
+        << "Refreshed response was not cached";
+
+    std::cout << "=== Completed TestStaleWhileRevalidate ===" << std::endl;
+}
+
+// ============== Test #16: stale-if-error ==============
+TEST_F(ProxyTest, TestStaleIfError) {
+    std::cout << "\n=== Starting TestStaleIfError ===" << std::endl;
+
+    std::atomic<int> calls(0);
+    LocalOrigin origin([&calls](const std::string &) {
+        if (++calls > 1) {
+            return std::string("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+        }
+        return std::string("HTTP/1.1 200 OK\r\n"
+                           "Cache-Control: max-age=1, stale-if-error=60\r\n"
+                           "Content-Length: 6\r\n\r\n"
+                           "stable");
+    });
+    std::string url = origin.url("/sie");
+    uint64_t served = CacheStats::getInstance().get(CacheStats::STALE_IF_ERROR_SERVED);
+
+    EXPECT_NE(proxy_get(create_client_socket(), url).find("stable"), std::string::npos);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+
+    std::string response = proxy_get(create_client_socket(), url);
+    EXPECT_EQ(response.find("HTTP/1.1 200"), 0u) << "Origin error was not masked: " << response;
+    EXPECT_NE(response.find("stable"), std::string::npos);
+    EXPECT_EQ(origin.getHits(), 2);
+    EXPECT_EQ(CacheStats::getInstance().get(CacheStats::STALE_IF_ERROR_SERVED), served + 1);
+
+    // must-revalidate and s-maxage rule out a stale copy, the error goes through
+    for (const std::string cc : {"max-age=1, must-revalidate", "s-maxage=1"}) {
+        std::atomic<int> strict_calls(0);
+        LocalOrigin strict([&strict_calls, cc](const std::string &) {
+            if (++strict_calls > 1) {
+                return std::string("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+            }
+            return "HTTP/1.1 200 OK\r\nCache-Control: " + cc + ", stale-if-error=60\r\n"
+                   "Content-Length: 6\r\n\r\nstrict";
+        });
+        std::string strict_url = strict.url("/sie-strict");
+        EXPECT_NE(proxy_get(create_client_socket(), strict_url).find("strict"), std::string::npos);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+
+        response = proxy_get(create_client_socket(), strict_url);
+        EXPECT_EQ(response.find("strict"), std::string::npos) << cc << " served stale: " << response;
+        EXPECT_EQ(strict.getHits(), 2);
+    }
+    EXPECT_EQ(CacheStats::getInstance().get(CacheStats::STALE_IF_ERROR_SERVED), served + 1);
+
+    std::cout << "=== Completed TestStaleIfError ===" << std::endl;
+}
+
+// ============== Test #17: Disk Tier Recovery ==============
+TEST(DiskCacheTest, TestRecoverAndSendfile) {
+    std::cout << "\n=== Starting TestRecoverAndSendfile ===" << std::endl;
+
+    std::string dir = (std::filesystem::temp_directory_path() / ("proxy-disk-" + std::to_string(getpid()))).string();
+    std::filesystem::remove_all(dir);
+    std::string headers = "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\nContent-Length: 4\r\n\r\n";
+
+    {
+        DiskCache disk(dir, 1024 * 1024, 2);
+        ASSERT_TRUE(disk.open());
+        EXPECT_TRUE(disk.store("http://a/kept", CacheEntry("200", headers, "kept")));
+        EXPECT_TRUE(disk.store("http://a/gone", CacheEntry("200", headers, "gone")));
+        disk.remove("http://a/gone");
+        EXPECT_TRUE(disk.store("http://a/v\ngzip", CacheEntry("200", headers, "vgz!")));
+        EXPECT_TRUE(disk.store("http://a/v\nbr", CacheEntry("200", headers, "vbr!")));
+        EXPECT_TRUE(disk.store("http://a/vv", CacheEntry("200", headers, "next")));
+    }
+
+    // a new instance rebuilds its index from the segment files
+    DiskCache disk(dir, 1024 * 1024, 2);
+    ASSERT_TRUE(disk.open());
+    EXPECT_EQ(disk.getEntryNumber(), 4u);
+
+    // variants are found through their url, also after recovery
+    EXPECT_EQ(disk.purge("http://a/v"), 2u);
+    EXPECT_TRUE(disk.remove("http://a/vv"));
+    EXPECT_EQ(disk.getEntryNumber(), 1u);
+
+    DiskCache::Location location;
+    EXPECT_FALSE(disk.lookup("http://a/gone", location)) << "Tombstone lost on recovery";
+    ASSERT_TRUE(disk.lookup("http://a/kept", location));
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    EXPECT_TRUE(disk.sendTo(fds[0], "http://a/kept", location));
+    char buffer[256];
+    ssize_t n = recv(fds[1], buffer, sizeof(buffer), 0);
+    EXPECT_EQ(std::string(buffer, n), headers + "kept");
+    close(fds[0]);
+    close(fds[1]);
+
+    // recovered keys are indexed too, so a prefix purge finds them
+    EXPECT_TRUE(disk.store("http://a/img/1", CacheEntry("200", headers, "img1")));
+    EXPECT_TRUE(disk.store("http://b/img/1", CacheEntry("200", headers, "img1")));
+    EXPECT_EQ(disk.removePrefix("http://a/"), 2u);
+    EXPECT_FALSE(disk.lookup("http://a/kept", location));
+    EXPECT_EQ(disk.getEntryNumber(), 1u);
+
+    std::filesystem::remove_all(dir);
+    std::cout << "=== Completed TestRecoverAndSendfile ===" << std::endl;
+}
+
+// ============== Test #18: Warm Restart Snapshot ==============
+TEST(CacheSnapshotTest, TestRoundTripAndCorruption) {
+    std::cout << "\n=== Starting TestRoundTripAndCorruption ===" << std::endl;
+
+    std::string path = (std::filesystem::temp_directory_path() / ("proxy-snap-" + std::to_string(getpid()) + ".snap")).string();
+    std::string fresh = "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\nContent-Length: 5\r\n\r\n";
+    std::string expired = "HTTP/1.1 200 OK\r\nCache-Control: max-age=0\r\nContent-Length: 5\r\n\r\n";
+    time_t now = time(nullptr);
+
+    std::vector<std::pair<std::string, CacheEntry>> entries;
+    entries.emplace_back("http://a/fresh", CacheEntry("200", fresh, "fresh", now, now + 600));
+    // expired without a validator, not worth a slot after restart
+    entries.emplace_back("http://a/dead", CacheEntry("200", expired, "dead!", now - 10, now - 5));
+    EXPECT_EQ(CacheSnapshot::writeFile(path, entries), 1u);
+
+    std::vector<std::pair<std::string, CacheEntry>> loaded;
+    ASSERT_EQ(CacheSnapshot::readFile(path, loaded), 1u);
+    EXPECT_EQ(loaded[0].first, "http://a/fresh");
+    EXPECT_EQ(loaded[0].second.getFullResponse(), fresh + "fresh");
+    EXPECT_EQ(loaded[0].second.getExpiresTime(), now + 600);
+
+    // flip one body byte, the whole file must be rejected
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(-10, std::ios::end);
+        file.put('X');
+    }
+    loaded.clear();
+    EXPECT_EQ(CacheSnapshot::readFile(path, loaded), 0u);
+    EXPECT_TRUE(loaded.empty());
+
+    // counts and lengths beyond the file are refused before allocating
+    auto writeRaw = [&path](uint32_t count, uint32_t key_len) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        uint32_t header[6] = {0, 0, count, 0, 0, 0};
+        memcpy(header, "PXSNAP01", 8);
+        file.write(reinterpret_cast<const char *>(header), sizeof(header));
+        if (key_len > 0) {
+            uint32_t record[8] = {key_len, 0, 0, 0, 0, 0, 0, 0};
+            file.write(reinterpret_cast<const char *>(record), sizeof(record));
+            file.write("http://a/\0\0\0\0\0\0\0\0", 17);
+        }
+    };
+    writeRaw(0xffffffff, 0);
+    EXPECT_EQ(CacheSnapshot::readFile(path, loaded), 0u);
+    writeRaw(1, 0xffffffff);
+    EXPECT_EQ(CacheSnapshot::readFile(path, loaded), 0u);
+    EXPECT_TRUE(loaded.empty());
+
+    std::filesystem::remove(path);
+    std::cout << "=== Completed TestRoundTripAndCorruption ===" << std::endl;
+}
+
+// ============== Test #19: Consistent Sharding And Global Budget ==============
+TEST(CacheMasterTest, TestResizeAndGlobalBudget) {
+    std::cout << "\n=== Starting TestResizeAndGlobalBudget ===" << std::endl;
+
+    // growing 8 -> 9 nodes should move about 1/9 of the keys, not 8/9
+    HashRing eight, nine;
+    for (int i = 0; i < 9; i++) {
+        if (i < 8) eight.addNode("shard-" + std::to_string(i));
+        nine.addNode("shard-" + std::to_string(i));
+    }
+    int moved = 0;
+    for (int i = 0; i < 10000; i++) {
+        std::string key = "http://example.com/item/" + std::to_string(i);
+        moved += eight.selectIndex(key) != nine.selectIndex(key);
+    }
+    EXPECT_LT(moved, 2000) << "Too many keys moved: " << moved;
+
+    // every entry lands on one hot shard, it may still use the whole budget
+    CacheMaster & master = CacheMaster::getInstance();
+    master.configure(4, 64 * 1024);
+    // never requested urls, the admission filter would keep them all out
+    master.setAdmission(false);
+    std::string headers = "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\n\r\n";
+    std::string body(1000, 'x');
+    Cache & hot = master.getCache(0);
+    int stored = 0;
+    for (int i = 0; stored < 100; i++) {
+        std::string url = "http://hot/" + std::to_string(i);
+        if (master.selectIndex(url) == 0) {
+            hot.addToCache(url, "200", headers, body);
+            stored++;
+        }
+    }
+    EXPECT_LE(master.getUsed(), master.getBudget());
+    EXPECT_GT(hot.getCurrentSize(), master.getBudget() / 2) << "Hot shard limited to a fixed slice";
+
+    // inserts into other shards evict from the hot one through the clock
+    for (int i = 0; i < 200; i++) {
+        std::string url = "http://cold/" + std::to_string(i);
+        if (master.selectIndex(url) != 0) {
+            master.selectCache(url).addToCache(url, "200", headers, body);
+        }
+    }
+    EXPECT_LE(master.getUsed(), master.getBudget());
+    EXPECT_LT(hot.getCurrentSize(), master.getBudget() / 2);
+
+    // the victim is the entry expiring first, among those of its budget
+    Cache order(1024 * 1024);
+    auto add = [&order](const std::string & url, const std::string & line, int max_age) {
+        order.addToCache(url, line, line + "\r\nCache-Control: max-age=" + std::to_string(max_age) + "\r\n\r\n", "body");
+    };
+    add("http://order/a", "HTTP/1.1 200 OK", 300);
+    add("http://order/b", "HTTP/1.1 200 OK", 100);
+    add("http://order/c", "HTTP/1.1 200 OK", 100);
+    add("http://order/missing", "HTTP/1.1 404 Not Found", 50);
+    std::string first = order.peekVictim(false);
+    EXPECT_TRUE(first == "http://order/b" || first == "http://order/c") << first;
+    order.removeEntry(first);
+    // one expiry time holds both
+    EXPECT_EQ(order.peekVictim(false), first == "http://order/b" ? "http://order/c" : "http://order/b");
+    order.removeEntry(order.peekVictim(false));
+    EXPECT_EQ(order.peekVictim(false), "http://order/a");
+    EXPECT_EQ(order.peekVictim(true), "http://order/missing");
+    // a replaced entry takes its new place
+    add("http://order/d", "HTTP/1.1 200 OK", 1000);
+    add("http://order/a", "HTTP/1.1 200 OK", 2000);
+    EXPECT_EQ(order.peekVictim(false), "http://order/d");
+    EXPECT_TRUE(order.evictOne(false));
+    EXPECT_TRUE(order.evictOne(false));
+    EXPECT_EQ(order.peekVictim(false), "");
+    EXPECT_EQ(order.peekVictim(true), "http://order/missing");
+
+    master.setAdmission(true);
+    master.configure(8, 80 * 1024 * 1024);
+    std::cout << "=== Completed TestResizeAndGlobalBudget ===" << std::endl;
+}
+
+// ============== Test #20: Compressed Cache Storage ==============
+TEST_F(ProxyTest, TestGzipStorage) {
+    std::cout << "\n=== Starting TestGzipStorage ===" << std::endl;
+
+    std::string page;
+    for (int i = 0; i < 200; i++) {
+        page += "<p>line " + std::to_string(i % 10) + " of a repetitive page</p>\n";
+    }
+    std::atomic<bool> asked_gzip(false);
+    LocalOrigin origin([&page, &asked_gzip](const std::string & request) {
+        asked_gzip = request.find("Accept-Encoding: gzip") != std::string::npos;
+        return "HTTP/1.1 200 OK\r\n"
+               "Content-Type: text/html\r\n"
+               "Cache-Control: max-age=600\r\n"
+               "ETag: \"page-1\"\r\n"
+               "Content-Length: " + std::to_string(page.size()) + "\r\n\r\n" + page;
+    });
+    std::string url = origin.url("/page");
+    uint64_t stored = CacheStats::getInstance().get(CacheStats::GZIP_STORED);
+
+    std::string first = proxy_get(create_client_socket(), url);
+    EXPECT_TRUE(asked_gzip) << "Proxy did not offer gzip to the origin";
+    EXPECT_NE(first.find(page), std::string::npos);
+    // the entry is stored right after the first client is answered
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(CacheStats::getInstance().get(CacheStats::GZIP_STORED), stored + 1);
+
+    // a gzip capable client gets the stored bytes as they are
+    std::string compressed = proxy_get(create_client_socket(), url, "Accept-Encoding: gzip, deflate\r\n");
+    ASSERT_NE(compressed.find("Content-Encoding: gzip"), std::string::npos) << compressed.substr(0, 300);
+    std::string body;
+    ASSERT_TRUE(Compression::gunzip(compressed.substr(compressed.find("\r\n\r\n") + 4), body));
+    EXPECT_EQ(body, page);
+    EXPECT_LT(compressed.size(), page.size() / 4);
+    // re-encoded by the proxy, the origin's strong tag is weakened
+    EXPECT_NE(compressed.find("ETag: W/\"page-1\"\r\n"), std::string::npos) << compressed.substr(0, 300);
+    EXPECT_EQ(compressed.find("ETag: \"page-1\""), std::string::npos);
+    // and stays weak when a 304 names the origin's tag again
+    CacheEntry refreshed("HTTP/1.1 200 OK", "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nETag: W/\"page-1\"\r\n\r\n", "");
+    refreshed.refresh("HTTP/1.1 304 Not Modified\r\nETag: \"page-1\"\r\n\r\n");
+    EXPECT_EQ(refreshed.getETag(), "W/\"page-1\"");
+    refreshed.refresh("HTTP/1.1 304 Not Modified\r\nETag: \"page-2\"\r\n\r\n");
+    EXPECT_EQ(refreshed.getETag(), "page-2");
+
+    // anyone else gets it inflated on the fly
+    std::string identity = proxy_get(create_client_socket(), url, "Accept-Encoding: gzip;q=0\r\n");
+    EXPECT_EQ(identity.find("Content-Encoding"), std::string::npos);
+    EXPECT_NE(identity.find("Content-Length: " + std::to_string(page.size())), std::string::npos);
+    EXPECT_EQ(identity.substr(identity.find("\r\n\r\n") + 4), page);
+    EXPECT_EQ(origin.getHits(), 1);
+
+    std::cout << "=== Completed TestGzipStorage ===" << std::endl;
+}
+
+// ============== Test #21: Vary Variants ==============
+TEST_F(ProxyTest, TestVaryVariants) {
+    std::cout << "\n=== Starting TestVaryVariants ===" << std::endl;
+
+    LocalOrigin origin([](const std::string & request) {
+        std::string body = request.find("Accept-Language: fr") != std::string::npos ? "bonjour" : "hello";
+        return "HTTP/1.1 200 OK\r\n"
+               "Cache-Control: max-age=600\r\n"
+               "Vary: Accept-Language\r\n"
+               "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    });
+    std::string url = origin.url("/greeting");
+    auto get = [this, &url](const std::string & language) {
+        std::string response = proxy_get(create_client_socket(), url, "Accept-Language: " + language + "\r\n");
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        return response.substr(response.find("\r\n\r\n") + 4);
+    };
+
+    EXPECT_EQ(get("en"), "hello");
+    EXPECT_EQ(get("fr"), "bonjour") << "Served the English variant to a French client";
+    EXPECT_EQ(origin.getHits(), 2);
+
+    // both variants are cached now, and header case does not matter
+    EXPECT_EQ(get("EN"), "hello");
+    EXPECT_EQ(get("fr"), "bonjour");
+    EXPECT_EQ(origin.getHits(), 2);
+
+    // demoted to disk, the variant is still looked up under its own key
+    std::string dir = (std::filesystem::temp_directory_path() / ("proxy-vary-" + std::to_string(getpid()))).string();
+    std::filesystem::remove_all(dir);
+    DiskCache disk(dir, 1024 * 1024, 2);
+    ASSERT_TRUE(disk.open());
+    Cache cache;
+    cache.setEvictHook([&disk](const std::string & key, const CacheEntry & entry) { disk.store(key, entry); });
+    std::string raw = "GET http://h/greeting HTTP/1.1\r\nHost: h\r\nAccept-Language: fr\r\n\r\n";
+    Request request(std::vector<char>(raw.begin(), raw.end()));
+    std::string key = Cache::variantKey(request.getCacheUrl(), {"accept-language"}, request);
+    cache.addEntry(key, CacheEntry("200", "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\n"
+                                          "Vary: Accept-Language\r\nContent-Length: 7\r\n\r\n", "bonjour"));
+    EXPECT_EQ(cache.lookupKey(request), key);
+    ASSERT_TRUE(cache.evictOne());
+    EXPECT_FALSE(cache.contains(key));
+    EXPECT_EQ(cache.lookupKey(request), key) << "Vary list dropped with the last variant in memory";
+    DiskCache::Location location;
+    EXPECT_TRUE(disk.lookup(cache.lookupKey(request), location));
+    std::filesystem::remove_all(dir);
+
+    std::cout << "=== Completed TestVaryVariants ===" << std::endl;
+}
+
+// ============== Test #22: Cache Key Normalization ==============
+TEST(CacheKeyTest, TestNormalize) {
+    std::cout << "\n=== Starting TestNormalize ===" << std::endl;
+
+    CacheKey & cacheKey = CacheKey::getInstance();
+    CacheKey::Rules saved = cacheKey.getRules();
+    cacheKey.configure(CacheKey::Rules());
+
+    std::string expected = "http://example.com/a~b/%2F?id=7&page=2";
+    EXPECT_EQ(cacheKey.normalize("http://Example.COM:80/a%7eb/%2f?page=2&utm_source=x&id=7#top"), expected);
+    EXPECT_EQ(cacheKey.normalize("http://example.com/a~b/%2F?id=7&fbclid=abc&page=2"), expected);
+    EXPECT_EQ(cacheKey.normalize("http://example.com"), "http://example.com/");
+    EXPECT_EQ(cacheKey.normalize("http://example.com:8080/?utm_medium=y"), "http://example.com:8080/");
+    // repeated names keep their order, it can matter to the origin
+    EXPECT_EQ(cacheKey.normalize("http://h/?b=2&a=1&b=1"), "http://h/?a=1&b=2&b=1");
+
+    CacheKey::Rules rules;
+    rules.keep_params = {"id"};
+    rules.lowercase_path = true;
+    cacheKey.configure(rules);
+    EXPECT_EQ(cacheKey.normalize("http://h/Item?session=9&id=3"), "http://h/item?id=3");
+
+    cacheKey.configure(saved);
+    std::cout << "=== Completed TestNormalize ===" << std::endl;
+}
+
+// ============== Test #23: Header Metadata Parser ==============
+TEST(HeaderMetaTest, TestParse) {
+    std::cout << "\n=== Starting TestParse ===" << std::endl;
+
+    std::string headers =
+        "HTTP/1.1 200 OK\r\n"
+        "cache-control: public, MAX-AGE=60, s-maxage=120, stale-if-error=\"30\"\r\n"
+        "ETag: \"v1\"\r\n"
+        "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+        "X-Note: no-store private must-revalidate\r\n"
+        "Content-Encoding: gzip\r\n\r\n";
+    HeaderMeta meta = HeaderMeta::parse(headers);
+    EXPECT_TRUE(meta.is_public);
+    EXPECT_EQ(meta.max_age, 60);
+    EXPECT_EQ(meta.stale_if_error, 30);
+    // directives are matched by name, not anywhere in the block
+    EXPECT_FALSE(meta.no_store);
+    EXPECT_FALSE(meta.is_private);
+    EXPECT_FALSE(meta.requiresRevalidation());
+    EXPECT_TRUE(meta.forbidsStale());
+    EXPECT_EQ(meta.etag, "v1");
+    EXPECT_EQ(meta.last_modified, 784111777);
+    EXPECT_TRUE(meta.gzip);
+    // a shared cache uses s-maxage
+    EXPECT_EQ(meta.expiresAt(1000), 1120);
+
+    meta = HeaderMeta::parse("HTTP/1.1 200 OK\r\nPragma: no-cache\r\nExpires: garbage\r\nVary: *\r\n\r\n");
+    EXPECT_TRUE(meta.no_cache);
+    EXPECT_TRUE(meta.vary_star);
+    EXPECT_EQ(meta.expires, 0);
+    EXPECT_EQ(meta.expiresAt(1000), 1000 + 3600);
+
+    HeaderMeta request;
+    request.parseCacheControl("max-stale, min-fresh=99999999999");
+    EXPECT_EQ(request.max_stale, HeaderMeta::UNLIMITED);
+    EXPECT_EQ(request.min_fresh, HeaderMeta::UNLIMITED);
+    EXPECT_EQ(request.max_age, HeaderMeta::ABSENT);
+
+    std::cout << "=== Completed TestParse ===" << std::endl;
+}
+
+// ============== Test #24: HTTP Dates ==============
+TEST(HttpDateTest, TestParseAndFormat) {
+    std::cout << "\n=== Starting TestParseAndFormat ===" << std::endl;
+
+    // the three forms RFC 9110 asks recipients to accept
+    EXPECT_EQ(HttpDate::parse("Sun, 06 Nov 1994 08:49:37 GMT"), 784111777);
+    EXPECT_EQ(HttpDate::parse("Sunday, 06-Nov-94 08:49:37 GMT"), 784111777);
+    EXPECT_EQ(HttpDate::parse("Sun Nov  6 08:49:37 1994"), 784111777);
+    EXPECT_EQ(HttpDate::parse("Sun, 06 Nov 1994 08:49:37 UTC"), 0);
+    EXPECT_EQ(HttpDate::parse("Sun, 06 Xyz 1994 08:49:37 GMT"), 0);
+    EXPECT_EQ(HttpDate::parse("Sun, 0x Nov 1994 08:49:37 GMT"), 0);
+    EXPECT_EQ(HttpDate::parse(""), 0);
+
+    EXPECT_EQ(HttpDate::format(784111777), "Sun, 06 Nov 1994 08:49:37 GMT");
+    EXPECT_EQ(HttpDate::toAsctime(784111777), "Sun Nov  6 08:49:37 1994");
+    EXPECT_EQ(HttpDate::format(951782400), "Tue, 29 Feb 2000 00:00:00 GMT");
+
+    // round trip against the libc calendar, the result must not depend on TZ
+    for (time_t t = 0; t < 4102444800; t += 86400 * 37 + 3671) {
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        char expected[64];
+        strftime(expected, sizeof(expected), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        ASSERT_EQ(HttpDate::format(t), expected);
+        ASSERT_EQ(HttpDate::parse(expected), t);
+    }
+
+    time_t before = time(nullptr);
+    time_t now = HttpDate::parse(HttpDate::now());
+    EXPECT_GE(now, before);
+    EXPECT_LE(now, time(nullptr));
+    EXPECT_EQ(HttpDate::nowLocal().size(), std::string("1994-11-06 08:49:37").size());
+
+    std::cout << "=== Completed TestParseAndFormat ===" << std::endl;
+}
+
+// ============== Test #25: Revalidation With If-Modified-Since ==============
+TEST_F(ProxyTest, TestIfModifiedSinceRefresh) {
+    std::cout << "\n=== Starting TestIfModifiedSinceRefresh ===" << std::endl;
+
+    std::string last_modified = "Sun, 06 Nov 1994 08:49:37 GMT";
+    std::atomic<int> conditional(0);
+    LocalOrigin origin([&last_modified, &conditional](const std::string & request) -> std::string {
+        if (request.find("If-Modified-Since: " + last_modified) != std::string::npos) {
+            conditional++;
+            return "HTTP/1.1 304 Not Modified\r\n"
+                   "Cache-Control: max-age=600\r\n"
+                   "X-Version: 2\r\n\r\n";
+        }
+        return "HTTP/1.1 200 OK\r\n"
+               "Cache-Control: max-age=1\r\n"
+               "Last-Modified: " + last_modified + "\r\n"
+               "X-Version: 1\r\n"
+               "Content-Length: 5\r\n\r\nasset";
+    });
+    std::string url = origin.url("/asset.js");
+    uint64_t not_modified = CacheStats::getInstance().get(CacheStats::NOT_MODIFIED);
+
+    std::string first = proxy_get(create_client_socket(), url);
+    EXPECT_NE(first.find("asset"), std::string::npos);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2200));
+
+    // expired without an ETag: a conditional request, not a refetch
+    std::string second = proxy_get(create_client_socket(), url);
+    EXPECT_EQ(conditional, 1);
+    EXPECT_EQ(second.substr(second.find("\r\n\r\n") + 4), "asset");
+    EXPECT_NE(second.find("X-Version: 2"), std::string::npos) << "304 headers were not merged";
+    EXPECT_EQ(second.find("X-Version: 1"), std::string::npos);
+    EXPECT_EQ(CacheStats::getInstance().get(CacheStats::NOT_MODIFIED), not_modified + 1);
+
+    // the 304 restarted its freshness, so no new revalidation
+    std::string third = proxy_get(create_client_socket(), url);
+    EXPECT_EQ(third.substr(third.find("\r\n\r\n") + 4), "asset");
+    EXPECT_EQ(origin.getHits(), 2);
+
+    // an ETag goes back as an entity-tag, quoted, weak ones keep their W/
+    std::atomic<int> matched(0);
+    LocalOrigin tagged([&matched](const std::string & request) -> std::string {
+        bool weak = request.find("GET /weak") == 0;
+        std::string tag = weak ? "W/\"w1\"" : "\"tag-1\"";
+        if (request.find("If-None-Match: " + tag + "\r\n") != std::string::npos) {
+            matched++;
+            return "HTTP/1.1 304 Not Modified\r\nCache-Control: max-age=600\r\n\r\n";
+        }
+        return "HTTP/1.1 200 OK\r\n"
+               "Cache-Control: max-age=1\r\n"
+               "ETag: " + tag + "\r\n"
+               "Content-Length: 6\r\n\r\ntagged";
+    });
+    proxy_get(create_client_socket(), tagged.url("/strong"));
+    proxy_get(create_client_socket(), tagged.url("/weak"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2200));
+    std::string strong = proxy_get(create_client_socket(), tagged.url("/strong"));
+    std::string weak = proxy_get(create_client_socket(), tagged.url("/weak"));
+    EXPECT_EQ(strong.substr(strong.find("\r\n\r\n") + 4), "tagged");
+    EXPECT_EQ(weak.substr(weak.find("\r\n\r\n") + 4), "tagged");
+    EXPECT_EQ(matched, 2) << "If-None-Match was not a valid entity-tag";
+    EXPECT_EQ(tagged.getHits(), 4);
+
+    std::cout << "=== Completed TestIfModifiedSinceRefresh ===" << std::endl;
+}
+
+// ============== Test #26: Client Conditional Requests ==============
+TEST_F(ProxyTest, TestClientNotModified) {
+    std::cout << "\n=== Starting TestClientNotModified ===" << std::endl;
+
+    CacheEntry entry("200", "HTTP/1.1 200 OK\r\nETag: W/\"v1\"\r\n"
+                     "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n", "body");
+    EXPECT_TRUE(CacheDecision::clientCopyIsCurrent("\"v1\"", "", entry));
+    EXPECT_TRUE(CacheDecision::clientCopyIsCurrent("\"v0\", W/\"v1\"", "", entry));
+    EXPECT_TRUE(CacheDecision::clientCopyIsCurrent("*", "", entry));
+    // If-None-Match decides alone when present
+    EXPECT_FALSE(CacheDecision::clientCopyIsCurrent("\"v0\"", "Mon, 07 Nov 1994 08:49:37 GMT", entry));
+    EXPECT_TRUE(CacheDecision::clientCopyIsCurrent("", "Sun, 06 Nov 1994 08:49:37 GMT", entry));
+    EXPECT_FALSE(CacheDecision::clientCopyIsCurrent("", "Sat, 05 Nov 1994 08:49:37 GMT", entry));
+    EXPECT_FALSE(CacheDecision::clientCopyIsCurrent("", "yesterday", entry));
+
+    LocalOrigin origin([](const std::string &) {
+        return "HTTP/1.1 200 OK\r\n"
+               "Cache-Control: max-age=600\r\n"
+               "ETag: \"v1\"\r\n"
+               "Content-Length: 7\r\n\r\npayload";
+    });
+    std::string url = origin.url("/logo.png");
+    std::string first = proxy_get(create_client_socket(), url);
+    EXPECT_NE(first.find("payload"), std::string::npos);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::string revalidated = proxy_get(create_client_socket(), url, "If-None-Match: \"v1\"\r\n");
+    EXPECT_EQ(revalidated.find("HTTP/1.1 304"), 0u) << revalidated;
+    EXPECT_NE(revalidated.find("ETag: \"v1\""), std::string::npos);
+    EXPECT_EQ(revalidated.find("payload"), std::string::npos);
+
+    std::string changed = proxy_get(create_client_socket(), url, "If-None-Match: \"v0\"\r\n");
+    EXPECT_NE(changed.find("payload"), std::string::npos);
+    EXPECT_EQ(origin.getHits(), 1);
+
+    std::cout << "=== Completed TestClientNotModified ===" << std::endl;
+}
+
+// ============== Test #27: Negative And Redirect Caching ==============
+TEST_F(ProxyTest, TestNegativeCaching) {
+    std::cout << "\n=== Starting TestNegativeCaching ===" << std::endl;
+
+    HeaderMeta none;
+    EXPECT_TRUE(Cache::isCacheableStatus(301, none));
+    EXPECT_TRUE(Cache::isCacheableStatus(410, none));
+    EXPECT_FALSE(Cache::isCacheableStatus(302, none));
+    EXPECT_FALSE(Cache::isCacheableStatus(500, none));
+    HeaderMeta explicitly = HeaderMeta::parse("HTTP/1.1 302 Found\r\nCache-Control: max-age=60\r\n\r\n");
+    EXPECT_EQ(explicitly.status, 302);
+    EXPECT_TRUE(Cache::isCacheableStatus(302, explicitly));
+
+    int saved_ttl = CacheEntry::getNegativeTtl();
+    CacheEntry::setNegativeTtl(1);
+    LocalOrigin origin([](const std::string & request) -> std::string {
+        if (request.find("GET /old") == 0) {
+            return "HTTP/1.1 301 Moved Permanently\r\n"
+                   "Location: /new\r\n"
+                   "Content-Length: 0\r\n\r\n";
+        }
+        return "HTTP/1.1 404 Not Found\r\n"
+               "Content-Length: 9\r\n\r\nnot found";
+    });
+    auto get = [this](const std::string & url) {
+        std::string response = proxy_get(create_client_socket(), url);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        return response;
+    };
+
+    EXPECT_EQ(get(origin.url("/old")).find("HTTP/1.1 301"), 0u);
+    EXPECT_EQ(get(origin.url("/old")).find("HTTP/1.1 301"), 0u);
+    EXPECT_EQ(get(origin.url("/missing")).find("HTTP/1.1 404"), 0u);
+    EXPECT_NE(get(origin.url("/missing")).find("not found"), std::string::npos);
+    EXPECT_EQ(origin.getHits(), 2) << "Redirect or 404 was fetched again";
+    EXPECT_GT(CacheMaster::getInstance().getNegativeUsed(), 0u);
+
+    // the short negative TTL runs out long before the redirect's hour
+    std::this_thread::sleep_for(std::chrono::milliseconds(2200));
+    get(origin.url("/missing"));
+    get(origin.url("/old"));
+    EXPECT_EQ(origin.getHits(), 3);
+    CacheEntry::setNegativeTtl(saved_ttl);
+
+    // error answers are bounded by their own budget and leave content alone
+    CacheMaster & master = CacheMaster::getInstance();
+    master.configure(2, 64 * 1024, 2048);
+    std::string page = "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\n\r\n";
+    std::string gone = "HTTP/1.1 410 Gone\r\n\r\n";
+    for (int i = 0; i < 10; i++) {
+        std::string url = "http://content/" + std::to_string(i);
+        master.selectCache(url).addToCache(url, "200", page, std::string(1000, 'x'));
+    }
+    size_t content = master.getUsed();
+    for (int i = 0; i < 100; i++) {
+        std::string url = "http://gone/" + std::to_string(i);
+        master.selectCache(url).addToCache(url, "410", gone, std::string(200, 'x'));
+    }
+    EXPECT_LE(master.getNegativeUsed(), 2048u);
+    EXPECT_GT(master.getNegativeUsed(), 1024u);
+    EXPECT_EQ(master.getUsed(), content);
+    master.configure(8, 80 * 1024 * 1024);
+
+    std::cout << "=== Completed TestNegativeCaching ===" << std::endl;
+}
+
+// ============== Test #28: TinyLFU Admission ==============
+TEST(CacheMasterTest, TestAdmission) {
+    std::cout << "\n=== Starting TestAdmission ===" << std::endl;
+
+    FrequencySketch sketch(1024);
+    uint64_t hot = HashRing::hash("http://site/hot");
+    uint64_t once = HashRing::hash("http://site/once");
+    for (int i = 0; i < 10; i++) sketch.increment(hot);
+    sketch.increment(once);
+    EXPECT_GE(sketch.estimate(hot), 8);
+    EXPECT_EQ(sketch.estimate(once), 1) << "doorkeeper should absorb the first access";
+    EXPECT_TRUE(sketch.admit(hot, once));
+    EXPECT_FALSE(sketch.admit(once, hot));
+    // popularity fades once a sample of other accesses went by
+    for (size_t i = 0; i < sketch.getSampleSize(); i++) {
+        sketch.increment(HashRing::hash("http://site/other/" + std::to_string(i % 5000)));
+    }
+    EXPECT_LT(sketch.estimate(hot), 8);
+
+    // a sweep of one-hit urls does not push out a hot set
+    CacheMaster & master = CacheMaster::getInstance();
+    master.configure(2, 16 * 1024);
+    // start empty, earlier tests leave entries behind in the singleton
+    for (size_t i = 0; i < master.getCacheNumber(); i++) {
+        for (auto & [url, entry] : master.getCache(i).copyEntries()) {
+            master.getCache(i).removeEntry(url);
+        }
+    }
+    std::string headers = "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\n\r\n";
+    std::string body(1000, 'x');
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 12; i++) {
+            std::string url = "http://site/hot/" + std::to_string(i);
+            master.recordAccess(url);
+            master.selectCache(url).addToCache(url, "200", headers, body);
+        }
+    }
+    for (int i = 0; i < 200; i++) {
+        std::string url = "http://site/crawl/" + std::to_string(i);
+        master.recordAccess(url);
+        master.selectCache(url).addToCache(url, "200", headers, body);
+    }
+    int kept = 0;
+    for (int i = 0; i < 12; i++) {
+        std::string url = "http://site/hot/" + std::to_string(i);
+        kept += master.selectCache(url).contains(url);
+    }
+    EXPECT_EQ(kept, 12);
+    master.configure(8, 80 * 1024 * 1024);
+
+    std::cout << "=== Completed TestAdmission ===" << std::endl;
+}
+
+// ============== Test #29: Segmented Bodies ==============
+TEST_F(ProxyTest, TestSegmentedBody) {
+    std::cout << "\n=== Starting TestSegmentedBody ===" << std::endl;
+
+    const size_t segment = SegmentedBody::SEGMENT_SIZE;
+    std::string data(segment * 2 + 100, 'a');
+    for (size_t i = 0; i < data.size(); i++) data[i] = 'a' + i % 26;
+    SegmentedBody body;
+    body.append(data.substr(0, 10));
+    body.append(data.substr(10));
+    EXPECT_EQ(body.size(), data.size());
+    EXPECT_EQ(body.getSegmentNumber(), 3u);
+    EXPECT_EQ(body.toString(), data);
+    std::vector<struct iovec> iov;
+    body.appendIovecs(iov, segment + 5);
+    ASSERT_EQ(iov.size(), 2u);
+    EXPECT_EQ(iov[0].iov_len, segment - 5);
+    EXPECT_EQ(static_cast<char *>(iov[0].iov_base)[0], data[segment + 5]);
+    // a copy shares segments, appending to it leaves the original alone
+    SegmentedBody copy = body;
+    copy.append("tail");
+    EXPECT_EQ(body.toString(), data);
+    EXPECT_EQ(copy.toString(), data + "tail");
+    // only whole segments are dropped
+    EXPECT_EQ(body.truncate(segment * 2), 100u);
+    EXPECT_EQ(body.truncate(segment + 1), segment);
+    EXPECT_EQ(body.size(), segment);
+
+    // a large body gives up its tail under pressure and is refilled with a Range request
+    CacheMaster & master = CacheMaster::getInstance();
+    master.configure(1, 1024 * 1024);
+    master.setAdmission(false);
+    for (auto & [key, entry] : master.getCache(0).copyEntries()) {
+        master.getCache(0).removeEntry(key);
+    }
+    std::string asset(300 * 1024, 'x');
+    for (size_t i = 0; i < asset.size(); i++) asset[i] = 'A' + i % 53 % 26;
+    std::atomic<int> ranges(0);
+    std::string range_seen;
+    LocalOrigin origin([&asset, &ranges, &range_seen](const std::string & request) -> std::string {
+        std::string headers = "Cache-Control: max-age=600\r\n"
+                              "Content-Type: application/octet-stream\r\n"
+                              "ETag: \"big\"\r\n";
+        size_t range = request.find("Range: bytes=");
+        if (range != std::string::npos && request.find("If-Range: \"big\"") != std::string::npos) {
+            ranges++;
+            size_t offset = std::stoul(request.substr(range + 13));
+            range_seen = std::to_string(offset);
+            return "HTTP/1.1 206 Partial Content\r\n" + headers +
+                   "Content-Range: bytes " + std::to_string(offset) + "-" + std::to_string(asset.size() - 1) +
+                   "/" + std::to_string(asset.size()) + "\r\n"
+                   "Content-Length: " + std::to_string(asset.size() - offset) + "\r\n\r\n" + asset.substr(offset);
+        }
+        return "HTTP/1.1 200 OK\r\n" + headers +
+               "Content-Length: " + std::to_string(asset.size()) + "\r\n\r\n" + asset;
+    });
+    std::string url = origin.url("/big.bin");
+    std::string first = proxy_get(create_client_socket(), url);
+    EXPECT_EQ(first.substr(first.find("\r\n\r\n") + 4), asset);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    Cache & cache = master.selectCache(url);
+    ASSERT_TRUE(cache.contains(url));
+    EXPECT_EQ(cache.copyEntry(url)->getBody().getSegmentNumber(), 5u);
+
+    // a copy held by a send in progress keeps its whole body
+    std::optional<CacheEntry> sending = cache.copyEntry(url);
+    uint64_t truncations = CacheStats::getInstance().get(CacheStats::BODY_TRUNCATIONS);
+    cache.addToCache("http://filler/", "200", "HTTP/1.1 200 OK\r\nCache-Control: max-age=6000\r\n\r\n",
+                     std::string(900 * 1024, 'f'));
+    ASSERT_TRUE(cache.contains("http://filler/"));
+    ASSERT_TRUE(cache.contains(url)) << "the large entry should be truncated, not evicted";
+    EXPECT_TRUE(cache.copyEntry(url)->isPartial());
+    EXPECT_EQ(CacheStats::getInstance().get(CacheStats::BODY_TRUNCATIONS), truncations + 1);
+    EXPECT_LE(master.getUsed(), master.getBudget());
+    size_t kept = cache.copyEntry(url)->getBody().size();
+    EXPECT_GT(kept, 0u);
+    EXPECT_EQ(sending->getResponseBody(), asset);
+    sending.reset();
+    cache.removeEntry("http://filler/");
+
+    std::string second = proxy_get(create_client_socket(), url);
+    EXPECT_EQ(second.substr(second.find("\r\n\r\n") + 4), asset);
+    EXPECT_EQ(ranges, 1);
+    EXPECT_EQ(range_seen, std::to_string(kept));
+    ASSERT_TRUE(cache.contains(url));
+    EXPECT_FALSE(cache.copyEntry(url)->isPartial());
+
+    // the size limit is a policy, not the budget
+    Cache::setMaxObjectSize(100 * 1024);
+    cache.addToCache("http://large/", "200", "HTTP/1.1 200 OK\r\nCache-Control: max-age=60\r\n\r\n", asset);
+    EXPECT_FALSE(cache.contains("http://large/"));
+    Cache::setMaxObjectSize(0);
+    master.setAdmission(true);
+    master.configure(8, 80 * 1024 * 1024);
+
+    std::cout << "=== Completed TestSegmentedBody ===" << std::endl;
+}
+
+// ============== Test #30: Purge And Invalidation ==============
+TEST_F(ProxyTest, TestPurge) {
+    std::cout << "\n=== Starting TestPurge ===" << std::endl;
+
+    PrefixIndex index;
+    for (const char * key : {"http://a/x", "http://a/xy", "http://a/xyz", "http://a/y", "http://b/"}) {
+        index.insert(key);
+    }
+    index.insert("http://a/x");
+    EXPECT_EQ(index.size(), 5u);
+    EXPECT_EQ(index.withPrefix("http://a/x"), (std::vector<std::string>{"http://a/x", "http://a/xy", "http://a/xyz"}));
+    EXPECT_EQ(index.withPrefix("http://a/").size(), 4u);
+    EXPECT_TRUE(index.withPrefix("http://c").empty());
+    index.erase("http://a/xy");
+    index.erase("http://a/nope");
+    EXPECT_FALSE(index.contains("http://a/xy"));
+    EXPECT_TRUE(index.contains("http://a/xyz"));
+    EXPECT_FALSE(index.contains("http://a/"));
+    EXPECT_EQ(index.withPrefix("http://a/x"), (std::vector<std::string>{"http://a/x", "http://a/xyz"}));
+    EXPECT_EQ(index.size(), 4u);
+
+    CacheMaster & master = CacheMaster::getInstance();
+    std::string headers = "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\n\r\n";
+    for (const char * url : {"http://a.com/img/1", "http://a.com/img/2", "http://a.com/js/x", "http://a.com:8080/x",
+                             "http://a.com/page\naccept-language=en", "http://a.com/page\naccept-language=de",
+                             "http://a.com/page2", "http://b.com/img/1"}) {
+        master.selectCache(url).addToCache(url, "200", headers, "body");
+    }
+    auto present = [&master](const std::string & url) { return master.selectCache(url).contains(url); };
+    EXPECT_EQ(master.purge("http://a.com/page"), 2u);
+    EXPECT_TRUE(present("http://a.com/page2"));
+    // a site's root is one url, not its subtree
+    EXPECT_EQ(master.purge("http://a.com/"), 0u);
+    EXPECT_TRUE(present("http://a.com/js/x"));
+    EXPECT_EQ(master.purgePrefix("http://a.com/img/"), 2u);
+    EXPECT_TRUE(present("http://a.com/js/x"));
+    EXPECT_EQ(master.purgeHost("A.com"), 3u);
+    EXPECT_FALSE(present("http://a.com:8080/x"));
+    EXPECT_TRUE(present("http://b.com/img/1"));
+
+    // the admin endpoint, on a port of its own
+    EXPECT_EQ(AdminServer::handle("GET /purge?url=x HTTP/1.1\r\n\r\n").find("HTTP/1.1 405"), 0u);
+    EXPECT_EQ(AdminServer::handle("POST /nothing HTTP/1.1\r\n\r\n").find("HTTP/1.1 404"), 0u);
+    EXPECT_EQ(AdminServer::handle("POST /purge HTTP/1.1\r\n\r\n").find("HTTP/1.1 400"), 0u);
+    AdminServer admin(0);
+    admin.start();
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(admin.getPort());
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    ASSERT_EQ(connect(sock, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    std::string purge = "POST /purge?url=http%3A%2F%2FB.com%2Fimg%2F1 HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    send(sock, purge.c_str(), purge.size(), 0);
+    std::string answer = read_one_response(sock);
+    close(sock);
+    EXPECT_EQ(answer.find("HTTP/1.1 200"), 0u) << answer;
+    EXPECT_EQ(answer.substr(answer.find("\r\n\r\n") + 4), "purged 1\n");
+    EXPECT_FALSE(present("http://b.com/img/1"));
+    admin.stop();
+
+    // a successful POST drops the cached target and the Location it names
+    LocalOrigin origin([](const std::string & request) -> std::string {
+        if (request.rfind("POST", 0) == 0) {
+            return "HTTP/1.1 201 Created\r\nLocation: /items/2\r\nContent-Length: 0\r\n\r\n";
+        }
+        return "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\nContent-Length: 4\r\n\r\nitem";
+    });
+    std::string list = origin.url("/items");
+    std::string item = origin.url("/items/2");
+    proxy_get(create_client_socket(), list);
+    proxy_get(create_client_socket(), item);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    ASSERT_TRUE(present(list));
+    ASSERT_TRUE(present(item));
+    int client = create_client_socket();
+    std::string post = "POST " + list + " HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: 2\r\n\r\nhi";
+    send(client, post.c_str(), post.size(), 0);
+    std::string created = read_one_response(client);
+    close(client);
+    EXPECT_EQ(created.find("HTTP/1.1 201"), 0u) << created;
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_FALSE(present(list));
+    EXPECT_FALSE(present(item));
+    proxy_get(create_client_socket(), list);
+    EXPECT_EQ(origin.getHits(), 4);
+
+    std::cout << "=== Completed TestPurge ===" << std::endl;
+}
+
+// ============== Test #31: Peer Caching ==============
+TEST_F(ProxyTest, TestPeerCaching) {
+    std::cout << "\n=== Starting TestPeerCaching ===" << std::endl;
+
+    // a sibling on localhost, both nodes list both
+    Proxy sibling(0);
+    std::thread sibling_thread([&sibling]() { sibling.run(); });
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    std::string self = "127.0.0.1:" + std::to_string(proxy_port);
+    std::string other = "127.0.0.1:" + std::to_string(sibling.getPort());
+    auto peers = std::make_shared<PeerSet>(std::vector<std::string>{self, other}, self, 1);
+    auto sibling_peers = std::make_shared<PeerSet>(std::vector<std::string>{self, other}, other, 1);
+    proxy->setPeers(peers);
+    sibling.setPeers(sibling_peers);
+    EXPECT_THROW(PeerSet({self, other}, "127.0.0.1:1", 1), std::runtime_error);
+
+    LocalOrigin origin([](const std::string &) -> std::string {
+        return "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\nContent-Length: 6\r\n\r\nshared";
+    });
+    // both nodes agree on the owner, and each owns a fair share
+    std::string owned_here, owned_there;
+    int there = 0;
+    for (int i = 0; i < 200; i++) {
+        std::string key = CacheKey::getInstance().normalize(origin.url("/peer/" + std::to_string(i)));
+        EXPECT_EQ(peers->ownerName(key), sibling_peers->ownerName(key));
+        if (peers->ownerOf(key)) {
+            there++;
+            owned_there = origin.url("/peer/" + std::to_string(i));
+        } else {
+            owned_here = origin.url("/peer/" + std::to_string(i));
+        }
+    }
+    EXPECT_GT(there, 50);
+    EXPECT_LT(there, 150);
+
+    CacheStats & stats = CacheStats::getInstance();
+    uint64_t fetches = stats.get(CacheStats::PEER_FETCHES);
+    uint64_t served = stats.get(CacheStats::PEER_REQUESTS);
+    uint64_t failures = stats.get(CacheStats::PEER_FAILURES);
+
+    // a url the sibling owns goes through the sibling, which fetches it once
+    std::string response = proxy_get(create_client_socket(), owned_there);
+    EXPECT_EQ(response.find("HTTP/1.1 200"), 0u) << response;
+    EXPECT_NE(response.find("shared"), std::string::npos);
+    EXPECT_EQ(origin.getHits(), 1);
+    EXPECT_EQ(stats.get(CacheStats::PEER_FETCHES), fetches + 1);
+    EXPECT_EQ(stats.get(CacheStats::PEER_REQUESTS), served + 1);
+    // a url this node owns goes straight to the origin
+    proxy_get(create_client_socket(), owned_here);
+    EXPECT_EQ(origin.getHits(), 2);
+    EXPECT_EQ(stats.get(CacheStats::PEER_FETCHES), fetches + 1);
+
+    // the sibling goes away: fall back to the origin and stop asking it
+    sibling.stop();
+    sibling_thread.join();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CacheMaster::getInstance().purge(CacheKey::getInstance().normalize(owned_there));
+    response = proxy_get(create_client_socket(), owned_there);
+    EXPECT_EQ(response.find("HTTP/1.1 200"), 0u) << response;
+    EXPECT_EQ(origin.getHits(), 3);
+    EXPECT_EQ(stats.get(CacheStats::PEER_FAILURES), failures + 1);
+    EXPECT_FALSE(peers->isUp(other));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CacheMaster::getInstance().purge(CacheKey::getInstance().normalize(owned_there));
+    proxy_get(create_client_socket(), owned_there);
+    EXPECT_EQ(stats.get(CacheStats::PEER_FETCHES), fetches + 2);
+    EXPECT_EQ(origin.getHits(), 4);
+
+    // the health check brings it back once something listens there again
+    peers->checkNow();
+    EXPECT_FALSE(peers->isUp(other));
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(sibling.getPort());
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    ASSERT_EQ(bind(listener, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    listen(listener, 4);
+    peers->checkNow();
+    EXPECT_TRUE(peers->isUp(other));
+    close(listener);
+    proxy->setPeers(nullptr);
+
+    std::cout << "=== Completed TestPeerCaching ===" << std::endl;
+}
+
+// ============== Test #32: Entry Arena ==============
+TEST(EntryArenaTest, TestArenaAndPacking) {
+    // size classes round up by at most a quarter
+    for (size_t size : {1, 100, 1000, 5000, 40000, 65536}) {
+        size_t block = EntryArena::classSize(size);
+        EXPECT_GE(block, size);
+        EXPECT_LE(block, size + 64 + size / 4 + 16) << size;
+    }
+    EXPECT_EQ(EntryArena::classSize(200 * 1024), 0u);
+
+    auto arena = EntryArena::create();
+    char * first;
+    {
+        EntryArena::Block block = arena->allocate(100);
+        EXPECT_GE(block.capacity(), 100u);
+        EntryArena::Block copy = block;
+        EXPECT_TRUE(copy.shared());
+        first = block.data();
+        EXPECT_EQ(arena->getUsage().blocks, 1u);
+        EntryArena::Block big = arena->allocate(200 * 1024);
+        EXPECT_GE(big.capacity(), 200u * 1024);
+    }
+    EXPECT_EQ(arena->getUsage().blocks, 0u);
+    EXPECT_EQ(arena->getUsage().reserved, 0u);
+    // a freed block is reused by the next entry of its class
+    EXPECT_EQ(arena->allocate(100).data(), first);
+    EXPECT_EQ(arena->getUsage().mapped, EntryArena::CHUNK_SIZE);
+
+    // a chunk goes back once its last block is freed
+    {
+        std::vector<EntryArena::Block> blocks;
+        for (int i = 0; i < 150; i++) {
+            blocks.push_back(arena->allocate(60000));
+        }
+        EXPECT_GE(arena->getUsage().mapped, 4 * EntryArena::CHUNK_SIZE);
+        EntryArena::Block kept = blocks.front();
+        blocks.clear();
+        // the first chunk still holds a block, the last one is carved from
+        EXPECT_EQ(arena->getUsage().mapped, 2 * EntryArena::CHUNK_SIZE);
+        EXPECT_EQ(arena->getUsage().blocks, 1u);
+    }
+    EXPECT_EQ(arena->getUsage().mapped, EntryArena::CHUNK_SIZE);
+    EXPECT_EQ(arena->getUsage().blocks, 0u);
+    // its free blocks left the lists with it
+    std::vector<EntryArena::Block> reused;
+    for (int i = 0; i < 50; i++) {
+        reused.push_back(arena->allocate(60000));
+        memset(reused.back().data(), 'r', 60000);
+    }
+    reused.clear();
+
+    // small appends grow a segment instead of starting a 64 KB one
+    SegmentedBody body;
+    std::string expected;
+    for (int i = 0; i < 1000; i++) {
+        body.append(std::string(1, 'a' + i % 26));
+        expected += static_cast<char>('a' + i % 26);
+    }
+    EXPECT_EQ(body.toString(), expected);
+    EXPECT_EQ(body.getSegmentNumber(), 1u);
+    EXPECT_LT(body.footprint(), 4096u);
+
+    // a stored entry is one block: line, headers and body back to back
+    Cache cache(4 * 1024 * 1024);
+    std::string headers = "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\nETag: \"v1\"\r\nContent-Length: 5\r\n\r\n";
+    cache.addToCache("http://arena/small", "HTTP/1.1 200 OK", headers, "small");
+    std::optional<CacheEntry> entry = cache.copyEntry("http://arena/small");
+    ASSERT_TRUE(entry);
+    EXPECT_EQ(entry->getFullResponse(), headers + "small");
+    EXPECT_EQ(entry->getResponseLine(), "HTTP/1.1 200 OK");
+    EXPECT_EQ(entry->getETag(), "v1");
+    EXPECT_EQ(cache.getArena().getUsage().blocks, 1u);
+    EXPECT_LT(entry->getFootprint(), sizeof(CacheEntry) + EntryArena::classSize(entry->getSize()) + 1);
+    // copies share the block, a 304 repacks it with the new headers
+    size_t blocks = cache.getArena().getUsage().blocks;
+    std::optional<CacheEntry> copy = cache.copyEntry("http://arena/small");
+    EXPECT_EQ(cache.getArena().getUsage().blocks, blocks);
+    ASSERT_TRUE(cache.refreshEntry("http://arena/small", "HTTP/1.1 304 Not Modified\r\nETag: \"v2\"\r\n\r\n"));
+    entry = cache.copyEntry("http://arena/small");
+    EXPECT_EQ(entry->getETag(), "v2");
+    EXPECT_EQ(entry->getResponseBody(), "small");
+    EXPECT_EQ(copy->getETag(), "v1");
+    EXPECT_EQ(copy->getResponseBody(), "small");
+
+    // a large body stays segmented
+    std::string large(200 * 1024, 'x');
+    cache.addToCache("http://arena/large", "HTTP/1.1 200 OK", headers, large);
+    entry = cache.copyEntry("http://arena/large");
+    ASSERT_TRUE(entry);
+    EXPECT_EQ(entry->getBody().getSegmentNumber(), 4u);
+    EXPECT_EQ(entry->getResponseBody(), large);
+
+    // the overhead of small entries stays in the hundreds of bytes
+    for (int i = 0; i < 1000; i++) {
+        cache.addToCache("http://arena/item/" + std::to_string(i), "HTTP/1.1 200 OK", headers, std::string(100, 'b'));
+    }
+    Cache::MemoryUsage usage = cache.getMemoryUsage();
+    EXPECT_EQ(usage.entries, 1002u);
+    size_t overhead = (usage.footprint - usage.payload) / usage.entries;
+    std::cout << "overhead per entry: " << overhead << " bytes" << std::endl;
+    EXPECT_LT(overhead, 512u);
+    EXPECT_NE(CacheMaster::getInstance().memoryReport().find("overhead_per_entry="), std::string::npos);
+    EXPECT_EQ(AdminServer::handle("GET /stats HTTP/1.1\r\n\r\n").find("HTTP/1.1 200"), 0u);
+}
+
+// ============== Test #33: Shared Memory Cache ==============
+TEST_F(ProxyTest, TestSharedCache) {
+    std::cout << "\n=== Starting TestSharedCache ===" << std::endl;
+
+    std::string name = "/proxy-test-" + std::to_string(getpid());
+    SharedCache::unlink(name);
+    std::string headers = "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\nContent-Length: 5\r\n\r\n";
+    CacheEntry small("200", headers, "hello");
+    SharedCache::Meta meta;
+    std::string response;
+    {
+        SharedCache creator(name, 2 * 1024 * 1024);
+        ASSERT_TRUE(creator.open());
+        EXPECT_TRUE(creator.store("http://shared/a", small));
+        EXPECT_TRUE(creator.lookup("http://shared/a", response, meta));
+        EXPECT_EQ(response, headers + "hello");
+        EXPECT_EQ(meta.expires_time, small.getExpiresTime());
+
+        // a second mapping sees the same cache, wherever it is mapped
+        SharedCache other(name, 0);
+        ASSERT_TRUE(other.open());
+        EXPECT_TRUE(other.lookup("http://shared/a", response, meta));
+        EXPECT_TRUE(other.store("http://shared/b", small));
+        EXPECT_TRUE(creator.lookup("http://shared/b", response, meta));
+
+        // and so does another process
+        pid_t child = fork();
+        if (child == 0) {
+            SharedCache forked(name, 0);
+            bool ok = forked.open() && forked.store("http://shared/child", CacheEntry("200", headers, "child"));
+            _exit(ok ? 0 : 1);
+        }
+        int child_status = -1;
+        waitpid(child, &child_status, 0);
+        EXPECT_EQ(child_status, 0);
+        ASSERT_TRUE(creator.lookup("http://shared/child", response, meta));
+        EXPECT_EQ(response, headers + "child");
+
+        // a url is purged with its variants, and nothing else
+        size_t entries = creator.getEntryNumber();
+        for (const char * key : {"http://shared/v", "http://shared/v\ngzip", "http://shared/v\nbr", "http://shared/vv"}) {
+            EXPECT_TRUE(creator.store(key, small));
+        }
+        EXPECT_EQ(other.purge("http://shared/v"), 3u);
+        EXPECT_FALSE(creator.lookup("http://shared/v\nbr", response, meta));
+        EXPECT_TRUE(creator.remove("http://shared/vv"));
+        EXPECT_EQ(creator.getEntryNumber(), entries);
+
+        // a full segment gives up blocks of the same class
+        std::string body(10 * 1024, 'x');
+        for (int i = 0; i < 300; i++) {
+            EXPECT_TRUE(creator.store("http://shared/big/" + std::to_string(i), CacheEntry("200", headers, body))) << i;
+        }
+        EXPECT_LE(creator.getUsed(), creator.getSize());
+        EXPECT_LT(creator.getEntryNumber(), 300u);
+        EXPECT_TRUE(creator.lookup("http://shared/big/299", response, meta));
+        EXPECT_TRUE(creator.lookup("http://shared/a", response, meta));
+        // once the bump area is gone, another class splits a larger block
+        std::string medium(2 * 1024, 'm');
+        EXPECT_TRUE(creator.store("http://shared/medium", CacheEntry("200", headers, medium)));
+        EXPECT_TRUE(creator.lookup("http://shared/medium", response, meta));
+        EXPECT_TRUE(creator.remove("http://shared/medium"));
+        // and a class larger than any block gives up after a bounded walk
+        EXPECT_FALSE(creator.store("http://shared/huge", CacheEntry("200", headers, std::string(1024 * 1024, 'h'))));
+
+        EXPECT_GT(other.removePrefix("http://shared/big/"), 0u);
+        EXPECT_FALSE(creator.lookup("http://shared/big/299", response, meta));
+        EXPECT_TRUE(creator.remove("http://shared/b"));
+        EXPECT_FALSE(creator.remove("http://shared/b"));
+        EXPECT_EQ(creator.getEntryNumber(), 2u);
+    }
+    // nobody maps it now, a restarted process finds it warm
+    {
+        SharedCache restarted(name, 0);
+        ASSERT_TRUE(restarted.open());
+        EXPECT_EQ(restarted.getEntryNumber(), 2u);
+        EXPECT_TRUE(restarted.lookup("http://shared/child", response, meta));
+    }
+
+    // through the proxy: a response stored by one process serves the next
+    ASSERT_TRUE(CacheMaster::getInstance().enableSharedTier(name, 0));
+    LocalOrigin origin([](const std::string &) -> std::string {
+        return "HTTP/1.1 200 OK\r\nCache-Control: max-age=600\r\nContent-Length: 6\r\n\r\nshared";
+    });
+    std::string url = origin.url("/shared");
+    std::string key = CacheKey::getInstance().normalize(url);
+    CacheStats & stats = CacheStats::getInstance();
+    uint64_t stores = stats.get(CacheStats::SHARED_STORES);
+    uint64_t hits = stats.get(CacheStats::SHARED_HITS);
+    proxy_get(create_client_socket(), url);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(stats.get(CacheStats::SHARED_STORES), stores + 1);
+    // as if this process had just started: nothing in memory
+    CacheMaster::getInstance().selectCache(key).removeEntry(key);
+    response = proxy_get(create_client_socket(), url);
+    EXPECT_EQ(response.find("HTTP/1.1 200"), 0u) << response;
+    EXPECT_NE(response.find("shared"), std::string::npos);
+    EXPECT_EQ(origin.getHits(), 1);
+    EXPECT_EQ(stats.get(CacheStats::SHARED_HITS), hits + 1);
+    EXPECT_EQ(CacheMaster::getInstance().purge(key), 2u);
+    SharedCache::unlink(name);
+
+    std::cout << "=== Completed TestSharedCache ===" << std::endl;
+}
+
+// ============== Test #34: Zero-copy Messages ==============
+TEST(MessageTest, TestViewsIntoBuffer) {
+    std::string raw = "POST http://example.com/form?a=1 HTTP/1.1\r\n"
+                      "Host: example.com\r\n"
+                      "cache-control: no-cache\r\n"
+                      "Transfer-Encoding: chunked\r\n\r\n"
+                      "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\nTrailer: x\r\n\r\n";
+    std::vector<char> buffer(raw.begin(), raw.end());
+    const char * bytes = buffer.data();
+    Parser parser;
+    Request request = parser.parseRequest(std::move(buffer));
+    EXPECT_EQ(request.getMethod(), Request::Method::POST);
+    EXPECT_EQ(request.getMethodName(), "POST");
+    EXPECT_EQ(request.getUrl(), "http://example.com/form?a=1");
+    EXPECT_EQ(request.getVersion(), "HTTP/1.1");
+    EXPECT_EQ(request.getRequestLine(), "POST http://example.com/form?a=1 HTTP/1.1");
+    EXPECT_EQ(request.getHeader("CACHE-CONTROL"), "no-cache");
+    EXPECT_TRUE(request.getCacheControl().no_cache);
+    EXPECT_EQ(request.getHeaders().size(), 3u);
+    // the chunks were joined in place
+    EXPECT_EQ(request.getBody(), "hello world");
+
+    // every view points into the received buffer, and still does after a move
+    Request moved = std::move(request);
+    EXPECT_EQ(moved.getUrl().data(), bytes + 5);
+    EXPECT_EQ(moved.getHeader("Host").data(), bytes + raw.find("example.com\r\n"));
+    EXPECT_EQ(moved.getBody().data(), bytes + raw.find("\r\n\r\n") + 4);
+
+    // a clone has bytes of its own, same id
+    Request copy = moved.clone();
+    EXPECT_EQ(copy.getId(), moved.getId());
+    EXPECT_NE(copy.getUrl().data(), moved.getUrl().data());
+    EXPECT_EQ(copy.getHeader("Host"), "example.com");
+    EXPECT_EQ(copy.getBody(), "hello world");
+
+    EXPECT_EQ(Request::toMethod("GET"), Request::Method::GET);
+    EXPECT_EQ(Request::toMethod("INVALID"), Request::Method::OTHER);
+    for (std::string bad : {"GET / HTTP/1.1\r\nHost: a\r\n", "GET /\r\n\r\n", "G(T / HTTP/1.1\r\n\r\n",
+                            "GET / HTTP/1.1\r\nBad Name: a\r\n\r\n",
+                            "POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\nshort"}) {
+        EXPECT_THROW(parser.parseRequest(std::vector<char>(bad.begin(), bad.end())), std::runtime_error) << bad;
+    }
+
+    // a response views its head and plain body where they were received
+    std::string received = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nETag: \"v1\"\r\n\r\nhelloextra";
+    Response response = parser.parseResponse(received);
+    EXPECT_EQ(response.getResult(), 200);
+    EXPECT_EQ(response.getFirstLine(), "HTTP/1.1 200 OK");
+    EXPECT_EQ(response.getHeadersStr(), received.substr(0, received.find("\r\n\r\n") + 4));
+    EXPECT_EQ(response.getHeadersStr().data(), received.data());
+    EXPECT_EQ(response.getHeader("etag"), "\"v1\"");
+    EXPECT_EQ(response.getBody(), "hello");
+    EXPECT_EQ(response.getBody().data(), received.data() + received.find("hello"));
+
+    std::string chunked = "HTTP/1.1 404 Not Found\r\nTransfer-Encoding: gzip, chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n";
+    Response missing = parser.parseResponse(chunked);
+    EXPECT_EQ(missing.getResult(), 404);
+    EXPECT_EQ(missing.getBody(), "abc");
+    Response unchanged = parser.parseResponse("HTTP/1.1 304 Not Modified\r\nContent-Length: 10\r\n\r\n");
+    EXPECT_FALSE(unchanged.hasBody());
+    EXPECT_THROW(parser.parseResponse("HTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\nshort"), std::runtime_error);
+    EXPECT_THROW(parser.parseResponse("ICY 200 OK\r\n\r\n"), std::runtime_error);
+}
+
+// ============== Test #35: Header Scanner ==============
+// a head parsed by Beast, nullopt-like ok=false if it refuses it
+struct BeastHead {
+    bool ok = false;
+    std::string method, target;
+    std::vector<std::pair<std::string, std::string>> fields;
+};
+
+static BeastHead beastParse(const std::string & raw) {
+    BeastHead head;
+    boost::beast::http::request_parser<boost::beast::http::empty_body> parser;
+    boost::system::error_code ec;
+    parser.put(boost::asio::buffer(raw.data(), raw.size()), ec);
+    if (ec || !parser.is_header_done()) {
+        return head;
+    }
+    head.ok = true;
+    head.method = std::string(parser.get().method_string());
+    head.target = std::string(parser.get().target());
+    for (const auto & field : parser.get()) {
+        head.fields.emplace_back(std::string(field.name_string()), std::string(field.value()));
+    }
+    return head;
+}
+
+// Beast files a field next to the others of its name, order them the same way
+static std::vector<std::pair<std::string, std::string>> byName(std::vector<std::pair<std::string, std::string>> fields) {
+    std::stable_sort(fields.begin(), fields.end(), [](const auto & a, const auto & b) {
+        return strcasecmp(a.first.c_str(), b.first.c_str()) < 0;
+    });
+    return fields;
+}
+
+TEST(HeaderScannerTest, TestFuzzAgainstBeast) {
+    std::cout << "\n=== Starting TestFuzzAgainstBeast ===" << std::endl;
+    HeaderScanner::Level widest = HeaderScanner::supported();
+    std::cout << "widest scanner: " << HeaderScanner::levelName(widest) << std::endl;
+    std::mt19937 random(20261019);
+    const std::string nasty = std::string("\0\t\r\n :(|~\x7f\x80\xff\"{}/@aZ9", 19);
+
+    // every level finds exactly what the scalar loop finds, from every offset
+    for (int round = 0; round < 2000; round++) {
+        std::string bytes(random() % 100, 'a');
+        for (char & c : bytes) {
+            c = random() % 4 == 0 ? nasty[random() % nasty.size()] : static_cast<char>(random() % 256);
+        }
+        // long runs of token chars cross whole vectors
+        if (round % 2 == 0) {
+            bytes = std::string(random() % 70, 'x') + bytes;
+        }
+        const char * end = bytes.data() + bytes.size();
+        for (size_t offset = 0; offset <= bytes.size(); offset++) {
+            HeaderScanner::setLevel(HeaderScanner::SCALAR);
+            const char * token = HeaderScanner::skipToken(bytes.data() + offset, end);
+            const char * control = HeaderScanner::findControl(bytes.data() + offset, end);
+            for (int level = HeaderScanner::SSE42; level <= widest; level++) {
+                HeaderScanner::setLevel(static_cast<HeaderScanner::Level>(level));
+                ASSERT_EQ(HeaderScanner::skipToken(bytes.data() + offset, end), token) << level;
+                ASSERT_EQ(HeaderScanner::findControl(bytes.data() + offset, end), control) << level;
+            }
+        }
+    }
+
+    // heads built from a grammar, then a byte or two mutated: Request
+    // accepts exactly what Beast accepts, with the same fields
+    const std::vector<std::string> methods = {"GET", "POST", "M-SEARCH", "PURGE"};
+    const std::vector<std::string> names = {"Host", "Accept", "X-Forwarded-For", "cache-control", "If-None-Match",
+                                            "X_Long_Name_That_Crosses_A_Whole_Vector_Of_Bytes", "a|b~c"};
+    const std::vector<std::string> values = {"example.com", " text/html, */*;q=0.8 ", "\"v1\"", "",
+                                             "max-age=0\t", "obs-text \xe2\x82\xac", std::string(40, 'v')};
+    int accepted = 0;
+    for (int round = 0; round < 20000; round++) {
+        std::string raw = methods[random() % methods.size()] + " http://example.com/p?q=" +
+                          std::to_string(random() % 1000) + " HTTP/1.1\r\n";
+        for (int field = random() % 8; field > 0; field--) {
+            raw += names[random() % names.size()] + ":" + values[random() % values.size()] + "\r\n";
+        }
+        raw += "\r\n";
+        for (int mutation = random() % 3; mutation > 0; mutation--) {
+            raw[random() % raw.size()] = nasty[random() % nasty.size()];
+        }
+        // obsolete line folding: Beast unfolds it, a proxy may refuse it
+        if (raw.find("\r\n ") != std::string::npos || raw.find("\r\n\t") != std::string::npos) {
+            continue;
+        }
+
+        BeastHead expected = beastParse(raw);
+        accepted += expected.ok;
+        for (int level = HeaderScanner::SCALAR; level <= widest; level++) {
+            HeaderScanner::setLevel(static_cast<HeaderScanner::Level>(level));
+            bool ok = true;
+            Request request;
+            try {
+                request = Request(std::vector<char>(raw.begin(), raw.end()));
+            } catch (const std::runtime_error &) {
+                ok = false;
+            }
+            ASSERT_EQ(ok, expected.ok) << HeaderScanner::levelName(HeaderScanner::getLevel()) << " " << raw;
+            if (!ok) {
+                continue;
+            }
+            EXPECT_EQ(request.getMethodName(), expected.method);
+            EXPECT_EQ(request.getUrl(), expected.target);
+            std::vector<std::pair<std::string, std::string>> fields;
+            for (const auto & field : request.getHeaders()) {
+                fields.emplace_back(std::string(field.name), std::string(field.value));
+            }
+            EXPECT_EQ(byName(fields), byName(expected.fields)) << raw;
+        }
+    }
+    HeaderScanner::setLevel(widest);
+    std::cout << accepted << " of the mutated heads were valid" << std::endl;
+    EXPECT_GT(accepted, 1000);
+
+    // chunk sizes beyond the bytes sent, up to ones that wrap size_t
+    const std::vector<std::string> sizes = {"ffffffffffffffff", "fffffffffffffffe", "fffffffffffffffd",
+                                            "8000000000000000", "7fffffffffffffff", "100", "6"};
+    for (const std::string & size : sizes) {
+        std::string raw = "POST http://example.com/upload HTTP/1.1\r\nHost: example.com\r\n"
+                          "Transfer-Encoding: chunked\r\n\r\n" + size + "\r\nhello\r\n0\r\n\r\n";
+        EXPECT_THROW(Request(std::vector<char>(raw.begin(), raw.end())), std::runtime_error) << size;
+    }
+
+    std::cout << "=== Completed TestFuzzAgainstBeast ===" << std::endl;
+}
+
+
+// ============== Test #36: Single-pass Responses ==============
+TEST_F(ProxyTest, TestSinglePassResponse) {
+    std::cout << "\n=== Starting TestSinglePassResponse ===" << std::endl;
+
+    // fed a byte at a time, the response is complete exactly at its last byte
+    std::string wire = "HTTP/1.1 200 OK\r\nCache-Control: max-age=60, private\r\nETag: \"e1\"\r\n"
+                       "Transfer-Encoding: chunked\r\n\r\n4\r\nwiki\r\n5;x=y\r\npedia\r\n0\r\nT: 1\r\n\r\n";
+    Response fed;
+    for (size_t i = 0; i < wire.size(); i++) {
+        EXPECT_EQ(fed.feed(wire.data() + i, 1), i + 1 == wire.size()) << i;
+    }
+    Response moved = std::move(fed);
+    EXPECT_EQ(moved.getRaw(), wire);
+    EXPECT_EQ(moved.getBody(), "wikipedia");
+    EXPECT_EQ(moved.getHeader("etag").data(), moved.getRaw().data() + wire.find("\"e1\""));
+    // the verdict comes with the head
+    EXPECT_EQ(moved.getMeta().max_age, 60);
+    EXPECT_EQ(moved.getMeta().etag, "e1");
+    EXPECT_FALSE(Cache::isCacheable(moved));
+
+    // without a length the body ends with the connection
+    std::string open_ended = "HTTP/1.0 200 OK\r\n\r\nall of it";
+    Response unframed;
+    EXPECT_FALSE(unframed.feed(open_ended.data(), open_ended.size()));
+    unframed.finish();
+    EXPECT_EQ(unframed.getBody(), "all of it");
+    std::string short_body = "HTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\nshort";
+    Response cut;
+    EXPECT_FALSE(cut.feed(short_body.data(), short_body.size()));
+    EXPECT_THROW(cut.finish(), std::runtime_error);
+    // a claimed length reserves no more than an object may be, and bytes
+    // past the end of the message are dropped
+    std::string huge_claim = "HTTP/1.1 200 OK\r\nContent-Length: 1099511627776\r\n\r\nstart";
+    Response claimed;
+    EXPECT_FALSE(claimed.feed(huge_claim.data(), huge_claim.size()));
+    EXPECT_LE(claimed.getRaw().capacity(), huge_claim.size() + std::max<size_t>(Cache::getMaxObjectSize(), 1024 * 1024));
+    std::string trailing = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhelloHTTP/1.1 200 OK\r\n";
+    Response framed;
+    EXPECT_TRUE(framed.feed(trailing.data(), trailing.size()));
+    EXPECT_EQ(framed.getRaw(), trailing.substr(0, trailing.find("hello") + 5));
+    EXPECT_EQ(framed.getBody(), "hello");
+    std::string chunked_trailing = wire + "garbage";
+    Response chunked_framed;
+    EXPECT_TRUE(chunked_framed.feed(chunked_trailing.data(), chunked_trailing.size()));
+    EXPECT_EQ(chunked_framed.getRaw(), wire);
+    std::string not_modified = "HTTP/1.1 304 Not Modified\r\nContent-Length: 50\r\n\r\nextra";
+    Response empty_body;
+    EXPECT_TRUE(empty_body.feed(not_modified.data(), not_modified.size()));
+    EXPECT_EQ(empty_body.getRaw(), not_modified.substr(0, not_modified.size() - 5));
+
+    // a chunk size near 2^64 waits for bytes that never come
+    std::string huge_chunk = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nfffffffffffffffe\r\nwiki\r\n0\r\n\r\n";
+    Response oversized;
+    EXPECT_FALSE(oversized.feed(huge_chunk.data(), huge_chunk.size()));
+    EXPECT_THROW(oversized.finish(), std::runtime_error);
+    Response nothing;
+    EXPECT_NO_THROW(nothing.finish());
+    EXPECT_TRUE(nothing.getRaw().empty());
+
+    // through the proxy each origin response is parsed once and never copied
+    std::string body(20000, 'x');
+    LocalOrigin origin([&body](const std::string &) {
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                               "Cache-Control: max-age=600\r\nTransfer-Encoding: chunked\r\n\r\n";
+        for (size_t i = 0; i < body.size(); i += 7000) {
+            std::string chunk = body.substr(i, 7000);
+            char size[16];
+            snprintf(size, sizeof(size), "%zx\r\n", chunk.size());
+            response += size + chunk + "\r\n";
+        }
+        return response + "0\r\n\r\n";
+    });
+    CacheStats & stats = CacheStats::getInstance();
+    uint64_t upstream = stats.get(CacheStats::UPSTREAM_RESPONSES);
+    uint64_t parses = stats.get(CacheStats::RESPONSE_PARSES);
+    uint64_t copies = stats.get(CacheStats::RESPONSE_COPIES);
+
+    std::string first = proxy_get(create_client_socket(), origin.url("/blob"));
+    EXPECT_NE(first.find("Transfer-Encoding: chunked"), std::string::npos);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::string second = proxy_get(create_client_socket(), origin.url("/blob"));
+    EXPECT_EQ(second.substr(second.find("\r\n\r\n") + 4), body);
+    EXPECT_EQ(origin.getHits(), 1);
+
+    EXPECT_EQ(stats.get(CacheStats::UPSTREAM_RESPONSES), upstream + 1);
+    EXPECT_EQ(stats.get(CacheStats::RESPONSE_PARSES), parses + 1);
+    EXPECT_EQ(stats.get(CacheStats::RESPONSE_COPIES), copies);
+
+    std::cout << "=== Completed TestSinglePassResponse ===" << std::endl;
+}
+
+// ============== Test #37: Asynchronous Logger ==============
+// lines of file holding marker
+static size_t countLines(const std::string & file, const std::string & marker) {
+    std::ifstream in(file);
+    std::string line;
+    size_t count = 0;
+    while (std::getline(in, line)) {
+        count += line.find(marker) != std::string::npos;
+    }
+    return count;
+}
+
+TEST(LoggerTest, TestAsyncRings) {
+    Logger & logger = Logger::getInstance();
+    std::string dir = "../test_logs/logger_" + std::to_string(getpid()) + "/";
+    std::filesystem::remove_all(dir);
+    logger.setLogPath(dir);
+
+    // threads log concurrently, every record lands in the files of its level
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&logger, t]() {
+            for (int i = 0; i < 500; i++) {
+                logger.debug(t, "ring-debug " + std::to_string(i));
+                logger.info(t, "ring-info " + std::to_string(i));
+            }
+            logger.error(t, "ring-error");
+        });
+    }
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+    logger.flush();
+    EXPECT_EQ(countLines(dir + "DEBUG.log", "ring-debug"), 2000u);
+    EXPECT_EQ(countLines(dir + "DEBUG.log", "ring-info"), 2000u);
+    EXPECT_EQ(countLines(dir + "proxy.log", "ring-info"), 2000u);
+    EXPECT_EQ(countLines(dir + "proxy.log", "ring-debug"), 0u);
+    EXPECT_EQ(countLines(dir + "WARNING.log", "ring-error"), 4u);
+    EXPECT_EQ(countLines(dir + "ERROR.log", "ring-info"), 0u);
+    std::ifstream errors(dir + "ERROR.log");
+    std::string line;
+    ASSERT_TRUE(std::getline(errors, line));
+    // "2026-10-19 08:49:37 [ERROR] 2: ring-error"
+    EXPECT_EQ(line.substr(19, 9), " [ERROR] ") << line;
+    EXPECT_NE(line.find(": ring-error"), std::string::npos) << line;
+
+    // a tiny ring under the drop policy loses records, but counts every one
+    logger.setRingSize(8);
+    logger.setOverflow(Logger::Overflow::DROP);
+    uint64_t dropped = logger.getDropped();
+    std::thread([&logger]() {
+        for (int i = 0; i < 2000; i++) {
+            logger.debug("ring-drop " + std::to_string(i));
+        }
+    }).join();
+    logger.flush();
+    uint64_t lost = logger.getDropped() - dropped;
+    EXPECT_EQ(countLines(dir + "DEBUG.log", "ring-drop") + lost, 2000u);
+    // the writer may report them over several rounds, together they add up
+    uint64_t reported = 0;
+    std::ifstream warnings(dir + "WARNING.log");
+    while (std::getline(warnings, line)) {
+        size_t at = line.find("logger dropped ");
+        if (at != std::string::npos) {
+            reported += std::stoull(line.substr(at + 15));
+        }
+    }
+    EXPECT_EQ(reported, lost);
+    logger.setOverflow(Logger::Overflow::BLOCK);
+    logger.setRingSize(Logger::DEFAULT_RING_SIZE);
+    logger.setLogPath("../test_logs/");
+}
+
+// ============== Test #38: Log Level Filtering ==============
+TEST(LoggerTest, TestLevelFilter) {
+    Logger & logger = Logger::getInstance();
+    std::string dir = "../test_logs/level_" + std::to_string(getpid()) + "/";
+    std::filesystem::remove_all(dir);
+    logger.setLogPath(dir);
+    int built = 0;
+    auto message = [&built](const std::string & text) {
+        built++;
+        return text;
+    };
+
+    // below the level the message is not even built
+    logger.setLevel(Logger::Level::WARNING);
+    LOG_DEBUG(1, message("level-debug"));
+    LOG_INFO(1, message("level-info"));
+    LOG_WARNING(1, message("level-warning"));
+    EXPECT_EQ(built, 1);
+    logger.info("level-direct");
+    EXPECT_FALSE(logger.enabled(Logger::Level::INFO));
+    EXPECT_TRUE(logger.enabled(Logger::Level::ERROR));
+
+    logger.setLevel(Logger::Level::DEBUG);
+    LOG_DEBUG(message("level-debug"));
+    EXPECT_EQ(built, Logger::DEBUG_COMPILED ? 2 : 1);
+    logger.flush();
+    EXPECT_EQ(countLines(dir + "DEBUG.log", "level-debug"), Logger::DEBUG_COMPILED ? 1u : 0u);
+    EXPECT_EQ(countLines(dir + "DEBUG.log", "level-info"), 0u);
+    EXPECT_EQ(countLines(dir + "DEBUG.log", "level-direct"), 0u);
+    EXPECT_EQ(countLines(dir + "WARNING.log", "level-warning"), 1u);
+
+    EXPECT_EQ(Logger::parseLevel("info"), Logger::Level::INFO);
+    EXPECT_THROW(Logger::parseLevel("verbose"), std::runtime_error);
+    logger.setLogPath("../test_logs/");
+}
+
+// ============== Test #39: Binary Log ==============
+TEST(BinaryLogTest, TestRoundTripAndRotation) {
+    std::string dir = "../test_logs/binary_" + std::to_string(getpid()) + "/";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    // what the proxy logs per request: every one names another url, host
+    // and fd, so whole messages hardly ever repeat
+    std::vector<std::string> messages;
+    for (int i = 0; i < 600; i++) {
+        std::string host = "host" + std::to_string(i % 40) + ".example.com";
+        std::string url = "http://" + host + "/static/item" + std::to_string(i) + ".js?v=" + std::to_string(i * 7);
+        std::string fd = std::to_string(8 + i % 500);
+        messages.push_back("Requesting \"GET " + url + " HTTP/1.1\" from " + host + ":80");
+        messages.push_back("Successfully connected to destination server " + host + ":80 on fd " + fd);
+        messages.push_back("Received \"HTTP/1.1 200 OK\" from " + host);
+        messages.push_back("Added to cache: " + url + " (expires: Tue Nov 14 22:" + std::to_string(10 + i % 50) + ":20 2023)");
+        messages.push_back("Responding \"HTTP/1.1 200 OK\"");
+        messages.push_back("closed client fd: " + fd);
+    }
+    // text the pattern could get wrong
+    messages.push_back("");
+    messages.push_back("mark \x01 in the text \x01");
+    messages.push_back("numbers 0 007 4294967295 123456789 1234567890 -5 3.14");
+    messages.push_back("long " + std::string(2000, 'x') + " and " + std::string(600, 'y') + "/z");
+    std::string many = "many";
+    for (int i = 0; i < 50; i++) {
+        many += " /" + std::to_string(i);
+    }
+    messages.push_back(many);
+    messages.push_back("Initiating proxy shutdown... at host.example.com.");
+    messages.push_back("Sending request:\nGET / HTTP/1.1\r\nHost: a.com:8080\r\n\r\n");
+
+    // the text log lines, and the events rotating over a few files
+    size_t text_size = 0;
+    {
+        BinaryLog log(dir, 16 * 1024, 0);
+        for (size_t i = 0; i < messages.size(); i++) {
+            log.append(1700000000 + i / 100, i % 4, i % 3 == 0 ? -1 : i, messages[i]);
+            text_size += 32 + messages[i].size();
+        }
+    }
+
+    std::vector<std::string> files;
+    size_t binary_size = 0;
+    for (const auto & file : std::filesystem::directory_iterator(dir)) {
+        files.push_back(file.path().string());
+        binary_size += file.file_size();
+    }
+    std::sort(files.begin(), files.end(), [](const std::string & a, const std::string & b) {
+        // proxy.<stamp>.<n>.bin: the sequence number orders them
+        auto number = [](const std::string & name) {
+            size_t end = name.rfind('.');
+            return std::stoi(name.substr(name.rfind('.', end - 1) + 1));
+        };
+        return number(a) < number(b);
+    });
+    EXPECT_GT(files.size(), 1u);
+    EXPECT_LT(binary_size * 2, text_size);
+
+    size_t at = 0;
+    bool same = true;
+    for (const std::string & file : files) {
+        EXPECT_TRUE(BinaryLog::read(file, [&](const BinaryLog::Event & event) {
+            int i = at++;
+            same = same && event.time == 1700000000 + i / 100 && event.level == i % 4 &&
+                   event.pid == (i % 3 == 0 ? -1 : i) && event.message == messages[i];
+        }));
+    }
+    EXPECT_EQ(at, messages.size());
+    EXPECT_TRUE(same);
+
+    // a torn tail keeps the events before it
+    std::filesystem::resize_file(files[0], std::filesystem::file_size(files[0]) - 5);
+    size_t torn = 0;
+    EXPECT_FALSE(BinaryLog::read(files[0], [&torn](const BinaryLog::Event &) { torn++; }));
+    EXPECT_GT(torn, 0u);
+    EXPECT_FALSE(BinaryLog::read(dir + "missing.bin", [](const BinaryLog::Event &) {}));
+
+    // the logger writes every level into one binary file
+    std::string logger_dir = dir + "logger/";
+    Logger & logger = Logger::getInstance();
+    logger.setLogPath(logger_dir);
+    logger.setFormat(Logger::Format::BINARY, 1024 * 1024, 0);
+    logger.info(7, "binary-info");
+    logger.error("binary-error");
+    logger.flush();
+    logger.setFormat(Logger::Format::TEXT);
+    logger.setLogPath("../test_logs/");
+    EXPECT_FALSE(std::filesystem::exists(logger_dir + "proxy.log") &&
+                 std::filesystem::file_size(logger_dir + "proxy.log") > 0);
+    std::vector<std::string> logged;
+    for (const auto & file : std::filesystem::directory_iterator(logger_dir)) {
+        if (file.path().extension() == ".bin") {
+            BinaryLog::read(file.path().string(), [&logged](const BinaryLog::Event & event) {
+                logged.push_back(std::to_string(event.level) + " " + std::to_string(event.pid) + " " + event.message);
+            });
+        }
+    }
+    ASSERT_EQ(logged.size(), 2u);
+    EXPECT_EQ(logged[0], "1 7 binary-info");
+    EXPECT_EQ(logged[1], "3 -1 binary-error");
+}
 
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);